@@ -15,4 +15,17 @@ static const unsigned char ENV_DEVEUI[8] =  { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
 // ttn msb first, as-is
 static const unsigned char ENV_APPKEY[16] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
+// HMAC-SHA256 key of the downlink commands, shared with the backend; all 0x00 rejects every downlink
+static const unsigned char ENV_DOWNLINK_KEY[32] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                                    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// Further VeDirect devices besides the MPPT solar charger, which uses uart 2.
+// The ESP32 has one more uart free (uart 1), uart 0 is used for the Raspberry Pi.
+// BMV or SmartShunt battery monitor
+// #define VE_SHUNT_RX (16)
+// #define VE_SHUNT_TX (17)
+// Phoenix inverter
+// #define VE_INVERTER_RX (16)
+// #define VE_INVERTER_TX (17)
+
 #endif // ENV NEST
\ No newline at end of file
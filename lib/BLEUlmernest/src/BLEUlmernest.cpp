@@ -11,7 +11,9 @@ Schluesselbund* BLEUlmernest::pBund;
 std::vector<BLEAdvertisedDevice> BLEUlmernest::matched_devices;
 BLEAdvertisedDevice BLEUlmernest::device;
 std::vector<BLEAdvertisedDevice> BLEUlmernest::scan_results;
-BLEAdvertisedDevice* BLEUlmernest::pNuki;
+std::string BLEUlmernest::nuki_address;
+esp_ble_addr_type_t BLEUlmernest::nuki_address_type = BLE_ADDR_TYPE_PUBLIC;
+BLEUlmernest::ScanCallbacks_Nuki BLEUlmernest::scan_callbacks;
 BLEScan* BLEUlmernest::pBLEScan;
 BLEClient* BLEUlmernest::pClient;
 BLERemoteService* BLEUlmernest::pRemoteService;
@@ -20,9 +22,56 @@ BLERemoteService* BLEUlmernest::pUserService;
 BLERemoteCharacteristic* BLEUlmernest::pUSDIO;
 char BLEUlmernest::stored_address[18];
 int BLEUlmernest::current_state;
+volatile bool BLEUlmernest::link_lost = false;
+std::string BLEUlmernest::usdio_address;
+bool BLEUlmernest::usdio_indicating = false;
+uint32_t BLEUlmernest::last_activity = 0;
+uint32_t BLEUlmernest::last_reconnect = 0;
 
 // Nuki SL Keyturner States https://developer.nuki.io/page/nuki-smart-lock-api-latest/2/ -> Commands -> Keyturner States
 KeyturnerStates BLEUlmernest::keyturner_states;
+portMUX_TYPE BLEUlmernest::keyturner_states_lock = portMUX_INITIALIZER_UNLOCKED;
+
+QueueHandle_t BLEUlmernest::event_queue = nullptr;
+QueueHandle_t BLEUlmernest::request_queue = nullptr;
+QueueHandle_t BLEUlmernest::completion_queue = nullptr;
+TaskHandle_t BLEUlmernest::task_handle = nullptr;
+BLEUlmernest::ble_request BLEUlmernest::request;
+ble_result* BLEUlmernest::result = nullptr;
+
+
+/**********************
+ * Transaction tables
+ **********************/
+
+const BLEUlmernest::ble_transition BLEUlmernest::keyturner_state_transitions[]
+{
+  // phase event                          step
+  { 0,     transmission::t_rx_success,    step_keyturner_state }
+};
+
+const BLEUlmernest::ble_transition BLEUlmernest::lock_action_transitions[]
+{
+  // phase event                          step
+  { 0,     transmission::t_rx_success,    step_lock_state },
+  { 1,     transmission::t_challenge,     step_lock_challenge },
+  { 2,     transmission::t_rx_success,    step_lock_status }
+};
+
+const BLEUlmernest::ble_transition BLEUlmernest::log_entries_transitions[]
+{
+  // phase event                          step
+  { 0,     transmission::t_challenge,     step_log_challenge },
+  { 1,     transmission::t_rx_success,    step_log_entry }
+};
+
+// indexed by ble_operation
+const BLEUlmernest::ble_transaction BLEUlmernest::transactions[]
+{
+  { "keyturner state", start_keyturner_state, keyturner_state_transitions, sizeof(keyturner_state_transitions) / sizeof(ble_transition) },
+  { "lock action",     start_keyturner_state, lock_action_transitions,     sizeof(lock_action_transitions) / sizeof(ble_transition) },
+  { "log entries",     start_log_entries,     log_entries_transitions,     sizeof(log_entries_transitions) / sizeof(ble_transition) }
+};
 
 
 /***************
@@ -43,139 +92,108 @@ BLEUlmernest::BLEUlmernest ()
 std::vector<BLEAdvertisedDevice> BLEUlmernest::scan()
 {
   if (debug) Serial.println(" - Scanning for Nuki SL...");
+  matched_devices.clear();
 
-  // create new scan
+  // create new scan; results are matched by the callback as they arrive, which stops the scan once the lock is seen
   pBLEScan = BLEDevice::getScan();
+  pBLEScan->setAdvertisedDeviceCallbacks(&scan_callbacks, false);
   pBLEScan->setInterval(100);
   pBLEScan->setWindow(99); // less or equal setInterval value
+  pBLEScan->setActiveScan(false); // matched by advertised service, no scan response needed
 
   uint8_t scan_count = 0;
   // While no matches and either not reached max number of tries or
   while (matched_devices.size() == 0 && (SCAN_MAX_TRYS > scan_count || SCAN_MAX_TRYS == 0))
   {
-    pBLEScan->setActiveScan(true); // active scan uses more power, but get results faster
-    BLEScanResults foundDevices = pBLEScan->start(SCAN_TIME_SEC, false);
-
-    for (int i = 0; i < foundDevices.getCount(); i++) {
-
-      device = foundDevices.getDevice(i);
-      if (device.getName().find("Nuki") != std::string::npos) {
-        if (debug) Serial.println();
-        if (debug) Serial.print(" - Device found ");
-        if (debug) Serial.println(device.toString().c_str());
-        matched_devices.push_back(device);
-      }
-    }
+    pBLEScan->start(SCAN_TIME_SEC, false);
     pBLEScan->clearResults();   // delete results fromBLEScan buffer to release memory
     if (matched_devices.size() == 0)
     {
       if (debug) Serial.println(" - No Nuki found");
-      // delay(2000);
-      // esp_restart();
     }
     scan_count++;
   }
   return matched_devices;
 }
 
+/**
+ * Direct connection to the stored address
+ */
+bool BLEUlmernest::connect_stored ()
+{
+  if (debug) Serial.printf(" - connecting to stored address %s\n", nuki_address.c_str());
+  if (!pClient->connect(BLEAddress(nuki_address), nuki_address_type) || !pClient->isConnected())
+  {
+    if (debug) Serial.println(" ! stored address not reachable");
+    return false;
+  }
+  if (debug) Serial.println(" - Is Connected to stored address");
+
+  // load stored credentials
+  pBund->grab_keys();
+
+  // try to connect with user specific credentials
+  // this will most likely fail, but should result in successful calls later on
+  connect_user_specific();
+  return true;
+}
+
 /**
  * Initial connection to BLE
  */
 BLEClient* BLEUlmernest::initial_connect ()
 {
-  // Call scan() and store results
-  scan_results = scan();
-
-  // Return nullptr if there are no scan results
-  if (scan_results.size() == 0)
+  // Setup BLE client, kept when pairing is tried again
+  if (pClient == nullptr)
   {
-    if (debug) Serial.printf(" ! Max number (%d) trys to connect reached, returning nullptr\n", SCAN_MAX_TRYS);
-    return nullptr;
+    pClient = BLEDevice::createClient();
+    pClient->setClientCallbacks(new ClientCallbacks_Connect());
   }
 
-  // Setup BLE client
-  pClient = BLEDevice::createClient();
-  pClient->setClientCallbacks(new ClientCallbacks_Connect());
-
   // try to load stored BLE address
-  //   1) no address loaded: continue to try to pair
-  //   2) address loaded: try to match with scan results
+  //   1) no address loaded: scan and try to pair
+  //   2) address loaded: connect directly, scan for it only if that fails
   bool matching = true;
-  std::string connected_address;
   if (pBund->get_address(stored_address) == 0)
   {
     if (debug) Serial.println(" ! no address stored: trying to pair");
+    nuki_address.clear();
+    scan_results = scan();
   }
-  else // try to match stored mac address with scan_resutls
+  else
   {
-    if (debug)
-    {
-      Serial.print(" - stored address: ");
-      Serial.println(stored_address);
-    }
+    nuki_address = stored_address;
+    nuki_address_type = pBund->get_address_type();
+    if (connect_stored()) return pClient;
 
-    size_t i, j;
-    for (i = 0; i < scan_results.size(); i++)
+    // the stored address may have another type or the lock was out of reach: short scan for it
+    scan_results = scan();
+    for (size_t i = 0; i < scan_results.size(); i++)
     {
       device = scan_results.data()[i];
+      if (device.getAddress().toString() != nuki_address) continue;
 
-      // Connect to the remove BLE Server.
-      pClient->connect(&device);
-      if (pClient->isConnected()) {
-        if (debug) Serial.print(" - Is Connected to ");
-        if (debug) Serial.println(device.getName().c_str());
-      }
-      delay(50);
-
-      connected_address = device.getAddress().toString();
-      if (debug)
+      if (device.getAddressType() != nuki_address_type)
       {
-        Serial.print(" - connected address: ");
-        Serial.println(connected_address.c_str());
-      }
-
-      matching = true;
-      j = 0;
-      while (j < 18 && matching)
-      {
-        if (stored_address[j] != connected_address.c_str()[j++])
-        {
-          matching = false;
-          if (debug)
-          {
-            Serial.print(" ! not a match: j = ");
-            Serial.println(j);
-          }
-        }
-      }
-
-      // Match found: continue initial connection
-      if (matching)
-      {
-        pNuki = &device;
-        i = scan_results.size();
-        scan_results.clear();
-
-        // load stored credentials
-        pBund->grab_keys();
-
-        // try to connect with user specific credentials
-        // this will most likely fail, but should result in successful calls later on
-        connect_user_specific();
-
-        return pClient;
-      }
-      // No match found: contiue to try scan results
-      else
-      {
-        pClient->disconnect();
-        delay(50);
+        nuki_address_type = device.getAddressType();
+        pBund->store_address_type(nuki_address_type);
       }
+      scan_results.clear();
+      if (connect_stored()) return pClient;
+      break;
     }
+    matching = false;
     // None of the scan resuslts machted stored address
     if (debug) Serial.println(" ! No matching device found");
   }
 
+  // Return nullptr if there are no scan results
+  if (scan_results.size() == 0)
+  {
+    if (debug) Serial.printf(" ! Max number (%d) trys to connect reached, returning nullptr\n", SCAN_MAX_TRYS);
+    return nullptr;
+  }
+
   if (debug)
   {
 #ifdef overwrite_stored_device_pairing
@@ -216,6 +234,8 @@ BLEClient* BLEUlmernest::initial_connect ()
   for (size_t i = 0; i < scan_results.size(); i++)
   {
     device = scan_results.data()[i];
+    pRemoteService = nullptr;
+    pRemoteCharacteristic = nullptr;
 
     // Connect to the remote BLE Server.
     pClient->connect(&device);
@@ -254,7 +274,9 @@ BLEClient* BLEUlmernest::initial_connect ()
 
     if (pair())
     {
-      pNuki = &device;
+      nuki_address = device.getAddress().toString();
+      nuki_address_type = device.getAddressType();
+      pBund->store_address_type(nuki_address_type);
       scan_results.clear();
       connect_user_specific();
       return pClient;
@@ -281,21 +303,37 @@ bool BLEUlmernest::pair ()
   // get public key
   const uint8_t* public_key = pBund->get_public_key();
 
+  // indications of an earlier try are of no use
+  drain_events();
+
   // set BLE indicated callback to recieve the public key of the Nuki SL
   pRemoteCharacteristic->registerForNotify(pBote->notifyCallback_receive_pk, false);
-  delay(50);
 
   // update pairing state to wait for the public key callback
   current_state = (int)pairing_state::get_pk;
   // send request for public key of Nuki SL
   pBote->command((uint8_t)cmd::request_data).command((uint8_t)cmd::public_key).send(pRemoteCharacteristic, true);
 
-  // loop until pairing is either done or the connection expired
-  // possible improvements:
-  //   1) Run BLE loops like this as one or multiple tasks
-  //   2) Refactor to use loop() in main.cpp and continously check BLE states, so other routines are not blocked
-  while (pClient->isConnected() && current_state != (int)pairing_state::done)
+  // step through the indications until pairing is either done, failed or the connection expired;
+  // runs in setup() or in the engine task between transactions, nothing else takes the indications meanwhile
+  while (current_state != (int)pairing_state::done)
   {
+    ble_event event;
+    if (xQueueReceive(event_queue, &event, pdMS_TO_TICKS(BLE_TIMEOUT_MS)) != pdTRUE)
+    {
+      if (debug) Serial.println(" ! pairing: no answer from Nuki SL");
+      return false;
+    }
+    // the answer is read from Bote below
+    delete event.antwort;
+    if (event.state == ble_event_link_lost)
+    {
+      if (pClient->isConnected()) continue;
+      if (debug) Serial.println(" ! pairing: connection lost");
+      return false;
+    }
+    current_state = event.state;
+
     switch (current_state)
     {
     case (int)pairing_state::get_pk:
@@ -310,7 +348,6 @@ bool BLEUlmernest::pair ()
 
         // set BLE indicated callback to recieve challenge bytes
         pRemoteCharacteristic->registerForNotify(pBote->notifyCallback_challenge, false);
-        delay(50);
 
         if (debug) Serial.print("  * sending client public key ");
         // print_hex(public_key, KEY_LENGTH);
@@ -341,13 +378,12 @@ bool BLEUlmernest::pair ()
         pBund->calc_auth(r.data(), r.size(), pHash);
 
         // store address and credentials
-        char* addr_to_store = (char*)pClient->getPeerAddress().toString().c_str();
-        pBund->store_address(addr_to_store);
+        std::string addr_to_store = pClient->getPeerAddress().toString();
+        pBund->store_address((char*)addr_to_store.c_str());
         pBund->store_keys();
 
         // set BLE indicated callback to challenge authentication
         pRemoteCharacteristic->registerForNotify(pBote->notifyCallback_challenge_auth, false);
-        delay(50);
 
         if (debug) Serial.println("  * Sending client Authorization Authenticator");
         current_state = (int)pairing_state::idle;
@@ -384,7 +420,6 @@ bool BLEUlmernest::pair ()
 
         // set BLE indicated callback to recieve auth id
         pRemoteCharacteristic->registerForNotify(pBote->notifyCallback_get_auth_id, false);
-        delay(50);
 
         if (debug) Serial.println("  * Sending client Authorization Data");
         current_state = (int)pairing_state::idle;
@@ -426,7 +461,6 @@ bool BLEUlmernest::pair ()
         pBund->calc_auth(r.data(), r.size(), hash);
 
         pRemoteCharacteristic->registerForNotify(pBote->notifyCallback_confirm_auth_id, false);
-        delay(50);
 
         if (debug) Serial.println("  * Sending client Authorization confirmation");
         BLEUlmernest::current_state = (int)pairing_state::idle;
@@ -443,7 +477,6 @@ bool BLEUlmernest::pair ()
     default:
       break;
     }
-    delay(10);
   }
   esp_task_wdt_reset();
 
@@ -456,6 +489,393 @@ bool BLEUlmernest::pair ()
   return true;
 }
 
+/**
+ * Drop cached handles
+ */
+void BLEUlmernest::invalidate_cache ()
+{
+  pUserService = nullptr;
+  pUSDIO = nullptr;
+  usdio_address.clear();
+  usdio_indicating = false;
+  link_lost = false;
+}
+
+/**
+ * Indication callback of the user specific characteristic
+ */
+void BLEUlmernest::register_usdio (notify_callback callback)
+{
+  // the descriptor only has to be written once per connection; the write is confirmed before it returns
+  pUSDIO->registerForNotify(callback, false, !usdio_indicating);
+  usdio_indicating = true;
+}
+
+/**
+ * Drop stale events
+ */
+void BLEUlmernest::drain_events ()
+{
+  ble_event event;
+  while (xQueueReceive(event_queue, &event, 0) == pdTRUE) delete event.antwort;
+}
+
+/**
+ * Queue a transaction
+ */
+bool BLEUlmernest::submit (ble_request& r)
+{
+  if (task_handle == nullptr)
+  {
+    if (debug) Serial.printf(" ! %s: BLE not ready\n", transactions[(int)r.operation].name);
+    return false;
+  }
+  if (xQueueSend(request_queue, &r, 0) != pdTRUE)
+  {
+    if (debug) Serial.printf(" ! %s: BLE busy\n", transactions[(int)r.operation].name);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Engine task
+ */
+void BLEUlmernest::task (void* parameter)
+{
+  uint32_t wait_ms = hold_link();
+  for (;;)
+  {
+    if (xQueueReceive(request_queue, &request, pdMS_TO_TICKS(wait_ms)) == pdTRUE) run();
+    wait_ms = hold_link();
+  }
+}
+
+/**
+ * Run a transaction
+ */
+void BLEUlmernest::run ()
+{
+  const ble_transaction& transaction = transactions[(int)request.operation];
+  uint32_t started = millis();
+  result = new ble_result();
+  result->success = false;
+  result->status = -1;
+  result->logs_available = 0;
+
+  if (debug) Serial.printf(" - %s\n", transaction.name);
+  drain_events();
+  int phase = transaction.start();
+
+  while (phase >= 0)
+  {
+    uint32_t elapsed = millis() - started;
+    if (elapsed >= request.timeout_ms)
+    {
+      if (debug) Serial.printf(" ! %s: timeout in phase %d\n", transaction.name, phase);
+      phase = ble_phase_failed;
+      break;
+    }
+
+    ble_event event;
+    if (xQueueReceive(event_queue, &event, pdMS_TO_TICKS(request.timeout_ms - elapsed)) != pdTRUE) continue;
+
+    if (event.state == ble_event_link_lost)
+    {
+      // a disconnect of the former link may be reported late
+      if (pClient->isConnected()) continue;
+      if (debug) Serial.printf(" ! %s: connection lost\n", transaction.name);
+      phase = ble_phase_failed;
+      break;
+    }
+
+    const ble_transition* transition = nullptr;
+    for (size_t i = 0; i < transaction.transition_count; i++)
+    {
+      if (transaction.transitions[i].phase == phase && (int)transaction.transitions[i].event == event.state)
+      {
+        transition = &transaction.transitions[i];
+        break;
+      }
+    }
+    if (transition != nullptr) phase = transition->step(*event.antwort);
+    else if (debug) Serial.printf(" ! %s: event %d ignored in phase %d\n", transaction.name, event.state, phase);
+    delete event.antwort;
+  }
+
+  result->success = phase == ble_phase_done;
+  if (debug) Serial.printf(" - %s: %s after %u ms\n", transaction.name, result->success ? "done" : "failed", millis() - started);
+  last_activity = millis();
+
+  ble_completion completion = { request.callback, request.context, result };
+  result = nullptr;
+  if (completion.callback == nullptr || xQueueSend(completion_queue, &completion, 0) != pdTRUE) delete completion.result;
+}
+
+/**
+ * Hold the link to Nuki SL
+ */
+uint32_t BLEUlmernest::hold_link ()
+{
+  // not paired yet: scan and try to pair again
+  if (nuki_address.empty())
+  {
+    if (millis() - last_reconnect >= BLE_RECONNECT_INTERVAL_MS)
+    {
+      last_reconnect = millis();
+      initial_connect();
+    }
+    return BLE_RECONNECT_INTERVAL_MS;
+  }
+
+  if (BLE_IDLE_TIMEOUT_MS > 0)
+  {
+    if (!pClient->isConnected()) return BLE_IDLE_TIMEOUT_MS;
+    uint32_t idle = millis() - last_activity;
+    if (idle < BLE_IDLE_TIMEOUT_MS) return BLE_IDLE_TIMEOUT_MS - idle;
+
+    if (debug) Serial.println(" - BLE idle, disconnecting");
+    pClient->disconnect();
+    invalidate_cache();
+    return BLE_IDLE_TIMEOUT_MS;
+  }
+
+  if (link_lost || !pClient->isConnected())
+  {
+    last_reconnect = millis();
+    connect_user_specific();
+  }
+  return BLE_RECONNECT_INTERVAL_MS;
+}
+
+/**
+ * Parse keyturner states
+ */
+bool BLEUlmernest::parse_keyturner_states (const std::vector<uint8_t>& a)
+{
+  // 0-3 authorization id, 4-5 command, 22 bytes of states
+  if (a.size() < 28 || (a[4] | a[5] << 8) != (int)cmd::keyturn_states)
+  {
+    if (debug) Serial.println(" ! no keyturner states");
+    return false;
+  }
+
+  KeyturnerStates states;
+  size_t i = 6;
+  states.nuki_state                         = a[i++];
+  states.lock_state                         = a[i++];
+  states.trigger                            = a[i++];
+  for (size_t j = 0; j < 7; j++) states.current_time[j] = a[i++];
+  states.timezone_offset                    = a[i] | a[i + 1] << 8;
+  i += 2;
+  states.critical_battery_state             = a[i++];
+  states.config_update_count                = a[i++];
+  states.lock_n_go_timer                    = a[i++];
+  states.last_lock_action                   = a[i++];
+  states.last_lock_action_trigger           = a[i++];
+  states.last_lock_action_completion_status = a[i++];
+  states.door_sensor_state                  = a[i++];
+  states.nightmode_active                   = a[i] | a[i + 1] << 8;
+  i += 2;
+  states.accessory_battery_state            = a[i++];
+
+  portENTER_CRITICAL(&keyturner_states_lock);
+  keyturner_states = states;
+  portEXIT_CRITICAL(&keyturner_states_lock);
+  result->keyturner_states = states;
+  return true;
+}
+
+/**
+ * Send an encrypted request for data
+ */
+void BLEUlmernest::send_request (cmd command)
+{
+  pBote->command((uint8_t)cmd::request_data).command((uint8_t)command).send_cipher(pUSDIO, pBund);
+}
+
+
+/*****************************
+ * Steps of the transactions
+ *****************************/
+
+/**
+ * Keyturner states, also the first phase of a lock action
+ */
+int BLEUlmernest::start_keyturner_state ()
+{
+  if (connect_user_specific() != 0) return ble_phase_failed;
+  if (!pUSDIO->canIndicate() || !pUSDIO->canWrite()) return ble_phase_failed;
+
+  register_usdio(pBote->notifyCallback_crypto);
+  send_request(cmd::keyturn_states);
+  return 0;
+}
+
+int BLEUlmernest::step_keyturner_state (const std::vector<uint8_t>& a)
+{
+  if (debug) Serial.print("decrypted data: ");
+  print_hex(a.data(), a.size());
+  return parse_keyturner_states(a) ? ble_phase_done : ble_phase_failed;
+}
+
+/**
+ * Lock action: check door mode, then request a challenge
+ */
+int BLEUlmernest::step_lock_state (const std::vector<uint8_t>& a)
+{
+  if (!parse_keyturner_states(a)) return ble_phase_failed;
+
+  // check if Nuki SL is in door mode
+  if (result->keyturner_states.nuki_state != (unsigned char)nuki_states::door_mode)
+  {
+    if (debug)
+    {
+      Serial.print(" ! lock_action: nuki state is not door mode - ");
+      Serial.println(result->keyturner_states.nuki_state, HEX);
+    }
+    return ble_phase_failed;
+  }
+  result->status = result->keyturner_states.lock_state;
+
+  register_usdio(pBote->notifyCallback_req_challenge);
+  if (debug) Serial.println("Request Challenge: ");
+  send_request(cmd::req_challenge);
+  return 1;
+}
+
+/**
+ * Lock action: send the action with the challenge
+ */
+int BLEUlmernest::step_lock_challenge (const std::vector<uint8_t>& a)
+{
+  if (a.size() < 6 + KEY_LENGTH) return ble_phase_failed;
+  if (debug) Serial.print("decrypted challenge: ");
+  print_hex(a.data() + 6, 32);
+
+  uint8_t d[6] = { request.action, 0x00, 0, 0, 0, 0 };
+
+  if (debug) Serial.println("  send lock command");
+  register_usdio(pBote->notifyCallback_crypto);
+  pBote->command((uint8_t)cmd::lock_action);
+  pBote->data(d, sizeof d).data(a.data() + 6, KEY_LENGTH).send_cipher(pUSDIO, pBund);
+  return 2;
+}
+
+/**
+ * Lock action: follow the lock states until 'COMPLETE'
+ */
+int BLEUlmernest::step_lock_status (const std::vector<uint8_t>& a)
+{
+  if (a.size() < 8) return ble_phase_failed;
+
+  // check for status command and code 'COMPLETE'
+  if (a[4] == 0x0E && a[5] == 0x00 && a[6] == 0x00)
+  {
+    if (debug) Serial.println(" + locking done!");
+    return ble_phase_done;
+  }
+  // check for Nuki Error command
+  if (a[4] == 0x12 && a[5] == 0x00)
+  {
+    if (debug) Serial.printf(" ! lock_action: nuki error %02X\n", a[6]);
+    result->status = a[6];
+    return ble_phase_failed;
+  }
+  // locking state
+  result->status = a[7];
+  return 2;
+}
+
+/**
+ * Log entries: request a challenge
+ */
+int BLEUlmernest::start_log_entries ()
+{
+  if (connect_user_specific() != 0) return ble_phase_failed;
+  if (!pUSDIO->canIndicate() || !pUSDIO->canWrite()) return ble_phase_failed;
+
+  register_usdio(pBote->notifyCallback_req_challenge);
+  if (debug) Serial.println("Request Challenge: ");
+  send_request(cmd::req_challenge);
+  return 0;
+}
+
+/**
+ * Log entries: send the request with the challenge
+ */
+int BLEUlmernest::step_log_challenge (const std::vector<uint8_t>& a)
+{
+  if (a.size() < 6 + KEY_LENGTH) return ble_phase_failed;
+  if (debug) Serial.print("decrypted challenge: ");
+  print_hex(a.data() + 6, 32);
+
+  const uint8_t req[8] = {
+    (uint8_t)request.start_index, (uint8_t)(request.start_index >> 8), (uint8_t)(request.start_index >> 16), (uint8_t)(request.start_index >> 24),
+    (uint8_t)request.count, (uint8_t)(request.count >> 8),
+    request.order/** sort order 0x00 asc, 0x01 desc */,
+    (uint8_t)(request.with_count ? 0x01 : 0x00) };
+  const uint8_t pin[2] = { 0x00, 0x00 }; // pin 0:0:0:0
+
+  if (debug) Serial.println("  send request log entries");
+  register_usdio(pBote->notifyCallback_crypto);
+  pBote->command((uint8_t)cmd::request_log_entries);
+  pBote->data(req, sizeof req).data(a.data() + 6, KEY_LENGTH).data(pin, 2).send_cipher(pUSDIO, pBund);
+  return 1;
+}
+
+/**
+ * Log entries: collect count and entries until 'COMPLETE'
+ */
+int BLEUlmernest::step_log_entry (const std::vector<uint8_t>& a)
+{
+  if (a.size() < 7) return ble_phase_failed;
+
+  // check for status command and code 'COMPLETE'
+  if (a[4] == 0x0E && a[5] == 0x00 && a[6] == 0x00)
+  {
+    if (debug) Serial.println(" + req_log_entries: done!");
+    return ble_phase_done;
+  }
+  // check for Nuki Error command
+  if (a[4] == 0x12 && a[5] == 0x00)
+  {
+    if (debug)
+    {
+      Serial.print(" ! req_log_entries - nuki error: ");
+      print_hex(a.data(), a.size());
+    }
+    return ble_phase_failed;
+  }
+  // check for 'Log Entry Count' response
+  if (a[4] == 0x33 && a[5] == 0x00 && a.size() >= 9)
+  {
+    result->logs_available = a[7] | a[8] << 8;
+    if (debug)
+    {
+      Serial.print(" + logs available ");
+      Serial.println(result->logs_available);
+    }
+  }
+  // check for 'Log Entry' response
+  else if (a[4] == 0x32 && a[5] == 0x00 && a.size() >= 54)
+  {
+    if (debug > 1)
+    {
+      Serial.print("id: ");
+      Serial.println(a[6] | a[7] << 8 | a[8] << 16 | a[9] << 24);
+      uint16_t year = a[10] | a[11] << 8;
+      uint8_t month = a[12], day = a[13], hour = a[14], min = a[15], sec = a[16];
+      Serial.printf("date time: %d-%d-%d %d:%d:%d\n", year, month, day, hour, min, sec);
+      Serial.print("type: ");
+      Serial.println(a[53]);
+    }
+    result->logs.push_back(a);
+  }
+  // wait for next indication
+  return 1;
+}
+
 
 /******************
  * Getter, Setter
@@ -487,7 +907,24 @@ BLERemoteCharacteristic* BLEUlmernest::get_RemoteCharacteristic ()
 
 KeyturnerStates BLEUlmernest::get_keytuerner_states ()
 {
-  return keyturner_states;
+  portENTER_CRITICAL(&keyturner_states_lock);
+  KeyturnerStates states = keyturner_states;
+  portEXIT_CRITICAL(&keyturner_states_lock);
+  return states;
+}
+
+/**
+ * Hand an indication to the waiting transaction
+ */
+void BLEUlmernest::post_event (int state)
+{
+  if (event_queue == nullptr) return;
+  ble_event event = { state, state == ble_event_link_lost ? nullptr : new std::vector<uint8_t>(pBote->get_antwort()) };
+  if (xQueueSend(event_queue, &event, 0) != pdTRUE)
+  {
+    if (debug) Serial.println(" ! BLE event queue full");
+    delete event.antwort;
+  }
 }
 
 
@@ -506,12 +943,16 @@ bool BLEUlmernest::init (std::__cxx11::string device_name)
   pBund->init(device_name);
   // Create Bote Object
   pBote = new Bote(pBund);
-  // Try to initially connect to Nuki SL
-  pClient = initial_connect();
-
-  // If initial_connect() was successful return true, else false
-  if (pClient == nullptr) return false;
-  else return true;
+  // Indications are posted from the start, pairing waits on them
+  event_queue = xQueueCreate(BLE_EVENT_QUEUE_LENGTH, sizeof(ble_event));
+  // Try to initially connect to Nuki SL; without a connection the engine connects on demand or pairs later
+  bool connected = initial_connect() != nullptr;
+
+  request_queue = xQueueCreate(BLE_REQUEST_QUEUE_LENGTH, sizeof(ble_request));
+  completion_queue = xQueueCreate(BLE_REQUEST_QUEUE_LENGTH, sizeof(ble_completion));
+  last_activity = millis();
+  xTaskCreatePinnedToCore(task, "ble_task", BLE_TASK_STACK_SIZE, nullptr, 1, &task_handle, 1);
+  return connected;
 }
 
 /**
@@ -524,30 +965,32 @@ int BLEUlmernest::connect_user_specific ()
     if (debug) Serial.println(" ! connect_user_specific: pClient is nullptr");
     return -1;
   }
+  last_activity = millis();
+
+  // handles of a lost link are gone along with it
+  if (link_lost || !pClient->isConnected()) invalidate_cache();
+  if (pUSDIO != nullptr && usdio_address == nuki_address) return 0;
 
   if (!pClient->isConnected())
   {
     if (debug) Serial.println(" - Trying to connect...");
-    if (debug) Serial.println(pNuki->toString().c_str());
-    pClient->connect(pNuki);
+    if (debug) Serial.println(nuki_address.c_str());
+    pClient->connect(BLEAddress(nuki_address), nuki_address_type);
     if (pClient->isConnected())
     {
-      if (debug) Serial.print(" - Is Connected to ");
-      if (debug) Serial.println(pNuki->getName().c_str());
+      if (debug) Serial.println(" - Is Connected");
     }
     else
     {
       if (debug) Serial.println(" - Could not connect!");
       return -1;
     }
-    delay(50);
+    // a disconnect of the former link may be reported late
+    link_lost = false;
   }
 
-  // while (pClient->isConnected() && pUserService == nullptr)
-  {
-    pUserService = pClient->getService(uuid_service);
-    delay(50);
-  }
+  // discover service and characteristic once per connection
+  pUserService = pClient->getService(uuid_service);
   if (pUserService == nullptr)
   {
     if (debug)
@@ -558,11 +1001,7 @@ int BLEUlmernest::connect_user_specific ()
     return -1;
   }
 
-  // while (pClient->isConnected() && pUSDIO == nullptr)
-  {
-    pUSDIO = pUserService->getCharacteristic(uuid_user_specific_dio_characteristic);
-    delay(50);
-  }
+  pUSDIO = pUserService->getCharacteristic(uuid_user_specific_dio_characteristic);
   if (pUSDIO == nullptr)
   {
     if (debug)
@@ -572,9 +1011,26 @@ int BLEUlmernest::connect_user_specific ()
     }
     return -1;
   }
+  usdio_address = nuki_address;
+  usdio_indicating = false;
   return 0;
 }
 
+/**
+ * Run the callbacks of finished transactions
+ */
+void BLEUlmernest::loop ()
+{
+  if (completion_queue == nullptr) return;
+
+  ble_completion completion;
+  while (xQueueReceive(completion_queue, &completion, 0) == pdTRUE)
+  {
+    completion.callback(*completion.result, completion.context);
+    delete completion.result;
+  }
+}
+
 void BLEUlmernest::write (uint8_t* data, size_t len, bool response = false)
 {
   if (pRemoteCharacteristic->canWrite())
@@ -585,302 +1041,38 @@ void BLEUlmernest::write (uint8_t* data, size_t len, bool response = false)
   }
 }
 
-int BLEUlmernest::read_keyturner_state ()
+bool BLEUlmernest::request_keyturner_state (ble_callback_fn callback, void* context, uint32_t timeout_ms)
 {
-  if (connect_user_specific() != 0) return -1;
-
-  if (pUSDIO->canIndicate())
-  {
-    pUSDIO->registerForNotify(pBote->notifyCallback_crypto, false);
-    delay(50);
-  }
-  else
-  {
-    return -1;
-  }
-
-  if (debug) Serial.println("Lock state: ");
-  current_state = (int)transmission::t_await_rx;
-  if (pUSDIO->canWrite()) pBote->command((uint8_t)cmd::request_data).command((uint8_t)cmd::keyturn_states).send_cipher(pUSDIO, pBund);
-  else
-  {
-    // handle error
-    return -1;
-  }
-
-  while (pClient->isConnected() && current_state != (int)transmission::t_done)
-  {
-    switch (current_state)
-    {
-    case (int)transmission::t_rx_success:
-    {
-      std::vector<uint8_t> a = pBote->get_antwort();
-      if (debug) Serial.print("decrypted data: ");
-      print_hex(a.data(), a.size());
-
-      // 0-3 authorization id, 4-5 command
-      size_t i = 6, j = 0;
-      keyturner_states.nuki_state                         = a.data()[i++];
-      keyturner_states.lock_state                         = a.data()[i++];
-      keyturner_states.trigger                            = a.data()[i++];
-      while (j < 7) keyturner_states.current_time[j++]    = a.data()[i++];
-      keyturner_states.timezone_offset                    = a.data()[i++] | a.data()[i++] << 8;
-      keyturner_states.critical_battery_state             = a.data()[i++];
-      keyturner_states.config_update_count                = a.data()[i++];
-      keyturner_states.lock_n_go_timer                    = a.data()[i++];
-      keyturner_states.last_lock_action                   = a.data()[i++];
-      keyturner_states.last_lock_action_trigger           = a.data()[i++];
-      keyturner_states.last_lock_action_completion_status = a.data()[i++];
-      keyturner_states.door_sensor_state                  = a.data()[i++];
-      keyturner_states.nightmode_active                   = a.data()[i++] | a.data()[i++] << 8;
-      keyturner_states.accessory_battery_state            = a.data()[i++];
-
-      current_state = (int)transmission::t_done;
-      break;
-    }
-
-    case (int)transmission::t_failed:
-      return -1;
-      break;
-
-    default:
-      break;
-    }
-  }
-  esp_task_wdt_reset();
-  return 0;
+  ble_request r = {};
+  r.operation = ble_operation::keyturner_state;
+  r.timeout_ms = timeout_ms;
+  r.callback = callback;
+  r.context = context;
+  return submit(r);
 }
 
-/**
- * Requests Nuki SL to do a specific lock action.
- * Currently can block code execution in main.cpp loop() for up to serveral seconds,
- * because of the time it can take for the Nuki SL to execute a lock action.
- */
-int BLEUlmernest::lock_action (uint8_t action)
+bool BLEUlmernest::request_lock_action (uint8_t action, ble_callback_fn callback, void* context, uint32_t timeout_ms)
 {
-  int locking_state = 0;
-  // return -1 if connection failed
-  if (connect_user_specific() != 0) return -1;
-
-  // read keyturner states and get current nuki state (mode)
-  read_keyturner_state();
-  unsigned char nuki_state = get_keytuerner_states().nuki_state;
-
-  // check if Nuki SL is in door mode
-  // return -1 if not
-  if (nuki_state != (unsigned char)nuki_states::door_mode)
-  {
-    if (debug)
-    {
-      Serial.print(" ! lock_action: nuki state is not door mode - ");
-      Serial.println(nuki_state, HEX);
-    }
-    return -1;
-  }
-
-  pUSDIO->registerForNotify(pBote->notifyCallback_req_challenge, false);
-  delay(50);
-
-  if (debug) Serial.println("Request Challenge: ");
-  current_state = (int)transmission::t_idle;
-  pBote->command((uint8_t)cmd::request_data).command((uint8_t)cmd::req_challenge).send_cipher(pUSDIO, pBund);
-
-  while (pClient->isConnected() && current_state != (int)transmission::t_done)
-  {
-    switch (current_state)
-    {
-    case (int)transmission::t_challenge:
-    {
-      std::vector<uint8_t> a = pBote->get_antwort();
-      if (debug) Serial.print("decrypted challenge: ");
-      print_hex(a.data() + 6, 32);
-      uint8_t nonce[KEY_LENGTH];
-      std::copy(a.data() + 6, a.data() + 6 + KEY_LENGTH, nonce);
-
-      std::vector<uint8_t> d;
-      d.push_back(action);
-      d.push_back(0x00);
-      d.insert(d.end(), 4, 0);
-
-      if (debug) Serial.println("  send lock command");
-      pUSDIO->registerForNotify(pBote->notifyCallback_crypto, false);
-      delay(50);
-
-      current_state = (int)transmission::t_idle;
-      pBote->command((uint8_t)cmd::lock_action);
-      pBote->data(d.data(), d.size()).data(nonce, KEY_LENGTH).send_cipher(pUSDIO, pBund);
-      break;
-    }
-
-    case (int)transmission::t_rx_success:
-    {
-      std::vector<uint8_t> a = pBote->get_antwort();
-
-      // check for status command and code 'COMPLETE'
-      if (a.data()[4] == 0x0E && a.data()[5] == 0x00 && a.data()[6] == 0x00)
-      {
-        if (debug) Serial.println(" + locking done!");
-        current_state = (int)transmission::t_done;
-      }
-      // check for Nuki Error command
-      else if (a.data()[4] == 0x12 && a.data()[5] == 0x00)
-      {
-        locking_state = a.data()[6];
-        current_state = (int)transmission::t_failed;
-      }
-      // check for locking state
-      else
-      {
-        locking_state = a.data()[7];
-        current_state = (int)transmission::t_idle;
-      }
-      break;
-    }
-
-    case (int)transmission::t_failed:
-      if (debug) Serial.println("lock action: failed, something went wrong!");
-      current_state = (int)transmission::t_done;
-      break;
-
-    default:
-      break;
-    }
-    delay(10);
-  }
-  esp_task_wdt_reset();
-
-  return locking_state;
+  ble_request r = {};
+  r.operation = ble_operation::lock_action;
+  r.action = action;
+  r.timeout_ms = timeout_ms;
+  r.callback = callback;
+  r.context = context;
+  return submit(r);
 }
 
-/**
- * Request log entries from Nuki SL
- */
-std::vector<std::vector<uint8_t>> BLEUlmernest::req_log_entries (uint32_t start_index, uint16_t count, uint16_t &out_logs_available, uint8_t order)
+bool BLEUlmernest::request_log_entries (uint32_t start_index, uint16_t count, bool with_count, uint8_t order,
+                                        ble_callback_fn callback, void* context, uint32_t timeout_ms)
 {
-  // vector variable to store logs for return
-  std::vector<std::vector<uint8_t>> logs;
-  uint16_t logs_available = 0;
-
-  // return empty vector if there is no successful connection
-  if (connect_user_specific() != 0) return logs;
-
-  // register inication callback for requested challenge
-  pUSDIO->registerForNotify(pBote->notifyCallback_req_challenge, false);
-  delay(50);
-
-  if (debug) Serial.println("Request Challenge: ");
-  current_state = (int)transmission::t_idle;
-  pBote->command((uint8_t)cmd::request_data).command((uint8_t)cmd::req_challenge).send_cipher(pUSDIO, pBund);
-
-  while (pClient->isConnected() && current_state != (int)transmission::t_done)
-  {
-    switch (current_state)
-    {
-      // Nuki SL has responded with challenge
-    case (int)transmission::t_challenge:
-      {
-        std::vector<uint8_t> a = pBote->get_antwort();
-        if (debug) Serial.print("decrypted challenge: ");
-        print_hex(a.data() + 6, 32);
-        uint8_t nonce[KEY_LENGTH];
-        std::copy(a.data() + 6, a.data() + 6 + KEY_LENGTH, nonce);
-
-        const unsigned char req[8] = {
-          start_index, start_index >> 8, start_index >> 16, start_index >> 24,
-          count, count >> 8,
-          order/** sort order 0x00 asc, 0x01 desc */,
-          out_logs_available == 0 ? 0x01 : 0x00 };
-        std::vector<uint8_t> d;
-        d.insert(d.end(), req, req + 8);
-
-        const unsigned char pin[2] = { 0x00, 0x00 }; // pin 0:0:0:0
-
-        if (debug) Serial.println("  send request log entries");
-        pUSDIO->registerForNotify(pBote->notifyCallback_crypto, false);
-        delay(50);
-
-        current_state = (int)transmission::t_idle;
-        pBote->command((uint8_t)cmd::request_log_entries);
-        pBote->data(d.data(), d.size()).data(nonce, KEY_LENGTH).data(pin, 2).send_cipher(pUSDIO, pBund);
-
-        esp_task_wdt_reset();
-        break;
-      }
-
-      // Handle different responses from Nuki SL
-    case (int)transmission::t_rx_success:
-      {
-        // get recieved data
-        std::vector<uint8_t> a = pBote->get_antwort();
-
-        // check for status command and code 'COMPLETE'
-        if (a.data()[4] == 0x0E && a.data()[5] == 0x00 && a.data()[6] == 0x00)
-        {
-          if (debug) Serial.println(" + req_log_entries: done!");
-          // set state flag to t_done when status is COMPLETE
-          current_state = (int)transmission::t_done;
-        }
-        // check for Nuki Error command
-        else if (a.data()[4] == 0x12 && a.data()[5] == 0x00)
-        {
-          if (debug)
-          {
-            Serial.print(" ! req_log_entries - nuki error: ");
-            print_hex(a.data(), a.size());
-            // set state flag to t_failed if Error command was recieved
-            current_state = (int)transmission::t_failed;
-          }
-        }
-        // check for 'Log Entry Count' response
-        else if (a.data()[4] == 0x33 && a.data()[5] == 0x00)
-        {
-          // get number of available logs
-          logs_available = a.data()[7] | a.data()[8] << 8;
-          // set out variable to the number of available logs
-          out_logs_available = logs_available;
-          if (debug)
-          {
-            Serial.print(" + logs available ");
-            Serial.println(out_logs_available);
-          }
-          // wait for next indication
-          current_state = (int)transmission::t_idle;
-        }
-        // check for 'Log Entry' response
-        else if (a.data()[4] == 0x32 && a.data()[5] == 0x00)
-        {
-          if (debug > 1)
-          {
-            delay(50);
-            Serial.print("id: ");
-            Serial.println(a.data()[6] | a.data()[7] << 8 | a.data()[8] << 16 | a.data()[9] << 24);
-            uint16_t year = a.data()[10] | a.data()[11] << 8;
-            uint8_t month = a.data()[12], day = a.data()[13], hour = a.data()[14], min = a.data()[15], sec = a.data()[16];
-            Serial.printf("date time: %d-%d-%d %d:%d:%d\n", year, month, day, hour, min, sec);
-            Serial.print("type: ");
-            Serial.println(a.data()[53]);
-          }
-
-          // add log to return variable
-          logs.push_back(a);
-          // wait for next indication
-          current_state = (int)transmission::t_idle;
-        }
-
-        esp_task_wdt_reset();
-        break;
-      }
-
-    case (int)transmission::t_failed:
-      // error handling
-      current_state = (int)transmission::t_done;
-      break;
-
-    default:
-      break;
-    }
-    delay(5);
-  }
-  esp_task_wdt_reset();
-  return logs;
+  ble_request r = {};
+  r.operation = ble_operation::log_entries;
+  r.start_index = start_index;
+  r.count = count;
+  r.with_count = with_count;
+  r.order = order;
+  r.timeout_ms = timeout_ms;
+  r.callback = callback;
+  r.context = context;
+  return submit(r);
 }
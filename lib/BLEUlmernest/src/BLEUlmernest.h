@@ -8,6 +8,9 @@
 #include <BLEScan.h>
 #include <endian.h>
 #include <esp_task_wdt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 #include "Bote.h"
 #include "Schluesselbund.h"
 #include "enums/lock_actions.h"
@@ -24,13 +27,63 @@
 
 #define uuid_usdio "a92ee202-5501-11e4-916c-0800200c9a66"
 
-#define SCAN_TIME_SEC 5
+// Longest scan in seconds; a scan stops as soon as the lock is seen
+#define SCAN_TIME_SEC 3
 
 #ifndef SCAN_MAX_TRYS
 // SCAN_MAX_TRYS: 1 to 255; 0 unlimited
 #define SCAN_MAX_TRYS 1
 #endif
 
+#ifndef BLE_IDLE_TIMEOUT_MS
+// Time in ms the link to Nuki SL is held after the last operation; 0 keeps it up and reconnects after a loss
+#define BLE_IDLE_TIMEOUT_MS 30000
+#endif
+
+// Time in ms between reconnects while the link is kept up, and between pairing tries while not paired
+#define BLE_RECONNECT_INTERVAL_MS 10000
+
+#ifndef BLE_TIMEOUT_MS
+// Time in ms a transaction with Nuki SL may take from its start, including the connect
+#define BLE_TIMEOUT_MS 10000
+#endif
+
+// Lock actions wait for the motor, log requests for one indication per entry
+#define BLE_LOCK_TIMEOUT_MS 20000
+#define BLE_LOG_TIMEOUT_MS 30000
+
+// Transactions waiting for the engine, and indications waiting for their transaction
+#define BLE_REQUEST_QUEUE_LENGTH 4
+#define BLE_EVENT_QUEUE_LENGTH 16
+#define BLE_TASK_STACK_SIZE 8192
+
+// Transactions run by the engine; index of the transaction tables
+enum class ble_operation : uint8_t
+{
+  keyturner_state,
+  lock_action,
+  log_entries
+};
+
+// Outcome of a transaction, handed to the callback of the caller
+struct ble_result
+{
+  bool success;
+  // lock action: last lock state reported by Nuki SL, or its error code if it failed
+  int status;
+  KeyturnerStates keyturner_states;
+  std::vector<std::vector<uint8_t>> logs;
+  uint16_t logs_available;
+};
+
+/**
+ * Called from BLEUlmernest::loop() when a transaction is complete, failed or timed out
+ *
+ * @param result Outcome of the transaction
+ * @param context Pointer passed along with the request
+ */
+typedef void (*ble_callback_fn)(const ble_result& result, void* context);
+
 class BLEUlmernest : public BLEDevice
 {
 private:
@@ -44,7 +97,9 @@ private:
   static std::vector<BLEAdvertisedDevice> matched_devices;
   static BLEAdvertisedDevice device;
   static std::vector<BLEAdvertisedDevice> scan_results;
-  static BLEAdvertisedDevice* pNuki;
+  // Address of the paired lock, or of the lock paired with; empty before
+  static std::string nuki_address;
+  static esp_ble_addr_type_t nuki_address_type;
   static BLEScan* pBLEScan;
   static BLEClient* pClient;
   static BLERemoteService* pRemoteService;
@@ -54,7 +109,91 @@ private:
   static char stored_address[18];
   static int current_state;
 
+  // Link state; pUserService and pUSDIO are cached while the link is up and belong to usdio_address
+  static volatile bool link_lost;
+  static std::string usdio_address;
+  static bool usdio_indicating;
+  static uint32_t last_activity;
+  static uint32_t last_reconnect;
+
   static KeyturnerStates keyturner_states;
+  static portMUX_TYPE keyturner_states_lock;
+
+
+  /**********************
+   * Transaction engine
+   **********************/
+
+  // Indication of Nuki SL, or a lost link, posted by the BLE callbacks
+  struct ble_event
+  {
+    int state;
+    std::vector<uint8_t>* antwort;
+  };
+
+  // Transaction queued for the engine task
+  struct ble_request
+  {
+    ble_operation operation;
+    uint8_t action;
+    uint32_t start_index;
+    uint16_t count;
+    uint8_t order;
+    bool with_count;
+    uint32_t timeout_ms;
+    ble_callback_fn callback;
+    void* context;
+  };
+
+  // Finished transaction, handed back to loop()
+  struct ble_completion
+  {
+    ble_callback_fn callback;
+    void* context;
+    ble_result* result;
+  };
+
+  /**
+   * Step of a transaction: handles the answer of Nuki SL and sends the next message
+   *
+   * @return the next phase, ble_phase_done or ble_phase_failed
+   */
+  typedef int (*ble_step_fn)(const std::vector<uint8_t>& antwort);
+
+  // In phase, the event moves the transaction on by its step; other events are ignored
+  struct ble_transition
+  {
+    int phase;
+    transmission event;
+    ble_step_fn step;
+  };
+
+  struct ble_transaction
+  {
+    const char* name;
+    // connects and sends the first message; returns the first phase or ble_phase_failed
+    int (*start)();
+    const ble_transition* transitions;
+    size_t transition_count;
+  };
+
+  static const int ble_phase_done = -1;
+  static const int ble_phase_failed = -2;
+  static const int ble_event_link_lost = -1;
+
+  static const ble_transition keyturner_state_transitions[];
+  static const ble_transition lock_action_transitions[];
+  static const ble_transition log_entries_transitions[];
+  static const ble_transaction transactions[];
+
+  static QueueHandle_t event_queue;
+  static QueueHandle_t request_queue;
+  static QueueHandle_t completion_queue;
+  static TaskHandle_t task_handle;
+
+  // Transaction run by the engine task
+  static ble_request request;
+  static ble_result* result;
 
 
   /*******************
@@ -71,15 +210,42 @@ private:
     void onDisconnect(BLEClient* pclient)
     {
       if (debug) Serial.println("-> onDisconnect");
+      // runs on the BLE task; the cached handles are dropped by the next operation
+      link_lost = true;
+      post_event(ble_event_link_lost);
     }
   };
 
+  // Called for every advertisement during scan()
+  class ScanCallbacks_Nuki : public BLEAdvertisedDeviceCallbacks
+  {
+    void onResult(BLEAdvertisedDevice advertised)
+    {
+      bool is_nuki = advertised.isAdvertisingService(uuid_service) || advertised.isAdvertisingService(uuid_pairing_service) ||
+                     advertised.getName().find("Nuki") != std::string::npos;
+      if (!is_nuki) return;
+      if (debug) Serial.printf(" - Device found %s\n", advertised.toString().c_str());
+      matched_devices.push_back(advertised);
+      // stop once the paired lock is seen, or any lock if none is paired
+      if (nuki_address.empty() || advertised.getAddress().toString() == nuki_address) pBLEScan->stop();
+    }
+  };
+  static ScanCallbacks_Nuki scan_callbacks;
+
   /**
-   * Scan for BLE devices.
-   * @return All advertised BLE Devices as vector<BLEAdvertisedDevice>
+   * Passive scan for Nuki SL, by advertised service.
+   * Ends after SCAN_TIME_SEC, or as soon as the paired lock (any lock if none is paired) is seen.
+   * @return Advertised Nuki SL devices as vector<BLEAdvertisedDevice>
    */
   static std::vector<BLEAdvertisedDevice> scan ();
 
+  /**
+   * Connect straight to the stored address of the paired lock, without scan
+   *
+   * @return true if connected
+   */
+  static bool connect_stored ();
+
   /**
    * Establish initial connection with a desired BLE Device
    *
@@ -96,6 +262,69 @@ private:
    */
   static bool pair ();
 
+  /**
+   * Drop the cached service and characteristic, e.g. after the link has been lost
+   */
+  static void invalidate_cache ();
+
+  /**
+   * Set the indication callback of the user specific characteristic.
+   * Indications are only enabled on Nuki SL once per connection.
+   */
+  static void register_usdio (notify_callback);
+
+  /**
+   * Drop events left over from an earlier transaction or link
+   */
+  static void drain_events ();
+
+  /**
+   * Queue a transaction for the engine task
+   *
+   * @return false if the engine is not running or busy with too many transactions
+   */
+  static bool submit (ble_request&);
+
+  /**
+   * Engine task: runs queued transactions one at a time and holds the link in between
+   */
+  static void task (void*);
+
+  /**
+   * Run a transaction through its table until it is done, failed or timed out
+   */
+  static void run ();
+
+  /**
+   * Disconnect after BLE_IDLE_TIMEOUT_MS without transaction, or reconnect if the link is kept up;
+   * try to pair again every BLE_RECONNECT_INTERVAL_MS while not paired
+   *
+   * @return Time in ms until the link has to be looked after again
+   */
+  static uint32_t hold_link ();
+
+  /**
+   * Parse the keyturner states command into keyturner_states and the result
+   *
+   * @return false if the answer is not a complete keyturner states command
+   */
+  static bool parse_keyturner_states (const std::vector<uint8_t>&);
+
+  /**
+   * Send an encrypted request for data to the user specific characteristic
+   */
+  static void send_request (cmd);
+
+  // Starts and steps of the transactions, see the transition tables
+  static int start_keyturner_state ();
+  static int step_keyturner_state (const std::vector<uint8_t>&);
+  static int step_lock_state (const std::vector<uint8_t>&);
+  static int step_lock_challenge (const std::vector<uint8_t>&);
+  static int step_lock_status (const std::vector<uint8_t>&);
+  static int start_log_entries ();
+  static int step_log_challenge (const std::vector<uint8_t>&);
+  static int step_log_entry (const std::vector<uint8_t>&);
+
 
 public:
   /***************
@@ -111,6 +340,14 @@ public:
   static Schluesselbund* get_Bund();
   static int get_current_state();
   static void set_current_state(int pairing_state);
+
+  /**
+   * Hand an indication of Nuki SL to the waiting transaction or pairing, along with a copy of the answer.
+   * Called from the BLE callbacks; never blocks.
+   *
+   * @param state pairing_state or transmission reached by the indication
+   */
+  static void post_event(int state);
   BLERemoteCharacteristic* get_RemoteCharacteristic ();
   static KeyturnerStates get_keytuerner_states ();
 
@@ -124,19 +361,26 @@ public:
    *
    * @param device_name Name to identify the created BLE client.
    *
-   * @return  true:   The initialization finished successfully.
-   *          fasle:  BLE client could not be established.
+   * The engine task is started in any case and pairs or connects later.
+   *
+   * @return  true:   The initial connection to Nuki SL was established.
+   *          fasle:  Nuki SL was not connected yet.
    */
   static bool init (std::__cxx11::string device_name);
 
   /**
    * Connect to user specific funtionality of a BLE device.
-   * Requires a successful pairing.
+   * Requires a successful pairing. Returns at once while the link is up and the handles are cached.
    *
    * @return -1 - an error occured; otherwise 0 on connection
    */
   static int connect_user_specific ();
 
+  /**
+   * Run the callbacks of finished transactions. Call from loop().
+   */
+  static void loop ();
+
   /**
    * Write to a BLE characteristic.
    *
@@ -147,18 +391,28 @@ public:
   static void write (uint8_t* data, size_t len, bool response);
 
   /**
-   * Requests keyturner state from Nuki SL.
+   * Request the keyturner states from Nuki SL.
+   *
+   * @param callback Called from loop() with the result; may be nullptr
+   * @param context Passed to the callback
+   * @param timeout_ms Time the transaction may take
+   *
+   * @return true if the request was queued
    */
-  static int read_keyturner_state ();
+  static bool request_keyturner_state (ble_callback_fn callback, void* context, uint32_t timeout_ms = BLE_TIMEOUT_MS);
 
   /**
-   * Requests Nuki SL to do a specific lock action.
+   * Request Nuki SL to do a specific lock action. Requires Nuki SL to be in door mode.
+   * The status of the result is the lock state Nuki SL reported last.
    *
-   * @param lock_action Different possible actions specified in enums/lock_actions.h
+   * @param action Different possible actions specified in enums/lock_actions.h
+   * @param callback Called from loop() with the result; may be nullptr
+   * @param context Passed to the callback
+   * @param timeout_ms Time the transaction may take
    *
-   * @return Either returns a Nuki SL lock state as a positive value or -1 if the connection failed.
+   * @return true if the request was queued
    */
-  static int lock_action (uint8_t action);
+  static bool request_lock_action (uint8_t action, ble_callback_fn callback, void* context, uint32_t timeout_ms = BLE_LOCK_TIMEOUT_MS);
 
   /**
    * Request log entries from Nuki SL
@@ -167,10 +421,16 @@ public:
    *
    * @param start_index specific index of the log to begin the request with. 0 will start at the very begining of either direction.
    * @param count Number of logs to request.
-   * @param out_logs_available pointer of a variable to store the number of logs available.
-   * @param order Order of requested logs. Defautls to 0x01 which will result in the order begining from the most recent log. 0x00 will return the oldest log entry first.
+   * @param with_count Also request the number of logs available, returned in logs_available of the result.
+   * @param order Order of requested logs. 0x01 will result in the order begining from the most recent log. 0x00 will return the oldest log entry first.
+   * @param callback Called from loop() with the result; may be nullptr
+   * @param context Passed to the callback
+   * @param timeout_ms Time the transaction may take
+   *
+   * @return true if the request was queued
    */
-  static std::vector<std::vector<uint8_t>> req_log_entries (uint32_t start_index, uint16_t count, uint16_t &out_logs_available, uint8_t order = 0x01);
+  static bool request_log_entries (uint32_t start_index, uint16_t count, bool with_count, uint8_t order,
+                                   ble_callback_fn callback, void* context, uint32_t timeout_ms = BLE_LOG_TIMEOUT_MS);
 };
 
 #endif // BLEULMERNEST_H
\ No newline at end of file
@@ -261,17 +261,17 @@ void Bote::notifyCallback_receive_pk (BLERemoteCharacteristic* pBLERemoteCharact
     if (crc_validate(pData, length))
     {
       BLEUlmernest::get_Bund()->set_sl_public_key(pData + 2, KEY_LENGTH);
-      BLEUlmernest::set_current_state((int)pairing_state::send_pk);
+      BLEUlmernest::post_event((int)pairing_state::send_pk);
     }
     else
     {
-      BLEUlmernest::set_current_state((int)pairing_state::failed);
+      BLEUlmernest::post_event((int)pairing_state::failed);
     }
   }
   else
   {
     if (debug) Serial.println(" ! public key not indicated: Is target Nuki SL in pairing mode?");
-    BLEUlmernest::set_current_state((int)pairing_state::failed);
+    BLEUlmernest::post_event((int)pairing_state::failed);
   }
 }
 
@@ -294,11 +294,11 @@ void Bote::notifyCallback_challenge (BLERemoteCharacteristic* pBLERemoteCharacte
   if (crc_validate(pData, length))
   {
     receive(pBote, pData + 2, length - 2);
-    BLEUlmernest::set_current_state((int)pairing_state::challenge);
+    BLEUlmernest::post_event((int)pairing_state::challenge);
   }
   else
   {
-    BLEUlmernest::set_current_state((int)pairing_state::failed);
+    BLEUlmernest::post_event((int)pairing_state::failed);
   }
 }
 
@@ -322,11 +322,11 @@ void Bote::notifyCallback_challenge_auth (BLERemoteCharacteristic* pBLERemoteCha
   {
     // TODO: crypto verification
     receive(pBote, pData + 2, length - 2);
-    BLEUlmernest::set_current_state((int)pairing_state::challenge_auth);
+    BLEUlmernest::post_event((int)pairing_state::challenge_auth);
   }
   else
   {
-    BLEUlmernest::set_current_state((int)pairing_state::failed);
+    BLEUlmernest::post_event((int)pairing_state::failed);
   }
 }
 
@@ -349,11 +349,11 @@ void Bote::notifyCallback_get_auth_id (BLERemoteCharacteristic* pBLERemoteCharac
   if (crc_validate(pData, length))
   {
     receive(pBote, pData + 2, length - 2);
-    BLEUlmernest::set_current_state((int)pairing_state::conf_auth_id);
+    BLEUlmernest::post_event((int)pairing_state::conf_auth_id);
   }
   else
   {
-    BLEUlmernest::set_current_state((int)pairing_state::failed);
+    BLEUlmernest::post_event((int)pairing_state::failed);
   }
 }
 
@@ -378,7 +378,7 @@ void Bote::notifyCallback_confirm_auth_id (BLERemoteCharacteristic* pBLERemoteCh
     if (pData[0] == 0x0E && pData[1] == 0x00 && pData[2] == 0x00)
     {
     receive(pBote, pData + 2, length - 2);
-    BLEUlmernest::set_current_state((int)pairing_state::done);
+    BLEUlmernest::post_event((int)pairing_state::done);
     }
     else
     {
@@ -387,12 +387,12 @@ void Bote::notifyCallback_confirm_auth_id (BLERemoteCharacteristic* pBLERemoteCh
         Serial.print(" ! error confirm auth id: ");
         Serial.println(pData[2]);
       }
-      BLEUlmernest::set_current_state((int)pairing_state::failed);
+      BLEUlmernest::post_event((int)pairing_state::failed);
     }
   }
   else
   {
-    BLEUlmernest::set_current_state((int)pairing_state::failed);
+    BLEUlmernest::post_event((int)pairing_state::failed);
   }
 }
 
@@ -410,7 +410,7 @@ void Bote::notifyCallback_crypto (BLERemoteCharacteristic* pBLERemoteCharacteris
 
   receive_crypto(pBote, pData, length);
 
-  BLEUlmernest::set_current_state((int)transmission::t_rx_success);
+  BLEUlmernest::post_event((int)transmission::t_rx_success);
 }
 
 /**
@@ -428,5 +428,5 @@ void Bote::notifyCallback_req_challenge (BLERemoteCharacteristic* pBLERemoteChar
 
   receive_crypto(pBote, pData, length);
 
-  BLEUlmernest::set_current_state((int)transmission::t_challenge);
+  BLEUlmernest::post_event((int)transmission::t_challenge);
 }
@@ -0,0 +1,161 @@
+#include "Logbuch.h"
+
+/***************
+ * Constructor
+ ***************/
+
+Logbuch::Logbuch ()
+{
+  ring_next = 0;
+  ring_count = 0;
+  last_index = 0;
+  running = false;
+  first_new = 0;
+  batches = 0;
+  sync_callback = nullptr;
+  sync_context = nullptr;
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+const uint32_t Logbuch::get_last_index ()
+{
+  return last_index;
+}
+
+const size_t Logbuch::size ()
+{
+  return ring_count;
+}
+
+const bool Logbuch::is_running ()
+{
+  return running;
+}
+
+const logbuch_entry* Logbuch::get (size_t n)
+{
+  if (n >= ring_count) return nullptr;
+  return &ring[(ring_next + LOGBUCH_RING_SIZE - 1 - n) % LOGBUCH_RING_SIZE];
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+bool Logbuch::request_batch ()
+{
+  batches++;
+  // oldest first from the entry after the last one seen; the most recent one only, if none was seen yet
+  if (last_index == 0) return BLEUlmernest::request_log_entries(0, 1, false, 0x01, batch_done, this);
+  return BLEUlmernest::request_log_entries(last_index + 1, LOGBUCH_BATCH, false, 0x00, batch_done, this);
+}
+
+void Logbuch::add (const std::vector<uint8_t>& a)
+{
+  // 0-3 authorization id, 4-5 command, 6-9 index, 10-16 datetime, 17-20 authorization id, 21-52 name, 53 type, data
+  logbuch_entry& entry = ring[ring_next];
+  entry.index = a[6] | a[7] << 8 | a[8] << 16 | (uint32_t)a[9] << 24;
+  std::copy(a.begin() + 10, a.begin() + 17, entry.datetime);
+  entry.type = a[53];
+  memset(entry.data, 0, sizeof entry.data);
+  for (size_t i = 0; i < sizeof entry.data && 54 + i < a.size(); i++) entry.data[i] = a[54 + i];
+
+  ring_next = (ring_next + 1) % LOGBUCH_RING_SIZE;
+  if (ring_count < LOGBUCH_RING_SIZE) ring_count++;
+  if (entry.index > last_index) last_index = entry.index;
+}
+
+void Logbuch::finish (bool success)
+{
+  // flash is only written when there are new entries
+  if (esp_storage.getUInt("last_index", 0) != last_index) esp_storage.putUInt("last_index", last_index);
+  running = false;
+  if (debug) Serial.printf(" - logbuch: %s, last index %u, %d entries\n", success ? "synced" : "sync failed", last_index, ring_count);
+  if (sync_callback != nullptr) sync_callback(success, first_new, sync_context);
+}
+
+void Logbuch::batch_done (const ble_result& result, void* context)
+{
+  Logbuch* logbuch = (Logbuch*)context;
+  bool initial = logbuch->last_index == 0;
+  size_t added = 0;
+
+  for (const std::vector<uint8_t>& log : result.logs)
+  {
+    if (log.size() < 54) continue;
+    uint32_t index = log[6] | log[7] << 8 | log[8] << 16 | (uint32_t)log[9] << 24;
+    // entries are only taken once, even if Nuki SL sends one again
+    if (index <= logbuch->last_index) continue;
+    logbuch->add(log);
+    added++;
+  }
+  if (debug) Serial.printf(" - logbuch: %d of %d entries taken\n", added, result.logs.size());
+
+  // the most recent entry to start from is not counted as new
+  if (initial) logbuch->first_new = logbuch->last_index + 1;
+
+  // a full batch may be followed by more entries
+  if (result.success && !initial && result.logs.size() == LOGBUCH_BATCH && logbuch->batches < LOGBUCH_BATCHES_MAX)
+  {
+    if (logbuch->request_batch()) return;
+  }
+  logbuch->finish(result.success);
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+void Logbuch::init ()
+{
+  esp_storage.begin("logbuch", false);
+  last_index = esp_storage.getUInt("last_index", 0);
+
+  // indexes of another lock mean nothing
+  char address[18] = {0}, stored_address[18] = {0};
+  BLEUlmernest::get_Bund()->get_address(address);
+  esp_storage.getString("addr", stored_address, sizeof stored_address);
+  if (strcmp(address, stored_address) != 0)
+  {
+    if (debug) Serial.println(" - logbuch: new lock, starting over");
+    clear();
+    esp_storage.putString("addr", address);
+  }
+  if (debug) Serial.printf(" - logbuch: last index %u\n", last_index);
+}
+
+bool Logbuch::sync (logbuch_sync_fn callback, void* context)
+{
+  if (running) return false;
+
+  sync_callback = callback;
+  sync_context = context;
+  first_new = last_index + 1;
+  batches = 0;
+  running = request_batch();
+  return running;
+}
+
+size_t Logbuch::count (log_types type, uint32_t from_index)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < ring_count; i++)
+  {
+    if (ring[i].type == (uint8_t)type && ring[i].index >= from_index) n++;
+  }
+  return n;
+}
+
+void Logbuch::clear ()
+{
+  ring_next = 0;
+  ring_count = 0;
+  last_index = 0;
+  esp_storage.putUInt("last_index", 0);
+}
@@ -0,0 +1,149 @@
+/**
+ * Keep up with the log of Nuki SL
+ *
+ * Only entries newer than the last one seen are fetched, oldest first and in batches.
+ * The index of the last entry seen is kept in non-volatile memory across restarts.
+ * Fetched entries are decoded into a ring in RAM, so counts and events are served without BLE.
+ */
+
+#ifndef LOGBUCH_H
+#define LOGBUCH_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "BLEUlmernest.h"
+#include "enums/log_types.h"
+#include "Debug.h"
+
+// Number of decoded entries kept in the ring
+#ifndef LOGBUCH_RING_SIZE
+#define LOGBUCH_RING_SIZE 64
+#endif
+
+// Entries fetched per request, and requests per sync; the rest follows with the next sync.
+// One sync fits into the ring, so its entries can all be counted.
+#define LOGBUCH_BATCH 20
+#define LOGBUCH_BATCHES_MAX 3
+
+// Decoded log entry of Nuki SL
+struct logbuch_entry
+{
+  uint32_t index;
+  // year (2 bytes, LE), month, day, hour, minute, second
+  uint8_t datetime[7];
+  uint8_t type;
+  // first bytes of the type specific data, e.g. lock action, trigger, flags, completion status
+  uint8_t data[4];
+};
+
+/**
+ * Called from BLEUlmernest::loop() when a sync is done
+ *
+ * @param success false if a request failed; the entries fetched before are kept
+ * @param first_new Index of the first entry fetched by this sync
+ * @param context Pointer passed to sync()
+ */
+typedef void (*logbuch_sync_fn)(bool success, uint32_t first_new, void* context);
+
+class Logbuch
+{
+private:
+  Preferences esp_storage;
+
+  logbuch_entry ring[LOGBUCH_RING_SIZE];
+  size_t ring_next;
+  size_t ring_count;
+
+  // index of the last entry seen; 0 before the first sync
+  uint32_t last_index;
+  bool running;
+  uint32_t first_new;
+  uint8_t batches;
+  logbuch_sync_fn sync_callback;
+  void* sync_context;
+
+
+  /*******************
+   * Private Methods
+   *******************/
+
+  /**
+   * Request the next batch of entries after last_index
+   *
+   * @return true if the request was queued
+   */
+  bool request_batch ();
+
+  /**
+   * Decode a log entry command into the ring and move last_index on
+   */
+  void add (const std::vector<uint8_t>&);
+
+  /**
+   * End the sync, persist last_index and call back
+   */
+  void finish (bool success);
+
+  // Completion of a batch request
+  static void batch_done (const ble_result&, void*);
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  Logbuch ();
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  const uint32_t get_last_index ();
+  const size_t size ();
+  const bool is_running ();
+
+  /**
+   * Get an entry of the ring
+   *
+   * @param n 0 for the most recent entry
+   * @return nullptr if there is no such entry
+   */
+  const logbuch_entry* get (size_t n);
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Load the index of the last entry seen from non-volatile memory
+   */
+  void init ();
+
+  /**
+   * Fetch the entries Nuki SL logged since the last sync.
+   * Without a last entry seen only the most recent one is fetched to start from.
+   *
+   * @param callback Called when done; may be nullptr
+   * @param context Passed to the callback
+   *
+   * @return false if a sync is running or the request could not be queued
+   */
+  bool sync (logbuch_sync_fn callback = nullptr, void* context = nullptr);
+
+  /**
+   * Count entries of a type in the ring
+   *
+   * @param type Log type, see enums/log_types.h
+   * @param from_index Count entries with this index or a later one
+   */
+  size_t count (log_types type, uint32_t from_index = 0);
+
+  /**
+   * Forget the ring and the last entry seen, e.g. after pairing another lock
+   */
+  void clear ();
+};
+
+#endif
@@ -50,6 +50,7 @@ const uint8_t* Schluesselbund::get_public_key ()
 
 void Schluesselbund::set_sl_public_key (uint8_t* key, size_t len)
 {
+  forget_shared_secret();
   std::copy(key, key + len, sl_public_key);
 }
 
@@ -68,6 +69,16 @@ void Schluesselbund::store_address (char* address_to_remember)
   esp_storage.putString("addr", address_to_remember);
 }
 
+esp_ble_addr_type_t Schluesselbund::get_address_type ()
+{
+  return (esp_ble_addr_type_t)esp_storage.getUChar("addr_type", BLE_ADDR_TYPE_PUBLIC);
+}
+
+void Schluesselbund::store_address_type (esp_ble_addr_type_t type)
+{
+  esp_storage.putUChar("addr_type", type);
+}
+
 
 /*******************
  * Private Methods
@@ -90,6 +101,22 @@ bool Schluesselbund::store_key (const char* name, uint8_t* key, size_t len)
   }
 }
 
+/**
+ * Make the shared secret available
+ */
+void Schluesselbund::use_shared_secret ()
+{
+  if (!shared_secret_valid) calc_shared_secret();
+}
+
+/**
+ * Done with the shared secret
+ */
+void Schluesselbund::release_shared_secret ()
+{
+  if (SCHLUESSELBUND_PARANOID) forget_shared_secret();
+}
+
 
 /******************
  * Public Methods
@@ -135,6 +162,7 @@ void Schluesselbund::init (std::__cxx11::string name)
  */
 void Schluesselbund::generate_keypair ()
 {
+  forget_shared_secret();
   crypto_box_keypair(public_key, secret_key);
 }
 
@@ -171,23 +199,33 @@ void Schluesselbund::calc_shared_secret ()
   std::copy(c_buffer.begin(), c_buffer.end(), c);
 
   crypto_core_hsalsa20(shared_secret, inv, dh_key, c);
+  shared_secret_valid = true;
 
   wipe(dh_key, KEY_LENGTH);
 }
 
+/**
+ * Wipe the cached shared secret
+ */
+void Schluesselbund::forget_shared_secret ()
+{
+  wipe(shared_secret, KEY_LENGTH);
+  shared_secret_valid = false;
+}
+
 /**
  * Calculate authorization authentication
  */
 void Schluesselbund::calc_auth (const unsigned char* challenge, size_t len, unsigned char* hash)
 {
-  calc_shared_secret();
+  use_shared_secret();
 
   crypto_auth_hmacsha256_state state;
   crypto_auth_hmacsha256_init(&state, shared_secret, KEY_LENGTH);
   crypto_auth_hmacsha256_update(&state, challenge, len);
   crypto_auth_hmacsha256_final(&state, hash);
 
-  wipe(shared_secret, KEY_LENGTH);
+  release_shared_secret();
 }
 
 /**
@@ -196,6 +234,7 @@ void Schluesselbund::calc_auth (const unsigned char* challenge, size_t len, unsi
 void Schluesselbund::grab_keys ()
 {
   if (debug) Serial.println(" # grab...");
+  forget_shared_secret();
   esp_storage.getBytes("public_key", public_key, sizeof public_key);
   esp_storage.getBytes("secret_key", secret_key, sizeof secret_key);
   esp_storage.getBytes("sl_public_key", sl_public_key, sizeof sl_public_key);
@@ -227,7 +266,9 @@ void Schluesselbund::store_keys ()
  */
 void Schluesselbund::clear_credentials ()
 {
+  forget_shared_secret();
   esp_storage.remove("addr");
+  esp_storage.remove("addr_type");
   esp_storage.remove("public_key");
   esp_storage.remove("secret_key");
   esp_storage.remove("sl_public_key");
@@ -239,7 +280,7 @@ void Schluesselbund::clear_credentials ()
 void Schluesselbund::seal (unsigned char* cipher, const unsigned char* botschaft, size_t length, unsigned char* nonce_out)
 {
   esp_fill_random(nonce_out, crypto_secretbox_NONCEBYTES);
-  calc_shared_secret();
+  use_shared_secret();
 
   size_t length_padded = length + crypto_secretbox_ZEROBYTES;
   unsigned char c_padded[length_padded] = {0};
@@ -248,14 +289,14 @@ void Schluesselbund::seal (unsigned char* cipher, const unsigned char* botschaft
 
   if (crypto_secretbox_xsalsa20poly1305(c_padded, b_padded, length_padded, nonce_out, shared_secret) != 0)
   {
-    wipe(shared_secret, KEY_LENGTH);
+    release_shared_secret();
     if (debug) Serial.print(" # seal: something went wrong! ");
     return;
   }
 
   std::copy(c_padded + crypto_secretbox_BOXZEROBYTES, c_padded + length_padded, cipher);
 
-  wipe(shared_secret, KEY_LENGTH);
+  release_shared_secret();
 }
 
 /**
@@ -263,7 +304,7 @@ void Schluesselbund::seal (unsigned char* cipher, const unsigned char* botschaft
  */
 void Schluesselbund::open (unsigned char* botschaft, const unsigned char* cipher, size_t length, unsigned char* nonce)
 {
-  calc_shared_secret();
+  use_shared_secret();
 
   size_t length_padded = length + crypto_secretbox_BOXZEROBYTES;
   unsigned char b_padded[length_padded] = {0};
@@ -272,14 +313,14 @@ void Schluesselbund::open (unsigned char* botschaft, const unsigned char* cipher
 
   if (crypto_secretbox_xsalsa20poly1305_open(b_padded, c_padded, length_padded, nonce, shared_secret) != 0)
   {
-    wipe(shared_secret, KEY_LENGTH);
+    release_shared_secret();
     if (debug) Serial.println(" # open: something went wrong!");
     return;
   }
 
   if (length - crypto_secretbox_BOXZEROBYTES < 0)
   {
-    wipe(shared_secret, KEY_LENGTH);
+    release_shared_secret();
     if (debug) Serial.print(" # open: 'length' is too short! ");
     if (debug) Serial.println(length - crypto_secretbox_BOXZEROBYTES);
     return;
@@ -287,7 +328,7 @@ void Schluesselbund::open (unsigned char* botschaft, const unsigned char* cipher
 
   std::copy(b_padded + crypto_secretbox_ZEROBYTES, b_padded + (length_padded), botschaft);
 
-  wipe(shared_secret, KEY_LENGTH);
+  release_shared_secret();
 }
 
 /**
@@ -303,6 +344,7 @@ void Schluesselbund::wipe (void* buffer, size_t len)
  */
 void Schluesselbund::wipe_storage ()
 {
+  forget_shared_secret();
   if (esp_storage.clear())
   {
     if (debug)
@@ -17,6 +17,11 @@
 #include "Helper.h"
 #include "Debug.h"
 
+// Compute the shared secret for every message and wipe it right after, instead of keeping it until the keys change
+#ifndef SCHLUESSELBUND_PARANOID
+#define SCHLUESSELBUND_PARANOID 0
+#endif
+
 const size_t KEY_COUNT = 3;
 const size_t KEY_LENGTH = 32;
 
@@ -34,6 +39,8 @@ private:
   uint8_t* keys[KEY_COUNT] = { public_key, secret_key, sl_public_key };
   unsigned char dh_key[KEY_LENGTH];
   unsigned char shared_secret[KEY_LENGTH];
+  // shared_secret matches the current keys; cleared whenever they change
+  bool shared_secret_valid = false;
 
 
   /*******************
@@ -49,6 +56,16 @@ private:
    */
   bool store_key (const char* name, uint8_t* key, size_t len);
 
+  /**
+   * Make the shared secret available, calculating it only if it is not cached
+   */
+  void use_shared_secret ();
+
+  /**
+   * Done with the shared secret; wipes it in SCHLUESSELBUND_PARANOID mode
+   */
+  void release_shared_secret ();
+
 public:
   /***************
    * Constructor
@@ -81,6 +98,16 @@ public:
    */
   void store_address (char* address_to_remember);
 
+  /**
+   * Get the BLE address type of a paired Nuki SL; public if none is stored
+   */
+  esp_ble_addr_type_t get_address_type ();
+
+  /**
+   * Put the BLE address type of a paired Nuki SL in non-volatile memory
+   */
+  void store_address_type (esp_ble_addr_type_t);
+
 
   /******************
    * Public Methods
@@ -104,10 +131,15 @@ public:
   void calc_dh_key ();
 
   /**
-   * Calculate shared secret
+   * Calculate shared secret, kept until the keys change
    */
   void calc_shared_secret ();
 
+  /**
+   * Wipe the cached shared secret
+   */
+  void forget_shared_secret ();
+
   /**
    * Calculate authorization authentication
    */
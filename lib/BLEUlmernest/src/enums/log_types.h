@@ -0,0 +1,15 @@
+#ifndef LOG_TYPES_H
+#define LOG_TYPES_H
+
+enum class log_types : unsigned char
+{
+    logging_enabled     = 0x01,
+    lock_action         = 0x02,
+    calibration         = 0x03,
+    initialization_run  = 0x04,
+    keypad_action       = 0x05,
+    door_sensor         = 0x06,
+    door_sensor_logging = 0x07
+};
+
+#endif
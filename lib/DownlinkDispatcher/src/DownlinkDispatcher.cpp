@@ -0,0 +1,163 @@
+#include "DownlinkDispatcher.h"
+#include <sodium/utils.h>
+
+/***************
+ * Constructor
+ ***************/
+
+DownlinkDispatcher::DownlinkDispatcher ()
+{
+  command_count = 0;
+  has_key = false;
+  counter = 0;
+  counter_callback = nullptr;
+  memset(key, 0, sizeof(key));
+  memset(device_id, 0, sizeof(device_id));
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+const uint32_t DownlinkDispatcher::get_counter ()
+{
+  return counter;
+}
+
+void DownlinkDispatcher::set_counter (uint32_t _counter)
+{
+  counter = _counter;
+}
+
+void DownlinkDispatcher::set_counter_callback (downlink_counter_fn callback)
+{
+  counter_callback = callback;
+}
+
+void DownlinkDispatcher::set_key (const uint8_t* _key, const uint8_t* _device_id)
+{
+  memcpy(key, _key, DOWNLINK_KEY_SIZE);
+  memcpy(device_id, _device_id, DOWNLINK_DEVICE_ID_SIZE);
+  has_key = true;
+}
+
+const size_t DownlinkDispatcher::get_command_count ()
+{
+  return command_count;
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+const downlink_command* DownlinkDispatcher::find (uint8_t opcode)
+{
+  for (size_t i = 0; i < command_count; i++)
+  {
+    if (commands[i].opcode == opcode) return &commands[i];
+  }
+  return nullptr;
+}
+
+/**
+ * HMAC-SHA256 over device id, counter and commands; compared in constant time
+ */
+bool DownlinkDispatcher::authenticate (const uint8_t* data, size_t len)
+{
+  uint8_t mac[crypto_auth_hmacsha256_BYTES];
+  crypto_auth_hmacsha256_state state;
+  crypto_auth_hmacsha256_init(&state, key, DOWNLINK_KEY_SIZE);
+  crypto_auth_hmacsha256_update(&state, device_id, DOWNLINK_DEVICE_ID_SIZE);
+  crypto_auth_hmacsha256_update(&state, data, len - DOWNLINK_MAC_SIZE);
+  crypto_auth_hmacsha256_final(&state, mac);
+  return sodium_memcmp(mac, data + len - DOWNLINK_MAC_SIZE, DOWNLINK_MAC_SIZE) == 0;
+}
+
+/**
+ * Walk the commands between counter and HMAC
+ */
+bool DownlinkDispatcher::validate (const uint8_t* data, size_t len)
+{
+  size_t i = DOWNLINK_COUNTER_SIZE;
+  size_t end = len - DOWNLINK_MAC_SIZE;
+  while (i < end)
+  {
+    if (end - i < 2)
+    {
+      if (debug) Serial.printf(" ! downlink: command truncated at index %d\n", i);
+      return false;
+    }
+    const downlink_command* command = find(data[i]);
+    size_t args = data[i + 1];
+    if (command == nullptr)
+    {
+      if (debug) Serial.printf(" ! downlink: unknown opcode 0x%02X at index %d\n", data[i], i);
+      return false;
+    }
+    if (args < command->args_min || args > command->args_max || args > end - i - 2)
+    {
+      if (debug) Serial.printf(" ! downlink: 0x%02X with %d argument bytes\n", data[i], args);
+      return false;
+    }
+    i += 2 + args;
+  }
+  return true;
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+bool DownlinkDispatcher::add (const downlink_command& command)
+{
+  if (command_count >= DOWNLINK_COMMANDS_MAX || command.handler == nullptr || find(command.opcode) != nullptr) return false;
+  commands[command_count++] = command;
+  return true;
+}
+
+/**
+ * Check a frame as a whole, then run its commands
+ */
+int DownlinkDispatcher::parse (const uint8_t* data, size_t len)
+{
+  if (!has_key)
+  {
+    if (debug) Serial.println(" ! downlink: no key, rejected");
+    return -1;
+  }
+  if (len < DOWNLINK_COUNTER_SIZE + DOWNLINK_MAC_SIZE)
+  {
+    if (debug) Serial.printf(" ! downlink: %d bytes too short, rejected\n", len);
+    return -1;
+  }
+  if (!authenticate(data, len))
+  {
+    if (debug) Serial.println(" ! downlink: HMAC invalid, rejected");
+    return -1;
+  }
+
+  uint32_t frame_counter = (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+  if (frame_counter <= counter)
+  {
+    if (debug) Serial.printf(" ! downlink: counter %u not above %u, replay rejected\n", frame_counter, counter);
+    return -1;
+  }
+  if (!validate(data, len)) return -1;
+
+  counter = frame_counter;
+  if (counter_callback != nullptr) counter_callback(counter);
+
+  int done = 0;
+  size_t end = len - DOWNLINK_MAC_SIZE;
+  for (size_t i = DOWNLINK_COUNTER_SIZE; i < end; i += 2 + data[i + 1])
+  {
+    const downlink_command* command = find(data[i]);
+    if (debug) Serial.printf(" - downlink 0x%02X: %s\n", command->opcode, command->name);
+    if (command->handler(data + i + 2, data[i + 1])) done++;
+    else if (debug) Serial.printf(" ! downlink 0x%02X failed\n", command->opcode);
+  }
+  return done;
+}
@@ -0,0 +1,144 @@
+/**
+ * Table driven dispatcher of authenticated downlink commands.
+ *
+ * Frame:
+ *   4 bytes  counter, MSB first; has to be higher than the counter of the last accepted frame
+ *   n bytes  commands, each: 1 byte opcode | 1 byte number of argument bytes | arguments
+ *   8 bytes  HMAC-SHA256 over device id, counter and commands, truncated to the first 8 bytes
+ *
+ * A frame is checked as a whole before any command is run: an unknown opcode, an argument length out of the range of
+ * its command, a truncated command, a wrong HMAC or a counter not higher than the last one reject the whole frame.
+ * Commands are registered with add(), so new commands need no changes here.
+ */
+
+#ifndef DOWNLINKDISPATCHER_H
+#define DOWNLINKDISPATCHER_H
+
+#include <Arduino.h>
+#include <sodium/crypto_auth_hmacsha256.h>
+
+// Maximum number of commands of a dispatcher
+#ifndef DOWNLINK_COMMANDS_MAX
+#define DOWNLINK_COMMANDS_MAX 32
+#endif
+
+#define DOWNLINK_COUNTER_SIZE 4
+#define DOWNLINK_MAC_SIZE 8
+#define DOWNLINK_KEY_SIZE crypto_auth_hmacsha256_KEYBYTES
+#define DOWNLINK_DEVICE_ID_SIZE 8
+
+/**
+ * Run a command
+ *
+ * @param args Argument bytes
+ * @param len Number of argument bytes, within the range of the command
+ * @return false if the command failed
+ */
+typedef bool (*downlink_handler_fn)(const uint8_t* args, size_t len);
+
+/**
+ * Called with the counter of an accepted frame before its commands are run, e.g. to persist it
+ */
+typedef void (*downlink_counter_fn)(uint32_t counter);
+
+/**
+ * Description of a downlink command
+ */
+struct downlink_command
+{
+  uint8_t opcode;
+  // Range of the number of argument bytes
+  uint8_t args_min;
+  uint8_t args_max;
+  downlink_handler_fn handler;
+  // For debug output
+  const char* name;
+};
+
+class DownlinkDispatcher
+{
+private:
+  downlink_command commands[DOWNLINK_COMMANDS_MAX];
+  size_t command_count;
+
+  uint8_t key[DOWNLINK_KEY_SIZE];
+  uint8_t device_id[DOWNLINK_DEVICE_ID_SIZE];
+  bool has_key;
+
+  uint32_t counter;
+  downlink_counter_fn counter_callback;
+
+  /**
+   * @return Command of an opcode, nullptr if unknown
+   */
+  const downlink_command* find (uint8_t);
+
+  /**
+   * Check the HMAC of a frame
+   */
+  bool authenticate (const uint8_t*, size_t);
+
+  /**
+   * Check that the commands of a frame are known and complete
+   */
+  bool validate (const uint8_t*, size_t);
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  DownlinkDispatcher ();
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  /**
+   * @return Counter of the last accepted frame
+   */
+  const uint32_t get_counter ();
+
+  /**
+   * Set the counter of the last accepted frame, e.g. as persisted before a reset
+   */
+  void set_counter (uint32_t);
+
+  void set_counter_callback (downlink_counter_fn);
+
+  /**
+   * Set the key of the HMAC; without a key every frame is rejected
+   *
+   * @param key DOWNLINK_KEY_SIZE bytes
+   * @param device_id DOWNLINK_DEVICE_ID_SIZE bytes authenticated along with every frame, e.g. the DevEUI,
+   *                  so a frame for one device is not accepted by another one with the same key
+   */
+  void set_key (const uint8_t* key, const uint8_t* device_id);
+
+  const size_t get_command_count ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Register a command
+   *
+   * @return false if the dispatcher is full, the opcode is taken or the command has no handler
+   */
+  bool add (const downlink_command&);
+
+  /**
+   * Check a frame and run its commands in order
+   *
+   * @param data Frame bytes
+   * @param len Number of frame bytes
+   *
+   * @return Number of commands run successfully; -1 if the frame has been rejected
+   */
+  int parse (const uint8_t* data, size_t len);
+};
+
+#endif // DOWNLINKDISPATCHER_H
@@ -0,0 +1,132 @@
+#include "EnergyMeter.h"
+
+/***************
+ * Constructor
+ ***************/
+
+EnergyMeter::EnergyMeter (uint32_t max_gap)
+{
+  lock = portMUX_INITIALIZER_UNLOCKED;
+  max_gap_ms = max_gap;
+  clear();
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+const int64_t EnergyMeter::get_energy ()
+{
+  portENTER_CRITICAL(&lock);
+  int64_t energy = energy_uj;
+  portEXIT_CRITICAL(&lock);
+  return energy;
+}
+
+const uint32_t EnergyMeter::get_uncovered_ms ()
+{
+  portENTER_CRITICAL(&lock);
+  uint32_t uncovered = uncovered_ms;
+  portEXIT_CRITICAL(&lock);
+  return uncovered;
+}
+
+bool EnergyMeter::get_slot (size_t age, int64_t& energy, uint32_t* uncovered)
+{
+  portENTER_CRITICAL(&lock);
+  bool exists = age < slot_count;
+  if (exists)
+  {
+    size_t i = (slot_next + ENERGY_METER_SLOTS - 1 - age) % ENERGY_METER_SLOTS;
+    energy = slots[i];
+    if (uncovered != nullptr) *uncovered = slots_uncovered_ms[i];
+  }
+  portEXIT_CRITICAL(&lock);
+  return exists;
+}
+
+const size_t EnergyMeter::get_slot_count ()
+{
+  portENTER_CRITICAL(&lock);
+  size_t count = slot_count;
+  portEXIT_CRITICAL(&lock);
+  return count;
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+void EnergyMeter::add_sample (int32_t millivolt, int32_t milliamp, uint32_t now)
+{
+  // mV * mA = µW; fits easily into 64 bit for any 32 bit input
+  int64_t power = (int64_t)millivolt * (int64_t)milliamp;
+
+  portENTER_CRITICAL(&lock);
+  if (has_sample)
+  {
+    // unsigned difference stays correct when the clock wraps around
+    uint32_t elapsed = now - sample_ms;
+    if (elapsed <= max_gap_ms)
+    {
+      // µW * ms = nJ; split into whole µJ and the remainder carried over to the next sample
+      int64_t nano_joule = power_uw * (int64_t)elapsed + energy_remainder;
+      int64_t micro_joule = nano_joule / 1000;
+      int32_t remainder = (int32_t)(nano_joule % 1000);
+      if (remainder < 0)
+      {
+        remainder += 1000;
+        micro_joule--;
+      }
+      energy_uj += micro_joule;
+      energy_remainder = remainder;
+    }
+    else
+    {
+      uncovered_ms += elapsed;
+    }
+  }
+  power_uw = power;
+  sample_ms = now;
+  has_sample = true;
+  portEXIT_CRITICAL(&lock);
+}
+
+void EnergyMeter::reset_sample ()
+{
+  portENTER_CRITICAL(&lock);
+  has_sample = false;
+  portEXIT_CRITICAL(&lock);
+}
+
+int64_t EnergyMeter::close_slot ()
+{
+  portENTER_CRITICAL(&lock);
+  int64_t energy = energy_uj;
+  slots[slot_next] = energy;
+  slots_uncovered_ms[slot_next] = uncovered_ms;
+  slot_next = (slot_next + 1) % ENERGY_METER_SLOTS;
+  if (slot_count < ENERGY_METER_SLOTS) slot_count++;
+  energy_uj = 0;
+  uncovered_ms = 0;
+  portEXIT_CRITICAL(&lock);
+  return energy;
+}
+
+void EnergyMeter::clear ()
+{
+  portENTER_CRITICAL(&lock);
+  memset(slots, 0, sizeof(slots));
+  memset(slots_uncovered_ms, 0, sizeof(slots_uncovered_ms));
+  slot_next = 0;
+  slot_count = 0;
+  energy_uj = 0;
+  energy_remainder = 0;
+  uncovered_ms = 0;
+  power_uw = 0;
+  sample_ms = 0;
+  has_sample = false;
+  portEXIT_CRITICAL(&lock);
+}
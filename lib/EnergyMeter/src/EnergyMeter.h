@@ -0,0 +1,121 @@
+/**
+ * Energy metering from voltage and current samples in integer arithmetic.
+ * Every sample's power is held until the next sample and integrated over the real elapsed time between them,
+ * so late or missing samples are accounted for exactly instead of being extrapolated.
+ *
+ * Energy is accumulated in 64 bit microjoules; the sub-microjoule remainder is carried over, nothing is rounded away.
+ * Accumulated energy is closed into slots of a fixed-size ring, e.g. one slot per hour.
+ *
+ * Safe for samples from one core and slots being closed from the other.
+ */
+
+#ifndef ENERGYMETER_H
+#define ENERGYMETER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+// Number of closed slots kept in the ring
+#ifndef ENERGY_METER_SLOTS
+#define ENERGY_METER_SLOTS 24
+#endif
+
+// Default for the longest time between two samples that is integrated; longer gaps count as uncovered
+#define ENERGY_METER_MAX_GAP_MS 5000
+
+class EnergyMeter
+{
+private:
+  int64_t slots[ENERGY_METER_SLOTS];
+  uint32_t slots_uncovered_ms[ENERGY_METER_SLOTS];
+  size_t slot_next;
+  size_t slot_count;
+
+  int64_t energy_uj;
+  int32_t energy_remainder;   // µW * ms below one µJ, always 0..999
+  uint32_t uncovered_ms;
+
+  int64_t power_uw;
+  uint32_t sample_ms;
+  bool has_sample;
+
+  uint32_t max_gap_ms;
+  portMUX_TYPE lock;
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  /**
+   * @param max_gap Longest time in ms between two samples that is integrated
+   */
+  EnergyMeter (uint32_t max_gap = ENERGY_METER_MAX_GAP_MS);
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  /**
+   * @return Energy in µJ accumulated since the last closed slot
+   */
+  const int64_t get_energy ();
+
+  /**
+   * @return Time in ms since the last closed slot not covered by samples
+   */
+  const uint32_t get_uncovered_ms ();
+
+  /**
+   * Closed slot from the ring
+   *
+   * @param age 0 for the slot closed last, 1 for the one before, ...
+   * @param energy Set to the energy of the slot in µJ
+   * @param uncovered Set to the time in ms of the slot not covered by samples; may be nullptr
+   *
+   * @return false if the slot does not exist (yet)
+   */
+  bool get_slot (size_t age, int64_t& energy, uint32_t* uncovered = nullptr);
+
+  /**
+   * @return Number of closed slots in the ring, at most ENERGY_METER_SLOTS
+   */
+  const size_t get_slot_count ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Add a sample. The power of the previous sample is integrated up to now.
+   * Exact as long as power * max_gap stays within 64 bit nJ, e.g. up to 1.8 GW at the default gap.
+   *
+   * @param millivolt Voltage in mV
+   * @param milliamp Current in mA; negative if energy is fed back
+   * @param now Time of the sample in ms, e.g. millis(); may wrap around
+   */
+  void add_sample (int32_t millivolt, int32_t milliamp, uint32_t now);
+
+  /**
+   * Forget the previous sample, e.g. when the source has been disconnected.
+   * Integration starts again with the next sample.
+   */
+  void reset_sample ();
+
+  /**
+   * Move the accumulated energy into a new slot of the ring, overwriting the oldest one if full.
+   * The previous sample is kept, so energy up to the next sample is added to the following slot.
+   *
+   * @return Energy of the closed slot in µJ
+   */
+  int64_t close_slot ();
+
+  /**
+   * Forget all samples, accumulated energy and slots
+   */
+  void clear ();
+};
+
+#endif // ENERGYMETER_H
@@ -16,6 +16,14 @@ bool lmic_is_joined = false;
  */
 uint8_t* lora_queue ();
 size_t lora_queue_len ();
+uint8_t lora_queue_port ();
+bool lora_queue_confirmed ();
+unsigned lora_queue_interval ();
+void lora_queue_complete (bool acknowledged);
+void lora_queue_tx_start ();
+void lora_queue_dropped ();
+size_t lora_max_payload ();
+uint32_t lora_airtime_ms (size_t len);
 void parse_downlink (unsigned char* data, size_t len);
 
 void do_send (osjob_t* j);
@@ -43,6 +51,7 @@ static osjob_t sendjob;
 static const unsigned char ENV_APPEUI[8] =  {0};
 static const unsigned char ENV_DEVEUI[8] =  {0};
 static const unsigned char ENV_APPKEY[16] = {0};
+static const unsigned char ENV_DOWNLINK_KEY[32] = {0};
 #endif
 
 // This EUI must be in little-endian format, so least-significant-byte
@@ -68,11 +77,72 @@ bool COMM_BLOCK = true;
 // cycle limitations).
 const unsigned TX_INTERVAL = 300;
 
+// Schedule a follow-up TX after this many seconds if values did not fit into
+// the last payload (duty cycle limitations still apply).
+const unsigned TX_FOLLOW_UP_INTERVAL = 10;
+
+// Maximum application payload in bytes by data rate, for a frame without MAC
+// commands piggybacked (LoRaWAN Regional Parameters, repeater compatible).
+// LMIC does not check these limits; lora_max_payload() subtracts pending MAC commands.
+#if defined(CFG_eu868)
+static const uint8_t lora_max_payload_sizes[] = {
+  51, 51, 51, 115, 222, 222, 222, 222  // DR0 (SF12) .. DR7 (FSK)
+};
+// Spreading factor and bandwidth in kHz of the LoRa data rates
+static const uint8_t lora_dr_sf[] = { 12, 11, 10, 9, 8, 7, 7 };
+static const uint16_t lora_dr_bw[] = { 125, 125, 125, 125, 125, 125, 250 };
+#else
+static const uint8_t lora_max_payload_sizes[] = { 51 };
+static const uint8_t lora_dr_sf[] = { 12 };
+static const uint16_t lora_dr_bw[] = { 125 };
+#endif
+
+// Bytes of a LoRaWAN frame besides the application payload: MHDR, FHDR, FPort, MIC
+#define LORA_FRAME_OVERHEAD 13
+
 // This key should be in big endian format (or, since it is not really a
 // number but a block of memory, endianness does not really apply). In
 // practice, a key taken from ttnctl can be copied as-is.
 void os_getDevKey (u1_t* buf) { memcpy_P(buf, ENV_APPKEY, 16);}
 
+#include "LoRaSession.h"
+
+/**
+ * @return Maximum application payload in bytes at the current data rate, less the MAC commands
+ * LMIC piggybacks on the next uplink
+ */
+size_t lora_max_payload () {
+  size_t dr = LMIC.datarate;
+  size_t count = sizeof(lora_max_payload_sizes) / sizeof(lora_max_payload_sizes[0]);
+  // unknown data rates get the smallest size
+  size_t size = dr < count ? lora_max_payload_sizes[dr] : lora_max_payload_sizes[0];
+  // never more than a frame of the LMIC build holds
+  if (size > MAX_LEN_FRAME - LORA_FRAME_OVERHEAD) size = MAX_LEN_FRAME - LORA_FRAME_OVERHEAD;
+  // pending MAC answers go into FOpts of the same frame and count against the limit of the data rate
+  return size > LMIC.pendMacLen ? size - LMIC.pendMacLen : 0;
+}
+
+/**
+ * Time on air of an uplink at the current data rate, after the formula of the SX1276 datasheet
+ * (coding rate 4/5, explicit header, CRC, 8 symbols preamble); unknown data rates count as the slowest.
+ *
+ * @param len Number of bytes of the application payload
+ */
+uint32_t lora_airtime_ms (size_t len) {
+  size_t dr = LMIC.datarate;
+  if (dr >= sizeof(lora_dr_sf)) dr = 0;
+  int32_t sf = lora_dr_sf[dr];
+  uint32_t symbol_us = (1000UL << sf) / lora_dr_bw[dr];
+  // low data rate optimization for symbols longer than 16 ms
+  int32_t de = symbol_us > 16000 ? 1 : 0;
+
+  int32_t bits = 8 * (int32_t)(len + LORA_FRAME_OVERHEAD) - 4 * sf + 28 + 16;
+  int32_t symbols = 8;
+  if (bits > 0) symbols += (bits + 4 * (sf - 2 * de) - 1) / (4 * (sf - 2 * de)) * 5;
+  // preamble of 12.25 symbols
+  return ((49 + 4 * symbols) * symbol_us / 4 + 999) / 1000;
+}
+
 void do_send(osjob_t* j){
   // Check if there is not a current TX/RX job running
   if (LMIC.opmode & OP_TXRXPEND) {
@@ -81,10 +151,21 @@ void do_send(osjob_t* j){
     // Prepare upstream data transmission at the next possible time.
     uint8_t* data = lora_queue();
     size_t len = lora_queue_len();
-    LMIC_setTxData2(1, data, len, 0);
-    if (debug)
+    if (len == 0)
     {
-      Serial.print(F("Packet queued "));
+      // nothing to send now, e.g. no airtime left
+      os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(lora_queue_interval()), do_send);
+    }
+    else if (LMIC_setTxData2(lora_queue_port(), data, len, lora_queue_confirmed() ? 1 : 0) != 0)
+    {
+      if (debug) Serial.printf(" ! Packet of %d bytes not queued, DR%d\n", len, LMIC.datarate);
+      // no TX_COMPLETE follows: take the uplink back and try again later
+      lora_queue_dropped();
+      os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(lora_queue_interval()), do_send);
+    }
+    else if (debug)
+    {
+      Serial.printf("Packet queued, DR%d, max %d bytes: ", LMIC.datarate, lora_max_payload());
       print_hex(data, len);
     }
   }
@@ -144,6 +225,9 @@ void onEvent (ev_t ev) {
 
       // change joined bool state to true
       lmic_is_joined = true;
+      // keep the session, so a reset needs no new join
+      lora_session_save(true);
+      lora_session_nack_count = 0;
       break;
     /*
     || This event is defined but not used in the code. No
@@ -162,7 +246,16 @@ void onEvent (ev_t ev) {
     case EV_TXCOMPLETE:
       if (debug) Serial.println(F("EV_TXCOMPLETE (includes waiting for RX windows)"));
       if (LMIC.txrxFlags & TXRX_ACK)
+      {
         if (debug) Serial.println(F("Received ack"));
+      }
+      else if (LMIC.txrxFlags & TXRX_NACK)
+      {
+        if (debug) Serial.println(F("No ack received"));
+      }
+      if (LMIC.txrxFlags & (TXRX_ACK | TXRX_NACK)) lora_session_confirmed(LMIC.txrxFlags & TXRX_ACK);
+      lora_session_save();
+      lora_queue_complete(LMIC.txrxFlags & TXRX_ACK);
       if (LMIC.dataLen) {
         if (debug) Serial.print(F("Received "));
         if (debug) Serial.print(LMIC.dataLen);
@@ -177,8 +270,8 @@ void onEvent (ev_t ev) {
         parse_downlink(data, LMIC.dataLen);
 
       }
-      // Schedule next transmission
-      os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(TX_INTERVAL), do_send);
+      // Schedule next transmission; alarms and values that did not fit follow soon
+      os_setTimedCallback(&sendjob, os_getTime()+sec2osticks(lora_queue_interval()), do_send);
       break;
     case EV_LOST_TSYNC:
       if (debug) Serial.println(F("EV_LOST_TSYNC"));
@@ -192,6 +285,8 @@ void onEvent (ev_t ev) {
       break;
     case EV_LINK_DEAD:
       if (debug) Serial.println(F("EV_LINK_DEAD"));
+      // the network does not answer the session anymore
+      lora_rejoin();
       break;
     case EV_LINK_ALIVE:
       if (debug) Serial.println(F("EV_LINK_ALIVE"));
@@ -206,6 +301,8 @@ void onEvent (ev_t ev) {
     */
     case EV_TXSTART:
       if (debug) Serial.println(F("EV_TXSTART"));
+      // every transmission of an uplink counts, retransmissions of confirmed uplinks at their lower data rate
+      if (!(LMIC.opmode & OP_JOINING)) lora_queue_tx_start();
       break;
     case EV_TXCANCELED:
       if (debug) Serial.println(F("EV_TXCANCELED"));
@@ -0,0 +1,252 @@
+/**
+ * Persistence of the LoRaWAN session, so a reset does not need a new OTAA join.
+ *
+ * The session (keys, DevAddr, channels, data rate and ADR state) is written to NVS on join and whenever the network
+ * changes it. The uplink frame counter is written ahead by LORA_SESSION_FCNT_STEP, so NVS is only written every
+ * LORA_SESSION_FCNT_STEP uplinks and a restored counter is never one that has been used already.
+ * The downlink frame counter cannot be written ahead, downlinks below it would be rejected; it is written whenever
+ * a downlink has been received, so a restored counter never accepts a replayed downlink.
+ * A copy in RTC memory, updated on every uplink, survives esp_restart() and watchdog resets with the exact counters.
+ *
+ * A new join is only made on request (lora_rejoin()), for a session of another DevEUI, or once the session is
+ * considered invalid: EV_LINK_DEAD, or LORA_SESSION_NACK_MAX confirmed uplinks without ACK in a row.
+ *
+ * Part of LoRa.h, which defines os_getDevEui(), sendjob and do_send().
+ */
+
+#ifndef LORASESSION_H
+#define LORASESSION_H
+
+#include <Arduino.h>
+#include <lmic.h>
+#include <Preferences.h>
+#include <rom/rtc.h>
+
+#define LORA_SESSION_MAGIC 0x4E455354
+#define LORA_SESSION_VERSION 1
+
+// Uplinks between two writes of the frame counter to NVS
+#define LORA_SESSION_FCNT_STEP 32
+
+// Confirmed uplinks without ACK in a row after which the session is considered invalid
+#define LORA_SESSION_NACK_MAX 8
+
+struct lora_session
+{
+  uint32_t magic;
+  uint8_t version;
+  u1_t dev_eui[8];
+  u4_t netid;
+  devaddr_t devaddr;
+  u1_t nwk_key[16];
+  u1_t art_key[16];
+  u1_t datarate;
+  s1_t adr_tx_pow;
+  u1_t adr_enabled;
+  u1_t dn2_dr;
+  u4_t dn2_freq;
+  u1_t rx_delay;
+  u1_t rx1_dr_offset;
+  decltype(LMIC.channelFreq) channel_freq;
+  decltype(LMIC.channelDrMap) channel_dr_map;
+  decltype(LMIC.channelMap) channel_map;
+  // Counters; only kept exact in RTC memory, NVS has them in their own keys
+  // (the uplink counter written ahead, the downlink counter after every downlink)
+  u4_t seqno_up;
+  u4_t seqno_dn;
+};
+
+// Session as of the last uplink, kept over resets but not power loss
+RTC_DATA_ATTR lora_session lora_session_rtc;
+
+// Session as last written to NVS, without counters
+lora_session lora_session_saved;
+// Uplink frame counter as written to NVS
+u4_t lora_session_fcnt_saved = 0;
+// Downlink frame counter as written to NVS
+u4_t lora_session_fcnt_dn_saved = 0;
+
+size_t lora_session_nack_count = 0;
+static osjob_t lora_rejoin_job;
+
+/**
+ * Current session of LMIC
+ */
+void lora_session_get (lora_session& session)
+{
+  memset(&session, 0, sizeof(session));
+  session.magic = LORA_SESSION_MAGIC;
+  session.version = LORA_SESSION_VERSION;
+  os_getDevEui(session.dev_eui);
+  LMIC_getSessionKeys(&session.netid, &session.devaddr, session.nwk_key, session.art_key);
+  session.datarate = LMIC.datarate;
+  session.adr_tx_pow = LMIC.adrTxPow;
+  session.adr_enabled = LMIC.adrEnabled;
+  session.dn2_dr = LMIC.dn2Dr;
+  session.dn2_freq = LMIC.dn2Freq;
+  session.rx_delay = LMIC.rxDelay;
+  session.rx1_dr_offset = LMIC.rx1DrOffset;
+  memcpy(session.channel_freq, LMIC.channelFreq, sizeof(session.channel_freq));
+  memcpy(session.channel_dr_map, LMIC.channelDrMap, sizeof(session.channel_dr_map));
+  memcpy(&session.channel_map, &LMIC.channelMap, sizeof(session.channel_map));
+}
+
+/**
+ * @return true if a stored session belongs to this device and this firmware
+ */
+bool lora_session_valid (const lora_session& session)
+{
+  u1_t dev_eui[8];
+  os_getDevEui(dev_eui);
+  return session.magic == LORA_SESSION_MAGIC && session.version == LORA_SESSION_VERSION &&
+         memcmp(session.dev_eui, dev_eui, sizeof(dev_eui)) == 0 && session.devaddr != 0;
+}
+
+/**
+ * Keep the session after an uplink: always in RTC memory, in NVS if it has changed, the uplink frame counter
+ * has reached the value written ahead, or a downlink has been received.
+ *
+ * @param force Write the whole session, e.g. after a join
+ */
+void lora_session_save (bool force = false)
+{
+  lora_session session;
+  lora_session_get(session);
+  session.seqno_up = LMIC.seqnoUp;
+  session.seqno_dn = LMIC.seqnoDn;
+  memcpy(&lora_session_rtc, &session, sizeof(session));
+
+  session.seqno_up = 0;
+  session.seqno_dn = 0;
+  bool changed = force || memcmp(&session, &lora_session_saved, sizeof(session)) != 0;
+  bool fcnt = force || LMIC.seqnoUp >= lora_session_fcnt_saved;
+  bool fcnt_dn = force || LMIC.seqnoDn != lora_session_fcnt_dn_saved;
+  if (!changed && !fcnt && !fcnt_dn) return;
+
+  Preferences preferences;
+  preferences.begin("lorawan", false);
+  if (changed)
+  {
+    preferences.putBytes("session", &session, sizeof(session));
+    memcpy(&lora_session_saved, &session, sizeof(session));
+    if (debug) Serial.println(" - LoRaWAN session saved");
+  }
+  if (fcnt)
+  {
+    lora_session_fcnt_saved = LMIC.seqnoUp + LORA_SESSION_FCNT_STEP;
+    preferences.putUInt("fcnt_up", lora_session_fcnt_saved);
+  }
+  if (fcnt_dn)
+  {
+    lora_session_fcnt_dn_saved = LMIC.seqnoDn;
+    preferences.putUInt("fcnt_dn", lora_session_fcnt_dn_saved);
+  }
+  preferences.end();
+}
+
+/**
+ * Restore the last session after LMIC_reset()
+ *
+ * @return true if a session has been restored, so no join is needed
+ */
+bool lora_session_restore ()
+{
+  lora_session session;
+  Preferences preferences;
+  preferences.begin("lorawan", true);
+  bool stored = preferences.getBytes("session", &session, sizeof(session)) == sizeof(session) && lora_session_valid(session);
+  memcpy(&lora_session_saved, &session, sizeof(session));
+  lora_session_fcnt_saved = preferences.getUInt("fcnt_up", 0);
+  lora_session_fcnt_dn_saved = preferences.getUInt("fcnt_dn", 0);
+  preferences.end();
+  if (!stored)
+  {
+    if (debug) Serial.println(" - no LoRaWAN session stored, joining");
+    return false;
+  }
+
+  // RTC memory has the exact counters of the same session if this is not a power-on
+  bool rtc = rtc_get_reset_reason(0) != POWERON_RESET && lora_session_valid(lora_session_rtc) &&
+             lora_session_rtc.devaddr == session.devaddr &&
+             memcmp(lora_session_rtc.nwk_key, session.nwk_key, sizeof(session.nwk_key)) == 0;
+  if (rtc)
+  {
+    memcpy(&session, &lora_session_rtc, sizeof(session));
+  }
+  else
+  {
+    session.seqno_up = lora_session_fcnt_saved;
+    session.seqno_dn = lora_session_fcnt_dn_saved;
+  }
+
+  LMIC_setSession(session.netid, session.devaddr, session.nwk_key, session.art_key);
+  memcpy(LMIC.channelFreq, session.channel_freq, sizeof(session.channel_freq));
+  memcpy(LMIC.channelDrMap, session.channel_dr_map, sizeof(session.channel_dr_map));
+  memcpy(&LMIC.channelMap, &session.channel_map, sizeof(session.channel_map));
+  LMIC_setAdrMode(session.adr_enabled);
+  LMIC_setDrTxpow(session.datarate, session.adr_tx_pow);
+  LMIC.dn2Dr = session.dn2_dr;
+  LMIC.dn2Freq = session.dn2_freq;
+  LMIC.rxDelay = session.rx_delay;
+  LMIC.rx1DrOffset = session.rx1_dr_offset;
+  LMIC.seqnoUp = session.seqno_up;
+  LMIC.seqnoDn = session.seqno_dn;
+  LMIC_setLinkCheckMode(0);
+
+  if (debug) Serial.printf(" - LoRaWAN session restored from %s: devaddr %08X, FCntUp %u\n",
+    rtc ? "RTC memory" : "NVS", session.devaddr, session.seqno_up);
+  return true;
+}
+
+/**
+ * Forget the stored session
+ */
+void lora_session_clear ()
+{
+  memset(&lora_session_rtc, 0, sizeof(lora_session_rtc));
+  memset(&lora_session_saved, 0, sizeof(lora_session_saved));
+  lora_session_fcnt_saved = 0;
+  lora_session_fcnt_dn_saved = 0;
+  Preferences preferences;
+  preferences.begin("lorawan", false);
+  preferences.clear();
+  preferences.end();
+}
+
+void lora_rejoin_run (osjob_t* j)
+{
+  if (debug) Serial.println(" - LoRaWAN rejoin");
+  lora_session_clear();
+  lora_session_nack_count = 0;
+  lmic_is_joined = false;
+  LMIC_reset();
+  // sending starts OTAA
+  os_setCallback(&sendjob, do_send);
+}
+
+/**
+ * Forget the session and join again; runs as LMIC job, so it is safe to call from LMIC events
+ */
+void lora_rejoin ()
+{
+  os_setCallback(&lora_rejoin_job, lora_rejoin_run);
+}
+
+/**
+ * Count confirmed uplinks without ACK; too many in a row invalidate the session
+ */
+void lora_session_confirmed (bool acknowledged)
+{
+  if (acknowledged)
+  {
+    lora_session_nack_count = 0;
+    return;
+  }
+  if (++lora_session_nack_count >= LORA_SESSION_NACK_MAX)
+  {
+    if (debug) Serial.println(" ! LoRaWAN session not acknowledged, rejoin");
+    lora_rejoin();
+  }
+}
+
+#endif // LORASESSION_H
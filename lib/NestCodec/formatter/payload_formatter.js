@@ -0,0 +1,122 @@
+/**
+ * TTN (The Things Stack v3) uplink payload formatter for the nest uplink format, see src/NestCodec.h.
+ * Payload formatters are stateless, so fields of delta payloads are returned as a difference to the keyframe
+ * with the given sequence number; the receiving application adds it to the value of that keyframe.
+ *
+ * FPort 3 carries batches of the uplink backlog, snapshots taken while the uplink was down:
+ * timestamp of the batch, followed by records of length byte, timestamp and keyframe.
+ * A timestamp is the boot counter (1 byte) and the uptime in seconds (3 bytes, MSB first); for records of the boot
+ * of the batch, age is the number of seconds the record was taken before the batch was sent.
+ */
+
+var NEST_CODEC_VERSION = 1;
+
+// Channels of NEST_CODEC_VERSION: name, bits, signed, divisor to the unit
+var CHANNELS = [
+  ["reset_reason",          8, false, 1],
+  ["exec_state",            8, false, 1],
+  ["temp_outside",         16, true,  10],     // °C
+  ["temp_inside",          16, true,  10],     // °C
+  ["humidity_inside",       8, false, 2],      // %
+  ["door",                  1, false, 1],
+  ["lock",                  8, false, 1],
+  ["smoke_detector",        1, false, 1],
+  ["battery_volt",         16, false, 100],    // V
+  ["door_counter",          8, false, 1],
+  ["lock_counter",          8, false, 1],
+  ["motion_counter",        8, false, 1],
+  ["light_switch_counter",  8, false, 1],
+  ["mppt_battery_volt",    16, false, 1000],   // V
+  ["load_energy",          16, true,  100],    // Wh
+  ["pv_yield",             16, false, 100],    // kWh
+  ["shunt_battery_volt",   16, false, 1000],   // V
+  ["shunt_current",        16, true,  100],    // A
+  ["shunt_soc",            10, false, 10],     // %
+  ["inverter_ac_volt",     16, false, 100],    // V
+  ["inverter_ac_power",    16, false, 1]       // VA
+];
+
+var BACKLOG_PORT = 3;
+
+function decodeUplink(input) {
+  try {
+    if (input.fPort === BACKLOG_PORT) return { data: decodeBacklog(input.bytes) };
+    return { data: decodePayload(input.bytes) };
+  } catch (e) {
+    return { errors: [e.message] };
+  }
+}
+
+function decodeTimestamp(bytes, pos) {
+  if (pos + 4 > bytes.length) throw new Error("backlog truncated");
+  return { boot: bytes[pos], uptime: (bytes[pos + 1] << 16) | (bytes[pos + 2] << 8) | bytes[pos + 3] };
+}
+
+function decodeBacklog(bytes) {
+  var now = decodeTimestamp(bytes, 0);
+  var records = [];
+  var pos = 4;
+  while (pos < bytes.length) {
+    var len = bytes[pos];
+    if (len < 4 || pos + 1 + len > bytes.length) throw new Error("backlog truncated");
+    var record = decodeTimestamp(bytes, pos + 1);
+    if (record.boot === now.boot) record.age = now.uptime - record.uptime;
+    record.payload = decodePayload(bytes.slice(pos + 5, pos + 1 + len));
+    records.push(record);
+    pos += 1 + len;
+  }
+  return { boot: now.boot, uptime: now.uptime, records: records };
+}
+
+function decodePayload(bytes) {
+  var pos = 0;
+
+  function read(n) {
+    if (pos + n > bytes.length * 8) throw new Error("payload truncated");
+    var v = 0;
+    for (var i = 0; i < n; i++) {
+      v = v * 2 + ((bytes[pos >> 3] >> (7 - (pos & 7))) & 1);
+      pos++;
+    }
+    return v;
+  }
+
+  function signExtend(v, bits) {
+    return v >= Math.pow(2, bits - 1) ? v - Math.pow(2, bits) : v;
+  }
+
+  function unzigzag(v) {
+    return v % 2 ? -(v + 1) / 2 : v / 2;
+  }
+
+  var version = read(4);
+  if (version !== NEST_CODEC_VERSION) {
+    throw new Error("unknown payload version " + version);
+  }
+  var keyframe = read(1) === 1;
+  var sequence = read(3);
+
+  var present = [];
+  for (var c = 0; c < CHANNELS.length; c++) present.push(read(1) === 1);
+
+  var fields = {};
+  for (c = 0; c < CHANNELS.length; c++) {
+    if (!present[c]) continue;
+    var name = CHANNELS[c][0], bits = CHANNELS[c][1], signed = CHANNELS[c][2], divisor = CHANNELS[c][3];
+    var absolute = keyframe;
+    var width = 4;
+    if (!keyframe && read(1) === 1) {
+      // prefix 11: absolute value, prefix 10: 8 bit difference
+      absolute = read(1) === 1;
+      width = 8;
+    }
+    if (absolute) {
+      var v = read(bits);
+      fields[name] = { value: (signed ? signExtend(v, bits) : v) / divisor };
+    } else {
+      fields[name] = { delta: unzigzag(read(width)) / divisor };
+    }
+  }
+
+  return { version: version, keyframe: keyframe, sequence: sequence, fields: fields };
+}
@@ -0,0 +1,297 @@
+#include "NestCodec.h"
+
+/**
+ * Bit helpers
+ */
+
+// Write the lowest n bits of a value, MSB first
+static void write_bits (uint8_t* buffer, size_t& pos, uint32_t value, uint8_t n)
+{
+  for (int i = n - 1; i >= 0; i--)
+  {
+    if (value >> i & 1) buffer[pos >> 3] |= 0x80 >> (pos & 7);
+    pos++;
+  }
+}
+
+// Read n bits, MSB first; false if the buffer ends before
+static bool read_bits (const uint8_t* buffer, size_t len, size_t& pos, uint8_t n, uint32_t& value)
+{
+  if (pos + n > len * 8) return false;
+  value = 0;
+  for (uint8_t i = 0; i < n; i++)
+  {
+    value = value << 1 | (buffer[pos >> 3] >> (7 - (pos & 7)) & 1);
+    pos++;
+  }
+  return true;
+}
+
+static int32_t clamp (const codec_channel& c, int32_t value)
+{
+  int32_t max = c.is_signed ? (int32_t)((1UL << (c.bits - 1)) - 1) : (int32_t)((1UL << c.bits) - 1);
+  int32_t min = c.is_signed ? -max - 1 : 0;
+  return value > max ? max : value < min ? min : value;
+}
+
+static int32_t sign_extend (const codec_channel& c, uint32_t value)
+{
+  if (c.is_signed && (value >> (c.bits - 1) & 1)) value |= UINT32_MAX << c.bits;
+  return (int32_t)value;
+}
+
+static uint32_t zigzag (int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag (uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+
+/***************
+ * Constructor
+ ***************/
+
+NestEncoder::NestEncoder ()
+{
+  size = 0;
+  sequence = 0;
+  reset();
+  begin(true);
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+uint8_t* NestEncoder::get_buffer ()
+{
+  return buffer;
+}
+
+const size_t NestEncoder::get_size ()
+{
+  return (bits + 7) / 8;
+}
+
+const size_t NestEncoder::get_size_with (unsigned char channel, int32_t value)
+{
+  if (channel >= NEST_CODEC_CHANNELS || present[channel]) return get_size();
+  return (bits + field_bits(channel, value) + 7) / 8;
+}
+
+const bool NestEncoder::is_keyframe ()
+{
+  return keyframe;
+}
+
+const bool NestEncoder::has_reference_frame ()
+{
+  return reference_valid;
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+/**
+ * Number of bits of a field, choosing the shortest encoding in a delta payload
+ */
+size_t NestEncoder::field_bits (unsigned char channel, int32_t value)
+{
+  const codec_channel& c = codec_channels[channel];
+  if (keyframe) return c.bits;
+
+  size_t absolute = 2 + c.bits;
+  if (!has_reference[channel]) return absolute;
+  uint32_t delta = zigzag(clamp(c, value) - reference[channel]);
+  if (delta < 16 && 5 < absolute) return 5;
+  if (delta < 256 && 10 < absolute) return 10;
+  return absolute;
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+void NestEncoder::begin (bool _keyframe)
+{
+  // Without an acknowledged keyframe there is nothing to refer to
+  keyframe = _keyframe || !reference_valid;
+  if (keyframe)
+  {
+    sequence = (sequence + 1) % NEST_CODEC_SEQUENCES;
+    // the slot of the reference is kept until another keyframe is acknowledged, deltas still refer to it
+    if (reference_valid && sequence == reference_sequence) sequence = (sequence + 1) % NEST_CODEC_SEQUENCES;
+  }
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++) present[i] = false;
+  bits = NEST_CODEC_HEADER_BITS + NEST_CODEC_CHANNELS;
+  size = 0;
+}
+
+bool NestEncoder::add (unsigned char channel, int32_t value)
+{
+  if (channel >= NEST_CODEC_CHANNELS || present[channel]) return false;
+  bits += field_bits(channel, value);
+  values[channel] = clamp(codec_channels[channel], value);
+  present[channel] = true;
+  return true;
+}
+
+/**
+ * Encode the payload into the buffer
+ */
+size_t NestEncoder::finish ()
+{
+  size = get_size();
+  memset(buffer, 0, size);
+
+  size_t pos = 0;
+  write_bits(buffer, pos, NEST_CODEC_VERSION, 4);
+  write_bits(buffer, pos, keyframe ? 1 : 0, 1);
+  write_bits(buffer, pos, keyframe ? sequence : reference_sequence, 3);
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++) write_bits(buffer, pos, present[i] ? 1 : 0, 1);
+
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+  {
+    if (!present[i]) continue;
+    const codec_channel& c = codec_channels[i];
+    size_t n = field_bits(i, values[i]);
+    if (keyframe)
+    {
+      write_bits(buffer, pos, (uint32_t)values[i], c.bits);
+    }
+    else if (n == 5)
+    {
+      write_bits(buffer, pos, 0b0, 1);
+      write_bits(buffer, pos, zigzag(values[i] - reference[i]), 4);
+    }
+    else if (n == 10)
+    {
+      write_bits(buffer, pos, 0b10, 2);
+      write_bits(buffer, pos, zigzag(values[i] - reference[i]), 8);
+    }
+    else
+    {
+      write_bits(buffer, pos, 0b11, 2);
+      write_bits(buffer, pos, (uint32_t)values[i], c.bits);
+    }
+  }
+  return size;
+}
+
+void NestEncoder::acknowledge ()
+{
+  if (!keyframe) return;
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+  {
+    reference[i] = values[i];
+    has_reference[i] = present[i];
+  }
+  reference_sequence = sequence;
+  reference_valid = true;
+}
+
+void NestEncoder::reset ()
+{
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+  {
+    reference[i] = 0;
+    has_reference[i] = false;
+  }
+  reference_sequence = 0;
+  reference_valid = false;
+}
+
+
+/***************
+ * Constructor
+ ***************/
+
+NestDecoder::NestDecoder ()
+{
+  reset();
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+bool NestDecoder::decode (const uint8_t* data, size_t len, int32_t* values, bool* present)
+{
+  size_t pos = 0;
+  uint32_t version, keyframe, sequence, bit;
+  if (!read_bits(data, len, pos, 4, version) || version != NEST_CODEC_VERSION ||
+      !read_bits(data, len, pos, 1, keyframe) ||
+      !read_bits(data, len, pos, 3, sequence)) return false;
+  if (!keyframe && !keyframe_valid[sequence]) return false;
+
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+  {
+    if (!read_bits(data, len, pos, 1, bit)) return false;
+    present[i] = bit;
+  }
+
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+  {
+    if (!present[i]) continue;
+    const codec_channel& c = codec_channels[i];
+    uint32_t v;
+
+    if (keyframe)
+    {
+      if (!read_bits(data, len, pos, c.bits, v)) return false;
+      values[i] = sign_extend(c, v);
+      continue;
+    }
+
+    if (!read_bits(data, len, pos, 1, bit)) return false;
+    if (bit == 0)
+    {
+      if (!read_bits(data, len, pos, 4, v) || !keyframe_present[sequence][i]) return false;
+      values[i] = keyframes[sequence][i] + unzigzag(v);
+      continue;
+    }
+    if (!read_bits(data, len, pos, 1, bit)) return false;
+    if (bit == 0)
+    {
+      if (!read_bits(data, len, pos, 8, v) || !keyframe_present[sequence][i]) return false;
+      values[i] = keyframes[sequence][i] + unzigzag(v);
+      continue;
+    }
+    if (!read_bits(data, len, pos, c.bits, v)) return false;
+    values[i] = sign_extend(c, v);
+  }
+
+  // Remember a keyframe for the delta payloads referring to it
+  if (keyframe)
+  {
+    for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+    {
+      keyframes[sequence][i] = present[i] ? values[i] : 0;
+      keyframe_present[sequence][i] = present[i];
+    }
+    keyframe_valid[sequence] = true;
+  }
+  return true;
+}
+
+void NestDecoder::reset ()
+{
+  for (size_t s = 0; s < NEST_CODEC_SEQUENCES; s++)
+  {
+    for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+    {
+      keyframes[s][i] = 0;
+      keyframe_present[s][i] = false;
+    }
+    keyframe_valid[s] = false;
+  }
+}
@@ -0,0 +1,217 @@
+/**
+ * Compact bit-packed uplink format of the nest, replacing Cayenne LPP.
+ *
+ * Payload, bits MSB first:
+ *   4 bit   version (NEST_CODEC_VERSION)
+ *   1 bit   keyframe flag
+ *   3 bit   keyframe sequence number; of this keyframe, or of the reference keyframe of a delta payload.
+ *           New keyframes never take the sequence number of the reference keyframe.
+ *   n bit   presence bitmap, one bit per channel 0 .. NEST_CODEC_CHANNELS - 1
+ *   fields  of the present channels in ascending order, padded with 0 bits to a full byte
+ *
+ * In a keyframe every field is its absolute value with the width of its channel.
+ * In a delta payload every field starts with a prefix:
+ *   0  + 4 bit          zigzag encoded difference to the reference value
+ *   10 + 8 bit          zigzag encoded difference to the reference value
+ *   11 + channel width  absolute value
+ * The reference values are those of the last acknowledged keyframe; channels it does not contain are sent absolute.
+ * Keyframes are sent as confirmed uplinks and only an acknowledged keyframe becomes the reference,
+ * so a lost uplink never breaks the values of the following ones.
+ */
+
+#ifndef NESTCODEC_H
+#define NESTCODEC_H
+
+#include <Arduino.h>
+
+#define NEST_CODEC_VERSION 1
+
+// Number of channels of NEST_CODEC_VERSION
+#define NEST_CODEC_CHANNELS 21
+
+// Largest payload in bytes, the maximum of LoRaWAN EU868
+#define NEST_CODEC_SIZE_MAX 222
+
+// Number of keyframe sequence numbers
+#define NEST_CODEC_SEQUENCES 8
+
+// Number of bits of the header, without the presence bitmap
+#define NEST_CODEC_HEADER_BITS 8
+
+/**
+ * Width of the values of a channel
+ */
+struct codec_channel
+{
+  uint8_t bits;
+  bool is_signed;
+};
+
+/**
+ * Channels of NEST_CODEC_VERSION, indexed by channel; same channel numbers as the parameter table.
+ * Values are the raw values of the parameters, e.g. 0.1 °C for temperatures.
+ */
+constexpr codec_channel codec_channels[NEST_CODEC_CHANNELS]
+{
+  //  bits signed
+  {   8, false },   //  0 reset reason
+  {   8, false },   //  1 execution state
+  {  16, true  },   //  2 temperature outside; 0.1 °C
+  {  16, true  },   //  3 temperature inside; 0.1 °C
+  {   8, false },   //  4 humidity inside; 0.5 %
+  {   1, false },   //  5 door
+  {   8, false },   //  6 lock state
+  {   1, false },   //  7 smoke detector
+  {  16, false },   //  8 battery voltage; 0.01 V
+  {   8, false },   //  9 door counter; MSB last state
+  {   8, false },   // 10 lock counter; MSB last state
+  {   8, false },   // 11 motion counter
+  {   8, false },   // 12 light switch counter
+  {  16, false },   // 13 MPPT battery voltage; mV
+  {  16, true  },   // 14 load energy, hourly; 0.01 Wh
+  {  16, false },   // 15 PV yield today; 0.01 kWh
+  {  16, false },   // 16 shunt battery voltage; mV
+  {  16, true  },   // 17 shunt current; 10 mA
+  {  10, false },   // 18 shunt state of charge; 0.1 %
+  {  16, false },   // 19 inverter AC voltage; 0.01 V
+  {  16, false }    // 20 inverter AC power; VA
+};
+
+/**
+ * Encoder of payloads, keeping the reference values of the last acknowledged keyframe
+ */
+class NestEncoder
+{
+private:
+  uint8_t buffer[NEST_CODEC_SIZE_MAX];
+  size_t size;
+
+  // Payload being assembled
+  int32_t values[NEST_CODEC_CHANNELS];
+  bool present[NEST_CODEC_CHANNELS];
+  size_t bits;
+  bool keyframe;
+  uint8_t sequence;
+
+  // Reference values of the last acknowledged keyframe
+  int32_t reference[NEST_CODEC_CHANNELS];
+  bool has_reference[NEST_CODEC_CHANNELS];
+  uint8_t reference_sequence;
+  bool reference_valid;
+
+  /**
+   * Number of bits of a field of a channel with a value, including its prefix in a delta payload
+   */
+  size_t field_bits (unsigned char, int32_t);
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  NestEncoder ();
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  uint8_t* get_buffer ();
+
+  /**
+   * @return Number of bytes of the payload assembled since begin()
+   */
+  const size_t get_size ();
+
+  /**
+   * @return Number of bytes of the payload if a field were added
+   */
+  const size_t get_size_with (unsigned char channel, int32_t value);
+
+  const bool is_keyframe ();
+
+  /**
+   * @return true once a keyframe has been acknowledged, so payloads can be delta encoded
+   */
+  const bool has_reference_frame ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Start a new payload
+   *
+   * @param keyframe true for a keyframe with absolute values, which is to be sent confirmed
+   */
+  void begin (bool keyframe);
+
+  /**
+   * Add a field to the payload; values are clamped to the width of the channel
+   *
+   * @return false for unknown channels or if the channel has already been added
+   */
+  bool add (unsigned char channel, int32_t value);
+
+  /**
+   * Encode the payload into the buffer
+   *
+   * @return Number of bytes of the payload
+   */
+  size_t finish ();
+
+  /**
+   * The last payload, a keyframe, has been acknowledged; its values become the reference values
+   */
+  void acknowledge ();
+
+  /**
+   * Forget the reference values, e.g. after a new join
+   */
+  void reset ();
+};
+
+/**
+ * Reference decoder, keeping the values of the last keyframe of every sequence number.
+ * Whether a keyframe has been acknowledged is not known to the decoder; a delta payload names its keyframe.
+ */
+class NestDecoder
+{
+private:
+  int32_t keyframes[NEST_CODEC_SEQUENCES][NEST_CODEC_CHANNELS];
+  bool keyframe_present[NEST_CODEC_SEQUENCES][NEST_CODEC_CHANNELS];
+  bool keyframe_valid[NEST_CODEC_SEQUENCES];
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  NestDecoder ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Decode a payload
+   *
+   * @param data Payload bytes
+   * @param len Number of payload bytes
+   * @param values Set to the value of every present channel
+   * @param present Set for every channel contained in the payload
+   *
+   * @return false for payloads of another version, truncated payloads,
+   *         or deltas to a keyframe that has not been decoded
+   */
+  bool decode (const uint8_t* data, size_t len, int32_t* values, bool* present);
+
+  /**
+   * Forget all keyframes
+   */
+  void reset ();
+};
+
+#endif // NESTCODEC_H
@@ -0,0 +1,151 @@
+#include "PayloadScheduler.h"
+
+/***************
+ * Constructor
+ ***************/
+
+PayloadScheduler::PayloadScheduler ()
+{
+  field_count = 0;
+  reset();
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+const size_t PayloadScheduler::get_field_count ()
+{
+  return field_count;
+}
+
+size_t PayloadScheduler::set_threshold (unsigned char channel, int32_t threshold)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < field_count; i++)
+  {
+    if (fields[i].channel != channel) continue;
+    fields[i].threshold = threshold;
+    count++;
+  }
+  return count;
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+/**
+ * Check if a field has to be sent
+ */
+bool PayloadScheduler::is_pending (size_t i, int32_t value, uint32_t now)
+{
+  if (!has_sent[i]) return true;
+
+  const payload_field& f = fields[i];
+  uint32_t age = now - sent_times[i];
+  if (f.min_interval > 0 && age < f.min_interval) return false;
+  if (f.threshold < 0) return true;
+  if (f.max_age > 0 && age >= f.max_age) return true;
+
+  int64_t difference = (int64_t)value - (int64_t)sent_values[i];
+  return difference > f.threshold || difference < -(int64_t)f.threshold;
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+bool PayloadScheduler::add (const payload_field& field)
+{
+  if (field_count >= PAYLOAD_FIELDS_MAX || field.channel >= NEST_CODEC_CHANNELS || field.read == nullptr) return false;
+  fields[field_count] = field;
+  has_sent[field_count] = false;
+  field_count++;
+  return true;
+}
+
+/**
+ * Pack the pending fields into a payload
+ */
+size_t PayloadScheduler::build (NestEncoder& encoder, size_t max_size, uint32_t now)
+{
+  size_t pending[PAYLOAD_FIELDS_MAX];
+  int32_t values[PAYLOAD_FIELDS_MAX];
+  size_t pending_count = 0;
+
+  // Read every field once and collect the pending ones, ordered by priority and then by age
+  for (size_t i = 0; i < field_count; i++)
+  {
+    int32_t value;
+    if (!fields[i].read(fields[i], value) || !is_pending(i, value, now)) continue;
+
+    values[i] = value;
+    size_t j = pending_count++;
+    for (; j > 0; j--)
+    {
+      size_t k = pending[j - 1];
+      bool before = fields[i].priority > fields[k].priority ||
+                    (fields[i].priority == fields[k].priority &&
+                     ((!has_sent[i] && has_sent[k]) ||
+                      (has_sent[i] && has_sent[k] && now - sent_times[i] > now - sent_times[k])));
+      if (!before) break;
+      pending[j] = k;
+    }
+    pending[j] = i;
+  }
+
+  size_t rolled_over = 0;
+  for (size_t j = 0; j < pending_count; j++)
+  {
+    size_t i = pending[j];
+    const payload_field& f = fields[i];
+    if (encoder.get_size_with(f.channel, values[i]) > max_size || !encoder.add(f.channel, values[i]))
+    {
+      rolled_over++;
+      continue;
+    }
+
+    sent_values[i] = values[i];
+    sent_times[i] = now;
+    has_sent[i] = true;
+    if (f.sent != nullptr) f.sent(f, values[i]);
+    if (debug) Serial.printf(" - payload add channel %d: %d\n", f.channel, values[i]);
+  }
+
+  if (debug && rolled_over > 0) Serial.printf(" - %d payload fields roll over to the next uplink\n", rolled_over);
+  return rolled_over;
+}
+
+/**
+ * Add the current value of every field, highest priority first
+ */
+size_t PayloadScheduler::snapshot (NestEncoder& encoder, size_t max_size)
+{
+  size_t added = 0;
+  for (int priority = UINT8_MAX; priority >= 0; priority--)
+  {
+    for (size_t i = 0; i < field_count; i++)
+    {
+      const payload_field& f = fields[i];
+      int32_t value;
+      if (f.priority != priority || !f.read(f, value)) continue;
+      if (encoder.get_size_with(f.channel, value) > max_size || !encoder.add(f.channel, value)) continue;
+      added++;
+    }
+  }
+  return added;
+}
+
+void PayloadScheduler::reset ()
+{
+  for (size_t i = 0; i < PAYLOAD_FIELDS_MAX; i++)
+  {
+    sent_values[i] = 0;
+    sent_times[i] = 0;
+    has_sent[i] = false;
+  }
+}
@@ -0,0 +1,136 @@
+/**
+ * Scheduler for the fields of the uplink payload.
+ * Every field declares its channel, priority, change threshold and maximum age and how to read its value.
+ * On every uplink the pending fields are packed by priority into the payload size available;
+ * fields that do not fit stay pending and roll over to the next uplink instead of being dropped.
+ */
+
+#ifndef PAYLOADSCHEDULER_H
+#define PAYLOADSCHEDULER_H
+
+#include <Arduino.h>
+#include "NestCodec.h"
+
+// Maximum number of fields of a scheduler
+#ifndef PAYLOAD_FIELDS_MAX
+#define PAYLOAD_FIELDS_MAX 32
+#endif
+
+struct payload_field;
+
+/**
+ * Read the current value of a field
+ * @param field Field to read
+ * @param value Set to the raw value, in the unit of the channel
+ * @return false if the field has no value to send, e.g. a counter at 0
+ */
+typedef bool (*payload_read_fn)(const payload_field& field, int32_t& value);
+
+/**
+ * Called once a field has been packed into the payload, e.g. to reset a counter
+ */
+typedef void (*payload_sent_fn)(const payload_field& field, int32_t value);
+
+/**
+ * Description of a payload field
+ */
+struct payload_field
+{
+  unsigned char channel;
+  // Pending fields with a higher priority are packed first
+  uint8_t priority;
+  // Minimum change of the raw value before it is sent again; negative values send every value
+  int32_t threshold;
+  // Time in ms after which the value is sent again even if unchanged; 0 for none
+  uint32_t max_age;
+  // Time in ms the value is not sent again after it has been sent, e.g. for hourly values; 0 for none
+  uint32_t min_interval;
+  payload_read_fn read;
+  // may be nullptr
+  payload_sent_fn sent;
+  // Parameter code for fields of a parameter; free for other use by read and sent
+  unsigned char parameter_code;
+};
+
+class PayloadScheduler
+{
+private:
+  payload_field fields[PAYLOAD_FIELDS_MAX];
+  int32_t sent_values[PAYLOAD_FIELDS_MAX];
+  uint32_t sent_times[PAYLOAD_FIELDS_MAX];
+  bool has_sent[PAYLOAD_FIELDS_MAX];
+  size_t field_count;
+
+  /**
+   * Check if a field has to be sent
+   *
+   * @param i Index of the field
+   * @param value Current raw value
+   * @param now millis()
+   */
+  bool is_pending (size_t, int32_t, uint32_t);
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  PayloadScheduler ();
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  const size_t get_field_count ();
+
+  /**
+   * Change the threshold of the fields of a channel, e.g. from a downlink
+   *
+   * @return Number of fields changed
+   */
+  size_t set_threshold (unsigned char channel, int32_t threshold);
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Add a field
+   *
+   * @return false if the scheduler is full or the field has no channel of the payload format
+   */
+  bool add (const payload_field&);
+
+  /**
+   * Pack the pending fields into a payload.
+   * Fields are packed by descending priority; fields of equal priority that have waited longest go first.
+   * A field that does not fit is skipped and smaller fields of lower priority are tried instead.
+   *
+   * @param encoder Payload to add to, started with begin()
+   * @param max_size Maximum payload size in bytes
+   * @param now millis()
+   *
+   * @return Number of pending fields that did not fit and roll over to the next payload
+   */
+  size_t build (NestEncoder& encoder, size_t max_size, uint32_t now);
+
+  /**
+   * Add the current value of every field to a payload, e.g. for a snapshot of all values.
+   * Fields are added by descending priority as long as they fit; nothing is marked as sent.
+   *
+   * @param encoder Payload to add to, started with begin()
+   * @param max_size Maximum payload size in bytes
+   *
+   * @return Number of fields added
+   */
+  size_t snapshot (NestEncoder& encoder, size_t max_size);
+
+  /**
+   * Forget which values have been sent, e.g. after a new join, so every field is sent again
+   */
+  void reset ();
+};
+
+#endif // PAYLOADSCHEDULER_H
@@ -0,0 +1,112 @@
+/**
+ * Byte buffer with a fixed capacity and static storage.
+ * Used in place of std::vector to keep the heap untouched by every transmission.
+ */
+
+#ifndef BYTEBUFFER_H
+#define BYTEBUFFER_H
+
+#include <Arduino.h>
+
+template <size_t capacity>
+class ByteBuffer
+{
+private:
+  unsigned char buffer[capacity];
+  size_t len;
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  ByteBuffer () : len(0) {};
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  unsigned char* data () { return buffer; }
+  const size_t size () const { return len; }
+  // Number of bytes that can still be added
+  const size_t available () const { return capacity - len; }
+  unsigned char& operator[] (size_t i) { return buffer[i]; }
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Append a byte
+   * @return false if the buffer is full; nothing is appended
+   */
+  bool push_back (unsigned char b)
+  {
+    if (len >= capacity) return false;
+    buffer[len++] = b;
+    return true;
+  }
+
+  /**
+   * Append a number of bytes
+   * @return false if not all bytes fit; nothing is appended
+   */
+  bool append (const unsigned char* data, size_t n)
+  {
+    if (n > capacity - len) return false;
+    if (n > 0) memcpy(buffer + len, data, n);
+    len += n;
+    return true;
+  }
+
+  /**
+   * Replace the content with a number of bytes
+   * @return false if not all bytes fit; the buffer is empty then
+   */
+  bool assign (const unsigned char* data, size_t n)
+  {
+    clear();
+    return append(data, n);
+  }
+
+  /**
+   * Remove a number of bytes from the front
+   */
+  void erase_front (size_t n)
+  {
+    if (n >= len)
+    {
+      len = 0;
+      return;
+    }
+    memmove(buffer, buffer + n, len - n);
+    len -= n;
+  }
+
+  /**
+   * Remove a number of bytes at a position
+   */
+  void erase (size_t pos, size_t n = 1)
+  {
+    if (pos >= len) return;
+    if (n > len - pos) n = len - pos;
+    memmove(buffer + pos, buffer + pos + n, len - pos - n);
+    len -= n;
+  }
+
+  /**
+   * Position of the first occurrence of a byte, or size() if not contained
+   */
+  const size_t find (unsigned char b) const
+  {
+    size_t i = 0;
+    while (i < len && buffer[i] != b) i++;
+    return i;
+  }
+
+  void clear () { len = 0; }
+};
+
+#endif // BYTEBUFFER_H
@@ -0,0 +1,57 @@
+#include "Cobs.h"
+
+size_t cobs_encode (const uint8_t* in, size_t len, uint8_t* out)
+{
+  size_t read_index = 0, write_index = 1, code_index = 0;
+  uint8_t code = 1;
+
+  while (read_index < len)
+  {
+    if (in[read_index] == 0x00)
+    {
+      // Close the current block at the position of the removed 0x00
+      out[code_index] = code;
+      code = 1;
+      code_index = write_index++;
+      read_index++;
+    }
+    else
+    {
+      out[write_index++] = in[read_index++];
+      code++;
+      // Close a full block of 254 non-zero bytes
+      if (code == 0xFF)
+      {
+        out[code_index] = code;
+        code = 1;
+        code_index = write_index++;
+      }
+    }
+  }
+  out[code_index] = code;
+
+  return write_index;
+}
+
+size_t cobs_decode (const uint8_t* in, size_t len, uint8_t* out)
+{
+  size_t read_index = 0, write_index = 0;
+
+  while (read_index < len)
+  {
+    uint8_t code = in[read_index];
+    // A block must neither start with 0x00 nor exceed the input
+    if (code == 0x00 || read_index + code > len) return 0;
+    read_index++;
+
+    for (uint8_t i = 1; i < code; i++)
+    {
+      if (in[read_index] == 0x00) return 0;
+      out[write_index++] = in[read_index++];
+    }
+    // Every block shorter than 254 bytes, except the last, stands for a removed 0x00
+    if (code < 0xFF && read_index < len) out[write_index++] = 0x00;
+  }
+
+  return write_index;
+}
@@ -0,0 +1,40 @@
+/**
+ * Consistent Overhead Byte Stuffing (COBS)
+ * Removes every 0x00 from a frame, so 0x00 can be used as an unambiguous frame delimiter.
+ */
+
+#ifndef COBS_H
+#define COBS_H
+
+#include <Arduino.h>
+
+/**
+ * Maximum number of bytes of an encoded frame
+ *
+ * @param len Number of bytes to be encoded
+ */
+#define COBS_ENCODED_MAX(len) ((len) + (len) / 254 + 1)
+
+/**
+ * Encode bytes with COBS.
+ *
+ * @param in Bytes to be encoded
+ * @param len Number of bytes to be encoded
+ * @param out Memory for the encoded bytes; requires COBS_ENCODED_MAX(len) bytes
+ *
+ * @return Number of encoded bytes
+ */
+size_t cobs_encode (const uint8_t*, size_t, uint8_t*);
+
+/**
+ * Decode COBS encoded bytes.
+ *
+ * @param in Encoded bytes without the delimiting 0x00
+ * @param len Number of encoded bytes
+ * @param out Memory for the decoded bytes; requires len bytes
+ *
+ * @return Number of decoded bytes; 0 if the input is not valid COBS
+ */
+size_t cobs_decode (const uint8_t*, size_t, uint8_t*);
+
+#endif // COBS_H
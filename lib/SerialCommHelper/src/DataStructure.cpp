@@ -1,25 +1,40 @@
 #include "DataStructure.h"
-#include <map>
 
 /**
- * Number of bytes used to store parameter values.
+ * Decode a stored parameter value
  */
-std::map<unsigned char, unsigned char> parameter_size
+int32_t parameter_value (unsigned char code, const unsigned char* data)
 {
-  { (unsigned char)parameter_code::temp_outside,         2 },
-  { (unsigned char)parameter_code::temp_inside,          2 },
-  { (unsigned char)parameter_code::humidity_inside,      1 },
-  { (unsigned char)parameter_code::door,                 1 },
-  { (unsigned char)parameter_code::lock,                 1 },
-  { (unsigned char)parameter_code::smoke_detector,       1 },
-  { (unsigned char)parameter_code::smoke_detector_reset, 1 },
-  { (unsigned char)parameter_code::motion,               1 },
-  { (unsigned char)parameter_code::light,                1 },
-  { (unsigned char)parameter_code::light_switch,         1 },
-  { (unsigned char)parameter_code::battery_volt,         2 },
-  { (unsigned char)parameter_code::fan_state,            1 },
-  { (unsigned char)parameter_code::mppt_battery_volt,    2 },
-  { (unsigned char)parameter_code::mppt_load_energy,     2 },
-  { (unsigned char)parameter_code::PV_yield,             2 },
-  { (unsigned char)parameter_code::states_bit_field,     1 }
-};
\ No newline at end of file
+  const parameter_descriptor& p = get_parameter(code);
+  if (p.size == 0 || data == nullptr) return 0;
+
+  uint32_t v = 0;
+  for (size_t i = 0; i < p.size; i++) v = v << 8 | data[i];
+
+  // Sign extend from the most significant bit of the value
+  if (p.is_signed && (data[0] & 0x80)) v |= UINT32_MAX << (8 * p.size);
+  return (int32_t)v;
+}
+
+/**
+ * Encode a parameter value for storage
+ */
+bool parameter_bytes (unsigned char code, int32_t value, unsigned char* data)
+{
+  const parameter_descriptor& p = get_parameter(code);
+  if (p.size == 0 || data == nullptr) return false;
+
+  // Clamp to the range representable by the number of bytes of the parameter
+  int64_t max = p.is_signed ? (INT64_C(1) << (8 * p.size - 1)) - 1 : (INT64_C(1) << (8 * p.size)) - 1;
+  int64_t min = p.is_signed ? -max - 1 : 0;
+  int64_t v = value;
+  if (v > max) v = max;
+  if (v < min) v = min;
+
+  for (size_t i = p.size; i > 0; i--)
+  {
+    data[i - 1] = (unsigned char)v;
+    v >>= 8;
+  }
+  return true;
+}
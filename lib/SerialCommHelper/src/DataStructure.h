@@ -1,7 +1,8 @@
 #ifndef DATASTRUCTURE_H
 #define DATASTRUCTURE_H
 
-#include <map>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * Serial command codes
@@ -20,7 +21,18 @@ enum class cmd_code : unsigned char
   prep_for_sleep  = 0x06,
   esp_restart     = 0x07,
   ve_exec_toggle  = 0x08,
-  wipe_storage    = 0x09
+  wipe_storage    = 0x09,
+  protocol        = 0x0A
+};
+
+/**
+ * Frame types of serial protocol version 2
+ */
+enum class frame_type : unsigned char
+{
+  data  = 0x01,
+  ack   = 0x02,
+  nak   = 0x03
 };
 
 /**
@@ -43,7 +55,12 @@ enum class parameter_code : char
   mppt_battery_volt,
   mppt_load_energy,
   PV_yield,
-  states_bit_field
+  states_bit_field,
+  shunt_battery_volt,
+  shunt_current,
+  shunt_soc,
+  inverter_ac_volt,
+  inverter_ac_power
 };
 
 enum class states_bitmask : unsigned char
@@ -58,6 +75,101 @@ enum class states_bitmask : unsigned char
   fan                   = 1
 };
 
-extern std::map<unsigned char, unsigned char> parameter_size;
+// Channel of parameters that are not sent via LoRa on their own
+#define CHANNEL_NONE 0xFF
+
+/**
+ * Description of a parameter
+ * Values are stored with the number of bytes given by size, MSB first.
+ */
+struct parameter_descriptor
+{
+  unsigned char code;
+  // Number of bytes of the value; 0 for unknown parameter codes
+  unsigned char size;
+  bool is_signed;
+  // Channel of the uplink payload, see NestCodec.h for width and unit; CHANNEL_NONE if not sent on its own
+  unsigned char channel;
+  // Minimum change of the value before it is sent via LoRa again; negative values send every value
+  int8_t threshold;
+};
+
+/**
+ * Parameter descriptors, indexed by parameter code
+ */
+constexpr parameter_descriptor parameter_table[]
+{
+  // code                                              size signed channel       threshold
+  { 0x00,                                                0, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::temp_outside,         2, true,  2,              -1 },
+  { (unsigned char)parameter_code::temp_inside,          2, true,  3,              -1 },
+  { (unsigned char)parameter_code::humidity_inside,      1, false, 4,               4 },
+  { (unsigned char)parameter_code::door,                 1, false, 5,               0 },
+  { (unsigned char)parameter_code::lock,                 1, false, 6,               0 },
+  { (unsigned char)parameter_code::motion,               1, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::smoke_detector,       1, false, 7,               0 },
+  { (unsigned char)parameter_code::smoke_detector_reset, 1, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::light,                1, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::light_switch,         1, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::battery_volt,         2, false, 8,               0 },
+  { (unsigned char)parameter_code::fan_state,            1, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::mppt_battery_volt,    2, false, 13,              0 },
+  { (unsigned char)parameter_code::mppt_load_energy,     2, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::PV_yield,             2, false, 15,              0 },
+  { (unsigned char)parameter_code::states_bit_field,     1, false, CHANNEL_NONE,    0 },
+  { (unsigned char)parameter_code::shunt_battery_volt,   2, false, 16,             50 },
+  { (unsigned char)parameter_code::shunt_current,        2, true,  17,             10 },
+  { (unsigned char)parameter_code::shunt_soc,            2, false, 18,             10 },
+  { (unsigned char)parameter_code::inverter_ac_volt,     2, false, 19,            100 },
+  { (unsigned char)parameter_code::inverter_ac_power,    2, false, 20,             20 }
+};
+
+#define PARAMETER_COUNT (sizeof parameter_table / sizeof parameter_table[0])
+
+// Largest number of bytes of a parameter value
+#define PARAMETER_SIZE_MAX 2
+
+/**
+ * Descriptor of a parameter; the descriptor of size 0 at index 0 for unknown parameter codes
+ */
+constexpr const parameter_descriptor& get_parameter (unsigned char code)
+{
+  return code < PARAMETER_COUNT ? parameter_table[code] : parameter_table[0];
+}
+
+/**
+ * Number of bytes of a parameter value; 0 for unknown parameter codes
+ */
+constexpr unsigned char get_parameter_size (unsigned char code)
+{
+  return get_parameter(code).size;
+}
+
+constexpr bool parameter_table_valid (size_t i = 0)
+{
+  return i >= PARAMETER_COUNT ||
+         (parameter_table[i].code == i &&
+          parameter_table[i].size <= PARAMETER_SIZE_MAX &&
+          parameter_table_valid(i + 1));
+}
+
+static_assert(parameter_table_valid(), "parameter_table must be indexed by parameter code");
+
+/**
+ * Decode a stored parameter value
+ * @param code Parameter code
+ * @param data Value bytes, MSB first
+ * @return Value as integer, sign extended for signed parameters; 0 for unknown parameter codes
+ */
+int32_t parameter_value (unsigned char code, const unsigned char* data);
+
+/**
+ * Encode a parameter value for storage
+ * @param code Parameter code
+ * @param value Value as integer; clamped to the range of the parameter
+ * @param data Memory for get_parameter_size(code) bytes, set MSB first
+ * @return false for unknown parameter codes
+ */
+bool parameter_bytes (unsigned char code, int32_t value, unsigned char* data);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "ParameterStore.h"
+
+/***************
+ * Constructor
+ ***************/
+
+ParameterStore::ParameterStore ()
+{
+  write_lock = portMUX_INITIALIZER_UNLOCKED;
+  for (size_t i = 0; i < PARAMETER_COUNT; i++) sequence[i].store(0);
+  clear();
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+bool ParameterStore::set (unsigned char code, const unsigned char* data)
+{
+  return set(code, data, millis());
+}
+
+bool ParameterStore::set (unsigned char code, const unsigned char* data, unsigned long timestamp)
+{
+  unsigned char size = get_parameter_size(code);
+  if (size == 0 || data == nullptr) return false;
+
+  begin_write(code);
+  memcpy(values[code], data, size);
+  timestamps[code] = timestamp;
+  dirty[code] = true;
+  has_values[code] = true;
+  end_write(code);
+  return true;
+}
+
+bool ParameterStore::get (unsigned char code, unsigned char* data)
+{
+  bool has_value, has_sent_value, is_dirty;
+  unsigned long timestamp;
+  read(code, data, nullptr, has_value, has_sent_value, timestamp, is_dirty);
+  return has_value;
+}
+
+bool ParameterStore::get_sent (unsigned char code, unsigned char* data)
+{
+  bool has_value, has_sent_value, is_dirty;
+  unsigned long timestamp;
+  read(code, nullptr, data, has_value, has_sent_value, timestamp, is_dirty);
+  return has_sent_value;
+}
+
+const unsigned long ParameterStore::get_timestamp (unsigned char code)
+{
+  bool has_value, has_sent_value, is_dirty;
+  unsigned long timestamp;
+  read(code, nullptr, nullptr, has_value, has_sent_value, timestamp, is_dirty);
+  return has_value ? timestamp : 0;
+}
+
+const bool ParameterStore::has_value (unsigned char code)
+{
+  return get(code, nullptr);
+}
+
+const bool ParameterStore::has_sent_value (unsigned char code)
+{
+  return get_sent(code, nullptr);
+}
+
+const bool ParameterStore::is_dirty (unsigned char code)
+{
+  bool has_value, has_sent_value, is_dirty;
+  unsigned long timestamp;
+  read(code, nullptr, nullptr, has_value, has_sent_value, timestamp, is_dirty);
+  return is_dirty;
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+void ParameterStore::mark_sent (unsigned char code)
+{
+  if (get_parameter_size(code) == 0) return;
+
+  begin_write(code);
+  if (has_values[code])
+  {
+    memcpy(sent_values[code], values[code], get_parameter_size(code));
+    dirty[code] = false;
+    has_sent_values[code] = true;
+  }
+  end_write(code);
+}
+
+void ParameterStore::clear ()
+{
+  for (size_t i = 0; i < PARAMETER_COUNT; i++)
+  {
+    begin_write(i);
+    has_values[i] = false;
+    has_sent_values[i] = false;
+    dirty[i] = false;
+    timestamps[i] = 0;
+    end_write(i);
+  }
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+void ParameterStore::begin_write (unsigned char code)
+{
+  portENTER_CRITICAL(&write_lock);
+  sequence[code].fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ParameterStore::end_write (unsigned char code)
+{
+  sequence[code].fetch_add(1, std::memory_order_release);
+  portEXIT_CRITICAL(&write_lock);
+}
+
+void ParameterStore::read (unsigned char code, unsigned char* data, unsigned char* sent_data,
+                           bool& has_value, bool& has_sent_value, unsigned long& timestamp, bool& is_dirty)
+{
+  has_value = has_sent_value = is_dirty = false;
+  timestamp = 0;
+  unsigned char size = get_parameter_size(code);
+  if (size == 0) return;
+
+  uint32_t seq_begin, seq_end;
+  do
+  {
+    // Wait for a write in progress on the other core to finish
+    while ((seq_begin = sequence[code].load(std::memory_order_acquire)) & 1);
+
+    if (data != nullptr) memcpy(data, values[code], size);
+    if (sent_data != nullptr) memcpy(sent_data, sent_values[code], size);
+    has_value = has_values[code];
+    has_sent_value = has_sent_values[code];
+    timestamp = timestamps[code];
+    is_dirty = dirty[code];
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    seq_end = sequence[code].load(std::memory_order_relaxed);
+  } while (seq_begin != seq_end);
+}
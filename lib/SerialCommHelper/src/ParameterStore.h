@@ -0,0 +1,132 @@
+/**
+ * Flat storage of parameter values, indexed by parameter code.
+ * Every parameter has a fixed slot with inline storage for its current value and the value last sent via LoRa,
+ * so setting and getting a value neither searches nor allocates.
+ *
+ * Safe for access from both cores: writers are serialised by a spinlock, readers take no lock.
+ * Every slot has a sequence counter that is odd while the slot is written. Readers copy a value out
+ * and retry if the counter changed meanwhile (seqlock), so a multi-byte value is never read torn.
+ */
+
+#ifndef PARAMETERSTORE_H
+#define PARAMETERSTORE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include "DataStructure.h"
+
+class ParameterStore
+{
+private:
+  unsigned char values[PARAMETER_COUNT][PARAMETER_SIZE_MAX];
+  unsigned char sent_values[PARAMETER_COUNT][PARAMETER_SIZE_MAX];
+  bool has_values[PARAMETER_COUNT];
+  bool has_sent_values[PARAMETER_COUNT];
+  bool dirty[PARAMETER_COUNT];
+  unsigned long timestamps[PARAMETER_COUNT];
+  std::atomic<uint32_t> sequence[PARAMETER_COUNT];
+  portMUX_TYPE write_lock;
+
+  /**
+   * Enclose writes to a slot; readers retry while a write is in progress
+   */
+  void begin_write (unsigned char);
+  void end_write (unsigned char);
+
+  /**
+   * Copy a consistent snapshot of a slot
+   *
+   * @param code Parameter code
+   * @param data Memory for the current value; may be nullptr
+   * @param sent_data Memory for the value last sent; may be nullptr
+   * @param has_value Set if the parameter has a value
+   * @param has_sent_value Set if the parameter has been sent
+   * @param timestamp Set to millis() of the last set()
+   * @param is_dirty Set if the parameter has been set since it was last sent
+   */
+  void read (unsigned char, unsigned char*, unsigned char*, bool&, bool&, unsigned long&, bool&);
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  ParameterStore ();
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  /**
+   * Set the current value of a parameter and mark it as dirty
+   *
+   * @param code Parameter code
+   * @param data Value bytes; get_parameter_size(code) bytes, MSB first
+   *
+   * @return false for unknown parameter codes
+   */
+  bool set (unsigned char, const unsigned char*);
+
+  /**
+   * Set the current value of a parameter measured at a given time and mark it as dirty
+   *
+   * @param code Parameter code
+   * @param data Value bytes; get_parameter_size(code) bytes, MSB first
+   * @param timestamp millis() at which the value was measured
+   *
+   * @return false for unknown parameter codes
+   */
+  bool set (unsigned char, const unsigned char*, unsigned long);
+
+  /**
+   * Copy the current value of a parameter
+   *
+   * @param code Parameter code
+   * @param data Memory for get_parameter_size(code) bytes
+   *
+   * @return false if the parameter has no value
+   */
+  bool get (unsigned char, unsigned char*);
+
+  /**
+   * Copy the value of a parameter last sent via LoRa
+   *
+   * @param code Parameter code
+   * @param data Memory for get_parameter_size(code) bytes
+   *
+   * @return false if the parameter has not been sent
+   */
+  bool get_sent (unsigned char, unsigned char*);
+
+  /**
+   * @return millis() of the last set() of a parameter, or the timestamp given to it; 0 if it has no value
+   */
+  const unsigned long get_timestamp (unsigned char);
+
+  const bool has_value (unsigned char);
+  const bool has_sent_value (unsigned char);
+
+  /**
+   * @return true if a parameter has been set since it was last sent via LoRa
+   */
+  const bool is_dirty (unsigned char);
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Remember the current value of a parameter as sent via LoRa and clear its dirty flag
+   */
+  void mark_sent (unsigned char);
+
+  /**
+   * Remove all values
+   */
+  void clear ();
+};
+
+#endif // PARAMETERSTORE_H
@@ -1,6 +1,5 @@
 #include "SerialCommHelper.h"
 
-#include <CayenneLPP.h>
 
 /***************
  * Constructor
@@ -11,6 +10,17 @@ SerialComm_Helper::SerialComm_Helper (HardwareSerial& serial)
   s = &serial;
   cmd_buffer = 0;
   data_bytes_buffer = 0;
+  rx_decoder_state = rx_state::await_cmd;
+  rx_data_index = 0;
+  rx_last_byte_time = 0;
+  protocol_version = 1;
+  protocol_switch_version = 0;
+  protocol_offered = false;
+  protocol_offer_time = 0;
+  tx_seq = 0;
+  tx_request_id = 0;
+  for (auto& r : pending_requests) r.active = false;
+  reset_frames();
 }
 
 
@@ -28,6 +38,18 @@ const size_t SerialComm_Helper::get_lora_msg_size ()
   return lora_msg.size();
 }
 
+const unsigned char SerialComm_Helper::get_protocol_version ()
+{
+  return protocol_version;
+}
+
+const size_t SerialComm_Helper::get_pending_requests ()
+{
+  size_t n = 0;
+  for (auto& r : pending_requests) if (r.active) n++;
+  return n;
+}
+
 
 /******************
  * Public Methods
@@ -46,6 +68,16 @@ void SerialComm_Helper::loop ()
   }
 }
 
+/**
+ * Offer the highest supported serial protocol version to Raspberry Pi
+ */
+void SerialComm_Helper::negotiate_protocol ()
+{
+  protocol_offered = true;
+  protocol_offer_time = millis();
+  tx_protocol(SERIAL_PROTOCOL_VERSION);
+}
+
 /**
  * Request data for a parameter from Raspberry Pi
  * @param parameter_code Code of the parameter to request
@@ -89,8 +121,7 @@ void SerialComm_Helper::lora_msg_clear ()
  */
 void SerialComm_Helper::tx_sleep_raspberry ()
 {
-  tx_add_to_queue((unsigned char)cmd_code::prep_for_sleep);
-  tx_add_to_queue(0x00);
+  tx_add_transmission(cmd_code::prep_for_sleep, nullptr, 0);
 }
 
 
@@ -100,108 +131,270 @@ void SerialComm_Helper::tx_sleep_raspberry ()
 
 /**
  * Handle Serial RX
+ * Consumes only the bytes that already arrived and never waits for the rest of a transmission,
+ * so loop() and os_runloop_once() are not stalled by a partially recieved frame.
  */
 void SerialComm_Helper::rx ()
 {
-  cmd_buffer = 0;
-  data_bytes_buffer = 0;
-
-  if (!Serial)
+  if (!*s)
   {
     return;
   }
 
-  // Check if Serial buffer has data
-  if (Serial.available())
+  // Drop a partial transmission that did not complete in time
+  if ((rx_decoder_state != rx_state::await_cmd || rx_frame_len > 0) &&
+      millis() - rx_last_byte_time > RX_FRAME_TIMEOUT_MS)
   {
-    // 1) Try to read command byte
-    Serial.readBytes(&cmd_buffer, CMD_BYTES);
+    if (debug) Serial.println(" ! rx(): incomplete transmission timed out");
+    rx_decoder_state = rx_state::await_cmd;
+    rx_frame_len = 0;
+    rx_frame_overflow = false;
+  }
 
-    // Escape on cmd_buffer zero
-    if (cmd_buffer == 0)
-    {
-      return;
-    }
+  // Bound the bytes handled per loop() pass, remaining bytes are handled on the next pass
+  size_t n = 0;
+  while (n < RX_MAX_BYTES_PER_LOOP && s->available() > 0)
+  {
+    unsigned char b = s->read();
+    if (protocol_version >= 2) rx_frame_byte(b);
+    else rx_byte(b);
+    n++;
+  }
+}
+
+/**
+ * Feed a single recieved byte to the frame decoder
+ * @param b Recieved byte
+ */
+void SerialComm_Helper::rx_byte (unsigned char b)
+{
+  rx_last_byte_time = millis();
+
+  switch (rx_decoder_state)
+  {
+    case rx_state::await_cmd:
+      // 1) Command byte; skip terminating bytes between transmissions
+      if (b == 0x00) return;
+      cmd_buffer = b;
+      rx_decoder_state = rx_state::await_length;
+      break;
+
+    case rx_state::await_length:
+      // 2) Number of data bytes
+      data_bytes_buffer = b;
+      rx_data_index = 0;
+      if (data_bytes_buffer == 0) rx_dispatch();
+      else rx_decoder_state = rx_state::await_data;
+      break;
+
+    case rx_state::await_data:
+      // 3) Data bytes; dispatch once the transmission is complete
+      data_buffer[rx_data_index++] = b;
+      if (rx_data_index >= data_bytes_buffer) rx_dispatch();
+      break;
+  }
+}
 
-    // 2) Try to read the number of bytes for data_buffer
-    Serial.readBytes(&data_bytes_buffer, RX_DATA_BYTES);
-    if (data_bytes_buffer > 0)
+/**
+ * Hand a completely recieved transmission to the matching command handler
+ */
+void SerialComm_Helper::rx_dispatch ()
+{
+  rx_decoder_state = rx_state::await_cmd;
+
+  if (debug)
+  {
+    Serial.print("cmd: ");
+    Serial.print(cmd_buffer);
+    Serial.print("; length: ");
+    Serial.print(data_bytes_buffer);
+    Serial.print("; data: ");
+    for(size_t i = 0; i < data_bytes_buffer; ++i)
     {
-      // 3) If data_bytes_buffer > 0 try to read data bytes
-      Serial.readBytes(data_buffer, data_bytes_buffer);
+      if (debug) Serial.print(data_buffer[i] < 16 ? "0" : "");
+      if (debug) Serial.print(data_buffer[i], HEX);
+      if (debug) Serial.print(" ");
     }
+    Serial.println();
+  }
 
-    if (debug)
+  // Try to find a matching command code
+  switch (cmd_buffer)
+  {
+    case (int)cmd_code::request_data:
+      rx_request_data();
+      break;
+
+    case (int)cmd_code::response_data:
+      rx_response_data();
+      break;
+
+    case (int)cmd_code::response_state:
+      rx_response_state();
+      break;
+
+    case (int)cmd_code::update_data:
+      rx_update_data();
+      break;
+
+    case (int)cmd_code::unlock:
+      rx_unlock();
+      break;
+
+    case (int)cmd_code::lock:
+      rx_lock();
+      break;
+
+    case (int)cmd_code::lora_msg:
+      rx_lora_msg();
+      break;
+
+    case (int)cmd_code::esp_restart:
+      rx_esp_restart();
+      break;
+
+    case (int)cmd_code::ve_exec_toggle:
+      rx_ve_exec_state();
+      break;
+
+    case (int)cmd_code::wipe_storage:
+      rx_wipe_storage();
+      break;
+
+    case (int)cmd_code::protocol:
+      rx_protocol();
+      break;
+
+    default:
+      if (debug) Serial.println(" ! rx(): not a valid cmd!");
+      break;
+  }
+}
+
+/**
+ * Protocol version 2: Feed a single recieved byte to the current frame
+ * @param b Recieved byte
+ */
+void SerialComm_Helper::rx_frame_byte (unsigned char b)
+{
+  rx_last_byte_time = millis();
+
+  if (b != 0x00)
+  {
+    if (rx_frame_len < sizeof rx_frame_buffer) rx_frame_buffer[rx_frame_len++] = b;
+    else rx_frame_overflow = true;
+    return;
+  }
+
+  // 0x00 delimits a frame; empty frames between two delimiters are skipped
+  if (rx_frame_len > 0)
+  {
+    if (rx_frame_overflow)
     {
-      Serial.print("cmd: ");
-      Serial.print(cmd_buffer);
-      Serial.print("; length: ");
-      Serial.print(data_bytes_buffer);
-      Serial.print("; data: ");
-      for(size_t i = 0; i < data_bytes_buffer; ++i)
+      if (debug) Serial.println(" ! rx_frame_byte(): frame too long");
+      // A data frame whose delimiter got lost; the first COBS block starts with the frame type
+      if (rx_frame_buffer[0] > 0x01 && rx_frame_buffer[1] == (unsigned char)frame_type::data)
       {
-        if (debug) Serial.print(data_buffer[i] < 16 ? "0" : "");
-        if (debug) Serial.print(data_buffer[i], HEX);
-        if (debug) Serial.print(" ");
+        tx_control_frame(frame_type::nak, rx_last_seq + 1);
       }
-      Serial.println();
     }
-
-    // Try to find a matching command code
-    switch (cmd_buffer)
+    else
     {
-      case (int)cmd_code::request_data:
-        rx_request_data();
-        break;
+      rx_frame();
+    }
+  }
+  rx_frame_len = 0;
+  rx_frame_overflow = false;
+}
 
-      case (int)cmd_code::response_data:
-        rx_response_data();
-        break;
+/**
+ * Protocol version 2: Validate a completely recieved frame and handle its content
+ */
+void SerialComm_Helper::rx_frame ()
+{
+  unsigned char raw[FRAME_ENCODED_MAX];
+  size_t len = cobs_decode(rx_frame_buffer, rx_frame_len, raw);
 
-      case (int)cmd_code::response_state:
-        rx_response_state();
-        break;
+  if (len < FRAME_HEADER_BYTES + FRAME_CRC_BYTES || !crc_validate(raw, len))
+  {
+    // A legacy protocol offer: Raspberry Pi restarted and negotiates again
+    const unsigned char* offer = rx_frame_len >= 3 ? rx_frame_buffer + rx_frame_len - 3 : nullptr;
+    if (offer != nullptr && offer[0] == (unsigned char)cmd_code::protocol && offer[1] == 0x01)
+    {
+      if (debug) Serial.println(" - rx_frame(): legacy protocol offer");
+      cmd_buffer = offer[0];
+      data_bytes_buffer = offer[1];
+      data_buffer[0] = offer[2];
+      protocol_version = 1;
+      reset_frames();
+      rx_protocol();
+      return;
+    }
 
-      case (int)cmd_code::update_data:
-        rx_update_data();
-        break;
+    if (debug) Serial.println(" ! rx_frame(): invalid frame");
+    // Broken ACK and NAK frames and noise are dropped, the sender repeats them after its timeout
+    if (len >= FRAME_DATA_MIN && raw[0] == (unsigned char)frame_type::data)
+    {
+      tx_control_frame(frame_type::nak, rx_last_seq + 1);
+    }
+    return;
+  }
 
-      case (int)cmd_code::unlock:
-        rx_unlock();
-        break;
+  unsigned char seq = raw[1];
+  size_t payload_len = len - FRAME_HEADER_BYTES - FRAME_CRC_BYTES;
 
-      case (int)cmd_code::lock:
-        rx_lock();
-        break;
+  switch ((frame_type)raw[0])
+  {
+    case frame_type::ack:
+      if (tx_frame_len > 0 && seq == tx_seq) tx_frame_len = 0;
+      break;
 
-      case (int)cmd_code::lora_msg:
-        rx_lora_msg();
-        break;
+    case frame_type::nak:
+      if (tx_frame_len > 0) tx_frame_retransmit();
+      break;
 
-      case (int)cmd_code::esp_restart:
-        rx_esp_restart();
-        break;
+    case frame_type::data:
+      tx_control_frame(frame_type::ack, seq);
 
-      case (int)cmd_code::ve_exec_toggle:
-        rx_ve_exec_state();
+      // A retransmitted frame whose acknowledgement got lost
+      if (rx_seq_valid && seq == rx_last_seq)
+      {
+        if (debug) Serial.printf(" - rx_frame(): duplicate frame %d\n", seq);
         break;
+      }
+      rx_last_seq = seq;
+      rx_seq_valid = true;
 
-      case (int)cmd_code::wipe_storage:
-        rx_wipe_storage();
-        break;
+      // The payload holds one or more complete legacy transmissions
+      rx_decoder_state = rx_state::await_cmd;
+      for (size_t i = 0; i < payload_len; i++) rx_byte(raw[FRAME_HEADER_BYTES + i]);
+      if (rx_decoder_state != rx_state::await_cmd)
+      {
+        if (debug) Serial.println(" ! rx_frame(): incomplete transmission in frame");
+        rx_decoder_state = rx_state::await_cmd;
+      }
+      break;
 
-      default:
-        if (debug) Serial.println(" ! rx(): not a valid cmd!");
-        return;
-        break;
-    }
-  }
-  else
-  {
-    return;
+    default:
+      if (debug) Serial.printf(" ! rx_frame(): unknown frame type %x\n", raw[0]);
+      break;
   }
+}
 
-  rx();
+/**
+ * Reset the state of protocol version 2 frames
+ */
+void SerialComm_Helper::reset_frames ()
+{
+  rx_frame_len = 0;
+  rx_frame_overflow = false;
+  rx_last_seq = 0;
+  rx_seq_valid = false;
+  tx_frame_len = 0;
+  tx_frame_time = 0;
+  tx_frame_retries = 0;
+  // a new link starts without an open offer
+  protocol_offered = false;
 }
 
 /**
@@ -211,17 +404,24 @@ void SerialComm_Helper::rx_request_data ()
 {
   if (debug) Serial.println(" + rx_request_data()");
   if (data_bytes_buffer <= 0) return;
-  for (size_t i = 0; i < data_bytes_buffer; i++)
+  ByteBuffer<RX_DATA_BUFFER_SIZE> response;
+  size_t i = 0;
+
+  // Protocol version 2: the first data byte is the request ID, which is repeated in the response
+  if (protocol_version >= 2) response.push_back(data_buffer[i++]);
+
+  for (; i < data_bytes_buffer; i++)
   {
     if (data_buffer[i] == (unsigned char)parameter_code::lock)
     {
       update_lock();
     }
-    if (tx_queue_response(data_buffer[i]) != 0)
+    if (tx_queue_response(response, data_buffer[i]) != 0)
     {
       if (debug) Serial.printf(" ! no data for parameter %x\n", data_buffer[i]);
     }
   }
+  tx_add_transmission(cmd_code::response_data, response.data(), response.size());
 }
 
 /**
@@ -231,19 +431,60 @@ void SerialComm_Helper::rx_response_data ()
 {
   if (debug) Serial.println(" + rx_response_data()");
   if (data_bytes_buffer <= 0) return;
-  size_t i = 0, j = 0;
-  unsigned char parameter_code, data_size;
-  unsigned char* data = { 0 };
+  size_t i = 0;
+  pending_request* request = nullptr;
+
+  // Protocol version 2: the first data byte is the ID of the answered request
+  if (protocol_version >= 2)
+  {
+    unsigned char id = data_buffer[i++];
+    for (auto& r : pending_requests) if (r.active && r.id == id) request = &r;
+    if (request == nullptr && debug) Serial.printf(" - rx_response_data(): request %d not pending\n", id);
+  }
+
+  // Pairs of parameter code and data bytes
   while (i < data_bytes_buffer)
   {
-    parameter_code = await_res_params.data()[i++];
-    data_size = parameter_size.find((unsigned char)parameter_code)->second;
-    std::copy(data_buffer + j, data_buffer + j + data_size, data);
-    j += data_size;
-    set_data((unsigned char)parameter_code, data);
+    unsigned char parameter_code = data_buffer[i++];
+    unsigned char size = get_parameter_size(parameter_code);
+    if (size == 0 || i + size > data_bytes_buffer)
+    {
+      if (debug) Serial.printf(" ! rx_response_data(): malformed response at parameter %x\n", parameter_code);
+      break;
+    }
+    set_data(parameter_code, data_buffer + i);
+    i += size;
+
+    // The parameter has been answered, the request is complete once all parameters are
+    pending_request* r = protocol_version >= 2 ? request : rx_match_request(parameter_code);
+    if (r == nullptr) continue;
+    size_t pos = r->params.find(parameter_code);
+    if (pos < r->params.size()) r->params.erase(pos);
+    if (r->params.size() == 0) r->active = false;
   }
   esp_task_wdt_reset();
-  await_res_params.clear();
+}
+
+/**
+ * Find the oldest pending request for a parameter; used without request IDs of protocol version 2
+ * @param parameter_code The answered parameter
+ * @return Pending request or nullptr if the parameter was not requested
+ */
+SerialComm_Helper::pending_request* SerialComm_Helper::rx_match_request (unsigned char parameter_code)
+{
+  pending_request* oldest = nullptr;
+  unsigned char oldest_age = 0;
+  for (auto& r : pending_requests)
+  {
+    if (!r.active || r.params.find(parameter_code) >= r.params.size()) continue;
+    unsigned char age = tx_request_id - r.id;
+    if (oldest == nullptr || age > oldest_age)
+    {
+      oldest = &r;
+      oldest_age = age;
+    }
+  }
+  return oldest;
 }
 
 /**
@@ -264,15 +505,17 @@ void SerialComm_Helper::rx_update_data ()
   if (data_bytes_buffer < 2) return;
   unsigned char parameter_code = data_buffer[0];
   size_t data_len = data_bytes_buffer - 1;
-  unsigned char data[data_len] = { 0 };
-  std::copy(data_buffer + 1, data_buffer + data_bytes_buffer, data);
-  set_data((unsigned char)parameter_code, data);
+  unsigned char size = get_parameter_size(parameter_code);
+  if (size == 0 || data_len != size)
+  {
+    if (debug) Serial.printf(" ! rx_update_data(): %d data bytes for parameter %x\n", data_len, parameter_code);
+    return;
+  }
+  set_data((unsigned char)parameter_code, data_buffer + 1);
   if (debug)
   {
     Serial.print(" + rx_update_data() ");
-    int16_t v = 0;
-    for (size_t i = 0; i < data_len; i++) v = v | data[i] << (8 * (data_len - 1 - i));
-    Serial.println(v, HEX);
+    Serial.println(parameter_value(parameter_code, data_buffer + 1), HEX);
   }
 }
 
@@ -301,8 +544,7 @@ void SerialComm_Helper::rx_lora_msg ()
 {
   if (debug) Serial.println(" + rx_lora_msg()");
   if (data_bytes_buffer <= 0) return;
-  lora_msg.clear();
-  lora_msg.assign(data_buffer, data_buffer + data_bytes_buffer);
+  lora_msg.assign(data_buffer, data_bytes_buffer);
 }
 
 /**
@@ -329,16 +571,17 @@ void SerialComm_Helper::rx_esp_restart ()
     }
     return;
   }
-  esp_restart();
+  restart_on_serial_cmd();
 }
 
 /**
- * Recieve a command form Raspberry Pi to toggle the VeDirectFrameHandler execution flag
+ * Recieve a command form Raspberry Pi to toggle the VeDirectFrameHandler execution flag.
+ * VE.Direct frames are always processed, so nothing changes; the reply reports the handler as on.
  */
 void SerialComm_Helper::rx_ve_exec_state ()
 {
   if (debug) Serial.println(" + rx_ve_exec_state()");
-  if (data_bytes_buffer != (unsigned char)0x01)
+  if (data_bytes_buffer != 0x01)
   {
     if (debug)
     {
@@ -347,7 +590,10 @@ void SerialComm_Helper::rx_ve_exec_state ()
     }
     return;
   }
-  ve_exec_toggle_serial_cmd(data_buffer[0]);
+  if (debug && data_buffer[0] == 0x00) Serial.println(" ! rx_ve_exec_state(): VeDirect handler can not be disabled");
+
+  unsigned char state = 0x01;
+  tx_add_transmission(cmd_code::ve_exec_toggle, &state, 1);
 }
 
 /**
@@ -377,50 +623,188 @@ void SerialComm_Helper::rx_wipe_storage ()
   wipe_storage_on_serial_cmd();
 }
 
+/**
+ * Recieve a protocol version offer or the confirmation of an offer from Raspberry Pi
+ */
+void SerialComm_Helper::rx_protocol ()
+{
+  if (debug) Serial.println(" + rx_protocol()");
+  if (data_bytes_buffer != 0x01)
+  {
+    if (debug)
+    {
+      Serial.print(" ! incompatible data lenght: ");
+      Serial.println(data_bytes_buffer);
+    }
+    return;
+  }
+
+  // Use the highest version supported by both devices
+  unsigned char version = data_buffer[0] < SERIAL_PROTOCOL_VERSION ? data_buffer[0] : SERIAL_PROTOCOL_VERSION;
+  if (version < 1) version = 1;
+
+  // An offer without answer in time is void, so a later offer of Raspberry Pi is not taken as its confirmation
+  if (protocol_offered && millis() - protocol_offer_time > PROTOCOL_OFFER_TIMEOUT_MS) protocol_offered = false;
+
+  if (protocol_offered)
+  {
+    // Raspberry Pi confirmed the offer of this device
+    protocol_offered = false;
+    protocol_version = version;
+    reset_frames();
+  }
+  else
+  {
+    // Confirm the offer of Raspberry Pi with the current version, then switch
+    tx_protocol(version);
+    protocol_switch_version = version;
+  }
+  if (debug) Serial.printf(" - serial protocol version %d\n", version);
+}
+
 
 /**
  * Hanlde Serial TX
  */
 void SerialComm_Helper::tx ()
 {
-  // Check for queued requests
-  if (queue_req_params.size() > 0)
-  {
-    // append request command code
-    tx_queue.push_back((unsigned char)cmd_code::request_data);
-    // append number of requested parameters
-    tx_queue.push_back(queue_req_params.size());
-    // append the parameters to be requested
-    tx_queue.insert(tx_queue.end(), queue_req_params.begin(), queue_req_params.end());
-    // set the parameters that are expected from a response
-    await_res_params = queue_req_params;
-    queue_req_params.clear();
-  }
-
-  // check for queued responses
-  if (queue_res_params.size() > 0)
-  {
-    // append response command code
-    tx_queue.push_back((unsigned char)cmd_code::response_data);
-    // append number of response parameters
-    tx_queue.push_back(queue_res_params.size());
-    // append the parameter values to response with
-    tx_queue.insert(tx_queue.end(), queue_res_params.begin(), queue_res_params.end());
-    queue_res_params.clear();
-  }
-
-  // check if tx_queue is populated
-  if (tx_queue.size() <= 0) return;
-  // append terminating byte
-  tx_queue.push_back(0x00);
-  Serial.write(tx_queue.data(), tx_queue.size());
+  // Send queued requests and repeat requests without response
+  tx_pending_requests();
+
+  if (protocol_version >= 2)
+  {
+    // Wait for the acknowledgement of the frame in flight
+    if (tx_frame_len > 0)
+    {
+      if (millis() - tx_frame_time > FRAME_ACK_TIMEOUT_MS) tx_frame_retransmit();
+      return;
+    }
+
+    // Fill a frame with as many complete transmissions as fit
+    size_t payload_len = 0;
+    while (payload_len + 2 <= tx_queue.size())
+    {
+      size_t transmission_len = 2 + tx_queue[payload_len + 1];
+      if (payload_len + transmission_len > FRAME_PAYLOAD_MAX) break;
+      payload_len += transmission_len;
+    }
+
+    if (payload_len > 0)
+    {
+      tx_frame(payload_len);
+      tx_queue.erase_front(payload_len);
+    }
+    else if (tx_queue.size() > 0)
+    {
+      // drop only this transmission, the ones queued behind it still fit
+      size_t transmission_len = tx_queue.size() < 2 ? tx_queue.size() : 2 + tx_queue[1];
+      if (transmission_len > tx_queue.size()) transmission_len = tx_queue.size();
+      if (debug) Serial.printf(" ! tx(): transmission of %d bytes does not fit a frame, dropped\n", transmission_len);
+      tx_queue.erase_front(transmission_len);
+    }
+  }
+  else if (tx_queue.size() > 0)
+  {
+    // write straight from the tx queue, followed by the terminating byte
+    s->write(tx_queue.data(), tx_queue.size());
+    s->write((uint8_t)0x00);
+    if (debug)
+    {
+      Serial.print("\t");
+      print_hex(tx_queue.data(), tx_queue.size());
+      Serial.println(" tx() done");
+    }
+    tx_queue.clear();
+  }
+
+  // Switch the protocol version once the confirmation has been sent
+  if (protocol_switch_version > 0 && tx_queue.size() == 0)
+  {
+    protocol_version = protocol_switch_version;
+    protocol_switch_version = 0;
+    reset_frames();
+  }
+}
+
+/**
+ * Protocol version 2: Send the first bytes of the tx queue as a data frame
+ * @param payload_len Number of bytes from tx queue to send
+ */
+void SerialComm_Helper::tx_frame (size_t payload_len)
+{
+  unsigned char raw[FRAME_RAW_MAX];
+  size_t len = 0;
+
+  raw[len++] = (unsigned char)frame_type::data;
+  raw[len++] = ++tx_seq;
+  memcpy(raw + len, tx_queue.data(), payload_len);
+  len += payload_len;
+  uint16_t crc = crc_ccitt(raw, len);
+  raw[len++] = crc;
+  raw[len++] = crc >> 8;
+
+  // Delimit the frame on both ends, so bytes in front of it end up in a separate invalid frame
+  tx_frame_len = 0;
+  tx_frame_buffer[tx_frame_len++] = 0x00;
+  tx_frame_len += cobs_encode(raw, len, tx_frame_buffer + tx_frame_len);
+  tx_frame_buffer[tx_frame_len++] = 0x00;
+
+  s->write(tx_frame_buffer, tx_frame_len);
+  tx_frame_time = millis();
+  tx_frame_retries = 0;
   if (debug)
   {
     Serial.print("\t");
-    print_hex(tx_queue.data(), tx_queue.size());
-    Serial.println(" tx() done");
+    print_hex(raw, len);
+    Serial.println(" tx_frame() done");
+  }
+}
+
+/**
+ * Protocol version 2: Send the frame in flight again
+ */
+void SerialComm_Helper::tx_frame_retransmit ()
+{
+  if (tx_frame_retries >= FRAME_MAX_RETRIES)
+  {
+    if (debug) Serial.printf(" ! tx(): frame %d not acknowledged, dropped\n", tx_seq);
+    tx_frame_len = 0;
+    return;
   }
-  tx_queue.clear();
+  tx_frame_retries++;
+  s->write(tx_frame_buffer, tx_frame_len);
+  tx_frame_time = millis();
+}
+
+/**
+ * Protocol version 2: Send an acknowledgement or negative acknowledgement
+ * @param type frame_type::ack or frame_type::nak
+ * @param seq Sequence number of the concerned frame
+ */
+void SerialComm_Helper::tx_control_frame (frame_type type, unsigned char seq)
+{
+  unsigned char raw[FRAME_HEADER_BYTES + FRAME_CRC_BYTES];
+  unsigned char frame[COBS_ENCODED_MAX(sizeof raw) + 2];
+  size_t len = 0;
+
+  raw[0] = (unsigned char)type;
+  raw[1] = seq;
+  uint16_t crc = crc_ccitt(raw, FRAME_HEADER_BYTES);
+  raw[2] = crc;
+  raw[3] = crc >> 8;
+
+  frame[len++] = 0x00;
+  len += cobs_encode(raw, sizeof raw, frame + len);
+  frame[len++] = 0x00;
+  s->write(frame, len);
+}
+
+/**
+ * Offer or confirm a serial protocol version
+ */
+void SerialComm_Helper::tx_protocol (unsigned char version)
+{
+  tx_add_transmission(cmd_code::protocol, &version, 1);
 }
 
 /**
@@ -428,7 +812,64 @@ void SerialComm_Helper::tx ()
  */
 void SerialComm_Helper::tx_request_data (unsigned char parameter_code)
 {
-  queue_req_params.push_back((unsigned char)parameter_code);
+  if (queue_req_params.find(parameter_code) < queue_req_params.size()) return;
+  if (!queue_req_params.push_back((unsigned char)parameter_code))
+  {
+    if (debug) Serial.printf(" ! tx_request_data(): too many parameters, %x dropped\n", parameter_code);
+  }
+}
+
+/**
+ * Send the queued parameters as a new request once a slot for pending requests is free,
+ * repeat requests whose response timed out and drop them after REQUEST_MAX_RETRIES
+ */
+void SerialComm_Helper::tx_pending_requests ()
+{
+  for (auto& r : pending_requests)
+  {
+    if (r.active)
+    {
+      if (millis() - r.sent_time <= REQUEST_TIMEOUT_MS) continue;
+      if (r.retries >= REQUEST_MAX_RETRIES)
+      {
+        if (debug) Serial.printf(" ! tx_pending_requests(): request %d not answered, dropped\n", r.id);
+        r.active = false;
+        continue;
+      }
+      if (debug) Serial.printf(" - tx_pending_requests(): repeat request %d\n", r.id);
+      if (tx_request(r)) r.retries++;
+    }
+    else if (queue_req_params.size() > 0)
+    {
+      r.id = ++tx_request_id;
+      r.retries = 0;
+      r.params.assign(queue_req_params.data(), queue_req_params.size());
+      // Parameters stay queued for the next tx() if the tx queue is full
+      if (!tx_request(r)) return;
+      r.active = true;
+      queue_req_params.clear();
+    }
+  }
+}
+
+/**
+ * Add a request for the parameters of a pending request to the tx queue
+ * @param request The pending request
+ * @return true if the request was added to the tx queue
+ */
+bool SerialComm_Helper::tx_request (pending_request& request)
+{
+  unsigned char d[1 + TX_PARAMS_MAX];
+  size_t len = 0;
+
+  // Protocol version 2: prepend the request ID
+  if (protocol_version >= 2) d[len++] = request.id;
+  memcpy(d + len, request.params.data(), request.params.size());
+  len += request.params.size();
+
+  if (!tx_add_transmission(cmd_code::request_data, d, len)) return false;
+  request.sent_time = millis();
+  return true;
 }
 
 /**
@@ -436,8 +877,7 @@ void SerialComm_Helper::tx_request_data (unsigned char parameter_code)
  */
 void SerialComm_Helper::tx_request_state ()
 {
-  tx_queue.push_back((const unsigned char)cmd_code::request_state);
-  tx_queue.push_back(0);
+  tx_add_transmission(cmd_code::request_state, nullptr, 0);
 }
 
 /**
@@ -445,13 +885,11 @@ void SerialComm_Helper::tx_request_state ()
  */
 void SerialComm_Helper::tx_update_data (unsigned char parameter_code)
 {
-  unsigned char data_size = parameter_size.find((unsigned char)parameter_code)->second;
-  const unsigned char* data = get_data((unsigned char)parameter_code);
-  if (data == nullptr) return;
-  tx_queue.push_back((const unsigned char)cmd_code::update_data);
-  tx_queue.push_back(data_size + 1);
-  tx_queue.push_back((unsigned char)parameter_code);
-  tx_queue.insert(tx_queue.end(), data, data + data_size);
+  unsigned char data_size = get_parameter_size(parameter_code);
+  unsigned char d[1 + PARAMETER_SIZE_MAX];
+  if (data_size == 0 || !get_data((unsigned char)parameter_code, d + 1)) return;
+  d[0] = (unsigned char)parameter_code;
+  tx_add_transmission(cmd_code::update_data, d, 1 + data_size);
 }
 
 /**
@@ -459,9 +897,7 @@ void SerialComm_Helper::tx_update_data (unsigned char parameter_code)
  */
 void SerialComm_Helper::tx_update_state (unsigned char new_state)
 {
-  tx_queue.push_back((const unsigned char)cmd_code::update_state);
-  tx_queue.push_back(1);
-  tx_queue.push_back(new_state);
+  tx_add_transmission(cmd_code::update_state, &new_state, 1);
 }
 
 /**
@@ -480,27 +916,52 @@ void SerialComm_Helper::tx_add_to_queue (const unsigned char data)
  */
 void SerialComm_Helper::tx_add_to_queue (const unsigned char* data, const char data_bytes)
 {
-  tx_queue.insert(tx_queue.end(), data, data + data_bytes);
+  tx_queue.append(data, data_bytes);
+}
+
+/**
+ * Append a complete transmission of command, number of data bytes and data bytes to tx queue
+ * @param cmd Command code
+ * @param data Data bytes
+ * @param len Number of data bytes
+ * @return true if the transmission was added; false if it did not fit the tx queue
+ */
+bool SerialComm_Helper::tx_add_transmission (cmd_code cmd, const unsigned char* data, size_t len)
+{
+  if (len > 0xFF || tx_queue.available() < 2 + len)
+  {
+    if (debug) Serial.printf(" ! tx_add_transmission(): tx queue full, cmd %x dropped\n", (unsigned char)cmd);
+    return false;
+  }
+  tx_queue.push_back((unsigned char)cmd);
+  tx_queue.push_back(len);
+  tx_queue.append(data, len);
+  return true;
 }
 
 /**
  * Append a response for a request from Raspberry Pi
+ * @param response The response data bytes
  * @param parameter_code The requested parameter
  * @return 0 response has been added successfully; -1 if data for the parameter was not available
  */
-char SerialComm_Helper::tx_queue_response (unsigned char parameter_code)
+char SerialComm_Helper::tx_queue_response (ByteBuffer<RX_DATA_BUFFER_SIZE>& response, unsigned char parameter_code)
 {
-  const unsigned char* data = get_data((unsigned char)parameter_code);
-  unsigned char size = parameter_size.find((unsigned char)parameter_code)->second;
-  size_t i = 0;
-  queue_res_params.push_back((unsigned char)parameter_code);
-  if (data == nullptr)
+  unsigned char size = get_parameter_size(parameter_code);
+  if (size == 0)
+  {
+    if (debug) Serial.printf(" ! tx_queue_response(): unknown parameter %x\n", parameter_code);
+    return -1;
+  }
+  if (response.available() < 1 + (size_t)size)
   {
-    unsigned char d[size];
-    memset(d, 0xFF, size);
-    while (i < size) queue_res_params.push_back(d[i++]);
+    if (debug) Serial.printf(" ! tx_queue_response(): response full, %x dropped\n", parameter_code);
     return -1;
   }
-  while (i < size) queue_res_params.push_back(data[i++]);
-  return 0;
+  unsigned char data[PARAMETER_SIZE_MAX];
+  bool has_data = get_data((unsigned char)parameter_code, data);
+  if (!has_data) memset(data, 0xFF, size);
+  response.push_back((unsigned char)parameter_code);
+  response.append(data, size);
+  return has_data ? 0 : -1;
 }
\ No newline at end of file
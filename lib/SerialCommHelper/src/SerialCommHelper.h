@@ -5,12 +5,79 @@
 #include <map>
 #include <esp_task_wdt.h>
 #include "DataStructure.h"
+#include "ByteBuffer.h"
+#include "Cobs.h"
+#include "CRC-CCITT.h"
 #include "Helper.h"
 
 // Number of bytes for a command code
 #define CMD_BYTES 1
 // Number of data bytes read at a time
 #define RX_DATA_BYTES 1
+// Size of the rx data buffer. The n-Byte of a transmission addresses at most 255 data bytes
+#define RX_DATA_BUFFER_SIZE 255
+
+// Maximum number of bytes consumed by rx() in a single loop() pass
+#ifndef RX_MAX_BYTES_PER_LOOP
+#define RX_MAX_BYTES_PER_LOOP 64
+#endif
+
+// Discard a partially recieved transmission if no further byte arrives within this time (milliseconds)
+#ifndef RX_FRAME_TIMEOUT_MS
+#define RX_FRAME_TIMEOUT_MS 1000
+#endif
+
+// Highest serial protocol version supported by this device
+#define SERIAL_PROTOCOL_VERSION 2
+
+// An offered protocol version is only confirmed within this time (milliseconds); later offers are offers of Raspberry Pi
+#ifndef PROTOCOL_OFFER_TIMEOUT_MS
+#define PROTOCOL_OFFER_TIMEOUT_MS 2000
+#endif
+
+// Protocol version 2: frame type, sequence number and CRC bytes around the payload
+#define FRAME_HEADER_BYTES 2
+#define FRAME_CRC_BYTES 2
+// Protocol version 2: maximum number of payload bytes in one frame
+#define FRAME_PAYLOAD_MAX 250
+#define FRAME_RAW_MAX (FRAME_HEADER_BYTES + FRAME_PAYLOAD_MAX + FRAME_CRC_BYTES)
+#define FRAME_ENCODED_MAX (COBS_ENCODED_MAX(FRAME_RAW_MAX))
+// Protocol version 2: smallest data frame, carrying one transmission without data bytes
+#define FRAME_DATA_MIN (FRAME_HEADER_BYTES + 2 + FRAME_CRC_BYTES)
+
+// Capacity of the tx queue; holds at least one transmission of maximum length
+#ifndef TX_QUEUE_SIZE
+#define TX_QUEUE_SIZE 512
+#endif
+// Maximum number of parameters in a single request
+#define TX_PARAMS_MAX 32
+// Maximum number of bytes of a LoRa message from Raspberry Pi
+#define LORA_MSG_SIZE 255
+
+// Maximum number of data requests awaiting a response from Raspberry Pi at the same time
+#ifndef MAX_PENDING_REQUESTS
+#define MAX_PENDING_REQUESTS 4
+#endif
+
+// Request the missing parameters of a data request again if Raspberry Pi did not respond within this time (milliseconds)
+#ifndef REQUEST_TIMEOUT_MS
+#define REQUEST_TIMEOUT_MS 5000
+#endif
+
+// Number of repeated data requests before the missing parameters are dropped
+#ifndef REQUEST_MAX_RETRIES
+#define REQUEST_MAX_RETRIES 3
+#endif
+
+// Protocol version 2: retransmit an unacknowledged frame after this time (milliseconds)
+#ifndef FRAME_ACK_TIMEOUT_MS
+#define FRAME_ACK_TIMEOUT_MS 500
+#endif
+
+// Protocol version 2: number of retransmissions before a frame is dropped
+#ifndef FRAME_MAX_RETRIES
+#define FRAME_MAX_RETRIES 3
+#endif
 
 
 class SerialComm_Helper
@@ -20,7 +87,7 @@ public:
    * Constructor
    ***************/
 
-  SerialComm_Helper () : s(&Serial) {};
+  SerialComm_Helper () : SerialComm_Helper(Serial) {};
   SerialComm_Helper (HardwareSerial&);
 
 
@@ -30,6 +97,7 @@ public:
 
   unsigned char* get_lora_msg ();
   const size_t get_lora_msg_size ();
+  const unsigned char get_protocol_version ();
 
 
   /******************
@@ -41,12 +109,25 @@ public:
    */
   void loop ();
 
+  /**
+   * Offer the highest supported serial protocol version to Raspberry Pi.
+   * Communication continues with the legacy protocol until Raspberry Pi confirms the offer.
+   */
+  void negotiate_protocol ();
+
   /**
    * Request data from Raspberry Pi
+   * Parameters requested in the same loop() pass are sent as one request. Several requests may await
+   * their response at the same time; parameters without a response are requested again after REQUEST_TIMEOUT_MS.
    * @param parameter_code Code for the value to be requested.
    */
   void request_data (unsigned char);
 
+  /**
+   * Number of data requests still awaiting a response from Raspberry Pi
+   */
+  const size_t get_pending_requests ();
+
   /**
    * Send update to Rapberry Pi for the door state
    * @param door_state The door state to send to Raspberry Pi
@@ -79,7 +160,7 @@ public:
    */
 
   void set_data (unsigned char, unsigned char*);
-  const unsigned char* get_data (unsigned char);
+  bool get_data (unsigned char, unsigned char*);
   void set_state (unsigned char);
   const unsigned char get_state ();
 
@@ -99,9 +180,9 @@ public:
   void lock_on_serial_cmd ();
 
   /**
-   * Implement the functionality to toggle the execution of VeDirectFrameHandler with a serial command
+   * Implement the functionality to restart the esp32 with a serial command
    */
-  void ve_exec_toggle_serial_cmd (uint8_t);
+  void restart_on_serial_cmd ();
 
   /**
    * Implement the functionality to wipe non-volatile memory with a serial command
@@ -109,10 +190,60 @@ public:
   void wipe_storage_on_serial_cmd ();
 
 private:
+  /**
+   * States of the rx frame decoder
+   */
+  enum class rx_state : unsigned char
+  {
+    await_cmd,
+    await_length,
+    await_data
+  };
+
+  /**
+   * A data request awaiting the response of Raspberry Pi
+   */
+  struct pending_request
+  {
+    bool active;
+    unsigned char id;
+    unsigned char retries;
+    unsigned long sent_time;
+    ByteBuffer<TX_PARAMS_MAX> params;
+  };
+
   HardwareSerial* s;
   unsigned char cmd_buffer, data_bytes_buffer;
-  unsigned char data_buffer[200];
-  std::vector<unsigned char> tx_queue, queue_req_params, queue_res_params, await_res_params, lora_msg;
+  unsigned char data_buffer[RX_DATA_BUFFER_SIZE];
+  rx_state rx_decoder_state;
+  size_t rx_data_index;
+  unsigned long rx_last_byte_time;
+
+  // Serial protocol version in use and version to switch to after the next tx()
+  unsigned char protocol_version, protocol_switch_version;
+  bool protocol_offered;
+  unsigned long protocol_offer_time;
+
+  // Protocol version 2: frame being recieved
+  unsigned char rx_frame_buffer[FRAME_ENCODED_MAX];
+  size_t rx_frame_len;
+  bool rx_frame_overflow;
+  unsigned char rx_last_seq;
+  bool rx_seq_valid;
+
+  // Protocol version 2: frame awaiting acknowledgement
+  unsigned char tx_frame_buffer[FRAME_ENCODED_MAX + 2];
+  size_t tx_frame_len;
+  unsigned char tx_seq;
+  unsigned long tx_frame_time;
+  unsigned char tx_frame_retries;
+  ByteBuffer<TX_QUEUE_SIZE> tx_queue;
+  ByteBuffer<TX_PARAMS_MAX> queue_req_params;
+  ByteBuffer<LORA_MSG_SIZE> lora_msg;
+
+  // Data requests awaiting a response; requests are identified by an ID in protocol version 2 and by order otherwise
+  pending_request pending_requests[MAX_PENDING_REQUESTS];
+  unsigned char tx_request_id;
 
 
   /******************
@@ -124,8 +255,19 @@ private:
    */
 
   void rx ();
+  void rx_byte (unsigned char);
+  void rx_dispatch ();
+  void rx_frame_byte (unsigned char);
+  void rx_frame ();
+  void rx_protocol ();
+
+  /**
+   * Reset the state of protocol version 2 frames, e.g. after a change of the protocol version
+   */
+  void reset_frames ();
   void rx_request_data ();
   void rx_response_data ();
+  pending_request* rx_match_request (unsigned char parameter_code);
   void rx_response_state ();
   void rx_update_data ();
   void rx_unlock ();
@@ -140,8 +282,13 @@ private:
    */
 
   void tx ();
+  void tx_frame (size_t payload_len);
+  void tx_frame_retransmit ();
+  void tx_control_frame (frame_type, unsigned char seq);
+  void tx_protocol (unsigned char version);
   void tx_request_data (unsigned char);
-  void tx_response_data ();
+  void tx_pending_requests ();
+  bool tx_request (pending_request&);
   void tx_request_state ();
   void tx_update_data (unsigned char);
   void tx_update_state (unsigned char new_state);
@@ -152,7 +299,10 @@ private:
 
   void tx_add_to_queue (const unsigned char);
   void tx_add_to_queue (const unsigned char*, const char);
-  char tx_queue_response (const unsigned char);
+  bool tx_add_transmission (cmd_code, const unsigned char*, size_t);
+  char tx_queue_response (ByteBuffer<RX_DATA_BUFFER_SIZE>&, const unsigned char);
 };
 
+static_assert(TX_QUEUE_SIZE >= 2 + RX_DATA_BUFFER_SIZE, "TX_QUEUE_SIZE must hold a transmission of maximum length");
+
 #endif
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "UartEvents.h"
+
+#if __has_include(<esp_idf_version.h>)
+#include <esp_idf_version.h>
+#endif
+
+/***************
+ * Constructor
+ ***************/
+
+UartEvents::UartEvents (uart_port_t _port)
+{
+  port = _port;
+  event_queue = nullptr;
+  overflows = 0;
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+QueueHandle_t UartEvents::get_event_queue ()
+{
+  return event_queue;
+}
+
+const uint32_t UartEvents::get_overflows ()
+{
+  return overflows;
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+/**
+ * Discard all recieved bytes after an overflow
+ */
+void UartEvents::recover ()
+{
+  overflows++;
+  uart_flush_input(port);
+  uart_pattern_queue_reset(port, UART_EVENTS_PATTERN_QUEUE_LENGTH);
+  xQueueReset(event_queue);
+  if (debug) Serial.printf(" ! UartEvents: uart %d overflow, input discarded\n", port);
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+/**
+ * Install the uart driver with an event queue and pattern detection
+ */
+bool UartEvents::begin (uint32_t baud, int rx_pin, int tx_pin, char pattern)
+{
+  uart_config_t config = {};
+  config.baud_rate = baud;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity = UART_PARITY_DISABLE;
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+
+  if (uart_param_config(port, &config) != ESP_OK ||
+      uart_set_pin(port, tx_pin, rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK ||
+      uart_driver_install(port, UART_EVENTS_RX_BUFFER_SIZE, 0, UART_EVENTS_QUEUE_LENGTH, &event_queue, 0) != ESP_OK)
+  {
+    if (debug) Serial.printf(" ! UartEvents: could not install driver for uart %d\n", port);
+    return false;
+  }
+
+  // Detect every single pattern character, regardless of idle time around it
+#if defined(ESP_IDF_VERSION_MAJOR) && ESP_IDF_VERSION_MAJOR >= 4
+  uart_enable_pattern_det_baud_intr(port, pattern, 1, 9, 0, 0);
+#else
+  uart_enable_pattern_det_intr(port, pattern, 1, 10000, 0, 0);
+#endif
+  uart_pattern_queue_reset(port, UART_EVENTS_PATTERN_QUEUE_LENGTH);
+  uart_flush_input(port);
+
+  return true;
+}
+
+/**
+ * Wait for the next complete record
+ */
+size_t UartEvents::read (const uint8_t** data, TickType_t timeout)
+{
+  uart_event_t event;
+  *data = chunk;
+
+  if (event_queue == nullptr || xQueueReceive(event_queue, &event, timeout) != pdTRUE) return 0;
+
+  switch (event.type)
+  {
+    case UART_PATTERN_DET:
+    {
+      // Read up to and including the pattern character
+      int pos = uart_pattern_pop_pos(port);
+      size_t len = 0;
+      if (pos < 0)
+      {
+        // Pattern positions were lost, hand out everything buffered
+        uart_get_buffered_data_len(port, &len);
+      }
+      else
+      {
+        len = pos + 1;
+      }
+      if (len > sizeof chunk) len = sizeof chunk;
+      int n = uart_read_bytes(port, chunk, len, 0);
+      return n > 0 ? n : 0;
+    }
+
+    case UART_DATA:
+    {
+      // Records still pending are handed out by their pattern events
+      if (uart_pattern_get_pos(port) >= 0) return 0;
+      // No pattern follows, e.g. the checksum byte after the last '\n' of a VE.Direct frame:
+      // hand out the rest now instead of together with the next record
+      size_t len = 0;
+      uart_get_buffered_data_len(port, &len);
+      if (len > sizeof chunk) len = sizeof chunk;
+      int n = uart_read_bytes(port, chunk, len, 0);
+      return n > 0 ? n : 0;
+    }
+
+    case UART_FIFO_OVF:
+    case UART_BUFFER_FULL:
+      recover();
+      return 0;
+
+    default:
+      // line errors: wait for the pattern to complete the record
+      return 0;
+  }
+}
+
+/**
+ * Write bytes to the uart tx buffer
+ */
+void UartEvents::write (const uint8_t* data, size_t len)
+{
+  uart_write_bytes(port, (const char*)data, len);
+}
@@ -0,0 +1,98 @@
+/**
+ * Event driven UART access based on the ESP-IDF uart driver.
+ * A task waiting in read() only wakes up once a complete record, terminated by a pattern character, has arrived,
+ * or once the line went idle after bytes without a pattern character.
+ */
+
+#ifndef UARTEVENTS_H
+#define UARTEVENTS_H
+
+#include <Arduino.h>
+#include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// Size of the uart driver's rx ring buffer
+#ifndef UART_EVENTS_RX_BUFFER_SIZE
+#define UART_EVENTS_RX_BUFFER_SIZE 1024
+#endif
+
+// Maximum number of bytes handed out by a single read()
+#ifndef UART_EVENTS_CHUNK_SIZE
+#define UART_EVENTS_CHUNK_SIZE 256
+#endif
+
+// Number of events the uart driver can queue
+#define UART_EVENTS_QUEUE_LENGTH 20
+
+// Number of pattern positions the uart driver can remember
+#define UART_EVENTS_PATTERN_QUEUE_LENGTH 16
+
+
+class UartEvents
+{
+private:
+  uart_port_t port;
+  QueueHandle_t event_queue;
+  uint8_t chunk[UART_EVENTS_CHUNK_SIZE];
+  uint32_t overflows;
+
+  /**
+   * Discard all recieved bytes after a hardware FIFO or ring buffer overflow
+   */
+  void recover ();
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  UartEvents (uart_port_t);
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  QueueHandle_t get_event_queue ();
+  const uint32_t get_overflows ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Install the uart driver with an event queue and pattern detection.
+   *
+   * @param baud Baud rate
+   * @param rx_pin GPIO for RX
+   * @param tx_pin GPIO for TX
+   * @param pattern Character terminating a record, e.g. '\n' for VE.Direct
+   *
+   * @return true if the driver was installed successfully
+   */
+  bool begin (uint32_t baud, int rx_pin, int tx_pin, char pattern);
+
+  /**
+   * Wait for the next complete record, or for the bytes received without a pattern character once the line went idle.
+   * The bytes are handed out in a buffer owned by UartEvents without a further copy
+   * and stay valid until the next call of read().
+   *
+   * @param data Pointer to set to the recieved bytes
+   * @param timeout Maximum number of ticks to wait for a record
+   *
+   * @return Number of recieved bytes; 0 on timeout or if no bytes are to be handed out yet
+   */
+  size_t read (const uint8_t** data, TickType_t timeout);
+
+  /**
+   * Write bytes to the uart tx buffer.
+   *
+   * @param data Bytes to write
+   * @param len Number of bytes to write
+   */
+  void write (const uint8_t* data, size_t len);
+};
+
+#endif // UARTEVENTS_H
@@ -0,0 +1,355 @@
+#include "UplinkBacklog.h"
+#include <FastCRC.h>
+
+static FastCRC16 backlog_crc16;
+
+/**
+ * CRC of a record over its sequence number, length and data
+ */
+static uint16_t record_crc (uint32_t sequence, uint8_t len, const uint8_t* data)
+{
+  uint8_t buffer[5 + BACKLOG_RECORD_DATA_MAX];
+  for (size_t i = 0; i < 4; i++) buffer[i] = sequence >> (8 * i);
+  buffer[4] = len;
+  memcpy(buffer + 5, data, len);
+  return backlog_crc16.ccitt(buffer, 5 + len);
+}
+
+static size_t record_size (uint8_t len)
+{
+  return (BACKLOG_RECORD_HEADER_SIZE + len + 3) & ~(size_t)3;
+}
+
+
+/***************
+ * Constructor
+ ***************/
+
+UplinkBacklog::UplinkBacklog (const char* _label)
+{
+  label = _label;
+  partition = nullptr;
+  sector_count = 0;
+  head = 0;
+  tail = 0;
+  sequence = 0;
+  pending_count = 0;
+  peek_sequence = 0;
+  peek_valid = false;
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+const size_t UplinkBacklog::get_pending_count ()
+{
+  return pending_count;
+}
+
+const size_t UplinkBacklog::get_capacity ()
+{
+  return sector_count * BACKLOG_SECTOR_SIZE;
+}
+
+
+/*******************
+ * Private Methods
+ *******************/
+
+/**
+ * Read the header of a record and check it
+ */
+bool UplinkBacklog::read_record (size_t offset, uint32_t& record_sequence, uint8_t& len, uint8_t& state, uint8_t* data)
+{
+  if (offset % BACKLOG_SECTOR_SIZE + BACKLOG_RECORD_HEADER_SIZE > BACKLOG_SECTOR_SIZE) return false;
+
+  uint8_t header[BACKLOG_RECORD_HEADER_SIZE];
+  if (esp_partition_read(partition, offset, header, sizeof(header)) != ESP_OK) return false;
+
+  record_sequence = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+  len = header[4];
+  state = header[5];
+  uint16_t crc = header[6] | header[7] << 8;
+  if (state != BACKLOG_RECORD_PENDING && state != BACKLOG_RECORD_SENT) return false;
+  if (len > BACKLOG_RECORD_DATA_MAX || offset % BACKLOG_SECTOR_SIZE + record_size(len) > BACKLOG_SECTOR_SIZE) return false;
+
+  uint8_t buffer[BACKLOG_RECORD_DATA_MAX];
+  if (data == nullptr) data = buffer;
+  if (esp_partition_read(partition, offset + BACKLOG_RECORD_HEADER_SIZE, data, len) != ESP_OK) return false;
+  return record_crc(record_sequence, len, data) == crc;
+}
+
+/**
+ * Offset of the record after a record, on the next sector if it does not fit
+ */
+size_t UplinkBacklog::next_offset (size_t offset, uint8_t len)
+{
+  offset += record_size(len);
+  if (BACKLOG_SECTOR_SIZE - offset % BACKLOG_SECTOR_SIZE < record_size(0))
+  {
+    offset += BACKLOG_SECTOR_SIZE - offset % BACKLOG_SECTOR_SIZE;
+  }
+  return offset % get_capacity();
+}
+
+/**
+ * First pending record from an offset on, walking the ring up to head
+ */
+size_t UplinkBacklog::seek_pending (size_t offset)
+{
+  while (offset != head)
+  {
+    uint32_t record_sequence;
+    uint8_t len, state;
+    if (!read_record(offset, record_sequence, len, state))
+    {
+      // a damaged record in front of head ends the records
+      if (offset / BACKLOG_SECTOR_SIZE == head / BACKLOG_SECTOR_SIZE) return head;
+      // the rest of the sector is empty or damaged
+      offset = (offset / BACKLOG_SECTOR_SIZE + 1) % sector_count * BACKLOG_SECTOR_SIZE;
+      continue;
+    }
+    if (state == BACKLOG_RECORD_PENDING) return offset;
+    offset = next_offset(offset, len);
+  }
+  return head;
+}
+
+/**
+ * Erase a sector, dropping its pending records
+ */
+void UplinkBacklog::erase_sector (size_t offset)
+{
+  offset -= offset % BACKLOG_SECTOR_SIZE;
+  bool had_pending = pending_count > 0;
+
+  size_t dropped = 0;
+  for (size_t o = offset; o < offset + BACKLOG_SECTOR_SIZE; )
+  {
+    uint32_t record_sequence;
+    uint8_t len, state;
+    if (!read_record(o, record_sequence, len, state)) break;
+    if (state == BACKLOG_RECORD_PENDING) dropped++;
+    o += record_size(len);
+  }
+  esp_partition_erase_range(partition, offset, BACKLOG_SECTOR_SIZE);
+
+  if (dropped > 0)
+  {
+    pending_count = pending_count > dropped ? pending_count - dropped : 0;
+    if (debug) Serial.printf(" ! backlog full, %d oldest records dropped\n", dropped);
+  }
+  // the oldest pending records were in this sector
+  if (had_pending && tail / BACKLOG_SECTOR_SIZE == offset / BACKLOG_SECTOR_SIZE)
+  {
+    tail = seek_pending((offset + BACKLOG_SECTOR_SIZE) % get_capacity());
+  }
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+/**
+ * Find the partition and restore head, tail and sequence number from the records
+ */
+bool UplinkBacklog::begin ()
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)BACKLOG_PARTITION_SUBTYPE, label);
+  if (partition == nullptr || partition->size < 2 * BACKLOG_SECTOR_SIZE)
+  {
+    if (debug) Serial.printf(" ! backlog partition \"%s\" not found\n", label);
+    partition = nullptr;
+    return false;
+  }
+  sector_count = partition->size / BACKLOG_SECTOR_SIZE;
+
+  // The newest sector starts with the highest sequence number
+  bool found = false;
+  size_t newest = 0;
+  uint32_t newest_sequence = 0;
+  for (size_t s = 0; s < sector_count; s++)
+  {
+    uint32_t record_sequence;
+    uint8_t len, state;
+    if (!read_record(s * BACKLOG_SECTOR_SIZE, record_sequence, len, state)) continue;
+    if (!found || (int32_t)(record_sequence - newest_sequence) > 0)
+    {
+      newest = s;
+      newest_sequence = record_sequence;
+      found = true;
+    }
+  }
+
+  head = 0;
+  tail = 0;
+  sequence = 0;
+  pending_count = 0;
+  peek_valid = false;
+  if (!found)
+  {
+    erase_sector(head);
+    if (debug) Serial.println(" - backlog empty");
+    return true;
+  }
+
+  // Head follows the last record of the newest sector
+  size_t offset = newest * BACKLOG_SECTOR_SIZE;
+  sequence = newest_sequence;
+  while (offset / BACKLOG_SECTOR_SIZE == newest)
+  {
+    uint32_t record_sequence;
+    uint8_t len, state;
+    if (!read_record(offset, record_sequence, len, state))
+    {
+      // a record torn by a power loss is not written over, the next sector is started instead
+      uint8_t header[BACKLOG_RECORD_HEADER_SIZE];
+      esp_partition_read(partition, offset, header, sizeof(header));
+      for (uint8_t b : header)
+      {
+        if (b != 0xFF)
+        {
+          offset = (newest + 1) % sector_count * BACKLOG_SECTOR_SIZE;
+          break;
+        }
+      }
+      break;
+    }
+    sequence = record_sequence + 1;
+    offset = next_offset(offset, len);
+  }
+  head = offset;
+  tail = head;
+  // The sector at head is always erased
+  if (head % BACKLOG_SECTOR_SIZE == 0) erase_sector(head);
+
+  // The oldest sector is the first one with records after the newest one
+  tail = newest * BACKLOG_SECTOR_SIZE;
+  for (size_t i = 1; i < sector_count; i++)
+  {
+    size_t s = (newest + i) % sector_count;
+    uint32_t record_sequence;
+    uint8_t len, state;
+    if (read_record(s * BACKLOG_SECTOR_SIZE, record_sequence, len, state))
+    {
+      tail = s * BACKLOG_SECTOR_SIZE;
+      break;
+    }
+  }
+
+  // Count the pending records from the oldest on
+  tail = seek_pending(tail);
+  for (size_t o = tail; o != head; )
+  {
+    pending_count++;
+    uint32_t record_sequence;
+    uint8_t len, state;
+    read_record(o, record_sequence, len, state);
+    o = seek_pending(next_offset(o, len));
+  }
+
+  if (debug) Serial.printf(" - backlog: %d records pending\n", pending_count);
+  return true;
+}
+
+/**
+ * Append a record at head
+ */
+bool UplinkBacklog::append (const uint8_t* data, size_t len)
+{
+  if (partition == nullptr || len > BACKLOG_RECORD_DATA_MAX) return false;
+
+  // Start the next sector if the record does not fit; entering a sector evicts the oldest records
+  if (BACKLOG_SECTOR_SIZE - head % BACKLOG_SECTOR_SIZE < record_size(len))
+  {
+    head = (head / BACKLOG_SECTOR_SIZE + 1) % sector_count * BACKLOG_SECTOR_SIZE;
+    erase_sector(head);
+  }
+
+  uint8_t record[BACKLOG_RECORD_HEADER_SIZE + BACKLOG_RECORD_DATA_MAX];
+  uint16_t crc = record_crc(sequence, len, data);
+  for (size_t i = 0; i < 4; i++) record[i] = sequence >> (8 * i);
+  record[4] = len;
+  record[5] = BACKLOG_RECORD_PENDING;
+  record[6] = crc;
+  record[7] = crc >> 8;
+  memcpy(record + BACKLOG_RECORD_HEADER_SIZE, data, len);
+
+  if (esp_partition_write(partition, head, record, BACKLOG_RECORD_HEADER_SIZE + len) != ESP_OK)
+  {
+    if (debug) Serial.println(" ! backlog write failed");
+    return false;
+  }
+
+  if (pending_count == 0) tail = head;
+  pending_count++;
+  sequence++;
+  head = next_offset(head, len);
+  if (head % BACKLOG_SECTOR_SIZE == 0) erase_sector(head);
+  if (debug) Serial.printf(" - backlog append %d bytes, %d records pending\n", len, pending_count);
+  return true;
+}
+
+/**
+ * Copy the oldest pending records, prefixed with their length
+ */
+size_t UplinkBacklog::peek (uint8_t* buffer, size_t max_size)
+{
+  size_t size = 0;
+  peek_valid = false;
+  if (partition == nullptr) return 0;
+
+  for (size_t o = tail; o != head; )
+  {
+    uint32_t record_sequence;
+    uint8_t len, state;
+    if (!read_record(o, record_sequence, len, state) || size + 1 + len > max_size) break;
+
+    buffer[size] = len;
+    read_record(o, record_sequence, len, state, buffer + size + 1);
+    size += 1 + len;
+    peek_sequence = record_sequence;
+    peek_valid = true;
+    o = seek_pending(next_offset(o, len));
+  }
+  return size;
+}
+
+/**
+ * Mark the records up to the last one of peek() as sent
+ */
+void UplinkBacklog::commit ()
+{
+  if (!peek_valid) return;
+  peek_valid = false;
+
+  const uint8_t sent = BACKLOG_RECORD_SENT;
+  while (tail != head)
+  {
+    uint32_t record_sequence;
+    uint8_t len, state;
+    // records evicted since peek() are gone already
+    if (!read_record(tail, record_sequence, len, state) || (int32_t)(record_sequence - peek_sequence) > 0) break;
+
+    esp_partition_write(partition, tail + 5, &sent, 1);
+    if (pending_count > 0) pending_count--;
+    tail = seek_pending(next_offset(tail, len));
+  }
+  if (debug) Serial.printf(" - backlog drained, %d records pending\n", pending_count);
+}
+
+/**
+ * Erase the whole partition
+ */
+void UplinkBacklog::clear ()
+{
+  if (partition == nullptr) return;
+  esp_partition_erase_range(partition, 0, get_capacity());
+  head = 0;
+  tail = 0;
+  pending_count = 0;
+  peek_valid = false;
+}
@@ -0,0 +1,150 @@
+/**
+ * Persistent backlog of uplink records in a dedicated flash partition.
+ *
+ * Records are appended to a ring of flash sectors and never rewritten, so every sector is erased once per round
+ * and wear is spread evenly over the partition. A record that does not fit into the rest of a sector starts the next
+ * one; entering a sector erases it, evicting its records, which are always the oldest ones.
+ *
+ * Record in flash, aligned to 4 bytes:
+ *   4 bytes  sequence number, LSB first; increasing over the lifetime of the partition
+ *   1 byte   length of the data
+ *   1 byte   state: BACKLOG_RECORD_PENDING, or BACKLOG_RECORD_SENT once drained (only clears bits, no erase)
+ *   2 bytes  CRC CCITT over sequence number, length and data, LSB first
+ *   n bytes  data
+ * An erased header (0xFF) ends the records of a sector; a record with a wrong CRC, e.g. torn by a power loss, as well.
+ *
+ * Not thread safe; use from one task only.
+ */
+
+#ifndef UPLINKBACKLOG_H
+#define UPLINKBACKLOG_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+// Subtype of the data partition of the backlog, see partitions.csv
+#define BACKLOG_PARTITION_SUBTYPE 0x40
+
+#define BACKLOG_SECTOR_SIZE 4096
+
+// Largest data of a record in bytes
+#define BACKLOG_RECORD_DATA_MAX 64
+
+#define BACKLOG_RECORD_HEADER_SIZE 8
+
+#define BACKLOG_RECORD_PENDING 0xFE
+#define BACKLOG_RECORD_SENT 0xFC
+
+class UplinkBacklog
+{
+private:
+  const char* label;
+  const esp_partition_t* partition;
+  size_t sector_count;
+
+  // Offset of the next record
+  size_t head;
+  // Offset of the oldest pending record; head if there is none
+  size_t tail;
+  uint32_t sequence;
+  size_t pending_count;
+
+  // Last record returned by peek()
+  uint32_t peek_sequence;
+  bool peek_valid;
+
+  /**
+   * Read the header of a record and check it
+   *
+   * @param offset Offset of the record
+   * @param record_sequence Set to the sequence number
+   * @param len Set to the length of the data
+   * @param state Set to the state
+   * @param data Set to the data if not nullptr
+   *
+   * @return false for erased or damaged records
+   */
+  bool read_record (size_t, uint32_t&, uint8_t&, uint8_t&, uint8_t* = nullptr);
+
+  /**
+   * @return Offset of the record after a record of a length, on the next sector if it does not fit
+   */
+  size_t next_offset (size_t, uint8_t);
+
+  /**
+   * @return Offset of the first pending record from an offset on, or head if there is none
+   */
+  size_t seek_pending (size_t);
+
+  /**
+   * Erase the sector at an offset, dropping its pending records
+   */
+  void erase_sector (size_t);
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  /**
+   * @param label Label of the partition in the partition table
+   */
+  UplinkBacklog (const char* label);
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  /**
+   * @return Number of records not yet drained
+   */
+  const size_t get_pending_count ();
+
+  /**
+   * @return Number of bytes of the partition, 0 before begin()
+   */
+  const size_t get_capacity ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Find the partition and the records kept from before the last reboot
+   *
+   * @return false if there is no partition of the label with at least two sectors
+   */
+  bool begin ();
+
+  /**
+   * Append a record, evicting the oldest records when the partition is full
+   *
+   * @return false without partition or for data longer than BACKLOG_RECORD_DATA_MAX
+   */
+  bool append (const uint8_t* data, size_t len);
+
+  /**
+   * Copy the oldest pending records into a buffer, each prefixed with its length byte.
+   * The records stay pending until commit().
+   *
+   * @param buffer Buffer to copy to
+   * @param max_size Size of the buffer
+   *
+   * @return Number of bytes copied; 0 if no record is pending or the oldest one does not fit
+   */
+  size_t peek (uint8_t* buffer, size_t max_size);
+
+  /**
+   * Mark the records of the last peek() as drained
+   */
+  void commit ();
+
+  /**
+   * Erase the whole partition
+   */
+  void clear ();
+};
+
+#endif // UPLINKBACKLOG_H
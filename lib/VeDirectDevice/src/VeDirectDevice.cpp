@@ -0,0 +1,90 @@
+#include "VeDirectDevice.h"
+
+/***************
+ * Constructor
+ ***************/
+
+VeDirectDevice::VeDirectDevice (const char* _name, uart_port_t port, int _rx_pin, int _tx_pin, const ve_field* _fields, size_t _field_count)
+  : uart(port)
+{
+  name = _name;
+  rx_pin = _rx_pin;
+  tx_pin = _tx_pin;
+  fields = _fields;
+  field_count = _field_count;
+}
+
+
+/******************
+ * Getter, Setter
+ ******************/
+
+const char* VeDirectDevice::get_name ()
+{
+  return name;
+}
+
+const ve_field* VeDirectDevice::get_fields ()
+{
+  return fields;
+}
+
+const size_t VeDirectDevice::get_field_count ()
+{
+  return field_count;
+}
+
+VeDirectFrameHandler& VeDirectDevice::get_handler ()
+{
+  return handler;
+}
+
+QueueHandle_t VeDirectDevice::get_event_queue ()
+{
+  return uart.get_event_queue();
+}
+
+
+/******************
+ * Public Methods
+ ******************/
+
+/**
+ * Install the uart driver, waking on every complete record or HEX message ('\n'),
+ * and on the checksum byte ending a frame once the line went idle
+ */
+bool VeDirectDevice::begin ()
+{
+  bool ok = uart.begin(VE_DIRECT_BAUD, rx_pin, tx_pin, '\n');
+  if (debug)
+  {
+    if (ok) Serial.printf(" - VeDirect %s: uart begin\n", name);
+    else Serial.printf(" ! VeDirect %s: uart not available\n", name);
+  }
+  return ok;
+}
+
+/**
+ * Feed the next complete record to the frame handler
+ */
+bool VeDirectDevice::poll (TickType_t timeout)
+{
+  const uint8_t* record;
+  size_t len = uart.read(&record, timeout);
+
+  // A record is a single line, so it completes at most one frame
+  uint32_t frames = handler.getFrameCount();
+  for (size_t i = 0; i < len; i++)
+  {
+    handler.rxData(record[i]);
+  }
+  return handler.getFrameCount() != frames;
+}
+
+/**
+ * Write bytes to the device
+ */
+void VeDirectDevice::write (const uint8_t* data, size_t len)
+{
+  uart.write(data, len);
+}
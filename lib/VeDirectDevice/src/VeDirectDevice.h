@@ -0,0 +1,94 @@
+/**
+ * VE.Direct device on its own uart, e.g. an MPPT solar charger, a BMV/SmartShunt or a Phoenix inverter.
+ * Every device has its own VeDirectFrameHandler and a mapping from VE.Direct labels to parameter codes,
+ * so the values of a frame can be stored without code specific to the device.
+ */
+
+#ifndef VEDIRECTDEVICE_H
+#define VEDIRECTDEVICE_H
+
+#include <Arduino.h>
+#include "UartEvents.h"
+#include "VeDirectFrameHandler.h"
+
+// Baud rate of the VE.Direct text and HEX protocol
+#define VE_DIRECT_BAUD 19200
+
+/**
+ * Mapping of a VE.Direct label to a parameter
+ */
+struct ve_field
+{
+  VeLabel label;
+  unsigned char parameter_code;
+  // Divisor from the VE.Direct value to the stored value
+  int32_t divisor;
+  // Send via LoRa only once an hour instead of every TX_INTERVAL
+  bool hourly;
+};
+
+class VeDirectDevice
+{
+private:
+  const char* name;
+  int rx_pin;
+  int tx_pin;
+  const ve_field* fields;
+  size_t field_count;
+  UartEvents uart;
+  VeDirectFrameHandler handler;
+
+public:
+  /***************
+   * Constructor
+   ***************/
+
+  /**
+   * @param name Name for debug output
+   * @param port Uart the device is connected to
+   * @param rx_pin GPIO for RX
+   * @param tx_pin GPIO for TX
+   * @param fields Mapping of labels to parameters; must stay valid
+   * @param field_count Number of fields
+   */
+  VeDirectDevice (const char*, uart_port_t, int, int, const ve_field*, size_t);
+
+
+  /******************
+   * Getter, Setter
+   ******************/
+
+  const char* get_name ();
+  const ve_field* get_fields ();
+  const size_t get_field_count ();
+  VeDirectFrameHandler& get_handler ();
+  QueueHandle_t get_event_queue ();
+
+
+  /******************
+   * Public Methods
+   ******************/
+
+  /**
+   * Install the uart driver
+   *
+   * @return true if the driver was installed successfully
+   */
+  bool begin ();
+
+  /**
+   * Feed the next complete record, or the checksum byte ending a frame, to the frame handler
+   *
+   * @param timeout Maximum number of ticks to wait for a record
+   *
+   * @return true if the record completed a checksum-valid frame
+   */
+  bool poll (TickType_t timeout);
+
+  /**
+   * Write bytes to the device, e.g. VE.Direct HEX commands
+   */
+  void write (const uint8_t* data, size_t len);
+};
+
+#endif // VEDIRECTDEVICE_H
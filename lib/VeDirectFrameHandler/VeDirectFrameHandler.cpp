@@ -29,6 +29,10 @@
  * 2020.05.05 - 0.2 - initial release
  * 2020.06.21 - 0.2 - add MIT license, no code changes
  * 2020.08.20 - 0.3 - corrected #include reference
+ * 2026.10.17 - 0.4 - labels resolved to VeLabel ids and values parsed to integers as bytes arrive,
+ *                    replacing the name/value string buffers
+ * 2026.10.17 - 0.5 - HEX protocol: Ping, Get, Set and async register notifications
+ * 2026.10.17 - 0.6 - frame callback and frame counters
  *
  */
 
@@ -38,31 +42,56 @@
 #define MODULE "VE.Frame"	// Victron seems to use this to find out where logging messages were generated
 
 // The name of the record that contains the checksum.
-static constexpr char checksumTagName[] = "CHECKSUM";
+static constexpr uint32_t checksumTagHash = veLabelHash("CHECKSUM");
+
+// Values of ON/OFF fields
+static constexpr uint32_t onValueHash = veLabelHash("ON");
+static constexpr uint32_t offValueHash = veLabelHash("OFF");
 
 VeDirectFrameHandler::VeDirectFrameHandler() :
 	//mStop(false),	// don't know what Victron uses this for, not using
-	veName(),
-	veValue(),
 	frameIndex(0),
-	veEnd(0),
 	mState(IDLE),
+	mPrevState(IDLE),
 	mChecksum(0),
-	mTextPointer(0),
-	tempName(),
-	tempValue()
+	mNameHash(veHashInit),
+	mNameLen(0),
+	mLabel(VeLabel::Unknown),
+	mValue(0),
+	mValueHash(veHashInit),
+	mValueLen(0),
+	mValueNumeric(false),
+	mValueNegative(false),
+	mValueHex(false),
+	tempLabel(),
+	tempValue(),
+	veValue(),
+	veHasValue(),
+	mHexCommand(0),
+	mHexBuffer(),
+	mHexNibbles(0),
+	mHexLen(0),
+	mHexValid(false),
+	mFrameCallback(nullptr),
+	mFrameCount(0),
+	mFrameErrorCount(0),
+	mFrameTime(0),
+	mTx(nullptr),
+	mRegisterCallback(nullptr),
+	mFirmwareVersion(0)
 {
 }
 
 /*
  *	rxData
  *  This function is called by the application which passes a byte of serial data
- *  It is unchanged from Victron's example code
+ *  Derived from Victron's example code; names are hashed and values parsed while they arrive instead of being buffered
  */
 void VeDirectFrameHandler::rxData(uint8_t inbyte)
 {
 	//if (mStop) return;
 	if ( (inbyte == ':') && (mState != CHECKSUM) ) {
+		if (mState != RECORD_HEX) mPrevState = mState;
 		mState = RECORD_HEX;
 	}
 	if (mState != RECORD_HEX) {
@@ -83,8 +112,8 @@ void VeDirectFrameHandler::rxData(uint8_t inbyte)
 		}
 		break;
 	case RECORD_BEGIN:
-		mTextPointer = mName;
-		*mTextPointer++ = inbyte;
+		mNameHash = veHashByte(veHashInit, inbyte);
+		mNameLen = 1;
 		mState = RECORD_NAME;
 		break;
 	case RECORD_NAME:
@@ -92,20 +121,30 @@ void VeDirectFrameHandler::rxData(uint8_t inbyte)
 		switch(inbyte) {
 		case '\t':
 			// the Checksum record indicates a EOR
-			if ( mTextPointer < (mName + sizeof(mName)) ) {
-				*mTextPointer = 0; /* Zero terminate */
-				if (strcmp(mName, checksumTagName) == 0) {
+			if ( mNameLen < nameLen ) {
+				if (mNameHash == checksumTagHash) {
 					mState = CHECKSUM;
 					break;
 				}
+				mLabel = labelId(mNameHash);
+			} else {
+				mLabel = VeLabel::Unknown;
 			}
-			mTextPointer = mValue; /* Reset value pointer */
+			/* Reset value */
+			mValue = 0;
+			mValueHash = veHashInit;
+			mValueLen = 0;
+			mValueNumeric = true;
+			mValueNegative = false;
+			mValueHex = false;
 			mState = RECORD_VALUE;
 			break;
 		default:
 			// add byte to name, but do no overflow
-			if ( mTextPointer < (mName + sizeof(mName)) )
-				*mTextPointer++ = inbyte;
+			if ( mNameLen < nameLen ) {
+				mNameHash = veHashByte(mNameHash, inbyte);
+				mNameLen++;
+			}
 			break;
 		}
 		break;
@@ -113,19 +152,22 @@ void VeDirectFrameHandler::rxData(uint8_t inbyte)
 		// The record value is being received.  The \r indicates a new record.
 		switch(inbyte) {
 		case '\n':
-			// forward record, only if it could be stored completely
-			if ( mTextPointer < (mValue + sizeof(mValue)) ) {
-				*mTextPointer = 0; // make zero ended
-				textRxEvent(mName, mValue);
+			// forward record, only if it is a known label with a numeric value
+			if ( mLabel != VeLabel::Unknown ) {
+				if ( mValueNumeric && mValueLen > 0 && !(mValueNegative && mValueLen == 1) ) {
+					textRxEvent(mLabel, mValueNegative ? -mValue : mValue);
+				} else if ( mValueHash == onValueHash ) {
+					textRxEvent(mLabel, 1);
+				} else if ( mValueHash == offValueHash ) {
+					textRxEvent(mLabel, 0);
+				}
 			}
 			mState = RECORD_BEGIN;
 			break;
 		case '\r': /* Skip */
 			break;
 		default:
-			// add byte to value, but do no overflow
-			if ( mTextPointer < (mValue + sizeof(mValue)) )
-				*mTextPointer++ = inbyte;
+			valueRxEvent(inbyte);
 			break;
 		}
 		break;
@@ -143,59 +185,159 @@ void VeDirectFrameHandler::rxData(uint8_t inbyte)
 		break;
 	}
 	case RECORD_HEX:
+		// HEX messages do not count towards the text checksum, continue the text frame where it was interrupted
 		if (hexRxEvent(inbyte)) {
-			mChecksum = 0;
-			mState = IDLE;
+			mState = mPrevState;
 		}
 		break;
 	}
 }
 
+/*
+ *	getValue
+ *  Value of a label from the last checksum-valid frame. Returns false if the label has never been received.
+ */
+bool VeDirectFrameHandler::getValue(VeLabel label, int32_t & value) const {
+	if ( !hasValue(label) ) return false;
+	value = veValue[(byte)label];
+	return true;
+}
+
+bool VeDirectFrameHandler::hasValue(VeLabel label) const {
+	return label != VeLabel::Unknown && label < VeLabel::Count && veHasValue[(byte)label];
+}
+
+/*
+ *	labelId
+ *  Resolves a label hash to its VeLabel. Every case value is a compile time hash, so a collision between two known
+ *  labels fails to compile with a duplicate case value.
+ */
+VeLabel VeDirectFrameHandler::labelId(uint32_t hash) {
+	switch (hash) {
+	case veLabelHash("V"):        return VeLabel::V;
+	case veLabelHash("V2"):       return VeLabel::V2;
+	case veLabelHash("V3"):       return VeLabel::V3;
+	case veLabelHash("VS"):       return VeLabel::VS;
+	case veLabelHash("VM"):       return VeLabel::VM;
+	case veLabelHash("DM"):       return VeLabel::DM;
+	case veLabelHash("VPV"):      return VeLabel::VPV;
+	case veLabelHash("PPV"):      return VeLabel::PPV;
+	case veLabelHash("I"):        return VeLabel::I;
+	case veLabelHash("I2"):       return VeLabel::I2;
+	case veLabelHash("I3"):       return VeLabel::I3;
+	case veLabelHash("IL"):       return VeLabel::IL;
+	case veLabelHash("LOAD"):     return VeLabel::LOAD;
+	case veLabelHash("T"):        return VeLabel::T;
+	case veLabelHash("P"):        return VeLabel::P;
+	case veLabelHash("CE"):       return VeLabel::CE;
+	case veLabelHash("SOC"):      return VeLabel::SOC;
+	case veLabelHash("TTG"):      return VeLabel::TTG;
+	case veLabelHash("ALARM"):    return VeLabel::ALARM;
+	case veLabelHash("RELAY"):    return VeLabel::RELAY;
+	case veLabelHash("AR"):       return VeLabel::AR;
+	case veLabelHash("OR"):       return VeLabel::OR;
+	case veLabelHash("ERR"):      return VeLabel::ERR;
+	case veLabelHash("CS"):       return VeLabel::CS;
+	case veLabelHash("BMV"):      return VeLabel::BMV;
+	case veLabelHash("FW"):       return VeLabel::FW;
+	case veLabelHash("FWE"):      return VeLabel::FWE;
+	case veLabelHash("PID"):      return VeLabel::PID;
+	case veLabelHash("HSDS"):     return VeLabel::HSDS;
+	case veLabelHash("MODE"):     return VeLabel::MODE;
+	case veLabelHash("MPPT"):     return VeLabel::MPPT;
+	case veLabelHash("MON"):      return VeLabel::MON;
+	case veLabelHash("WARN"):     return VeLabel::WARN;
+	case veLabelHash("AC_OUT_V"): return VeLabel::AC_OUT_V;
+	case veLabelHash("AC_OUT_I"): return VeLabel::AC_OUT_I;
+	case veLabelHash("AC_OUT_S"): return VeLabel::AC_OUT_S;
+	case veLabelHash("H1"):       return VeLabel::H1;
+	case veLabelHash("H2"):       return VeLabel::H2;
+	case veLabelHash("H3"):       return VeLabel::H3;
+	case veLabelHash("H4"):       return VeLabel::H4;
+	case veLabelHash("H5"):       return VeLabel::H5;
+	case veLabelHash("H6"):       return VeLabel::H6;
+	case veLabelHash("H7"):       return VeLabel::H7;
+	case veLabelHash("H8"):       return VeLabel::H8;
+	case veLabelHash("H9"):       return VeLabel::H9;
+	case veLabelHash("H10"):      return VeLabel::H10;
+	case veLabelHash("H11"):      return VeLabel::H11;
+	case veLabelHash("H12"):      return VeLabel::H12;
+	case veLabelHash("H13"):      return VeLabel::H13;
+	case veLabelHash("H14"):      return VeLabel::H14;
+	case veLabelHash("H15"):      return VeLabel::H15;
+	case veLabelHash("H16"):      return VeLabel::H16;
+	case veLabelHash("H17"):      return VeLabel::H17;
+	case veLabelHash("H18"):      return VeLabel::H18;
+	case veLabelHash("H19"):      return VeLabel::H19;
+	case veLabelHash("H20"):      return VeLabel::H20;
+	case veLabelHash("H21"):      return VeLabel::H21;
+	case veLabelHash("H22"):      return VeLabel::H22;
+	case veLabelHash("H23"):      return VeLabel::H23;
+	default:                      return VeLabel::Unknown;
+	}
+}
+
+/*
+ * valueRxEvent
+ * This function is called for every byte of a field value. Decimal values, optionally negative, and 0x prefixed hex
+ * values are accumulated into mValue. Any other value is only hashed, to recognise ON and OFF.
+ */
+void VeDirectFrameHandler::valueRxEvent(uint8_t inbyte) {
+	mValueHash = veHashByte(mValueHash, inbyte);
+	if ( mValueNumeric ) {
+		if ( mValueLen == 0 && inbyte == '-' ) {
+			mValueNegative = true;
+		} else if ( mValueLen == 1 && inbyte == 'X' && mValue == 0 && !mValueNegative ) {
+			mValueHex = true;
+		} else if ( inbyte >= '0' && inbyte <= '9' ) {
+			mValue = mValue * (mValueHex ? 16 : 10) + (inbyte - '0');
+		} else if ( mValueHex && inbyte >= 'A' && inbyte <= 'F' ) {
+			mValue = mValue * 16 + (inbyte - 'A' + 10);
+		} else {
+			mValueNumeric = false;
+		}
+	}
+	if ( mValueLen < 0xFF ) mValueLen++;
+}
+
 /*
  * textRxEvent
- * This function is called every time a new name/value is successfully parsed.  It writes the values to the temporary buffer.
+ * This function is called every time a new label/value is successfully parsed.  It writes the value to the temporary buffer.
  */
-void VeDirectFrameHandler::textRxEvent(char * mName, char * mValue) {
-    strcpy(tempName[frameIndex], mName);    // copy name to temporary buffer
-    strcpy(tempValue[frameIndex], mValue);  // copy value to temporary buffer
+void VeDirectFrameHandler::textRxEvent(VeLabel label, int32_t value) {
+	if ( frameIndex >= frameLen ) return;	// stop any buffer overrun
+	tempLabel[frameIndex] = label;			// copy label to temporary buffer
+	tempValue[frameIndex] = value;			// copy value to temporary buffer
 	frameIndex++;
 }
 
 /*
  *	frameEndEvent
- *  This function is called at the end of the received frame.  If the checksum is valid, the temp buffer is read line by line.
- *  If the name exists in the public buffer, the new value is copied to the public buffer.	If not, a new name/value entry
- *  is created in the public buffer.
+ *  This function is called at the end of the received frame.  If the checksum is valid, the values of the temp buffer
+ *  are copied to the public buffer at the index of their label and the frame callback is called.
  */
 void VeDirectFrameHandler::frameEndEvent(bool valid) {
 	if ( valid ) {
-		for ( int i = 0; i < frameIndex; i++ ) {				// read each name already in the temp buffer
-			bool nameExists = false;
-			for ( int j = 0; j <= veEnd; j++ ) {				// compare to existing names in the public buffer
-				if ( strcmp(tempName[i], veName[j]) == 0 ) {
-					strcpy(veValue[j], tempValue[i]);			// overwrite tempValue in the public buffer
-					nameExists = true;
-					break;
-				}
-			}
-			if ( !nameExists ) {
-				strcpy(veName[veEnd], tempName[i]);				// write new Name to public buffer
-				strcpy(veValue[veEnd], tempValue[i]);			// write new Value to public buffer
-				veEnd++;										// increment end of public buffer
-				if ( veEnd >= buffLen ) {						// stop any buffer overrun
-					veEnd = buffLen - 1;
-				}
-			}
+		for ( int i = 0; i < frameIndex; i++ ) {
+			veValue[(byte)tempLabel[i]] = tempValue[i];
+			veHasValue[(byte)tempLabel[i]] = true;
 		}
+		mFrameCount++;
+		mFrameTime = millis();
+	} else {
+		mFrameErrorCount++;
 	}
 	frameIndex = 0;	// reset frame
+	if ( valid && mFrameCallback ) {
+		mFrameCallback(mFrameTime);
+	}
 }
 
 /*
  *	logE
  *  This function included for continuity and possible future use.
  */
-void VeDirectFrameHandler::logE(char * module, const char * error) {
+void VeDirectFrameHandler::logE(const char * module, const char * error) {
 	//Serial.print("MODULE: ");
 	//Serial.println(module);
 	//Serial.print("ERROR: ");
@@ -205,8 +347,164 @@ void VeDirectFrameHandler::logE(char * module, const char * error) {
 
 /*
  *	hexRxEvent
- *  This function included for continuity and possible future use.
+ *  This function is called for every byte of a HEX message, starting with the ':'. The hex digits are converted to
+ *  bytes as they arrive. Returns true once the message is complete.
  */
 bool VeDirectFrameHandler::hexRxEvent(uint8_t inbyte) {
-	return true;		// stubbed out for future
+	uint8_t nibble;
+	switch (inbyte) {
+	case ':':
+		mHexNibbles = 0;
+		mHexLen = 0;
+		mHexValid = true;
+		return false;
+	case '\r': /* Skip */
+		return false;
+	case '\n':
+		// command nibble, followed by complete bytes including the checksum
+		if ( mHexValid && mHexNibbles >= 3 && (mHexNibbles & 1) ) {
+			uint8_t checksum = mHexCommand;
+			for ( int i = 0; i < mHexLen; i++ ) checksum += mHexBuffer[i];
+			if ( checksum == veHexChecksum ) {
+				hexFrameEvent(mHexCommand, mHexBuffer, mHexLen - 1);
+			} else {
+				logE(MODULE, "[CHECKSUM] Invalid HEX message");
+			}
+		}
+		return true;
+	default:
+		if ( inbyte >= '0' && inbyte <= '9' ) {
+			nibble = inbyte - '0';
+		} else if ( inbyte >= 'A' && inbyte <= 'F' ) {
+			nibble = inbyte - 'A' + 10;
+		} else {
+			mHexValid = false;
+			return false;
+		}
+		break;
+	}
+
+	if ( mHexNibbles == 0 ) {
+		mHexCommand = nibble;
+	} else if ( mHexNibbles & 1 ) {
+		// high nibble, but do no overflow
+		if ( mHexLen >= hexLen ) {
+			mHexValid = false;
+			return false;
+		}
+		mHexBuffer[mHexLen] = nibble << 4;
+	} else {
+		mHexBuffer[mHexLen++] |= nibble;
+	}
+	mHexNibbles++;
+	return false;
+}
+
+/*
+ *	hexFrameEvent
+ *  This function is called for every checksum-valid HEX message, with the data bytes between command and checksum.
+ */
+void VeDirectFrameHandler::hexFrameEvent(uint8_t command, const uint8_t * data, byte len) {
+	switch (command) {
+	case veHexPingResponse:
+		if ( len >= 2 ) mFirmwareVersion = data[0] | data[1] << 8;
+		break;
+	case veHexGetResponse:
+	case veHexSetResponse:
+	case veHexAsync:
+		// register id, flags and value
+		if ( len >= 3 && mRegisterCallback ) {
+			mRegisterCallback(data[0] | data[1] << 8, data[2], data + 3, len - 3);
+		}
+		break;
+	case veHexUnknown:
+		logE(MODULE, "[HEX] Unknown command");
+		break;
+	case veHexError:
+		logE(MODULE, "[HEX] Frame error");
+		break;
+	case veHexDone:
+	default:
+		break;
+	}
+}
+
+/*
+ *	hexTx
+ *  Sends a HEX message with command, data bytes and checksum through the tx callback.
+ */
+bool VeDirectFrameHandler::hexTx(uint8_t command, const uint8_t * data, byte len) {
+	static const char digits[] = "0123456789ABCDEF";
+	char message[2 + 2 * (hexLen + 1) + 1];
+	size_t i = 0;
+
+	if ( !mTx || len >= hexLen ) return false;
+
+	uint8_t checksum = veHexChecksum - command;
+	message[i++] = ':';
+	message[i++] = digits[command & 0x0F];
+	for ( byte j = 0; j < len; j++ ) {
+		message[i++] = digits[data[j] >> 4];
+		message[i++] = digits[data[j] & 0x0F];
+		checksum -= data[j];
+	}
+	message[i++] = digits[checksum >> 4];
+	message[i++] = digits[checksum & 0x0F];
+	message[i++] = '\n';
+
+	mTx((const uint8_t *)message, i);
+	return true;
+}
+
+void VeDirectFrameHandler::setFrameCallback(veFrameCallback callback) {
+	mFrameCallback = callback;
+}
+
+uint32_t VeDirectFrameHandler::getFrameCount() const {
+	return mFrameCount;
+}
+
+uint32_t VeDirectFrameHandler::getFrameErrorCount() const {
+	return mFrameErrorCount;
+}
+
+uint32_t VeDirectFrameHandler::getFrameTime() const {
+	return mFrameTime;
+}
+
+void VeDirectFrameHandler::setTxCallback(veTxCallback tx) {
+	mTx = tx;
+}
+
+void VeDirectFrameHandler::setRegisterCallback(veRegisterCallback callback) {
+	mRegisterCallback = callback;
+}
+
+bool VeDirectFrameHandler::ping() {
+	return hexTx(veHexPing, nullptr, 0);
+}
+
+bool VeDirectFrameHandler::getRegister(uint16_t id) {
+	const uint8_t data[3] = { (uint8_t)id, (uint8_t)(id >> 8), 0x00 };
+	return hexTx(veHexGet, data, sizeof(data));
+}
+
+bool VeDirectFrameHandler::setRegister(uint16_t id, const uint8_t * value, uint8_t len) {
+	uint8_t data[hexLen];
+	if ( len > hexLen - 4 ) return false;
+	data[0] = (uint8_t)id;
+	data[1] = (uint8_t)(id >> 8);
+	data[2] = 0x00;
+	memcpy(data + 3, value, len);
+	return hexTx(veHexSet, data, 3 + len);
+}
+
+uint16_t VeDirectFrameHandler::getFirmwareVersion() const {
+	return mFirmwareVersion;
+}
+
+uint32_t VeDirectFrameHandler::registerValue(const uint8_t * value, uint8_t len) {
+	uint32_t v = 0;
+	for ( int i = len < 4 ? len - 1 : 3; i >= 0; i-- ) v = v << 8 | value[i];
+	return v;
 }
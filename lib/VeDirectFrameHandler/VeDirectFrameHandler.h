@@ -4,16 +4,96 @@
  * Derived from Victron framehandler reference implementation.
  *
  * 2020.05.05 - 0.2 - initial release
+ * 2026.10.17 - 0.4 - labels resolved to VeLabel ids and values parsed to integers as bytes arrive
+ * 2026.10.17 - 0.5 - HEX protocol: Ping, Get, Set and async register notifications
+ * 2026.10.17 - 0.6 - frame callback and frame counters
  *
  */
 
 #ifndef FRAMEHANDLER_H_
 #define FRAMEHANDLER_H_
 
+#include <Arduino.h>
+
 const byte frameLen = 18;                       // VE.Direct Protocol: max frame size is 18
-const byte buffLen = 40;                        // Maximum number of lines possible from the device. Current protocol shows this to be the BMV700 at 33 lines.
 const byte nameLen = 9;                         // VE.Direct Protocol: max name size is 9 including /0
-const byte valueLen = 33;                       // VE.Direct Protocol: max value size is 33 including /0
+const byte hexLen = 40;                         // VE.Direct HEX Protocol: max number of bytes following the command, including the checksum
+
+/*
+ * Label hash
+ * FNV-1a over the upper case label. Computed byte by byte while a label is received and at compile time
+ * for the known labels, so labels are never stored or compared as strings.
+ */
+constexpr uint32_t veHashInit = 2166136261u;
+constexpr uint32_t veHashPrime = 16777619u;
+
+constexpr uint32_t veHashByte(uint32_t hash, uint8_t inbyte) {
+    return (hash ^ inbyte) * veHashPrime;
+}
+
+constexpr uint32_t veLabelHash(const char * label, uint32_t hash = veHashInit) {
+    return *label ? veLabelHash(label + 1, veHashByte(hash, (uint8_t)*label)) : hash;
+}
+
+/*
+ * Labels of the VE.Direct text protocol with a numeric value (MPPT, BMV/SmartShunt, Phoenix inverter).
+ * Labels are upper case, since received bytes are converted to upper case.
+ */
+enum class VeLabel : uint8_t {
+    Unknown,
+    V, V2, V3, VS, VM, DM, VPV, PPV, I, I2, I3, IL, LOAD, T, P, CE, SOC, TTG,
+    ALARM, RELAY, AR, OR, ERR, CS, BMV, FW, FWE, PID, HSDS, MODE, MPPT, MON, WARN,
+    AC_OUT_V, AC_OUT_I, AC_OUT_S,
+    H1, H2, H3, H4, H5, H6, H7, H8, H9, H10, H11, H12, H13, H14, H15, H16, H17, H18,
+    H19, H20, H21, H22, H23,
+    Count
+};
+
+const byte labelCount = (byte)VeLabel::Count;
+
+/*
+ * VE.Direct HEX protocol
+ * ':' followed by the command nibble, the data bytes and a checksum byte as hex digits, terminated by '\n'.
+ * Command, data and checksum bytes add up to 0x55. Register ids and values are little endian.
+ */
+const uint8_t veHexChecksum = 0x55;
+
+// Commands sent to the device
+const uint8_t veHexPing = 0x1;
+const uint8_t veHexGet = 0x7;
+const uint8_t veHexSet = 0x8;
+
+// Responses and notifications from the device
+const uint8_t veHexDone = 0x1;
+const uint8_t veHexUnknown = 0x3;
+const uint8_t veHexError = 0x4;
+const uint8_t veHexPingResponse = 0x5;
+const uint8_t veHexGetResponse = 0x7;
+const uint8_t veHexSetResponse = 0x8;
+const uint8_t veHexAsync = 0xA;
+
+// Flags of a register response
+const uint8_t veHexFlagUnknownId = 0x01;
+const uint8_t veHexFlagNotSupported = 0x02;
+const uint8_t veHexFlagParameterError = 0x04;
+
+// Registers of MPPT solar chargers
+const uint16_t veRegDeviceState = 0x0201;       // un8; charger state, as CS
+const uint16_t veRegPanelPower = 0xEDBC;        // un32; 0.01 W
+const uint16_t veRegLoadCurrent = 0xEDAD;       // un16; 0.1 A
+const uint16_t veRegYieldToday = 0xEDD3;        // un16; 0.01 kWh
+const uint16_t veRegMaxPowerToday = 0xEDD2;     // un16; W
+const uint16_t veRegYieldYesterday = 0xEDD1;    // un16; 0.01 kWh
+const uint16_t veRegMaxPowerYesterday = 0xEDD0; // un16; W
+
+// Writes bytes to the device
+typedef void (*veTxCallback)(const uint8_t * data, size_t len);
+
+// Called for every checksum-valid frame, once its values are available; time is millis() of the checksum byte
+typedef void (*veFrameCallback)(uint32_t time);
+
+// Called for every register response and async notification; value is little endian
+typedef void (*veRegisterCallback)(uint16_t id, uint8_t flags, const uint8_t * value, uint8_t len);
 
 
 class VeDirectFrameHandler {
@@ -22,11 +102,27 @@ public:
     VeDirectFrameHandler();
     void rxData(uint8_t inbyte);                // byte of serial data to be passed by the application
 
-    char veName[buffLen][nameLen] = { };        // public buffer for received names
-    char veValue[buffLen][valueLen] = { };      // public buffer for received values
+    bool getValue(VeLabel label, int32_t & value) const;   // value of the last checksum-valid frame; false if never received
+    bool hasValue(VeLabel label) const;
+
+    static VeLabel labelId(uint32_t hash);      // VeLabel of a label hash; VeLabel::Unknown if not known
+
+    void setFrameCallback(veFrameCallback callback);
+    uint32_t getFrameCount() const;             // number of checksum-valid frames
+    uint32_t getFrameErrorCount() const;        // number of frames dropped for an invalid checksum
+    uint32_t getFrameTime() const;              // millis() of the last checksum-valid frame; 0 if never received
+
+    void setTxCallback(veTxCallback tx);        // required to send HEX commands
+    void setRegisterCallback(veRegisterCallback callback);
+
+    bool ping();                                // the response updates getFirmwareVersion()
+    bool getRegister(uint16_t id);              // the value arrives in the register callback
+    bool setRegister(uint16_t id, const uint8_t * value, uint8_t len);  // value little endian
+    uint16_t getFirmwareVersion() const;        // 0 until a ping response has been received
+
+    static uint32_t registerValue(const uint8_t * value, uint8_t len);  // little endian register value as integer
 
     int frameIndex;                             // which line of the frame are we on
-    int veEnd;                                  // current size (end) of the public buffer
 
 private:
     //bool mStop;                               // not sure what Victron uses this for, not using
@@ -41,20 +137,49 @@ private:
     };
 
     int mState;                                 // current state
+    int mPrevState;                             // text state to return to after a HEX message
 
     uint8_t	mChecksum;                          // checksum value
 
-    char * mTextPointer;                        // pointer to the private buffer we're writing to, name or value
+    uint32_t mNameHash;                         // hash of the field name received so far
+    byte mNameLen;                              // number of bytes of the field name received so far
+    VeLabel mLabel;                             // label of the field whose value is being received
+
+    int32_t mValue;                             // field value parsed so far
+    uint32_t mValueHash;                        // hash of the field value, to recognise ON and OFF
+    byte mValueLen;                             // number of bytes of the field value received so far
+    bool mValueNumeric;                         // field value is a decimal or 0x prefixed hex number so far
+    bool mValueNegative;
+    bool mValueHex;
+
+    VeLabel tempLabel[frameLen];                // private buffer for received labels
+    int32_t tempValue[frameLen];                // private buffer for received values
+
+    int32_t veValue[labelCount];                // public values, indexed by label
+    bool veHasValue[labelCount];
+
+    uint8_t mHexCommand;                        // command nibble of the HEX message being received
+    uint8_t mHexBuffer[hexLen];                 // data and checksum bytes of the HEX message being received
+    byte mHexNibbles;                           // number of hex digits received, including the command
+    byte mHexLen;                               // number of complete bytes in mHexBuffer
+    bool mHexValid;
+
+    veFrameCallback mFrameCallback;
+    uint32_t mFrameCount;
+    uint32_t mFrameErrorCount;
+    uint32_t mFrameTime;                        // millis() when the checksum byte was processed, the end of the frame
 
-    char mName[9];                              // buffer for the field name
-    char mValue[33];                            // buffer for the field value
-    char tempName[frameLen][nameLen];           // private buffer for received names
-    char tempValue[frameLen][valueLen];         // private buffer for received values
+    veTxCallback mTx;
+    veRegisterCallback mRegisterCallback;
+    uint16_t mFirmwareVersion;
 
-    void textRxEvent(char *, char *);
+    void valueRxEvent(uint8_t);
+    void textRxEvent(VeLabel, int32_t);
     void frameEndEvent(bool);
-    void logE(char *, const char *);
+    void logE(const char *, const char *);
     bool hexRxEvent(uint8_t);
+    void hexFrameEvent(uint8_t, const uint8_t *, byte);
+    bool hexTx(uint8_t, const uint8_t *, byte);
 };
 
 #endif // FRAMEHANDLER_H_
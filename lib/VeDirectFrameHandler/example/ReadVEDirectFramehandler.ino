@@ -15,6 +15,7 @@
 
  History:
    2020.05.05 - 0.3 - initial release
+   2026.10.17 - 0.4 - read values by VeLabel
 
 **************************************************************************************/
 
@@ -58,9 +59,13 @@ void EverySecond() {
 }
 
 void PrintData() {
-    for ( int i = 0; i < myve.veEnd; i++ ) {
-    Serial.print(myve.veName[i]);
-    Serial.print("= ");
-    Serial.println(myve.veValue[i]);    
+    int32_t value;
+    if ( myve.getValue(VeLabel::V, value) ) {
+        Serial.print("V= ");
+        Serial.println(value);
+    }
+    if ( myve.getValue(VeLabel::I, value) ) {
+        Serial.print("I= ");
+        Serial.println(value);
     }
 }
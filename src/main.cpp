@@ -1,5 +1,4 @@
 #include <Arduino.h>
-#include <map>
 #include <rom/rtc.h>
 
 
@@ -16,7 +15,13 @@
  ******************************************/
 
 #include "SerialCommHelper.h"
+#include "ParameterStore.h"
 const uint8_t SLEEP_RASPBERRY_PIN = (13);
+// Baud rate of the serial port. Rates above 115200 require serial protocol version 2 on Raspberry Pi.
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 115200
+#endif
+#define SERIAL_RX_BUFFER_SIZE 1024
 
 
 /*****************
@@ -24,6 +29,7 @@ const uint8_t SLEEP_RASPBERRY_PIN = (13);
  *****************/
 
 #include "BLEUlmernest.h"
+#include "Logbuch.h"
 #include "enums/lock_actions.h"
 #include "enums/keyturner_states/lock_states.h"
 
@@ -33,35 +39,160 @@ const uint8_t SLEEP_RASPBERRY_PIN = (13);
  ***********/
 
 #include "LoRa.h"
-#include <CayenneLPP.h>
+#include "NestCodec.h"
+#include "PayloadScheduler.h"
 uint64_t hourly_timer = 0;
 const uint32_t hourly_interval = 3600000; // milliseconds
 bool sent_last_reset_reason = false;
+const uint8_t payload_port = 1;
+
+
+/******************
+ * Uplink backlog
+ ******************/
+
+#include "UplinkBacklog.h"
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+// Snapshots of all values while the uplink is down, kept in flash and drained on backlog_port
+UplinkBacklog backlog("backlog");
+const uint8_t backlog_port = 3;
+NestEncoder backlog_encoder;
+// Boot counter and uptime in seconds, timestamp of every snapshot
+uint8_t backlog_boot = 0;
+const size_t backlog_timestamp_size = 4;
+// Largest snapshot, so a batch of one fits into the smallest payload
+const size_t backlog_snapshot_size = 51 - 1 - 2 * backlog_timestamp_size;
+uint64_t backlog_timer = 0;
+// Link state of the last loop; the link counts as down since boot, the first snapshot follows after an interval
+bool backlog_link_down = true;
+// Batches drained after every payload while the link is up
+const size_t backlog_batches_max = 4;
+size_t backlog_batches = 0;
+uint8_t backlog_batch[NEST_CODEC_SIZE_MAX];
+// The link is up from an acknowledged uplink until a confirmed uplink is not acknowledged
+bool lora_link_up = false;
+uint32_t lora_tx_complete_time = 0;
+
+// Airtime of all uplinks but alarms, refilled continuously; the rest of the duty cycle is kept for alarms
+const uint32_t lora_routine_airtime_per_hour = 24000; // milliseconds, of 36 s at 1% duty cycle
+uint32_t lora_routine_airtime = lora_routine_airtime_per_hour;
+uint32_t lora_routine_airtime_time = 0;
+// Airtime of all transmissions of the last uplink, retransmissions included; charged once it is complete
+uint32_t lora_payload_airtime = 0;
+// Smallest payload worth sending
+const size_t lora_routine_size_min = 5;
+
+
+/**********
+ * Alarms
+ **********/
+
+// Safety relevant events, sent at once as confirmed uplink on alarm_port
+const uint8_t alarm_port = 2;
+const uint8_t alarm_smoke = 0x01;
+const uint8_t alarm_door_forced = 0x02;
+const uint8_t alarm_lock_blocked = 0x04;
+// Events raised and not acknowledged yet, and those of the alarm uplink
+uint8_t alarm_events = 0;
+uint8_t alarm_events_sent = 0;
+uint8_t alarm_id = 0;
+uint8_t alarm_payload[3];
+// Retries of an alarm without ACK, the first after alarm_backoff seconds, doubled with every retry
+size_t alarm_retries = 0;
+const size_t alarm_retries_max = 4;
+const unsigned alarm_backoff = 15;
+
+
+/************
+ * Downlink
+ ************/
+
+#include "DownlinkDispatcher.h"
+
+// Authenticated commands, see readme; the counter of the last accepted frame and the configuration are kept in NVS
+DownlinkDispatcher downlink;
+// Uplink interval in seconds, TX_INTERVAL unless set by downlink
+unsigned tx_interval = TX_INTERVAL;
+const unsigned tx_interval_min = 60;
+// Thresholds set by downlink, indexed by channel; downlink_threshold_unset for the one of the field
+int32_t downlink_thresholds[NEST_CODEC_CHANNELS];
+const int32_t downlink_threshold_unset = INT32_MIN;
 
 
 /************************
  * VeDirectFrameHandler
  ************************/
 
-#include <HardwareSerial.h>
-#include "VeDirectFrameHandler.h"
+#include "VeDirectDevice.h"
+#include "EnergyMeter.h"
+#include <freertos/queue.h>
+
+// MPPT solar charger on uart 2; always present
 #define VE_RX (4)
 #define VE_TX (2)
-VeDirectFrameHandler ve_handler;
-HardwareSerial ve_Serial(2);
-// could lead to some problems if activated
-bool ve_exec = false;
-uint64_t ve_time = 0;
-const uint16_t ve_interval = 1000; // milliseconds
-// compansate for missed intervalls. increment on non-recording intervalls. reset on recorded intervall and lora tx
-uint8_t ve_intervals_missed = 0;
-std::vector<int32_t> ve_load_energy { 0 };
-// VeDirect labels
-const char yield_today[]         = "H20",
-           max_power_today[]     = "H21",
-           yield_yesterday[]     = "H22",
-           max_power_yesterday[] = "H23";
-bool ve_no_serial_error = true;
+const ve_field ve_mppt_fields[]
+{
+  // label        parameter code                                       divisor hourly
+  { VeLabel::V,   (unsigned char)parameter_code::mppt_battery_volt,    1,      true },
+  { VeLabel::H20, (unsigned char)parameter_code::PV_yield,             1,      true }
+};
+
+// BMV or SmartShunt battery monitor; enabled by defining VE_SHUNT_RX and VE_SHUNT_TX in the env header
+#ifdef VE_SHUNT_RX
+#ifndef VE_SHUNT_UART
+#define VE_SHUNT_UART UART_NUM_1
+#endif
+const ve_field ve_shunt_fields[]
+{
+  { VeLabel::V,   (unsigned char)parameter_code::shunt_battery_volt,   1,      false },
+  { VeLabel::I,   (unsigned char)parameter_code::shunt_current,        10,     false },
+  { VeLabel::SOC, (unsigned char)parameter_code::shunt_soc,            1,      false }
+};
+#endif
+
+// Phoenix inverter; enabled by defining VE_INVERTER_RX and VE_INVERTER_TX in the env header
+#ifdef VE_INVERTER_RX
+#ifndef VE_INVERTER_UART
+#define VE_INVERTER_UART UART_NUM_1
+#endif
+const ve_field ve_inverter_fields[]
+{
+  { VeLabel::AC_OUT_V, (unsigned char)parameter_code::inverter_ac_volt,  1, false },
+  { VeLabel::AC_OUT_S, (unsigned char)parameter_code::inverter_ac_power, 1, false }
+};
+#endif
+
+// VeDirect devices, each on its own uart. The MPPT comes first; HEX polling and the load energy meter use it.
+VeDirectDevice ve_devices[]
+{
+  { "mppt", UART_NUM_2, VE_RX, VE_TX, ve_mppt_fields, sizeof ve_mppt_fields / sizeof ve_mppt_fields[0] },
+#ifdef VE_SHUNT_RX
+  { "shunt", VE_SHUNT_UART, VE_SHUNT_RX, VE_SHUNT_TX, ve_shunt_fields, sizeof ve_shunt_fields / sizeof ve_shunt_fields[0] },
+#endif
+#ifdef VE_INVERTER_RX
+  { "inverter", VE_INVERTER_UART, VE_INVERTER_RX, VE_INVERTER_TX, ve_inverter_fields, sizeof ve_inverter_fields / sizeof ve_inverter_fields[0] },
+#endif
+};
+#define VE_DEVICE_COUNT (sizeof ve_devices / sizeof ve_devices[0])
+VeDirectDevice& ve_mppt = ve_devices[0];
+// longest wait of ve_task for a record, to keep up with the watchdog and HEX polling
+const uint16_t ve_read_timeout = 1000; // milliseconds
+// time without a valid frame until a missing VeDirect connection is reported
+const uint16_t ve_frame_timeout = 5000; // milliseconds
+// set while a device has not sent a valid frame for ve_frame_timeout
+bool ve_frames_missing[VE_DEVICE_COUNT];
+// energy used by the load, one slot per hour
+EnergyMeter ve_load_energy;
+// registers read on demand over the VeDirect HEX protocol, once per interval
+uint64_t ve_hex_poll_time = 0;
+const uint32_t ve_hex_poll_interval = 3600000; // milliseconds
+// stack of ve_task in bytes; frame handler, callbacks and debug output with printf
+const uint32_t ve_task_stack_size = 4096;
+// least free stack of ve_task seen so far in bytes, reported in debug mode whenever it shrinks
+UBaseType_t ve_task_stack_free = UINT32_MAX;
 
 
 /*********
@@ -78,61 +209,89 @@ TaskHandle_t sleep_raspberry_task;
 
 /**
  * main.cpp implementation of BLE Ulmernest lock_action
+ * The resulting keyturner lock state is sent to the Raspberry Pi when Nuki SL is done.
  *
  * @param action Action command code for Nuki SL
+ * @param error Set to the lock state, or to -1 if the action failed; nullptr if not needed
  *
- * @return  Returns -1 if an error occured,
- *          otherwise return the resulting keyturner lock state returned from Nuki SL
+ * @return false if the lock action could not be started
  */
-int lock_action (unsigned char);
+bool lock_action (unsigned char, unsigned char* error = nullptr);
+
+// Completion of a lock action; a failed one is followed by reading the lock state
+void lock_action_done (const ble_result&, void*);
+
+// Completion of reading the keyturner states; sends the lock state to the Raspberry Pi
+void lock_state_done (const ble_result&, void*);
 
-// main.cpp implementation for getting data
-const unsigned char* _get_data (unsigned char);
+// main.cpp implementation for getting data; copies the value, returns false if there is none
+bool _get_data (unsigned char, unsigned char*);
 
 // main.cpp implementation for setting data
 void _set_data(unsigned char, unsigned char*);
 
+// set current data value measured at a given millis()
+void _set_data(unsigned char, unsigned char*, unsigned long);
+
 // check if data has been set to a value
 bool has_data (unsigned char);
 
 // get previous data value. Intended use is for comparison with current data value
-const unsigned char* _get_prev_data (unsigned char);
+bool _get_prev_data (unsigned char, unsigned char*);
 
 // set current data value as previous. Use before new value is assigned
 void _set_prev_data (unsigned char);
 
-/**
- * Use to compare prev data value with current data value.
- *
- * @param parameter_code  Byte code of specific data
- * @param min_difference  Minimum difference threshold for comparison.
- *                        Default Value is 0. Always return true if min_difference is set to less than 0.
- *
- * @return  Returns true if the current value is lesser or greater than the previous value by min_difference or more.
- *          Also returns true if min_difference is set to less than 0.
- *          Return false if the current value is NOT lesser or greater than the previous value by min_difference or more,
- *          or if neither the current nor the previous data hold any value.
- */
-bool different_from_prev (unsigned char parameter_code, int8_t min_difference);
+// Payload field of a parameter as given by its parameter descriptor
+payload_field payload_parameter_field (unsigned char parameter_code, uint8_t priority, uint32_t min_interval = 0);
+
+// Add the fields of the LoRa payload to the payload scheduler
+void payload_setup ();
 
-// Read the incomming VeDirect protocol and make the data available
-void read_ve_data ();
+// Make the data of a frame recieved from a VeDirect device available
+void read_ve_data (VeDirectDevice&, uint32_t);
 
-// Task running a loop of read_ve_data()
+// Task feeding the VeDirect devices with records as they arrive, on any of their uarts
 void ve_task (void*);
 
-// Get the number of locking actions done by Nuki SL in the last LoRa interval
-int check_lock_action_count ();
+// Open the uplink backlog and count this boot
+void backlog_setup ();
 
-/**
- * Helper function to convert Nuki SL datetime timestamp to seconds for simpler comparison.
- * Subtracts 2000 from the year for a more managable output value.
- *
- * @param datetime Nuki SL datetime bytes
- *
- * @return Seconds converted from datetime timestamp
- */
-uint32_t datetime_to_sec (uint8_t* datetime);
+// Write the timestamp of now to a buffer
+void backlog_timestamp (uint8_t*);
+
+// Store a snapshot of all current values in the uplink backlog
+bool backlog_store_snapshot ();
+
+// Keep the values held in RAM before a requested restart
+void backlog_shutdown ();
+
+// Check if the uplink is down, so values are kept in the backlog
+bool lora_link_down ();
+
+// Largest payload the airtime left for routine uplinks allows at the current data rate
+size_t lora_routine_max_payload ();
+
+// Raise alarms for safety relevant changes of a parameter, before the new value is stored
+void alarm_check (unsigned char, const unsigned char*);
+
+// Send an alarm event as soon as possible
+void alarm_raise (uint8_t);
+
+// Register the downlink commands and restore the configuration set by downlink
+void downlink_setup ();
+
+// Send VeDirect HEX commands to the MPPT
+void ve_write (const uint8_t*, size_t);
+
+// Make register values recieved over the VeDirect HEX protocol available
+void ve_register_response (uint16_t id, uint8_t flags, const uint8_t* value, uint8_t len);
+
+// Fetch the log entries of Nuki SL since the last sync; its lock actions are added to lock_counter when done
+void check_lock_action_count ();
+
+// Completion of the log sync
+void lock_count_sync_done (bool success, uint32_t first_new, void* context);
 
 // Turn off Raspberry Pi: Send Serial command, wait and invert SLEEP_RASPBERRY_PIN.
 void sleep_raspberry();
@@ -150,17 +309,30 @@ void wake_raspberry();
 
 SerialComm_Helper serial_comm(Serial);
 
-// uint8_t parameter_code, std::vector<uint8_t> data
-std::map<unsigned char, std::vector<unsigned char>> map_data;
-
-// uint8_t parameter_code, std::vector<uint8_t> data
-std::map<unsigned char, std::vector<unsigned char>> prev_sent_data;
+// Current and previously sent parameter values, indexed by parameter code
+ParameterStore data_store;
 
-unsigned char exec_state = 99, prev_exec_state = 99, err_code = 0;
+unsigned char exec_state = 99, err_code = 0;
 signed int door_counter = 0, lock_counter, motion_counter, light_switch_counter;
 
+// Log entries of Nuki SL, fetched by check_lock_action_count()
+Logbuch logbuch;
+
 // Data formating for LoRa
-CayenneLPP lpp(51);
+NestEncoder payload_encoder;
+PayloadScheduler payload;
+// Payload returned by lora_queue()
+uint8_t* lora_payload = nullptr;
+size_t lora_payload_len = 0;
+bool lora_payload_confirmed = false;
+uint8_t lora_payload_port = payload_port;
+// Number of values that did not fit into the payload, sent with a follow-up uplink
+size_t lora_payload_rolled_over = 0;
+// Time after which a value is sent again even if unchanged
+const uint32_t payload_max_age = 3600000; // milliseconds
+// Load energy of the last hour, until sent
+int64_t ve_load_energy_hourly = 0;
+bool ve_load_energy_pending = false;
 
 
 /*********
@@ -170,10 +342,13 @@ CayenneLPP lpp(51);
 void setup ()
 {
   // Start serial port
-  Serial.begin(115200);
+  // Enlarge the rx buffer, so incomming frames from Raspberry Pi survive long BLE operations in loop()
+  Serial.setRxBufferSize(SERIAL_RX_BUFFER_SIZE);
+  Serial.begin(SERIAL_BAUD);
   while (!Serial);
   if (!debug) Serial.setDebugOutput(0);
   if (debug) Serial.println("Serial begin");
+  serial_comm.negotiate_protocol();
 
   // Setup GPIOs
   pinMode(SLEEP_RASPBERRY_PIN, OUTPUT);
@@ -182,25 +357,33 @@ void setup ()
   wake_raspberry();
 
   // BLE Ulmernest initiation
-  BLEUlmernest::init("nest_esp32_99");
+  if (!BLEUlmernest::init("nest_esp32_99") && debug) Serial.println(" ! Nuki SL not connected yet, BLE retries in the background");
+  logbuch.init();
+
+  // Fields of the LoRa payload and the backlog of values from times without uplink
+  payload_setup();
+  backlog_setup();
+  downlink_setup();
 
   // LMIC init
   os_init();
   // Reset the MAC state. Session and pending data transfers will be discarded.
   LMIC_reset();
-  // Start job (sending automatically starts OTAA too)
+  // Continue the last session; without one sending automatically starts OTAA
+  lmic_is_joined = lora_session_restore();
+  // Start job
   do_send(&sendjob);
 
   // init watchdog timer and add setup+loop
   esp_task_wdt_init(WDT_TIMEOUT_SECONDS, true);
   esp_task_wdt_add(NULL);
 
-  // VeDirect Serial
-  ve_Serial.begin(19200, SERIAL_8N1, VE_RX, VE_TX);
-  while (!ve_Serial);
-  if (debug) Serial.println("ve_Serial begin");
+  // VeDirect uarts, waking ve_task on every complete record or HEX message
+  for (VeDirectDevice& device : ve_devices) device.begin();
+  ve_mppt.get_handler().setTxCallback(ve_write);
+  ve_mppt.get_handler().setRegisterCallback(ve_register_response);
 
-  xTaskCreatePinnedToCore(ve_task, "ve_task", 1024, (void*) 1, 1, &ve_task_handle, 0);
+  xTaskCreatePinnedToCore(ve_task, "ve_task", ve_task_stack_size, (void*) 1, 1, &ve_task_handle, 0);
 }
 
 
@@ -209,10 +392,21 @@ void setup ()
  ********/
 
 void loop() {
-  if (ve_exec) read_ve_data();
   serial_comm.loop();
   os_runloop_once();
 
+  // Callbacks of finished BLE transactions with Nuki SL
+  BLEUlmernest::loop();
+
+  // Keep the values in the backlog while the uplink is down: once it goes down, then every interval
+  bool link_down = lora_link_down();
+  if (link_down && (!backlog_link_down || millis() - backlog_timer > tx_interval * 1000))
+  {
+    backlog_timer = millis();
+    backlog_store_snapshot();
+  }
+  backlog_link_down = link_down;
+
   esp_task_wdt_reset();
 }
 
@@ -224,61 +418,80 @@ void loop() {
 /**
  * main.cpp implementation of BLE Ulmernest lock_action
  */
-int lock_action (unsigned char action)
+bool lock_action (unsigned char action, unsigned char* error)
 {
-  int status = -1;
+  bool queued = false;
 
   if (1) // impl check door state
   {
-    status = BLEUlmernest::lock_action(action);
+    queued = BLEUlmernest::request_lock_action(action, lock_action_done, error);
   }
   else // door not closed so retract bolt > unlock
   {
     if (debug) Serial.println(" ! door sensor: door not closed or unknown state");
     if (BLEUlmernest::get_keytuerner_states().lock_state == (unsigned char)lock_states::locked)
     {
-      status = BLEUlmernest::lock_action((unsigned char)enum_lock_action::unlock);
+      queued = BLEUlmernest::request_lock_action((unsigned char)enum_lock_action::unlock, lock_action_done, error);
     }
   }
 
-  if (status == -1)
+  if (!queued)
+  {
+    if (debug) Serial.println(" ! lock_action: could not be started");
+    if (error != nullptr) *error = (unsigned char)-1;
+  }
+  return queued;
+}
+
+/**
+ * Completion of a lock action
+ */
+void lock_action_done (const ble_result& result, void* context)
+{
+  unsigned char* error = (unsigned char*)context;
+
+  if (!result.success)
   {
     if (debug) Serial.println(" ! lock_action: something went wrong");
-    BLEUlmernest::read_keyturner_state();
-    serial_comm.update_lock(BLEUlmernest::get_keytuerner_states().lock_state);
+    if (error != nullptr) *error = (unsigned char)-1;
+    BLEUlmernest::request_keyturner_state(lock_state_done, nullptr);
+    return;
   }
-  else
+
+  if (debug)
   {
-    if (debug)
-    {
-      Serial.print(" - lock_action: final status ");
-      Serial.println(status);
-    }
-    serial_comm.update_lock(status);
+    Serial.print(" - lock_action: final status ");
+    Serial.println(result.status);
   }
-  return status;
+  if (error != nullptr && result.status != 0) *error = result.status;
+  serial_comm.update_lock(result.status);
+}
+
+/**
+ * Completion of reading the keyturner states
+ */
+void lock_state_done (const ble_result& result, void* context)
+{
+  if (result.success) serial_comm.update_lock(result.keyturner_states.lock_state);
 }
 
 /**
  * main.cpp implementation for getting data
  */
-const unsigned char* _get_data (unsigned char parameter_code)
+bool _get_data (unsigned char parameter_code, unsigned char* data)
 {
-  // Check if key of parameter_code has been assigned a value
-  if (map_data.count(parameter_code) != 0)
+  // Check if parameter_code has been assigned a value
+  if (!data_store.get(parameter_code, data))
   {
-    return map_data[parameter_code].data();
-  }
-  else
-  {
-     if (debug)
+    if (debug)
     {
       Serial.print(" ! parameter code ");
       Serial.print(parameter_code, 16);
-      Serial.println(": not part of map_data");
+      Serial.println(": no data");
     }
-    return nullptr;
+    return false;
   }
+  return true;
 }
 
 /**
@@ -286,34 +499,39 @@ const unsigned char* _get_data (unsigned char parameter_code)
  */
 void _set_data (unsigned char _parameter_code, unsigned char* data)
 {
-  std::vector<unsigned char> v;
-  for (size_t i = 0; i < parameter_size.find(_parameter_code)->second; i++) v.push_back(data[i]);
+  _set_data(_parameter_code, data, millis());
+}
+
+void _set_data (unsigned char _parameter_code, unsigned char* data, unsigned long timestamp)
+{
+  bool new_entry = !data_store.has_value(_parameter_code);
+  alarm_check(_parameter_code, data);
+  if (!data_store.set(_parameter_code, data, timestamp))
+  {
+    if (debug) Serial.printf(" ! _set_data(): unknown parameter code 0x%x\n", _parameter_code);
+    return;
+  }
 
-  // Check if parameter already has been assigned a value
-  // if not create a new key-value-pair
-  // otherwise replace the existing value
-  if (map_data.count(_parameter_code) == 0)
+  if (new_entry)
   {
-    map_data.insert(std::make_pair(_parameter_code, v));
     if (debug)
     {
       // Serial.printf(" - 0x%x new data entry ", _parameter_code);
       Serial.print(" - 0x");
       Serial.print(_parameter_code, HEX);
       Serial.print(" new data entry ");
-      print_hex(_get_data(_parameter_code), parameter_size.find(_parameter_code)->second);
+      print_hex(data, get_parameter_size(_parameter_code));
     }
   }
   else
   {
-    map_data[_parameter_code] = v;
     if (debug >= 2)
     {
       // Serial.printf(" - 0x%x update data entry ", _parameter_code);
       Serial.print(" - 0x");
       Serial.print(_parameter_code, HEX);
       Serial.print(" update data entry ");
-      print_hex(_get_data(_parameter_code), parameter_size.find(_parameter_code)->second);
+      print_hex(data, get_parameter_size(_parameter_code));
     }
   }
 
@@ -342,29 +560,26 @@ void _set_data (unsigned char _parameter_code, unsigned char* data)
  */
 bool has_data (unsigned char parameter_code)
 {
-  return map_data.count(parameter_code) != 0;
+  return data_store.has_value(parameter_code);
 }
 
 /**
  * get previous data value. Intended use is for comparison with current data value
  */
-const unsigned char* _get_prev_data (unsigned char parameter_code)
+bool _get_prev_data (unsigned char parameter_code, unsigned char* data)
 {
-  // Check if key of parameter_code has been assigned a value
-  if (prev_sent_data.count(parameter_code) != 0)
-  {
-    return prev_sent_data[parameter_code].data();
-  }
-  else
+  // Check if a value of parameter_code has been sent
+  if (!data_store.get_sent(parameter_code, data))
   {
-     if (debug)
+    if (debug)
     {
       Serial.print(" ! parameter code ");
       Serial.print(parameter_code, 16);
-      Serial.println(": not part of prev_sent_data");
+      Serial.println(": no previous data");
     }
-    return nullptr;
+    return false;
   }
+  return true;
 }
 
 /**
@@ -372,345 +587,398 @@ const unsigned char* _get_prev_data (unsigned char parameter_code)
  */
 void _set_prev_data (unsigned char _parameter_code)
 {
-  std::vector<unsigned char> v;
-  const unsigned char* data = _get_data(_parameter_code);
-  for (size_t i = 0; i < parameter_size.find(_parameter_code)->second; i++) v.push_back(data[i]);
+  if (!data_store.has_value(_parameter_code)) return;
 
-  if (prev_sent_data.count(_parameter_code) == 0)
+  if (!data_store.has_sent_value(_parameter_code))
   {
     if (debug) Serial.printf(" - 0x%x new prev data entry ", _parameter_code);
-    prev_sent_data.insert(std::make_pair(_parameter_code, v));
-    print_hex(_get_data(_parameter_code), parameter_size.find(_parameter_code)->second);
   }
   else
   {
     if (debug >= 2) Serial.printf(" - 0x%x update prev data entry ", _parameter_code);
-    prev_sent_data[_parameter_code] = v;
-    print_hex(_get_data(_parameter_code), parameter_size.find(_parameter_code)->second);
   }
+  data_store.mark_sent(_parameter_code);
+  unsigned char data[PARAMETER_SIZE_MAX];
+  if (debug && _get_prev_data(_parameter_code, data)) print_hex(data, get_parameter_size(_parameter_code));
 }
 
 /**
- * Use to compare prev data value with current data value.
+ * Read a parameter from the data store for the payload scheduler
  */
-bool different_from_prev (unsigned char parameter_code, int8_t min_difference = 0)
+bool payload_read_parameter (const payload_field& field, int32_t& value)
 {
-  // Check if key of parameter_code for current data has been assigned a value
-  if (map_data.count(parameter_code) == 0)
-  {
-    if (debug) Serial.println(" - different_from_prev: no current data; return false");
-    return false;
-  }
-  // Check if key of parameter_code for previous data has been assigned a value
-  if (prev_sent_data.count(parameter_code) == 0)
-  {
-    if (debug) Serial.println(" - different_from_prev: has current data, but no previous; return true");
-    return true;
-  }
-
-  int16_t p = prev_sent_data[parameter_code][0] << 8 | prev_sent_data[parameter_code][1];
-  int16_t d = map_data[parameter_code][0] << 8 | map_data[parameter_code][1];
-  if (debug)
-  {
-    Serial.printf(" - previous data: %d; current data: %d; min. difference: %d\n", p, d, min_difference);
-  }
+  unsigned char data[PARAMETER_SIZE_MAX];
+  if (!_get_data(field.parameter_code, data)) return false;
+  value = parameter_value(field.parameter_code, data);
+  return true;
+}
 
-  // Compare current and previous
-  if (d < p - min_difference)
-  {
-    if (debug) Serial.printf(" - current data %d is smaller than previous data %d by more than %d\n", d, p, min_difference);
-    return true;
-  }
-  else if (d > p + min_difference)
-  {
-    if (debug) Serial.printf(" - current data %d is greater than previous data %d by more than %d\n", d, p, min_difference);
-    return true;
-  }
-  // Return true if min_difference < 0
-  else if (min_difference < 0)
-  {
-    if (debug) Serial.println(" - minimum difference has a negativ value; current value always be sent");
-    return true;
-  }
-  else return false;
+/**
+ * Remember a parameter as sent
+ */
+void payload_sent_parameter (const payload_field& field, int32_t value)
+{
+  _set_prev_data(field.parameter_code);
 }
 
 /**
- * Read the incomming VeDirect protocol and make the data available
+ * Payload field of a parameter with the channel and threshold of its parameter descriptor
+ * @param parameter_code Parameter code
+ * @param priority Priority of the field
+ * @param min_interval Time in ms to send the value at most once; the value is sent every time then
  */
-void read_ve_data ()
+payload_field payload_parameter_field (unsigned char parameter_code, uint8_t priority, uint32_t min_interval)
 {
-  // Initially clear serial rx queue to prevent buffer overflow error in VeDirectFrameHandler
-  if (ve_time == 0) ve_Serial.flush();
+  const parameter_descriptor& p = get_parameter(parameter_code);
+  payload_field f = {};
+  f.channel = p.channel;
+  f.priority = priority;
+  f.threshold = min_interval > 0 ? -1 : p.threshold;
+  f.max_age = p.threshold < 0 || min_interval > 0 ? 0 : payload_max_age;
+  f.min_interval = min_interval;
+  f.read = payload_read_parameter;
+  f.sent = payload_sent_parameter;
+  f.parameter_code = parameter_code;
+  return f;
+}
 
-  // Check for 1 second interval and if lmic library has joined the LoRa network
-  if (millis() - ve_time >= ve_interval && lmic_is_joined)
-  {
-    ve_time = millis();
+/**
+ * 0 - Fehler
+ *
+ * Reset Reason
+ * After connection to LoRa send the reset reason for both cores.
+ * Since there are 16 possible reset reasons both can be containted in a single Byte.
+ * The values for the reset reasons range from 1 to 16, so to accomedate them as
+ * a single digit hex value the value has to have one subtracted.
+ * This has to be accounted for on the recieving end!
+ */
+bool payload_read_reset_reason (const payload_field& field, int32_t& value)
+{
+  if (!lmic_is_joined || sent_last_reset_reason) return false;
+  uint8_t core_0 = rtc_get_reset_reason(0);
+  uint8_t core_1 = rtc_get_reset_reason(1);
+  value = 0x00 | (core_0 -1) | ((core_1 -1) << 4);
+  return true;
+}
 
-    // Check for new serial data
-    if (!ve_Serial.available() )
-    {
-      // Prevent debug spam
-      if (ve_no_serial_error)
-      {
-        ve_no_serial_error = false;
-        if (debug)
-        {
-          Serial.println(" ! no VeDirect serial message for this intervall");
-        }
-      }
+void payload_sent_reset_reason (const payload_field& field, int32_t value)
+{
+  sent_last_reset_reason = true;
+}
 
-      // account for missed frames
-      ve_intervals_missed++;
-      return;
-    }
-    else
-    {
-      // reset no serial error flag
-      ve_no_serial_error = true;
-    }
+/**
+ * 1 - execution state
+ * 8 Bit: state code; sent on change
+ */
+bool payload_read_exec_state (const payload_field& field, int32_t& value)
+{
+  if (exec_state == 99) return false;
+  value = exec_state;
+  return true;
+}
 
-    // read serial buffer and apply VeDirectFrameHanlder
-    while (ve_Serial.available())
-    {
-      ve_handler.rxData(ve_Serial.read());
-    }
-    if (debug >= 2)
-    {
-      Serial.print("\n + VeDirect read data: ");
-      for (size_t i = 0; i < ve_handler.veEnd; i++)
-      {
-        Serial.print(ve_handler.veName[i]);
-        Serial.print(" ");
-      }
-      Serial.println();
-    }
+/**
+ * 9 - Door counter
+ * MSB last known state | 7B count of state changes since last sent
+ */
+bool payload_read_door_counter (const payload_field& field, int32_t& value)
+{
+  if (door_counter == 0) return false;
+  uint8_t bits = door_counter > 0b01111111 ? 0b01111111 : door_counter;
+  uint8_t door_state = 0;
+  data_store.get((unsigned char)parameter_code::door, &door_state);
+  value = door_state > 0 ? 0b10000000 | bits : bits;
+  return true;
+}
 
-    // Get the recieved data from the frame handler
-    int16_t mV = 0, mA = 0;
-    for (size_t i = 0; i < ve_handler.veEnd; i++)
-    {
-      if (String(ve_handler.veName[i]).compareTo("V") == 0)
-      {
-        mV = std::strtoul(ve_handler.veValue[i], NULL, 10);
-        uint8_t data[2] = { (mV >> 8), mV };
-        _set_data((unsigned char)parameter_code::mppt_battery_volt, data);
-        // if (debug)
-        // {
-        //   Serial.print("   mV: ");
-        //   Serial.println(mV);
-        // }
-      }
-      else if (String(ve_handler.veName[i]).compareTo("IL") == 0)
-      {
-        mA = std::strtoul(ve_handler.veValue[i], NULL, 10);
-        // if (debug)
-        // {
-        //   Serial.print("   load mA: ");
-        //   Serial.println(mA);
-        // }
-      }
-      else if (String(ve_handler.veName[i]).compareTo(String(yield_today)) == 0)
-      {
-        uint16_t ve_value = std::strtoul(ve_handler.veValue[i], NULL, 10);
-        uint8_t data[2] = { (ve_value >> 8), ve_value };
-        _set_data((unsigned char)parameter_code::PV_yield, data);
-        // if (debug)
-        // {
-        //   Serial.print("   yield today: ");
-        //   Serial.println(mA);
-        // }
-      }
-      else if (String(ve_handler.veName[i]).compareTo(String(max_power_today)) == 0)
-      {}
-      else if (String(ve_handler.veName[i]).compareTo(String(yield_yesterday)) == 0)
-      {}
-      else if (String(ve_handler.veName[i]).compareTo(String(max_power_yesterday)) == 0)
-      {}
-    }
+void payload_sent_door_counter (const payload_field& field, int32_t value)
+{
+  door_counter = 0;
+}
 
-    ve_load_energy[ve_load_energy.size() - 1] += (mV * mA / 1000) * (1 + ve_intervals_missed);
-    ve_intervals_missed = 0;
+/**
+ * 10 - Lock counter
+ * MSB last known state | 7B count of lock actions since last sent
+ */
+bool payload_read_lock_counter (const payload_field& field, int32_t& value)
+{
+  if (lock_counter <= 0) return false;
+  uint8_t bits = lock_counter > 0b01111111 ? 0b01111111 : (uint8_t)lock_counter;
 
-    // if (debug)
-    // {
-    //   Serial.print("   ");
-    //   Serial.print(ve_load_energy[ve_load_energy.size() - 1]);
-    //   Serial.println(" mJ since last TX_INTERVAL");
-    // }
-  }
-  else
+  // last known state; reading it from Nuki SL would hold up the uplink
+  uint8_t lock_state = 0;
+  if (!data_store.get((unsigned char)parameter_code::lock, &lock_state))
   {
-    // ve_Serial.flush();
+    lock_state = BLEUlmernest::get_keytuerner_states().lock_state;
   }
+  value = lock_state == (uint8_t)lock_states::unlocked ? 0b10000000 | bits : bits;
+  return true;
+}
+
+void payload_sent_lock_counter (const payload_field& field, int32_t value)
+{
+  lock_counter = 0;
 }
 
 /**
- * Task running a loop of read_ve_data()
+ * 11 - Motion Counter
+ * 8 bit: state changes since last sent
  */
-void ve_task (void* param)
+bool payload_read_motion_counter (const payload_field& field, int32_t& value)
 {
-  // register watchdog timer
-  esp_task_wdt_add(NULL);
-  for (;;)
+  value = motion_counter > 0xFF ? 0xFF : motion_counter;
+  return motion_counter > 0;
+}
+
+void payload_sent_motion_counter (const payload_field& field, int32_t value)
+{
+  motion_counter = 0;
+}
+
+/**
+ * 12 - Light Switch Counter
+ * 8 bit: state changes since last sent
+ */
+bool payload_read_light_switch_counter (const payload_field& field, int32_t& value)
+{
+  value = light_switch_counter > 0xFF ? 0xFF : light_switch_counter;
+  return light_switch_counter > 0;
+}
+
+void payload_sent_light_switch_counter (const payload_field& field, int32_t value)
+{
+  light_switch_counter = 0;
+}
+
+/**
+ * 14 - Load Energy, hourly
+ * 16 Bit: singed floating number; 0.01 Wh
+ */
+bool payload_read_load_energy (const payload_field& field, int32_t& value)
+{
+  if (!ve_load_energy_pending) return false;
+  // µJ -> 0.01 Wh: / 3600 s / 10^6 * 100
+  int64_t centi_watt_hours = ve_load_energy_hourly / 36000000;
+  if (centi_watt_hours > INT16_MAX) centi_watt_hours = INT16_MAX;
+  if (centi_watt_hours < INT16_MIN) centi_watt_hours = INT16_MIN;
+  value = (int32_t)centi_watt_hours;
+  return true;
+}
+
+void payload_sent_load_energy (const payload_field& field, int32_t value)
+{
+  ve_load_energy_pending = false;
+}
+
+/**
+ * Add the fields of the LoRa payload to the payload scheduler
+ */
+void payload_setup ()
+{
+  // Fields without a parameter
+  const payload_field fields[]
   {
-    read_ve_data();
-    esp_task_wdt_reset();
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    // channel priority threshold max age min interval read                               sent
+    { 0,  7,       -1,       0,      0,           payload_read_reset_reason,         payload_sent_reset_reason },
+    { 1,  6,       0,        0,      0,           payload_read_exec_state,           nullptr },
+    { 9,  4,       -1,       0,      0,           payload_read_door_counter,         payload_sent_door_counter },
+    { 10, 4,       -1,       0,      0,           payload_read_lock_counter,         payload_sent_lock_counter },
+    { 11, 3,       -1,       0,      0,           payload_read_motion_counter,       payload_sent_motion_counter },
+    { 12, 3,       -1,       0,      0,           payload_read_light_switch_counter, payload_sent_light_switch_counter },
+    { 14, 1,       -1,       0,      0,           payload_read_load_energy,          payload_sent_load_energy }
+  };
+  for (const payload_field& f : fields) payload.add(f);
+
+  // Fields of parameters, with channel and threshold of the parameter descriptor
+  payload.add(payload_parameter_field((unsigned char)parameter_code::smoke_detector, 7));
+  payload.add(payload_parameter_field((unsigned char)parameter_code::door, 5));
+  payload.add(payload_parameter_field((unsigned char)parameter_code::lock, 5));
+  payload.add(payload_parameter_field((unsigned char)parameter_code::battery_volt, 3));
+  payload.add(payload_parameter_field((unsigned char)parameter_code::temp_outside, 2));
+  payload.add(payload_parameter_field((unsigned char)parameter_code::temp_inside, 2));
+  payload.add(payload_parameter_field((unsigned char)parameter_code::humidity_inside, 2));
+
+  // 13 - MPPT Battery Voltage, 15 - PV yield, 16.. - further VeDirect devices; as given by their fields
+  for (VeDirectDevice& device : ve_devices)
+  {
+    const ve_field* fields = device.get_fields();
+    for (size_t i = 0; i < device.get_field_count(); i++)
+    {
+      payload.add(payload_parameter_field(fields[i].parameter_code, 1, fields[i].hourly ? hourly_interval : 0));
+    }
   }
 }
 
 /**
- * Get the number of locking actions done by Nuki SL in the last LoRa interval
+ * Make the data of a frame recieved from a VeDirect device available.
+ * Called by ve_task for every checksum-valid frame; the values are stored as given by the fields of the device.
+ *
+ * @param device Device that sent the frame
+ * @param frame_time millis() at which the frame was completed
  */
-int check_lock_action_count ()
+void read_ve_data (VeDirectDevice& device, uint32_t frame_time)
 {
-  std::vector<std::vector<uint8_t>> logs;
-  // within time to last lora transmission
-  bool in_time_frame = true;
-  int lock_action_count = 0;
+  VeDirectFrameHandler& handler = device.get_handler();
+  const ve_field* fields = device.get_fields();
 
-  // read keyturner state to get the current timestamp from Nuki SL
-  if (BLEUlmernest::read_keyturner_state() != 0)
+  for (size_t i = 0; i < device.get_field_count(); i++)
   {
-    if (debug) {
-      Serial.println(" ! could not read keyturner state");
-      return 0;
+    int32_t value;
+    if (!handler.getValue(fields[i].label, value)) continue;
+
+    uint8_t data[PARAMETER_SIZE_MAX];
+    parameter_bytes(fields[i].parameter_code, value / fields[i].divisor, data);
+    _set_data(fields[i].parameter_code, data, frame_time);
+
+    if (debug >= 2)
+    {
+      Serial.printf(" + VeDirect %s: 0x%x = %d\n", device.get_name(), fields[i].parameter_code, value);
     }
   }
-  unsigned char* datetime = BLEUlmernest::get_keytuerner_states().current_time;
-  unsigned char log_datetime[7] = {0};
-  // calculate current secs from current datetime
-  uint32_t current_secs = datetime_to_sec(datetime);
-  uint32_t log_secs;
 
-  if (debug)
+  // integrated over the time since the previous frame
+  int32_t mV = 0, mA = 0;
+  if (&device == &ve_mppt && handler.getValue(VeLabel::V, mV) && mV > 0 && handler.getValue(VeLabel::IL, mA))
   {
-    Serial.print(" - datetime ");
-    print_hex(datetime, 7);
-    Serial.print(" - currently ");
-    Serial.print(current_secs);
-    Serial.println(" secs");
+    ve_load_energy.add_sample(mV, mA, frame_time);
   }
+}
 
-  uint16_t start_index = 0, count = 5, logs_available = 0;
-  while (in_time_frame)
+/**
+ * Task feeding the VeDirect devices with records as they arrive.
+ * A queue set over the uart event queues wakes the task for a record on any of the uarts.
+ * Every complete frame is processed by read_ve_data() right away, whether or not LoRa has joined.
+ */
+void ve_task (void* param)
+{
+  QueueSetHandle_t queue_set = xQueueCreateSet(VE_DEVICE_COUNT * UART_EVENTS_QUEUE_LENGTH);
+  for (VeDirectDevice& device : ve_devices)
   {
-    if (debug)
+    QueueHandle_t queue = device.get_event_queue();
+    if (queue == nullptr) continue;
+    // A queue can only be added to a set while it is empty; drop events of records already underway
+    do
     {
-      Serial.print(" # request log entries at start index ");
-      Serial.print(start_index);
-      Serial.print(" and count ");
-      Serial.println(count);
-    }
-    // get log entries from Nuki SL
-    logs = BLEUlmernest::req_log_entries(start_index, count, logs_available);
+      xQueueReset(queue);
+    } while (xQueueAddToSet(queue, queue_set) != pdPASS);
+  }
 
-    if (logs.size() == 0)
-    {
-      if (debug)
-      {
-        Serial.println(" ! no logs");
-      }
-      in_time_frame = false;
-      // return 0;
-    }
+  // register watchdog timer
+  esp_task_wdt_add(NULL);
+  for (;;)
+  {
+    // Sleep until a complete record arrived, at most the read timeout to keep up with HEX polling and the watchdog
+    QueueSetMemberHandle_t queue = xQueueSelectFromSet(queue_set, ve_read_timeout / portTICK_PERIOD_MS);
 
-    for (std::vector<std::vector<uint8_t>>::size_type i = 0; i < logs.size(); i++)
+    for (size_t i = 0; i < VE_DEVICE_COUNT; i++)
     {
-      // get the log timestamp
-      for (size_t j = 0; j < 7; j++) log_datetime[j] = logs[i].data()[j + 10];
-      if (debug)
+      VeDirectDevice& device = ve_devices[i];
+      VeDirectFrameHandler& handler = device.get_handler();
+
+      if (queue != nullptr && queue == device.get_event_queue() && device.poll(0))
       {
-        Serial.print(" - log datetime ");
-        print_hex(log_datetime, 7);
+        read_ve_data(device, handler.getFrameTime());
       }
 
-      // calculate secs for a log from the datetime of the log
-      log_secs = datetime_to_sec(log_datetime);
-
-      if (debug)
+      // Report a missing VeDirect connection once, and its return
+      bool frame_missing = millis() - handler.getFrameTime() >= ve_frame_timeout;
+      if (frame_missing && !ve_frames_missing[i])
       {
-        Serial.print(" - log ");
-        Serial.print((uint32_t)0x00000000 | logs[i].data()[6] | logs[i].data()[7] << 8 | logs[i].data()[8] << 16 | logs[i].data()[9] << 24);
-        Serial.print(" with ");
-        Serial.print(log_secs);
-        Serial.print(" secs of type ");
-        Serial.println(logs[i].data()[53]);
-
-        Serial.printf(" - difference %d - %d = %d\n", current_secs, log_secs, current_secs - log_secs);
+        if (debug)
+        {
+          Serial.printf(" ! VeDirect %s: no frame for %d ms; %u frames, %u checksum errors\n",
+            device.get_name(), ve_frame_timeout, handler.getFrameCount(), handler.getFrameErrorCount());
+        }
       }
-
-      if (current_secs - log_secs <= TX_INTERVAL && current_secs - log_secs > 0)
+      else if (!frame_missing && ve_frames_missing[i])
       {
-        // check if the log entry is a lock action, then increment lock_action_counter
-        if (logs[i].data()[53] == 0x02) lock_action_count++;
+        if (debug) Serial.printf(" - VeDirect %s: frames recieved again\n", device.get_name());
       }
-      else
+      ve_frames_missing[i] = frame_missing;
+    }
+
+    // Read registers on demand instead of waiting for the text protocol; the first poll is one interval after boot
+    if (millis() - ve_hex_poll_time >= ve_hex_poll_interval)
+    {
+      ve_hex_poll_time = millis();
+      ve_mppt.get_handler().getRegister(veRegYieldToday);
+    }
+
+    if (debug)
+    {
+      UBaseType_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+      if (stack_free < ve_task_stack_free)
       {
-        // break out of while loop and for loop
-        in_time_frame = false;
-        i = logs.size();
+        ve_task_stack_free = stack_free;
+        Serial.printf(" - ve_task: %u of %u bytes stack left\n", (unsigned)stack_free, (unsigned)ve_task_stack_size);
       }
     }
-    // setup for next loop
-    // clear logs
-    logs.clear();
-    // set the log that will be the starting point for the next iteration
-    if (start_index == 0) start_index = logs_available - count;
-    else start_index -= count;
-    delay(2);
-    // esp_task_wdt_reset();
-  }
-  if (debug)
-  {
-    Serial.print(" - lock action count: ");
-    Serial.println(lock_action_count);
+
+    esp_task_wdt_reset();
   }
-  return lock_action_count;
 }
 
 /**
- * Helper function to convert Nuki SL datetime timestamp to seconds for simpler comparison
+ * Send VeDirect HEX commands to the MPPT
  */
-uint32_t datetime_to_sec (uint8_t* datetime)
+void ve_write (const uint8_t* data, size_t len)
 {
-  uint32_t secs = 0;
-  uint16_t year = datetime[0] | datetime[1] << 8;
-  uint8_t month = datetime[2], day = datetime[3], hour = datetime[4], min = datetime[5], sec = datetime[6];
+  ve_mppt.write(data, len);
+}
 
-  // Get secs from seconds, minutes, hours, and days of the month
-  // Subtracts one form day of the month, since it's accounted for by seconds, minutes and hours.
-  secs = sec + min * 60 + hour * 3600 + (day - 1) * 86400;
-  if (month > 1)
+/**
+ * Make register values recieved over the VeDirect HEX protocol available
+ * @param id Register id
+ * @param flags Response flags; 0 if the value is valid
+ * @param value Register value, little endian
+ * @param len Number of bytes of the value
+ */
+void ve_register_response (uint16_t id, uint8_t flags, const uint8_t* value, uint8_t len)
+{
+  if (flags != 0)
   {
-    // 31-day months: Every one in two months until the 8th month, where an additional 31 day month is introduced
-    secs += month / 2 * 2678400;
-    if (month > 8) secs +=  2678400;
+    if (debug) Serial.printf(" ! VeDirect register 0x%04x: flags 0x%02x\n", id, flags);
+    return;
+  }
+
+  uint32_t v = VeDirectFrameHandler::registerValue(value, len);
+  if (debug >= 2) Serial.printf(" + VeDirect register 0x%04x: %u\n", id, v);
 
-    // febuary 28 or 29 days
-    if (month > 2)
+  switch (id)
+  {
+    // 0.01 kWh, as H20 of the text protocol
+    case veRegYieldToday:
     {
-      secs += 2419200;
-      // every 4 years, except every turn of a century if it is not dividable by 400
-      if (year % 4 == 0 && !(year % 100 == 0) && year % 400 == 0) secs += 86400;
+      uint8_t data[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+      _set_data((unsigned char)parameter_code::PV_yield, data);
+      break;
     }
 
-    // 30-day months
-    // every other month before 8th, exclude current month, subtract one to account for february
-    if (month < 8) secs += ( ( (month - 1) / 2 ) - 1 ) * 2592000;
-    // all 30-day months before the 8th month
-    else secs += 5184000;
-    if (month > 9) secs += 2592000;
-    if (month > 11) secs += 2592000;
+    default:
+      break;
   }
-  // subtracting 2000 years to get a simpler seconds value to work with
-  secs += (year - 2000) * 31536000;
-  // account for leap years
-  secs += (year - 2001) / 4 * 86400;
+}
 
-  return secs;
+/**
+ * Fetch the log entries of Nuki SL since the last sync
+ */
+void check_lock_action_count ()
+{
+  if (!logbuch.sync(lock_count_sync_done, nullptr) && debug) Serial.println(" ! log sync not started");
+}
+
+/**
+ * Completion of the log sync: count the new lock actions, kept until sent
+ */
+void lock_count_sync_done (bool success, uint32_t first_new, void* context)
+{
+  size_t count = logbuch.count(log_types::lock_action, first_new);
+  lock_counter += count;
+  if (debug)
+  {
+    Serial.print(" - lock action count: ");
+    Serial.println(count);
+  }
 }
 
 
@@ -729,9 +997,9 @@ void SerialComm_Helper::set_data (unsigned char parameter_code, unsigned char* d
 /**
  * Implemente getting data for SerialComm_Helper
  */
-const unsigned char* SerialComm_Helper::get_data (unsigned char parameter_code)
+bool SerialComm_Helper::get_data (unsigned char parameter_code, unsigned char* data)
 {
-  return _get_data(parameter_code);
+  return _get_data(parameter_code, data);
 }
 
 /**
@@ -756,9 +1024,8 @@ const unsigned char SerialComm_Helper::get_state ()
  */
 void SerialComm_Helper::update_lock ()
 {
-  BLEUlmernest::read_keyturner_state();
-  unsigned char lock_state = BLEUlmernest::get_keytuerner_states().lock_state;
-  _set_data((unsigned char)parameter_code::lock, &lock_state);
+  // answered with the last known state; a changed state follows as update when Nuki SL has answered
+  BLEUlmernest::request_keyturner_state(lock_state_done, nullptr);
 }
 
 /**
@@ -766,8 +1033,7 @@ void SerialComm_Helper::update_lock ()
  */
 void SerialComm_Helper::unlock_on_serial_cmd ()
 {
-  int status = lock_action((unsigned char)enum_lock_action::unlock);
-  if (status != 0) err_code = status;
+  lock_action((unsigned char)enum_lock_action::unlock, &err_code);
 }
 
 /**
@@ -775,48 +1041,314 @@ void SerialComm_Helper::unlock_on_serial_cmd ()
  */
 void SerialComm_Helper::lock_on_serial_cmd ()
 {
-  int status = lock_action((unsigned char)enum_lock_action::lock);
-  if (status != 0) err_code = status;
+  lock_action((unsigned char)enum_lock_action::lock, &err_code);
 }
 
 /**
- * Implemente toggling VeDirectFrameHandler execution flag for SerialComm_Helper
+ * Implemente restart for SerialComm_Helper
  */
-void SerialComm_Helper::ve_exec_toggle_serial_cmd (uint8_t data)
+void SerialComm_Helper::restart_on_serial_cmd ()
 {
-  if (data > 0)
-  {
-    ve_exec = true;
-    if (debug)
-    {
-      Serial.println(" # ve_exec_toggle_serial_cmd: VeDirect handler is now enabled");
-    }
-  }
-  else if (data == 0)
+  backlog_shutdown();
+  esp_restart();
+}
+
+/**
+ * Implemente wiping non-volatile storage for SerialComm_Helper
+ */
+void SerialComm_Helper::wipe_storage_on_serial_cmd ()
+{
+  BLEUlmernest::get_Bund()->wipe_storage();
+}
+
+
+/*******************************************
+ * Implementation uplink backlog functions
+ *******************************************/
+
+/**
+ * Open the uplink backlog and count this boot, so snapshots of different boots can be told apart
+ */
+void backlog_setup ()
+{
+  Preferences preferences;
+  preferences.begin("backlog", false);
+  backlog_boot = preferences.getUChar("boot", 0) + 1;
+  preferences.putUChar("boot", backlog_boot);
+  preferences.end();
+
+  backlog.begin();
+}
+
+/**
+ * Timestamp of now
+ * 1 Byte boot counter | 3 Bytes uptime in seconds, MSB first
+ */
+void backlog_timestamp (uint8_t* buffer)
+{
+  uint32_t uptime = esp_timer_get_time() / 1000000;
+  buffer[0] = backlog_boot;
+  buffer[1] = uptime >> 16;
+  buffer[2] = uptime >> 8;
+  buffer[3] = uptime;
+}
+
+/**
+ * Store a timestamped keyframe of all current values in the uplink backlog.
+ * Nothing is marked as sent, counters keep counting until the next payload.
+ */
+bool backlog_store_snapshot ()
+{
+  uint8_t record[backlog_timestamp_size + backlog_snapshot_size];
+  backlog_timestamp(record);
+
+  backlog_encoder.begin(true);
+  payload.snapshot(backlog_encoder, backlog_snapshot_size);
+  size_t len = backlog_encoder.finish();
+  memcpy(record + backlog_timestamp_size, backlog_encoder.get_buffer(), len);
+
+  return backlog.append(record, backlog_timestamp_size + len);
+}
+
+/**
+ * Called before a requested esp_restart(): keep the counters and the running hour of the load energy meter in the backlog.
+ * Not a shutdown handler, panic and watchdog resets must not write to flash.
+ */
+void backlog_shutdown ()
+{
+  if (debug) Serial.println(" - restart, snapshot to backlog");
+  int64_t energy = ve_load_energy.close_slot();
+  ve_load_energy_hourly = ve_load_energy_pending ? ve_load_energy_hourly + energy : energy;
+  ve_load_energy_pending = true;
+  backlog_store_snapshot();
+}
+
+
+/**********************************
+ * Implementation alarm functions
+ **********************************/
+
+/**
+ * Raise an alarm on smoke, on the door opened while locked, and on a blocked lock motor
+ */
+void alarm_check (unsigned char parameter_code, const unsigned char* data)
+{
+  uint8_t previous = 0;
+  bool has_previous = false;
+  uint8_t lock_state = 0;
+
+  switch (parameter_code)
   {
-    ve_exec = false;
-    if (debug)
+  case (unsigned char)parameter_code::smoke_detector:
+    has_previous = data_store.get(parameter_code, &previous);
+    if (data[0] != 0 && (!has_previous || previous == 0)) alarm_raise(alarm_smoke);
+    break;
+
+  case (unsigned char)parameter_code::door:
+    has_previous = data_store.get(parameter_code, &previous);
+    if (data[0] == 0x01 && (!has_previous || previous != 0x01) &&
+        data_store.get((unsigned char)parameter_code::lock, &lock_state) &&
+        lock_state == (uint8_t)lock_states::locked)
     {
-      Serial.println(" # ve_exec_toggle_serial_cmd: VeDirect handler is now disabled");
+      alarm_raise(alarm_door_forced);
     }
-  }
-  else
-  {
-    if (debug)
+    break;
+
+  case (unsigned char)parameter_code::lock:
+    has_previous = data_store.get(parameter_code, &previous);
+    if (data[0] == (uint8_t)lock_states::motor_blocked && (!has_previous || previous != data[0]))
     {
-      Serial.print(" ! ve_exec_toggle_serial_cmd: unexpected value ");
-      Serial.println(data);
+      alarm_raise(alarm_lock_blocked);
     }
-    return;
+    break;
+
+  default:
+    break;
   }
 }
 
 /**
- * Implemente wiping non-volatile storage for SerialComm_Helper
+ * Add an event to the alarm and send it now, unless an uplink is queued or under way;
+ * then it follows right after that one
  */
-void SerialComm_Helper::wipe_storage_on_serial_cmd ()
+void alarm_raise (uint8_t event)
 {
-  BLEUlmernest::get_Bund()->wipe_storage();
+  if (debug) Serial.printf(" ! alarm 0x%x\n", event);
+  alarm_events |= event;
+  alarm_retries = 0;
+  // a queued uplink is not replaced
+  if (!(LMIC.opmode & (OP_TXRXPEND | OP_TXDATA))) os_setCallback(&sendjob, do_send);
+}
+
+
+/*************************************
+ * Implementation downlink functions
+ *************************************/
+
+/**
+ * Persist the counter of an accepted downlink before its commands run, so it cannot be replayed after a restart
+ */
+void downlink_save_counter (uint32_t counter)
+{
+  Preferences preferences;
+  preferences.begin("downlink", false);
+  preferences.putUInt("counter", counter);
+  preferences.end();
+}
+
+/**
+ * Persist the configuration set by downlink
+ */
+void downlink_save_config ()
+{
+  Preferences preferences;
+  preferences.begin("downlink", false);
+  preferences.putUInt("tx_interval", tx_interval);
+  preferences.putBytes("thresholds", downlink_thresholds, sizeof(downlink_thresholds));
+  preferences.end();
+}
+
+// 0x01 - change exec state
+bool downlink_exec_state (const uint8_t* args, size_t len)
+{
+  serial_comm.set_state(args[0]);
+  return true;
+}
+
+// 0x04 - unlock door
+bool downlink_unlock (const uint8_t* args, size_t len)
+{
+  return lock_action((unsigned char)enum_lock_action::unlock);
+}
+
+// 0x40 - lock door
+bool downlink_lock (const uint8_t* args, size_t len)
+{
+  return lock_action((unsigned char)enum_lock_action::lock);
+}
+
+// 0x06 - sleep raspberry, 0xFF to confirm
+bool downlink_sleep_raspberry (const uint8_t* args, size_t len)
+{
+  if (args[0] != 0xFF) return false;
+  sleep_raspberry();
+  return true;
+}
+
+// 0x60 - wake raspberry, 0xFF to confirm
+bool downlink_wake_raspberry (const uint8_t* args, size_t len)
+{
+  if (args[0] != 0xFF) return false;
+  wake_raspberry();
+  return true;
+}
+
+// 0x07 - restart esp32, 0xFF to confirm
+bool downlink_restart (const uint8_t* args, size_t len)
+{
+  if (args[0] != 0xFF) return false;
+  backlog_shutdown();
+  esp_restart();
+  return true;
+}
+
+// 0x08 - new LoRaWAN join, 0xFF to confirm
+bool downlink_rejoin (const uint8_t* args, size_t len)
+{
+  if (args[0] != 0xFF) return false;
+  lora_rejoin();
+  return true;
+}
+
+// 0x09 - uplink interval in seconds, 2 bytes MSB first; 0 for TX_INTERVAL
+bool downlink_tx_interval (const uint8_t* args, size_t len)
+{
+  unsigned interval = args[0] << 8 | args[1];
+  if (interval == 0) interval = TX_INTERVAL;
+  if (interval < tx_interval_min) return false;
+  tx_interval = interval;
+  downlink_save_config();
+  if (debug) Serial.printf(" - uplink interval %u s\n", tx_interval);
+  return true;
+}
+
+// 0x0A - threshold of a channel: channel, then the threshold in the unit of the channel, 4 bytes MSB first;
+//        negative sends every value. Channel only: the threshold of the field applies again after a restart
+bool downlink_threshold (const uint8_t* args, size_t len)
+{
+  unsigned char channel = args[0];
+  if (channel >= NEST_CODEC_CHANNELS || (len != 1 && len != 5)) return false;
+  int32_t threshold = len == 1 ? downlink_threshold_unset
+                               : (int32_t)((uint32_t)args[1] << 24 | args[2] << 16 | args[3] << 8 | args[4]);
+  downlink_thresholds[channel] = threshold;
+  downlink_save_config();
+  if (threshold == downlink_threshold_unset) return true;
+  if (debug) Serial.printf(" - threshold of channel %d: %d\n", channel, threshold);
+  return payload.set_threshold(channel, threshold) > 0;
+}
+
+// 0x0B - forget the configuration set by downlink and restart, 0xFF to confirm
+bool downlink_reset_config (const uint8_t* args, size_t len)
+{
+  if (args[0] != 0xFF) return false;
+  Preferences preferences;
+  preferences.begin("downlink", false);
+  preferences.remove("tx_interval");
+  preferences.remove("thresholds");
+  preferences.end();
+  backlog_shutdown();
+  esp_restart();
+  return true;
+}
+
+/**
+ * Register the downlink commands, set the key and restore counter and configuration
+ */
+void downlink_setup ()
+{
+  const downlink_command commands[]
+  {
+    // opcode args min args max handler                   name
+    { 0x01,   1,       1,       downlink_exec_state,      "change exec state" },
+    { 0x04,   0,       0,       downlink_unlock,          "unlock door" },
+    { 0x40,   0,       0,       downlink_lock,            "lock door" },
+    { 0x06,   1,       1,       downlink_sleep_raspberry, "sleep raspberry" },
+    { 0x60,   1,       1,       downlink_wake_raspberry,  "wake raspberry" },
+    { 0x07,   1,       1,       downlink_restart,         "esp_restart" },
+    { 0x08,   1,       1,       downlink_rejoin,          "LoRaWAN rejoin" },
+    { 0x09,   2,       2,       downlink_tx_interval,     "uplink interval" },
+    { 0x0A,   1,       5,       downlink_threshold,       "threshold" },
+    { 0x0B,   1,       1,       downlink_reset_config,    "reset configuration" }
+  };
+  for (const downlink_command& c : commands) downlink.add(c);
+
+  // Without a key no downlink is accepted at all
+  bool has_key = false;
+  for (unsigned char b : ENV_DOWNLINK_KEY) has_key |= b != 0;
+  if (has_key)
+  {
+    u1_t dev_eui[8];
+    os_getDevEui(dev_eui);
+    downlink.set_key(ENV_DOWNLINK_KEY, dev_eui);
+  }
+  else if (debug) Serial.println(" ! ENV_DOWNLINK_KEY not set, downlinks are rejected");
+  downlink.set_counter_callback(downlink_save_counter);
+
+  Preferences preferences;
+  preferences.begin("downlink", true);
+  downlink.set_counter(preferences.getUInt("counter", 0));
+  tx_interval = preferences.getUInt("tx_interval", TX_INTERVAL);
+  if (preferences.getBytes("thresholds", downlink_thresholds, sizeof(downlink_thresholds)) != sizeof(downlink_thresholds))
+  {
+    for (int32_t& t : downlink_thresholds) t = downlink_threshold_unset;
+  }
+  preferences.end();
+
+  for (size_t channel = 0; channel < NEST_CODEC_CHANNELS; channel++)
+  {
+    if (downlink_thresholds[channel] != downlink_threshold_unset) payload.set_threshold(channel, downlink_thresholds[channel]);
+  }
+  if (debug) Serial.printf(" - downlink counter %u, uplink interval %u s\n", downlink.get_counter(), tx_interval);
 }
 
 
@@ -829,340 +1361,244 @@ void SerialComm_Helper::wipe_storage_on_serial_cmd ()
  */
 uint8_t* lora_queue ()
 {
-  // reset Cayenne LPP object
-  lpp.reset();
-
-  // check for hourly transmissions
-  bool hourly;
-  if (millis() - hourly_timer > hourly_interval)
-  {
-    hourly = true;
-    hourly_timer = millis();
-  }
-  else
+  // Alarms go first, confirmed and regardless of the routine airtime: id, events, lock state
+  if (alarm_events != 0)
   {
-    hourly = false;
+    // a new id for new events, retries keep theirs
+    if (alarm_events != alarm_events_sent) alarm_id++;
+    alarm_events_sent = alarm_events;
+    uint8_t lock_state = 0xFF;
+    data_store.get((unsigned char)parameter_code::lock, &lock_state);
+    alarm_payload[0] = alarm_id;
+    alarm_payload[1] = alarm_events;
+    alarm_payload[2] = lock_state;
+    lora_payload = alarm_payload;
+    lora_payload_len = sizeof(alarm_payload);
+    lora_payload_port = alarm_port;
+    lora_payload_confirmed = true;
+    return lora_payload;
   }
 
-  // check for serial LoRa message
-  if (serial_comm.get_lora_msg_size() > 0)
+  // Payload limit of the current data rate and the airtime left
+  size_t max_size = lora_routine_max_payload();
+  if (max_size < lora_routine_size_min)
   {
-    unsigned char* m = serial_comm.get_lora_msg();
-    serial_comm.lora_msg_clear();
-    return m;
+    if (debug) Serial.println(" ! no airtime left for routine uplinks");
+    lora_payload_len = 0;
+    lora_payload_rolled_over = 0;
+    return nullptr;
   }
 
-  // 0 - Debug
-  // if (debug) lpp.addDigitalInput(0, 0xFF);
-
-  /**
-   * 0 - Fehler
-   *
-   * Reset Reason
-   * After connection to LoRa send the reset reason for both cores.
-   * Since there are 16 possible reset reasons both can be containted in a single Byte.
-   * The values for the reset reasons range from 1 to 16, so to accomedate them as
-   * a single digit hex value the value has to have one subtracted.
-   * This has to be accounted for on the recieving end!
-   */
-  if (lmic_is_joined && !sent_last_reset_reason)
+  // check for serial LoRa message; kept until the data rate allows its size
+  if (serial_comm.get_lora_msg_size() > max_size)
   {
-    uint8_t core_0 = rtc_get_reset_reason(0);
-    uint8_t core_1 = rtc_get_reset_reason(1);
-    uint8_t reset_reason_payload = 0x00 | (core_0 -1) | ((core_1 -1) << 4);
-    lpp.addDigitalInput(0, reset_reason_payload);
-    sent_last_reset_reason = true;
+    if (debug) Serial.printf(" ! serial LoRa message of %d bytes exceeds %d bytes, postponed\n",
+      serial_comm.get_lora_msg_size(), max_size);
   }
-  // if (err_code != 0)
-  // {
-  //   lpp.addDigitalInput(0, err_code);
-  //   err_code = 0;
-  // }
-
-  /**
-   * 1 - execution state
-   * 8 Bit: state code
-   */
-  if (exec_state != 99 && exec_state != prev_exec_state)
+  else if (serial_comm.get_lora_msg_size() > 0)
   {
-    lpp.addDigitalInput(1, exec_state);
-    prev_exec_state = exec_state;
+    lora_payload = serial_comm.get_lora_msg();
+    lora_payload_len = serial_comm.get_lora_msg_size();
+    lora_payload_port = payload_port;
+    lora_payload_confirmed = false;
+    lora_payload_rolled_over = 0;
+    serial_comm.lora_msg_clear();
+    return lora_payload;
   }
 
-  /**
-   * 2 - Temperature outside
-   * 16 Bit: 0.1 °C Signed MSB
-   */
-  if (has_data((unsigned char)parameter_code::temp_outside) &&
-      different_from_prev((unsigned char)parameter_code::temp_outside, -1))
+  // Drain a batch of the backlog after a payload, confirmed so it is only dropped once received:
+  // timestamp of now, followed by the oldest records, each with its length
+  if (backlog_batches > 0 && lora_payload_rolled_over == 0 && !lora_link_down() && backlog.get_pending_count() > 0)
   {
-    int16_t d = _get_data((unsigned char)parameter_code::temp_outside)[0] << 8 |
-                _get_data((unsigned char)parameter_code::temp_outside)[1];
-    float temp = (float)d / 10.0f;
-    lpp.addTemperature(2, temp);
-    // _set_prev_data((unsigned char)parameter_code::temp_outside);
-    if (debug)
+    backlog_batches--;
+    backlog_timestamp(backlog_batch);
+    size_t len = backlog.peek(backlog_batch + backlog_timestamp_size, max_size - backlog_timestamp_size);
+    if (len > 0)
     {
-      Serial.println();
-      Serial.println(d, 16);
-      Serial.print("lpp add temp outside ");
-      Serial.println(temp);
+      lora_payload = backlog_batch;
+      lora_payload_len = backlog_timestamp_size + len;
+      lora_payload_port = backlog_port;
+      lora_payload_confirmed = true;
+      return lora_payload;
     }
   }
 
-  /**
-   * 3 - Temperature inside
-   * 16 Bit: 0.1 °C Signed MSB
-   */
-  if (has_data((unsigned char)parameter_code::temp_inside) &&
-      different_from_prev((unsigned char)parameter_code::temp_inside, -1))
+  // check for hourly values
+  bool hourly;
+  if (millis() - hourly_timer > hourly_interval)
   {
-    int16_t d = _get_data((unsigned char)parameter_code::temp_inside)[0] << 8 |
-                _get_data((unsigned char)parameter_code::temp_inside)[1];
-    float temp = (float)d / 10.0f;
-    lpp.addTemperature(3, temp);
-    // _set_prev_data((unsigned char)parameter_code::temp_inside);
-    if (debug)
-    {
-      Serial.println();
-      Serial.println(d, 16);
-      Serial.print("lpp add temp inside ");
-      Serial.println(temp);
-    }
+    hourly = true;
+    hourly_timer = millis();
   }
-
-  /**
-   * 4 - Relative Humidity
-   * 8 Bit: in % (0.5% steps)
-   */
-  if (has_data((unsigned char)parameter_code::humidity_inside) &&
-      different_from_prev((unsigned char)parameter_code::humidity_inside, 4)) // min diff 2%
+  else
   {
-    uint16_t rh = _get_data((unsigned char)parameter_code::humidity_inside)[0];
-    lpp.addRelativeHumidity(4, (float)rh / 2.0f);
-    // _set_prev_data((unsigned char)parameter_code::humidity_inside);
-    if (debug)
-    {
-      Serial.print("lpp add humidity inside ");
-      Serial.println((float)rh / 2.0f);
-    }
+    hourly = false;
   }
 
-  /**
-   * 5 - Door
-   * door status open/closed
-   */
-  if (has_data((unsigned char)parameter_code::door) &&
-      different_from_prev((unsigned char)parameter_code::door))
+  // Lock actions since the last uplink; counted in the background and sent with a later payload
+  if (lmic_is_joined) check_lock_action_count();
+
+  // Close the hour of the load energy meter; sent with the next payload that has room for it
+  if (hourly)
   {
-    lpp.addDigitalInput(5, _get_data((unsigned char)parameter_code::door)[0]);
-    // _set_prev_data((unsigned char)parameter_code::door);
+    int64_t energy = ve_load_energy.close_slot();
+    // an hour not sent yet is added up with this one
+    ve_load_energy_hourly = ve_load_energy_pending ? ve_load_energy_hourly + energy : energy;
+    ve_load_energy_pending = true;
     if (debug)
     {
-      Serial.print("lpp add door ");
-      Serial.println(_get_data((unsigned char)parameter_code::door)[0]);
+      uint32_t uncovered_ms = 0;
+      ve_load_energy.get_slot(0, energy, &uncovered_ms);
+      Serial.printf(" + energy used by load: %d mWh; %u ms without VeDirect data\n",
+        (int)(energy / 3600000), uncovered_ms);
     }
   }
 
-  /**
-   * 6 - Lock
-   * Nuki lock state
-   */
-  if (has_data((unsigned char)parameter_code::lock) &&
-      different_from_prev((unsigned char)parameter_code::lock))
-  {
-    uint8_t lock_state = _get_data((unsigned char)parameter_code::lock)[0];
-    // if (lock_state != (unsigned char)lock_states::unlocked ||
-    //   lock_state != (unsigned char)lock_states::unlocking ||
-    //   lock_state != (unsigned char)lock_states::locked ||
-    //   lock_state != (unsigned char)lock_states::locking)
-    {
-      lpp.addDigitalInput(6, lock_state);
-      // _set_prev_data((unsigned char)parameter_code::lock);
-      if (debug)
-      {
-        Serial.print("lpp add lock ");
-        Serial.println(_get_data((unsigned char)parameter_code::lock)[0]);
-      }
-    }
-  }
+  // A keyframe every hour, sent confirmed; deltas to the last acknowledged keyframe in between.
+  // Filled up to the limit of the data rate, values of lower priority follow with the next uplink.
+  payload_encoder.begin(hourly);
+  lora_payload_rolled_over = payload.build(payload_encoder, max_size, millis());
+  lora_payload = payload_encoder.get_buffer();
+  lora_payload_len = payload_encoder.finish();
+  lora_payload_port = payload_port;
+  lora_payload_confirmed = payload_encoder.is_keyframe();
+  backlog_batches = backlog_batches_max;
+  return lora_payload;
+}
 
 /**
- * 7 - smoke detector
+ * @return Number of bytes for lora_queue
  */
-  if (has_data((unsigned char)parameter_code::smoke_detector) &&
-      different_from_prev((unsigned char)parameter_code::smoke_detector))
-  {
-    lpp.addDigitalInput(7, _get_data((unsigned char)parameter_code::smoke_detector)[0]);
-    // _set_prev_data((unsigned char)parameter_code::smoke_detector);
-    if (debug)
-    {
-      Serial.print("lpp add smoke detector ");
-      Serial.println(_get_data((unsigned char)parameter_code::smoke_detector)[0]);
-    }
-  }
+size_t lora_queue_len()
+{
+  return lora_payload_len;
+}
 
-  /**
-   * 8 - Battery Voltage
-   * Battery voltagae
-   */
-  if (has_data((unsigned char)parameter_code::battery_volt) &&
-      different_from_prev((unsigned char)parameter_code::battery_volt))
-  {
-    uint16_t d = _get_data((unsigned char)parameter_code::battery_volt)[0] << 8 |
-                 _get_data((unsigned char)parameter_code::battery_volt)[1];
-    lpp.addAnalogInput(8, (float)d / 100.0);
-    // _set_prev_data((unsigned char)parameter_code::battery_volt);
-    if (debug)
-    {
-      Serial.print("battery voltage ");
-      Serial.println(d);
-    }
-  }
+/**
+ * @return FPort of the payload of lora_queue
+ */
+uint8_t lora_queue_port ()
+{
+  return lora_payload_port;
+}
+
+/**
+ * @return true if the payload of lora_queue is to be sent as confirmed uplink
+ */
+bool lora_queue_confirmed ()
+{
+  return lora_payload_confirmed;
+}
 
-  /**
-   * 9 - Door counter
-   * MSB last known state | 7B count of state changes since last TX_INTERVAL
-   */
-  if (door_counter != 0)
+/**
+ * @return Seconds until the next uplink: at once or after a backoff for alarms,
+ *         soon if values did not fit into the payload of lora_queue, tx_interval otherwise
+ */
+unsigned lora_queue_interval ()
+{
+  if (alarm_events != 0) return alarm_retries == 0 ? 0 : alarm_backoff << (alarm_retries - 1);
+  if (lora_payload_rolled_over > 0) return TX_FOLLOW_UP_INTERVAL;
+  if (backlog_batches > 0 && !lora_link_down() && backlog.get_pending_count() > 0) return TX_FOLLOW_UP_INTERVAL;
+  return tx_interval;
+}
+
+/**
+ * The last uplink has been sent
+ * @param acknowledged true if a confirmed uplink has been acknowledged
+ */
+void lora_queue_complete (bool acknowledged)
+{
+  lora_tx_complete_time = millis();
+  if (lora_payload_port != alarm_port)
   {
-    uint8_t bits = door_counter > 0b01111111 ? 0b01111111 : door_counter;
-    uint8_t door_state = 0;
-    if (has_data((unsigned char)parameter_code::door) &&
-        different_from_prev((unsigned char)parameter_code::door))
-    {
-      door_state = _get_data((unsigned char)parameter_code::door)[0];
-    }
-    bits = door_state > 0 ? 0b10000000 | bits : bits;
-    lpp.addDigitalInput(9, bits);
-    if (debug)
-    {
-      Serial.print("lpp add door 0b");
-      Serial.println(bits, BIN);
-    }
+    lora_routine_airtime = lora_routine_airtime > lora_payload_airtime ? lora_routine_airtime - lora_payload_airtime : 0;
   }
+  lora_payload_airtime = 0;
+  if (!lora_payload_confirmed) return;
+  lora_link_up = acknowledged;
 
-  /**
-   * 10 - Lock counter
-   * MSB last known state | 7B count state changes since last TX_INTERVAL
-   */
-  if (lmic_is_joined) lock_counter = check_lock_action_count();
-  if (lock_counter > 0)
+  if (lora_payload_port == alarm_port)
   {
-    uint8_t bits = lock_counter > 0b01111111 ? 0b01111111 : (uint8_t)lock_counter;
-
-    uint8_t lock_state = 0;
-    if (has_data((unsigned char)parameter_code::lock))
-    {
-      lock_state = _get_data((unsigned char)parameter_code::lock)[0];
-    }
-    else
+    if (acknowledged || ++alarm_retries > alarm_retries_max)
     {
-      if (BLEUlmernest::read_keyturner_state() == 0) lock_state = BLEUlmernest::get_keytuerner_states().lock_state;
-    }
-    bits = lock_state == (uint8_t)lock_states::unlocked ? 0b10000000 | bits : bits;
-    lpp.addDigitalInput(10, bits);
-    if (debug)
-    {
-      Serial.print("lpp add lock 0b");
-      Serial.println(bits, BIN);
+      if (!acknowledged && debug) Serial.printf(" ! alarm 0x%x not acknowledged, given up\n", alarm_events_sent);
+      // events raised meanwhile stay
+      alarm_events &= ~alarm_events_sent;
+      alarm_events_sent = 0;
+      alarm_retries = 0;
     }
   }
-
-  /**
-   * 11 - Motion Counter
-   * 8 bit: state changes since last TX_INTERVAL
-   */
-  if (motion_counter > 0)
+  else if (lora_payload_port == backlog_port)
   {
-    lpp.addDigitalInput(11, motion_counter);
-    motion_counter = 0;
+    if (acknowledged) backlog.commit();
   }
-
-  /**
-   * 12 - Light Switch Counter
-   * 8 bit: state changes since last TX_INTERVAL
-   */
-  if (light_switch_counter > 0)
+  else if (acknowledged)
   {
-    lpp.addDigitalInput(12, light_switch_counter);
-    light_switch_counter = 0;
+    payload_encoder.acknowledge();
   }
+  // a lost keyframe takes the link down, loop() keeps its values in the backlog
+}
 
-  /**
-   * 13 - MPPT Battery Voltage, hourly
-   * 16 Bit: singed floating number; 0.01 V
-   */
-  if (hourly &&
-      has_data((unsigned char)parameter_code::mppt_battery_volt) &&
-      different_from_prev((unsigned char)parameter_code::mppt_battery_volt))
-  {
-    uint16_t d = _get_data((unsigned char)parameter_code::mppt_battery_volt)[0] << 8 |
-                 _get_data((unsigned char)parameter_code::mppt_battery_volt)[1];
-    lpp.addAnalogInput(13, d);
-    // _set_prev_data((unsigned char)parameter_code::mppt_battery_volt);
-    if (debug)
-    {
-      Serial.print("mppt battery voltage ");
-      Serial.println(d);
-    }
-  }
+/**
+ * A transmission of the last uplink starts, at the data rate it is sent with
+ */
+void lora_queue_tx_start ()
+{
+  lora_payload_airtime += lora_airtime_ms(lora_payload_len);
+}
 
-  /**
-   * 14 - Load Power, hourly
-   * 16 Bit: singed floating number; 0.01 mWh
-   */
-  if (hourly)
+/**
+ * The last uplink could not be queued by LMIC and is not sent
+ */
+void lora_queue_dropped ()
+{
+  if (lora_payload_port == alarm_port)
   {
-    double milli_watt_hours = 0;
-    for (int32_t energy : ve_load_energy)
+    // retried after the backoff, as if not acknowledged
+    if (++alarm_retries > alarm_retries_max)
     {
-      // mJ -> mWh with TX_INTERVAL sec out of an hour (3600 sec): / TX_INTERVAL/3600
-      milli_watt_hours += ((double)energy / (double)TX_INTERVAL / 3600.0);
+      if (debug) Serial.printf(" ! alarm 0x%x not sent, given up\n", alarm_events_sent);
+      alarm_events &= ~alarm_events_sent;
+      alarm_events_sent = 0;
+      alarm_retries = 0;
     }
-    if (debug)
-    {
-      Serial.print(" + energy used by load in milli watt hours: ");
-      Serial.println(milli_watt_hours, 2);
-    }
-    ve_load_energy.clear();
-
-    lpp.addAnalogInput(14, milli_watt_hours);
   }
-  // append new element to add next cycle or after clear
-  ve_load_energy.push_back(0);
-
-  /**
-   * 15 - PV yield, hourly
-   * 16 Bit: singed floating number; 0.01 kWh
-   */
-  if (hourly &&
-      has_data((unsigned char)parameter_code::PV_yield) &&
-      different_from_prev((unsigned char)parameter_code::PV_yield))
+  else if (lora_payload_port == payload_port && lora_payload == payload_encoder.get_buffer())
   {
-    uint16_t d = _get_data((unsigned char)parameter_code::PV_yield)[0] << 8 |
-                 _get_data((unsigned char)parameter_code::PV_yield)[1];
-    lpp.addAnalogInput(15, d);
-    // _set_prev_data((unsigned char)parameter_code::PV_yield);
-    if (debug)
-    {
-      Serial.print("PV yield today ");
-      Serial.println(d);
-    }
+    // the values have been marked as sent: send every field again
+    payload.reset();
   }
-  return lpp.getBuffer();
+  // a backlog batch is only dropped from the backlog once acknowledged
+  lora_payload_len = 0;
+  lora_payload_airtime = 0;
 }
 
 /**
- * @return Number of bytes for lora_queue
+ * @return true if the uplink is down: not joined, the last confirmed uplink has not been acknowledged,
+ *         or no uplink has been completed for two intervals
  */
-size_t lora_queue_len()
+bool lora_link_down ()
 {
-  return lpp.getSize();
+  return !lmic_is_joined || !lora_link_up || millis() - lora_tx_complete_time > 2 * tx_interval * 1000;
 }
 
 /**
- * Interprete bytes recieved from a downlink.
+ * Refill the routine airtime and find the largest payload it allows
+ */
+size_t lora_routine_max_payload ()
+{
+  uint32_t elapsed = millis() - lora_routine_airtime_time;
+  lora_routine_airtime_time = millis();
+  uint64_t airtime = lora_routine_airtime + (uint64_t)elapsed * lora_routine_airtime_per_hour / 3600000;
+  lora_routine_airtime = airtime > lora_routine_airtime_per_hour ? lora_routine_airtime_per_hour : airtime;
+
+  size_t size = lora_max_payload();
+  while (size > 0 && lora_airtime_ms(size) > lora_routine_airtime) size--;
+  return size;
+}
+
+/**
+ * Interprete bytes recieved from a downlink, see DownlinkDispatcher for the frame.
  * @param data Data bytes
  * @param len Number of data bytes
  */
@@ -1174,61 +1610,13 @@ void parse_downlink (unsigned char* data, size_t len)
     for (size_t i = 0; i < len; i++)
     {
       Serial.print(" 0x");
-      if (data[i] <= 16) Serial.print("0");
+      if (data[i] < 16) Serial.print("0");
       Serial.print(data[i], HEX);
     }
     Serial.println();
   }
 
-  size_t i = 0;
-  while (i < len)
-  {
-    switch (data[i++])
-    {
-    case 0x01: // change exec state
-      if (debug) Serial.println(" - 0x01: change exec state");
-      serial_comm.set_state(data[i++]);
-      break;
-
-    case 0x04: // unlock door
-      if (debug) Serial.println(" - 0x04: unlock door");
-      lock_action((unsigned char)enum_lock_action::unlock);
-      break;
-
-    case 0x40: // lock door
-      if (debug) Serial.println(" - 0x40: lock door");
-      lock_action((unsigned char)enum_lock_action::lock);
-      break;
-
-      case 0x06: // sleep raspberry
-      if (debug) Serial.println(" - 0x06: sleep_raspberry");
-      if (data[i++] == 0xFF) sleep_raspberry();
-      else if (debug) Serial.println(" ! 2nd byte not 0xFF");
-      break;
-
-    case 0x60: // wake raspberry
-      if (debug) Serial.println(" - 0x06: wake_raspberry");
-      if (data[i++] == 0xFF) wake_raspberry();
-      else if (debug) Serial.println(" ! 2nd byte not 0xFF");
-      break;
-
-    case 0x07: // restart esp32
-      if (debug) Serial.println(" - 0x07: esp_restart");
-      if (data[i++] == 0xFF) esp_restart();
-      else if (debug) Serial.println(" ! 2nd byte not 0xFF");
-      break;
-
-    default:
-      if (debug)
-      {
-        Serial.print(" ! unknown downlink value ");
-        Serial.print(data[i], HEX);
-        Serial.print(" on index ");
-        Serial.println(i);
-      }
-      break;
-    }
-  }
+  downlink.parse(data, len);
 }
 
 /**
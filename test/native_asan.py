@@ -0,0 +1,4 @@
+# Link the AddressSanitizer runtime, build_flags only reach the compiler
+Import("env")
+
+env.Append(LINKFLAGS=["-fsanitize=address"])
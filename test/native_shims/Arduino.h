@@ -0,0 +1,108 @@
+/**
+ * Host shim of the Arduino core for the native tests.
+ * Only what the platform independent units use; millis() is set by the tests.
+ */
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+// BLEUlmernest.h names std::string as the esp32 toolchain does
+namespace std { namespace __cxx11 { typedef std::basic_string<char> string; } }
+
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+#define F(x) (x)
+#define PROGMEM
+#define memcpy_P memcpy
+
+/**
+ * Uart in RAM: the tests queue the bytes to receive with inject() and find the bytes written in written
+ */
+class HardwareSerial
+{
+public:
+  std::deque<uint8_t> received;
+  std::vector<uint8_t> written;
+
+  void inject (const uint8_t* data, size_t len) { received.insert(received.end(), data, data + len); }
+  void inject (std::initializer_list<uint8_t> data) { received.insert(received.end(), data.begin(), data.end()); }
+
+  operator bool () { return true; }
+  int available () { return received.size(); }
+
+  int read ()
+  {
+    if (received.empty()) return -1;
+    uint8_t b = received.front();
+    received.pop_front();
+    return b;
+  }
+
+  size_t write (uint8_t b)
+  {
+    written.push_back(b);
+    return 1;
+  }
+
+  size_t write (const uint8_t* data, size_t len)
+  {
+    written.insert(written.end(), data, data + len);
+    return len;
+  }
+
+  template <typename T> size_t print (T value, int = DEC) { return 0; }
+  template <typename T> size_t println (T value, int = DEC) { return 0; }
+  size_t println () { return 0; }
+
+  int printf (const char* format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n;
+  }
+};
+
+inline HardwareSerial Serial;
+
+/**
+ * Time of the tests in ms, returned by millis()
+ */
+inline unsigned long native_millis = 0;
+
+inline unsigned long millis ()
+{
+  return native_millis;
+}
+
+inline void delay (unsigned long ms)
+{
+  native_millis += ms;
+}
+
+/**
+ * Number of calls of esp_restart()
+ */
+inline unsigned int native_restarts = 0;
+
+inline void esp_restart ()
+{
+  native_restarts++;
+}
+
+#endif // NATIVE_ARDUINO_H
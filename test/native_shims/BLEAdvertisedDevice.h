@@ -0,0 +1,6 @@
+#ifndef NATIVE_BLEADVERTISEDDEVICE_H
+#define NATIVE_BLEADVERTISEDDEVICE_H
+
+#include "BLEDevice.h"
+
+#endif // NATIVE_BLEADVERTISEDDEVICE_H
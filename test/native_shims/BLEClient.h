@@ -0,0 +1,6 @@
+#ifndef NATIVE_BLECLIENT_H
+#define NATIVE_BLECLIENT_H
+
+#include "BLEDevice.h"
+
+#endif // NATIVE_BLECLIENT_H
@@ -0,0 +1,91 @@
+/**
+ * Host shim of the esp32 BLE library for the native tests.
+ * Declarations only, so BLEUlmernest.h can be included by the units built on the host, e.g. Logbuch.
+ */
+
+#ifndef NATIVE_BLEDEVICE_H
+#define NATIVE_BLEDEVICE_H
+
+#include <Arduino.h>
+
+typedef uint8_t esp_ble_addr_type_t;
+#define BLE_ADDR_TYPE_PUBLIC 0x00
+#define BLE_ADDR_TYPE_RANDOM 0x01
+
+class BLEUUID
+{
+public:
+  BLEUUID (const char*) {}
+  std::string toString () { return ""; }
+};
+
+class BLEAddress
+{
+public:
+  BLEAddress (std::string) {}
+  std::string toString () { return ""; }
+};
+
+class BLERemoteCharacteristic;
+typedef void (*notify_callback)(BLERemoteCharacteristic*, uint8_t*, size_t, bool);
+
+class BLERemoteCharacteristic
+{
+public:
+  void writeValue (uint8_t*, size_t, bool = false) {}
+  void registerForNotify (notify_callback, bool = true, bool = true) {}
+};
+
+class BLERemoteService
+{
+public:
+  BLERemoteCharacteristic* getCharacteristic (BLEUUID) { return nullptr; }
+};
+
+class BLEClient;
+
+class BLEClientCallbacks
+{
+public:
+  virtual ~BLEClientCallbacks () {}
+  virtual void onConnect (BLEClient*) = 0;
+  virtual void onDisconnect (BLEClient*) = 0;
+};
+
+class BLEClient
+{
+public:
+  bool isConnected () { return false; }
+  void disconnect () {}
+};
+
+class BLEAdvertisedDevice
+{
+public:
+  std::string getName () { return ""; }
+  BLEAddress getAddress () { return BLEAddress(""); }
+  esp_ble_addr_type_t getAddressType () { return BLE_ADDR_TYPE_PUBLIC; }
+  bool isAdvertisingService (BLEUUID) { return false; }
+  std::string toString () { return ""; }
+};
+
+class BLEAdvertisedDeviceCallbacks
+{
+public:
+  virtual ~BLEAdvertisedDeviceCallbacks () {}
+  virtual void onResult (BLEAdvertisedDevice) = 0;
+};
+
+class BLEScan
+{
+public:
+  void stop () {}
+};
+
+class BLEDevice
+{
+public:
+  static void init (std::string) {}
+};
+
+#endif // NATIVE_BLEDEVICE_H
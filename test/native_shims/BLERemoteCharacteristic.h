@@ -0,0 +1,6 @@
+#ifndef NATIVE_BLEREMOTECHARACTERISTIC_H
+#define NATIVE_BLEREMOTECHARACTERISTIC_H
+
+#include "BLEDevice.h"
+
+#endif // NATIVE_BLEREMOTECHARACTERISTIC_H
@@ -0,0 +1,6 @@
+#ifndef NATIVE_BLESCAN_H
+#define NATIVE_BLESCAN_H
+
+#include "BLEDevice.h"
+
+#endif // NATIVE_BLESCAN_H
@@ -0,0 +1,6 @@
+#ifndef NATIVE_BLEUTILS_H
+#define NATIVE_BLEUTILS_H
+
+#include "BLEDevice.h"
+
+#endif // NATIVE_BLEUTILS_H
@@ -0,0 +1,52 @@
+/**
+ * Host shim of CayenneLPP for the native tests: the data types the nest used, encoded as the library does.
+ * Only the benchmark of NestCodec against the previous format uses it.
+ */
+
+#ifndef NATIVE_CAYENNELPP_H
+#define NATIVE_CAYENNELPP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LPP_DIGITAL_INPUT 0
+#define LPP_ANALOG_INPUT 2
+#define LPP_TEMPERATURE 103
+#define LPP_RELATIVE_HUMIDITY 104
+
+#define LPP_DIGITAL_INPUT_SIZE 1
+#define LPP_ANALOG_INPUT_SIZE 2
+#define LPP_TEMPERATURE_SIZE 2
+#define LPP_RELATIVE_HUMIDITY_SIZE 1
+
+class CayenneLPP
+{
+public:
+  CayenneLPP (uint8_t size) : maxsize(size), cursor(0) { buffer = new uint8_t[size]; }
+  ~CayenneLPP () { delete[] buffer; }
+
+  void reset () { cursor = 0; }
+  uint8_t getSize () { return cursor; }
+  uint8_t* getBuffer () { return buffer; }
+
+  uint8_t addDigitalInput (uint8_t channel, uint8_t value) { return add(channel, LPP_DIGITAL_INPUT, value, 1); }
+  uint8_t addAnalogInput (uint8_t channel, float value) { return add(channel, LPP_ANALOG_INPUT, (int16_t)(value * 100), 2); }
+  uint8_t addTemperature (uint8_t channel, float celsius) { return add(channel, LPP_TEMPERATURE, (int16_t)(celsius * 10), 2); }
+  uint8_t addRelativeHumidity (uint8_t channel, float rh) { return add(channel, LPP_RELATIVE_HUMIDITY, (uint8_t)(rh * 2), 1); }
+
+private:
+  uint8_t* buffer;
+  uint8_t maxsize;
+  uint8_t cursor;
+
+  uint8_t add (uint8_t channel, uint8_t type, int32_t value, uint8_t size)
+  {
+    if (cursor + 2 + size > maxsize) return 0;
+    buffer[cursor++] = channel;
+    buffer[cursor++] = type;
+    for (int i = size - 1; i >= 0; i--) buffer[cursor++] = value >> (8 * i);
+    return cursor;
+  }
+};
+
+#endif // NATIVE_CAYENNELPP_H
@@ -0,0 +1,29 @@
+/**
+ * Host shim of FastCRC for the native tests, bitwise instead of table driven
+ */
+
+#ifndef NATIVE_FASTCRC_H
+#define NATIVE_FASTCRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class FastCRC16
+{
+public:
+  /**
+   * CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF
+   */
+  uint16_t ccitt (const uint8_t* data, size_t len)
+  {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+      crc ^= (uint16_t)data[i] << 8;
+      for (int bit = 0; bit < 8; bit++) crc = crc & 0x8000 ? (uint16_t)(crc << 1 ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+  }
+};
+
+#endif // NATIVE_FASTCRC_H
@@ -0,0 +1,102 @@
+/**
+ * Host shim of the Preferences library for the native tests.
+ * Values are kept in RAM per namespace and survive the Preferences object, like NVS survives a restart.
+ */
+
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+
+class Preferences
+{
+private:
+  std::string name;
+
+  std::vector<uint8_t>* find (const char* key)
+  {
+    std::map<std::string, std::vector<uint8_t>>::iterator i = storage().find(name + "/" + key);
+    return i == storage().end() ? nullptr : &i->second;
+  }
+
+  size_t put (const char* key, const void* value, size_t len)
+  {
+    const uint8_t* bytes = (const uint8_t*)value;
+    storage()[name + "/" + key].assign(bytes, bytes + len);
+    return len;
+  }
+
+  template <typename T> T get (const char* key, T default_value)
+  {
+    std::vector<uint8_t>* value = find(key);
+    if (value == nullptr || value->size() != sizeof(T)) return default_value;
+    T v;
+    memcpy(&v, value->data(), sizeof(T));
+    return v;
+  }
+
+public:
+  /**
+   * Values of all namespaces; cleared by the tests to start from an empty NVS
+   */
+  static std::map<std::string, std::vector<uint8_t>>& storage ()
+  {
+    static std::map<std::string, std::vector<uint8_t>> values;
+    return values;
+  }
+
+  bool begin (const char* _name, bool = false)
+  {
+    name = _name;
+    return true;
+  }
+
+  void end () {}
+
+  bool isKey (const char* key) { return find(key) != nullptr; }
+  bool remove (const char* key) { return storage().erase(name + "/" + key) > 0; }
+
+  bool clear ()
+  {
+    std::map<std::string, std::vector<uint8_t>>::iterator i = storage().lower_bound(name + "/");
+    while (i != storage().end() && i->first.compare(0, name.size() + 1, name + "/") == 0) i = storage().erase(i);
+    return true;
+  }
+
+  uint8_t getUChar (const char* key, uint8_t d = 0) { return get(key, d); }
+  size_t putUChar (const char* key, uint8_t v) { return put(key, &v, sizeof v); }
+  int32_t getInt (const char* key, int32_t d = 0) { return get(key, d); }
+  size_t putInt (const char* key, int32_t v) { return put(key, &v, sizeof v); }
+  uint32_t getUInt (const char* key, uint32_t d = 0) { return get(key, d); }
+  size_t putUInt (const char* key, uint32_t v) { return put(key, &v, sizeof v); }
+
+  size_t getBytesLength (const char* key)
+  {
+    std::vector<uint8_t>* value = find(key);
+    return value == nullptr ? 0 : value->size();
+  }
+
+  size_t getBytes (const char* key, void* buffer, size_t len)
+  {
+    std::vector<uint8_t>* value = find(key);
+    if (value == nullptr || value->size() > len) return 0;
+    memcpy(buffer, value->data(), value->size());
+    return value->size();
+  }
+
+  size_t putBytes (const char* key, const void* value, size_t len) { return put(key, value, len); }
+
+  size_t getString (const char* key, char* buffer, size_t len)
+  {
+    std::vector<uint8_t>* value = find(key);
+    if (value == nullptr || value->size() + 1 > len) return 0;
+    memcpy(buffer, value->data(), value->size());
+    buffer[value->size()] = 0;
+    return value->size() + 1;
+  }
+
+  size_t putString (const char* key, const char* value) { return put(key, value, strlen(value)); }
+};
+
+#endif // NATIVE_PREFERENCES_H
@@ -0,0 +1,82 @@
+/**
+ * Host shim of the esp32 partition API for the native tests.
+ * A single partition in RAM with the semantics of NOR flash: writes only clear bits, erasing sets whole sectors to 0xFF.
+ */
+
+#ifndef NATIVE_ESP_PARTITION_H
+#define NATIVE_ESP_PARTITION_H
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+#define NATIVE_PARTITION_SECTOR_SIZE 4096
+
+typedef enum
+{
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+
+struct esp_partition_t
+{
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  bool encrypted;
+};
+
+/**
+ * Contents of the partition; resized by the tests, e.g. native_flash().assign(4 * 4096, 0xFF)
+ */
+inline std::vector<uint8_t>& native_flash ()
+{
+  static std::vector<uint8_t> flash(4 * NATIVE_PARTITION_SECTOR_SIZE, 0xFF);
+  return flash;
+}
+
+inline const esp_partition_t* esp_partition_find_first (esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+  static esp_partition_t partition;
+  if (native_flash().empty()) return nullptr;
+  partition.type = type;
+  partition.subtype = subtype;
+  partition.address = 0;
+  partition.size = native_flash().size();
+  strncpy(partition.label, label != nullptr ? label : "", sizeof partition.label - 1);
+  partition.encrypted = false;
+  return &partition;
+}
+
+inline esp_err_t esp_partition_read (const esp_partition_t* partition, size_t offset, void* dst, size_t len)
+{
+  if (offset + len > partition->size) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, native_flash().data() + offset, len);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write (const esp_partition_t* partition, size_t offset, const void* src, size_t len)
+{
+  if (offset + len > partition->size) return ESP_ERR_INVALID_SIZE;
+  const uint8_t* bytes = (const uint8_t*)src;
+  for (size_t i = 0; i < len; i++) native_flash()[offset + i] &= bytes[i];
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range (const esp_partition_t* partition, size_t offset, size_t len)
+{
+  if (offset % NATIVE_PARTITION_SECTOR_SIZE != 0 || len % NATIVE_PARTITION_SECTOR_SIZE != 0) return ESP_ERR_INVALID_ARG;
+  if (offset + len > partition->size) return ESP_ERR_INVALID_SIZE;
+  memset(native_flash().data() + offset, 0xFF, len);
+  return ESP_OK;
+}
+
+#endif // NATIVE_ESP_PARTITION_H
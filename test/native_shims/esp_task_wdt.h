@@ -0,0 +1,9 @@
+#ifndef NATIVE_ESP_TASK_WDT_H
+#define NATIVE_ESP_TASK_WDT_H
+
+inline int esp_task_wdt_reset ()
+{
+  return 0;
+}
+
+#endif // NATIVE_ESP_TASK_WDT_H
@@ -0,0 +1,51 @@
+/**
+ * Host shim of FreeRTOS for the native tests
+ */
+
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* QueueHandle_t;
+typedef void* TaskHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef struct
+{
+  uint32_t owner;
+  uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_FREE_VAL 0xB33FFFFF
+#define portMUX_INITIALIZER_UNLOCKED { portMUX_FREE_VAL, 0 }
+
+/**
+ * Spinlock as on the esp32, so tests with several threads are serialised like the two cores
+ */
+inline void portENTER_CRITICAL (portMUX_TYPE* mux)
+{
+  uint32_t expected = portMUX_FREE_VAL;
+  while (!__atomic_compare_exchange_n(&mux->owner, &expected, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+  {
+    expected = portMUX_FREE_VAL;
+  }
+  mux->count++;
+}
+
+inline void portEXIT_CRITICAL (portMUX_TYPE* mux)
+{
+  mux->count--;
+  __atomic_store_n(&mux->owner, portMUX_FREE_VAL, __ATOMIC_RELEASE);
+}
+
+#endif // NATIVE_FREERTOS_H
@@ -0,0 +1,6 @@
+#ifndef NATIVE_FREERTOS_TASK_H
+#define NATIVE_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#endif // NATIVE_FREERTOS_TASK_H
@@ -0,0 +1,156 @@
+/**
+ * Host shim of the HMAC-SHA256 of libsodium for the native tests (FIPS 180-4, RFC 2104)
+ */
+
+#ifndef NATIVE_CRYPTO_AUTH_HMACSHA256_H
+#define NATIVE_CRYPTO_AUTH_HMACSHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define crypto_auth_hmacsha256_BYTES 32U
+#define crypto_auth_hmacsha256_KEYBYTES 32U
+
+typedef struct
+{
+  uint32_t state[8];
+  uint64_t count;
+  uint8_t buffer[64];
+} native_sha256_state;
+
+typedef struct
+{
+  native_sha256_state ictx;
+  native_sha256_state octx;
+} crypto_auth_hmacsha256_state;
+
+static const uint32_t native_sha256_k[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t native_sha256_rotr (uint32_t x, int n)
+{
+  return x >> n | x << (32 - n);
+}
+
+static inline void native_sha256_block (native_sha256_state* s, const uint8_t* block)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = native_sha256_rotr(w[i - 15], 7) ^ native_sha256_rotr(w[i - 15], 18) ^ w[i - 15] >> 3;
+    uint32_t s1 = native_sha256_rotr(w[i - 2], 17) ^ native_sha256_rotr(w[i - 2], 19) ^ w[i - 2] >> 10;
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t v[8];
+  memcpy(v, s->state, sizeof v);
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t s1 = native_sha256_rotr(v[4], 6) ^ native_sha256_rotr(v[4], 11) ^ native_sha256_rotr(v[4], 25);
+    uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+    uint32_t t1 = v[7] + s1 + ch + native_sha256_k[i] + w[i];
+    uint32_t s0 = native_sha256_rotr(v[0], 2) ^ native_sha256_rotr(v[0], 13) ^ native_sha256_rotr(v[0], 22);
+    uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+    memmove(v + 1, v, 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0] = t1 + s0 + maj;
+  }
+  for (int i = 0; i < 8; i++) s->state[i] += v[i];
+}
+
+static inline void native_sha256_init (native_sha256_state* s)
+{
+  static const uint32_t iv[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(s->state, iv, sizeof iv);
+  s->count = 0;
+}
+
+static inline void native_sha256_update (native_sha256_state* s, const uint8_t* data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    s->buffer[s->count++ % 64] = data[i];
+    if (s->count % 64 == 0) native_sha256_block(s, s->buffer);
+  }
+}
+
+static inline void native_sha256_final (native_sha256_state* s, uint8_t* out)
+{
+  uint64_t bits = s->count * 8;
+  uint8_t pad = 0x80;
+  native_sha256_update(s, &pad, 1);
+  pad = 0;
+  while (s->count % 64 != 56) native_sha256_update(s, &pad, 1);
+  for (int i = 7; i >= 0; i--)
+  {
+    uint8_t b = (uint8_t)(bits >> (8 * i));
+    native_sha256_update(s, &b, 1);
+  }
+  for (int i = 0; i < 32; i++) out[i] = (uint8_t)(s->state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static inline int crypto_auth_hmacsha256_init (crypto_auth_hmacsha256_state* state, const unsigned char* key, size_t keylen)
+{
+  uint8_t block[64] = {0};
+  if (keylen > 64)
+  {
+    native_sha256_init(&state->ictx);
+    native_sha256_update(&state->ictx, key, keylen);
+    native_sha256_final(&state->ictx, block);
+  }
+  else
+  {
+    memcpy(block, key, keylen);
+  }
+
+  uint8_t pad[64];
+  for (int i = 0; i < 64; i++) pad[i] = block[i] ^ 0x36;
+  native_sha256_init(&state->ictx);
+  native_sha256_update(&state->ictx, pad, 64);
+  for (int i = 0; i < 64; i++) pad[i] = block[i] ^ 0x5c;
+  native_sha256_init(&state->octx);
+  native_sha256_update(&state->octx, pad, 64);
+  return 0;
+}
+
+static inline int crypto_auth_hmacsha256_update (crypto_auth_hmacsha256_state* state, const unsigned char* in, unsigned long long inlen)
+{
+  native_sha256_update(&state->ictx, in, (size_t)inlen);
+  return 0;
+}
+
+static inline int crypto_auth_hmacsha256_final (crypto_auth_hmacsha256_state* state, unsigned char* out)
+{
+  uint8_t inner[32];
+  native_sha256_final(&state->ictx, inner);
+  native_sha256_update(&state->octx, inner, sizeof inner);
+  native_sha256_final(&state->octx, out);
+  return 0;
+}
+
+static inline int crypto_auth_hmacsha256 (unsigned char* out, const unsigned char* in, unsigned long long inlen, const unsigned char* key)
+{
+  crypto_auth_hmacsha256_state state;
+  crypto_auth_hmacsha256_init(&state, key, crypto_auth_hmacsha256_KEYBYTES);
+  crypto_auth_hmacsha256_update(&state, in, inlen);
+  return crypto_auth_hmacsha256_final(&state, out);
+}
+
+#endif // NATIVE_CRYPTO_AUTH_HMACSHA256_H
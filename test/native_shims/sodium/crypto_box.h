@@ -0,0 +1,15 @@
+/**
+ * Host shim of libsodium for the native tests; declarations only, the units built on the host do not encrypt
+ */
+
+#ifndef NATIVE_CRYPTO_BOX_H
+#define NATIVE_CRYPTO_BOX_H
+
+#include <stddef.h>
+
+#define crypto_box_PUBLICKEYBYTES 32U
+#define crypto_box_SECRETKEYBYTES 32U
+
+int crypto_box_keypair (unsigned char* pk, unsigned char* sk);
+
+#endif // NATIVE_CRYPTO_BOX_H
@@ -0,0 +1,6 @@
+#ifndef NATIVE_CRYPTO_CORE_HSALSA20_H
+#define NATIVE_CRYPTO_CORE_HSALSA20_H
+
+int crypto_core_hsalsa20 (unsigned char* out, const unsigned char* in, const unsigned char* k, const unsigned char* c);
+
+#endif // NATIVE_CRYPTO_CORE_HSALSA20_H
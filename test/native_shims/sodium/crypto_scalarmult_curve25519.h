@@ -0,0 +1,8 @@
+#ifndef NATIVE_CRYPTO_SCALARMULT_CURVE25519_H
+#define NATIVE_CRYPTO_SCALARMULT_CURVE25519_H
+
+#define crypto_scalarmult_curve25519_BYTES 32U
+
+int crypto_scalarmult_curve25519 (unsigned char* q, const unsigned char* n, const unsigned char* p);
+
+#endif // NATIVE_CRYPTO_SCALARMULT_CURVE25519_H
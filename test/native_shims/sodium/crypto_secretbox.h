@@ -0,0 +1,15 @@
+#ifndef NATIVE_CRYPTO_SECRETBOX_H
+#define NATIVE_CRYPTO_SECRETBOX_H
+
+#define crypto_secretbox_KEYBYTES 32U
+#define crypto_secretbox_NONCEBYTES 24U
+#define crypto_secretbox_ZEROBYTES 32U
+#define crypto_secretbox_BOXZEROBYTES 16U
+#define crypto_secretbox_xsalsa20poly1305_NONCEBYTES 24U
+
+int crypto_secretbox_xsalsa20poly1305 (unsigned char* c, const unsigned char* m, unsigned long long mlen,
+                                       const unsigned char* n, const unsigned char* k);
+int crypto_secretbox_xsalsa20poly1305_open (unsigned char* m, const unsigned char* c, unsigned long long clen,
+                                            const unsigned char* n, const unsigned char* k);
+
+#endif // NATIVE_CRYPTO_SECRETBOX_H
@@ -0,0 +1,21 @@
+#ifndef NATIVE_SODIUM_UTILS_H
+#define NATIVE_SODIUM_UTILS_H
+
+#include <stddef.h>
+#include <string.h>
+
+static inline int sodium_memcmp (const void* b1, const void* b2, size_t len)
+{
+  const unsigned char* a = (const unsigned char*)b1;
+  const unsigned char* b = (const unsigned char*)b2;
+  unsigned char d = 0;
+  for (size_t i = 0; i < len; i++) d |= a[i] ^ b[i];
+  return d == 0 ? 0 : -1;
+}
+
+static inline void sodium_memzero (void* pnt, size_t len)
+{
+  memset(pnt, 0, len);
+}
+
+#endif // NATIVE_SODIUM_UTILS_H
@@ -0,0 +1,310 @@
+/**
+ * One day of the six fields of a nest sent every 5 minutes: temperature outside and inside (0.1 °C), humidity
+ * inside (0.5 %), battery voltage (0.01 V), MPPT battery voltage (mV) and PV yield today (0.01 kWh).
+ * Synthetic: daily curves with some noise, generated once and kept fixed; not recorded from a device.
+ */
+
+#ifndef DAY_H
+#define DAY_H
+
+#include <stdint.h>
+
+#define DAY_UPLINKS 288
+#define DAY_FIELDS 6
+
+// Channels of the fields, in the order of the columns
+static const unsigned char day_channels[DAY_FIELDS] = { 2, 3, 4, 8, 13, 15 };
+
+static const int32_t day[DAY_UPLINKS][DAY_FIELDS] =
+{
+  {    31,   173,   152,  1259, 12588,     0 },
+  {    29,   173,   151,  1259, 12593,     0 },
+  {    30,   172,   151,  1261, 12604,     0 },
+  {    29,   173,   152,  1260, 12601,     0 },
+  {    25,   172,   154,  1261, 12614,     0 },
+  {    25,   171,   154,  1258, 12590,     0 },
+  {    26,   170,   154,  1259, 12592,     0 },
+  {    24,   170,   153,  1261, 12604,     0 },
+  {    22,   170,   156,  1260, 12597,     0 },
+  {    20,   169,   155,  1261, 12606,     0 },
+  {    21,   169,   156,  1258, 12585,     0 },
+  {    19,   168,   155,  1260, 12589,     0 },
+  {    18,   167,   155,  1261, 12612,     0 },
+  {    19,   167,   155,  1260, 12599,     0 },
+  {    17,   166,   158,  1261, 12609,     0 },
+  {    17,   165,   159,  1259, 12590,     0 },
+  {    18,   166,   159,  1259, 12590,     0 },
+  {    14,   166,   156,  1260, 12590,     0 },
+  {    16,   164,   157,  1260, 12604,     0 },
+  {    16,   164,   159,  1259, 12600,     0 },
+  {    15,   163,   159,  1259, 12594,     0 },
+  {    13,   163,   157,  1261, 12607,     0 },
+  {    12,   163,   159,  1261, 12603,     0 },
+  {    12,   162,   159,  1261, 12615,     0 },
+  {    12,   161,   158,  1260, 12607,     0 },
+  {    11,   162,   159,  1262, 12609,     0 },
+  {    12,   162,   160,  1261, 12604,     0 },
+  {    13,   161,   159,  1258, 12586,     0 },
+  {    11,   160,   160,  1262, 12613,     0 },
+  {    13,   161,   161,  1260, 12605,     0 },
+  {    11,   161,   158,  1258, 12586,     0 },
+  {    11,   160,   158,  1260, 12603,     0 },
+  {    11,   160,   161,  1259, 12593,     0 },
+  {    11,   160,   160,  1260, 12612,     0 },
+  {    11,   159,   161,  1260, 12595,     0 },
+  {     9,   158,   162,  1261, 12605,     0 },
+  {     8,   157,   158,  1260, 12593,     0 },
+  {     8,   158,   162,  1258, 12593,     0 },
+  {     9,   158,   162,  1261, 12610,     0 },
+  {     9,   158,   159,  1262, 12610,     0 },
+  {    10,   158,   159,  1261, 12608,     0 },
+  {    10,   156,   161,  1261, 12611,     0 },
+  {     9,   157,   159,  1260, 12604,     0 },
+  {    13,   156,   158,  1260, 12607,     0 },
+  {    12,   156,   159,  1259, 12589,     0 },
+  {    11,   156,   160,  1259, 12585,     0 },
+  {    13,   156,   158,  1260, 12609,     0 },
+  {    11,   157,   161,  1261, 12607,     0 },
+  {    12,   156,   161,  1260, 12594,     0 },
+  {    14,   156,   159,  1259, 12590,     0 },
+  {    13,   157,   158,  1261, 12614,     0 },
+  {    15,   155,   160,  1259, 12598,     0 },
+  {    14,   155,   157,  1258, 12588,     0 },
+  {    13,   156,   156,  1259, 12594,     0 },
+  {    17,   154,   157,  1260, 12595,     0 },
+  {    15,   156,   158,  1260, 12601,     0 },
+  {    15,   155,   157,  1261, 12600,     0 },
+  {    16,   156,   156,  1260, 12593,     0 },
+  {    17,   155,   157,  1259, 12595,     0 },
+  {    20,   156,   156,  1261, 12609,     0 },
+  {    18,   156,   155,  1260, 12607,     0 },
+  {    19,   155,   157,  1259, 12586,     0 },
+  {    23,   155,   155,  1262, 12610,     0 },
+  {    24,   155,   154,  1258, 12592,     0 },
+  {    23,   155,   155,  1261, 12611,     0 },
+  {    22,   155,   154,  1259, 12594,     0 },
+  {    25,   155,   153,  1259, 12591,     0 },
+  {    25,   155,   152,  1259, 12603,     0 },
+  {    28,   156,   152,  1259, 12585,     0 },
+  {    26,   156,   151,  1258, 12585,     0 },
+  {    29,   156,   153,  1259, 12587,     0 },
+  {    31,   156,   152,  1260, 12599,     0 },
+  {    30,   156,   153,  1261, 12609,     0 },
+  {    33,   156,   151,  1262, 12616,     0 },
+  {    31,   155,   150,  1263, 12622,     0 },
+  {    33,   156,   151,  1264, 12636,     0 },
+  {    34,   156,   147,  1266, 12651,     0 },
+  {    36,   157,   148,  1267, 12669,     0 },
+  {    37,   156,   147,  1268, 12683,     0 },
+  {    40,   157,   148,  1272, 12714,     1 },
+  {    42,   157,   149,  1273, 12729,     1 },
+  {    41,   157,   148,  1273, 12724,     1 },
+  {    41,   157,   146,  1275, 12757,     1 },
+  {    43,   159,   147,  1276, 12758,     1 },
+  {    44,   159,   144,  1280, 12789,     2 },
+  {    48,   159,   145,  1279, 12783,     2 },
+  {    47,   159,   142,  1280, 12796,     2 },
+  {    48,   159,   145,  1281, 12813,     2 },
+  {    52,   159,   145,  1286, 12852,     3 },
+  {    51,   159,   142,  1285, 12839,     3 },
+  {    55,   160,   142,  1286, 12860,     3 },
+  {    56,   161,   142,  1288, 12870,     4 },
+  {    57,   161,   139,  1289, 12896,     4 },
+  {    58,   161,   139,  1290, 12900,     4 },
+  {    59,   161,   137,  1293, 12926,     5 },
+  {    59,   162,   140,  1292, 12923,     5 },
+  {    63,   163,   137,  1295, 12942,     6 },
+  {    61,   163,   139,  1298, 12970,     6 },
+  {    65,   163,   134,  1296, 12964,     7 },
+  {    68,   163,   135,  1300, 12991,     7 },
+  {    67,   164,   134,  1301, 13014,     8 },
+  {    69,   163,   135,  1302, 13013,     8 },
+  {    70,   165,   134,  1303, 13022,     9 },
+  {    72,   165,   132,  1306, 13049,     9 },
+  {    75,   165,   132,  1306, 13057,    10 },
+  {    77,   165,   130,  1308, 13075,    11 },
+  {    76,   168,   131,  1307, 13069,    11 },
+  {    77,   167,   132,  1310, 13095,    12 },
+  {    82,   168,   130,  1311, 13107,    12 },
+  {    84,   169,   129,  1309, 13091,    13 },
+  {    83,   168,   127,  1312, 13121,    14 },
+  {    83,   169,   128,  1313, 13128,    14 },
+  {    87,   169,   126,  1314, 13133,    15 },
+  {    87,   170,   125,  1315, 13153,    16 },
+  {    90,   171,   127,  1316, 13169,    16 },
+  {    91,   171,   125,  1315, 13150,    17 },
+  {    93,   172,   123,  1316, 13166,    18 },
+  {    95,   172,   124,  1318, 13180,    19 },
+  {    95,   173,   124,  1318, 13180,    19 },
+  {    98,   173,   121,  1320, 13207,    20 },
+  {    99,   174,   124,  1320, 13198,    21 },
+  {   101,   174,   121,  1322, 13206,    22 },
+  {   103,   176,   119,  1322, 13230,    23 },
+  {   104,   175,   120,  1324, 13236,    23 },
+  {   104,   176,   121,  1325, 13246,    24 },
+  {   103,   177,   118,  1324, 13246,    25 },
+  {   108,   177,   118,  1326, 13246,    26 },
+  {   109,   178,   118,  1325, 13253,    27 },
+  {   109,   178,   115,  1327, 13264,    28 },
+  {   109,   179,   118,  1326, 13267,    28 },
+  {   111,   179,   116,  1327, 13270,    29 },
+  {   113,   180,   116,  1327, 13280,    30 },
+  {   115,   180,   115,  1326, 13265,    31 },
+  {   114,   181,   116,  1327, 13272,    32 },
+  {   118,   181,   115,  1328, 13279,    33 },
+  {   119,   181,   114,  1329, 13294,    34 },
+  {   119,   182,   113,  1329, 13298,    35 },
+  {   120,   183,   111,  1329, 13288,    35 },
+  {   124,   184,   110,  1329, 13293,    36 },
+  {   123,   183,   110,  1329, 13281,    37 },
+  {   124,   185,   113,  1331, 13305,    38 },
+  {   126,   186,   110,  1329, 13302,    39 },
+  {   128,   186,   109,  1331, 13311,    40 },
+  {   130,   185,   110,  1331, 13308,    41 },
+  {   129,   186,   109,  1328, 13288,    42 },
+  {   131,   186,   108,  1329, 13286,    43 },
+  {   133,   187,   107,  1330, 13306,    44 },
+  {   133,   188,   106,  1331, 13311,    44 },
+  {   132,   189,   106,  1331, 13311,    45 },
+  {   135,   189,   108,  1329, 13288,    46 },
+  {   135,   189,   106,  1330, 13293,    47 },
+  {   136,   189,   108,  1331, 13306,    48 },
+  {   136,   190,   106,  1330, 13293,    49 },
+  {   138,   191,   105,  1328, 13280,    50 },
+  {   138,   192,   104,  1328, 13276,    51 },
+  {   140,   192,   103,  1327, 13280,    51 },
+  {   142,   193,   102,  1327, 13262,    52 },
+  {   141,   194,   105,  1327, 13279,    53 },
+  {   143,   193,   103,  1327, 13278,    54 },
+  {   142,   195,   105,  1326, 13265,    55 },
+  {   143,   195,   104,  1327, 13261,    56 },
+  {   145,   194,   103,  1325, 13250,    57 },
+  {   143,   195,   102,  1325, 13258,    57 },
+  {   147,   195,   101,  1323, 13231,    58 },
+  {   146,   196,   103,  1324, 13230,    59 },
+  {   145,   196,   101,  1323, 13230,    60 },
+  {   146,   198,   103,  1322, 13231,    61 },
+  {   146,   198,   101,  1320, 13204,    61 },
+  {   148,   198,    99,  1320, 13195,    62 },
+  {   147,   199,   100,  1319, 13190,    63 },
+  {   150,   198,   100,  1320, 13193,    64 },
+  {   147,   199,    99,  1319, 13189,    65 },
+  {   148,   200,   100,  1318, 13179,    65 },
+  {   149,   199,   100,  1315, 13154,    66 },
+  {   148,   200,    98,  1316, 13167,    67 },
+  {   148,   200,   100,  1315, 13146,    67 },
+  {   150,   201,    99,  1315, 13140,    68 },
+  {   151,   201,   100,  1311, 13113,    69 },
+  {   148,   201,    98,  1312, 13120,    69 },
+  {   151,   201,   100,  1312, 13115,    70 },
+  {   151,   202,   102,  1311, 13103,    71 },
+  {   149,   201,   100,  1306, 13072,    71 },
+  {   151,   201,   101,  1309, 13085,    72 },
+  {   149,   203,    99,  1306, 13057,    73 },
+  {   149,   203,    99,  1305, 13043,    73 },
+  {   150,   203,    98,  1304, 13041,    74 },
+  {   150,   202,    99,  1303, 13028,    74 },
+  {   151,   203,    99,  1303, 13021,    75 },
+  {   148,   203,   100,  1300, 13005,    75 },
+  {   148,   203,    99,  1298, 12978,    76 },
+  {   149,   205,    99,  1298, 12973,    76 },
+  {   147,   203,   100,  1296, 12958,    77 },
+  {   147,   204,   102,  1295, 12942,    77 },
+  {   147,   205,   103,  1295, 12944,    78 },
+  {   148,   205,   101,  1291, 12909,    78 },
+  {   147,   204,   100,  1291, 12912,    78 },
+  {   147,   205,   103,  1290, 12901,    79 },
+  {   144,   205,   102,  1288, 12875,    79 },
+  {   145,   204,   101,  1288, 12878,    80 },
+  {   145,   205,   103,  1286, 12856,    80 },
+  {   143,   205,   101,  1286, 12851,    80 },
+  {   143,   205,   101,  1284, 12838,    80 },
+  {   140,   205,   102,  1281, 12811,    81 },
+  {   141,   205,   105,  1280, 12808,    81 },
+  {   141,   205,   102,  1277, 12766,    81 },
+  {   141,   204,   103,  1276, 12755,    81 },
+  {   141,   204,   104,  1276, 12765,    82 },
+  {   137,   204,   105,  1273, 12722,    82 },
+  {   138,   204,   106,  1272, 12728,    82 },
+  {   136,   204,   104,  1271, 12718,    82 },
+  {   136,   204,   105,  1271, 12706,    82 },
+  {   135,   205,   105,  1267, 12676,    82 },
+  {   133,   205,   106,  1265, 12648,    82 },
+  {   132,   204,   106,  1262, 12632,    82 },
+  {   131,   205,   106,  1264, 12635,    82 },
+  {   132,   204,   109,  1260, 12601,    83 },
+  {   129,   204,   108,  1259, 12593,    83 },
+  {   129,   205,   109,  1261, 12606,    83 },
+  {   125,   204,   110,  1260, 12595,    83 },
+  {   124,   203,   112,  1260, 12610,    83 },
+  {   124,   204,   111,  1260, 12606,    83 },
+  {   125,   202,   112,  1259, 12594,    83 },
+  {   124,   202,   112,  1261, 12612,    83 },
+  {   123,   203,   113,  1260, 12597,    83 },
+  {   121,   202,   111,  1261, 12610,    83 },
+  {   118,   203,   115,  1260, 12593,    83 },
+  {   119,   202,   113,  1261, 12606,    83 },
+  {   116,   202,   115,  1260, 12606,    83 },
+  {   116,   202,   114,  1261, 12606,    83 },
+  {   115,   202,   115,  1260, 12606,    83 },
+  {   114,   201,   117,  1260, 12605,    83 },
+  {   110,   201,   115,  1260, 12606,    83 },
+  {   110,   201,   116,  1259, 12592,    83 },
+  {   107,   200,   116,  1259, 12589,    83 },
+  {   109,   200,   118,  1260, 12608,    83 },
+  {   104,   199,   121,  1259, 12594,    83 },
+  {   106,   200,   118,  1260, 12602,    83 },
+  {   104,   199,   121,  1260, 12607,    83 },
+  {   100,   198,   123,  1260, 12600,    83 },
+  {   101,   199,   123,  1260, 12588,    83 },
+  {    99,   197,   123,  1258, 12590,    83 },
+  {    98,   198,   124,  1261, 12609,    83 },
+  {    94,   196,   123,  1261, 12612,    83 },
+  {    95,   196,   123,  1259, 12600,    83 },
+  {    93,   196,   124,  1260, 12605,    83 },
+  {    92,   196,   126,  1260, 12609,    83 },
+  {    88,   196,   127,  1259, 12586,    83 },
+  {    87,   195,   126,  1259, 12598,    83 },
+  {    87,   195,   128,  1261, 12607,    83 },
+  {    84,   193,   129,  1260, 12591,    83 },
+  {    84,   193,   131,  1262, 12613,    83 },
+  {    80,   194,   128,  1261, 12614,    83 },
+  {    80,   192,   132,  1260, 12610,    83 },
+  {    78,   192,   132,  1260, 12590,    83 },
+  {    77,   191,   133,  1261, 12598,    83 },
+  {    77,   191,   131,  1259, 12603,    83 },
+  {    75,   191,   133,  1261, 12603,    83 },
+  {    74,   190,   133,  1261, 12606,    83 },
+  {    72,   190,   135,  1259, 12595,    83 },
+  {    68,   189,   134,  1259, 12587,    83 },
+  {    69,   188,   136,  1259, 12600,    83 },
+  {    65,   189,   135,  1262, 12613,    83 },
+  {    65,   187,   137,  1260, 12609,    83 },
+  {    62,   187,   137,  1260, 12604,    83 },
+  {    61,   187,   137,  1260, 12590,    83 },
+  {    62,   186,   139,  1259, 12599,    83 },
+  {    58,   185,   139,  1260, 12603,    83 },
+  {    56,   185,   141,  1259, 12600,    83 },
+  {    56,   184,   141,  1261, 12604,    83 },
+  {    56,   184,   142,  1261, 12608,    83 },
+  {    55,   184,   141,  1259, 12590,    83 },
+  {    51,   183,   143,  1260, 12609,    83 },
+  {    51,   182,   143,  1259, 12604,    83 },
+  {    47,   181,   144,  1259, 12588,    83 },
+  {    47,   182,   142,  1259, 12588,    83 },
+  {    48,   181,   145,  1259, 12595,    83 },
+  {    44,   180,   146,  1260, 12610,    83 },
+  {    45,   180,   147,  1261, 12606,    83 },
+  {    41,   179,   146,  1261, 12604,    83 },
+  {    41,   178,   145,  1260, 12594,    83 },
+  {    39,   177,   148,  1262, 12607,    83 },
+  {    38,   177,   147,  1260, 12610,    83 },
+  {    37,   176,   149,  1260, 12600,    83 },
+  {    36,   177,   149,  1260, 12591,    83 },
+  {    33,   175,   150,  1259, 12588,    83 },
+  {    36,   174,   149,  1260, 12593,    83 },
+  {    33,   175,   150,  1259, 12593,    83 },
+  {    30,   174,   152,  1260, 12590,    83 }
+};
+
+#endif // DAY_H
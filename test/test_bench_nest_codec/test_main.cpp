@@ -0,0 +1,79 @@
+/**
+ * Benchmark of the uplink format: bytes of a day of uplinks with NestCodec against Cayenne LPP,
+ * with an acknowledged keyframe every hour and deltas in between
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <CayenneLPP.h>
+#include "NestCodec.h"
+#include "day.h"
+
+// Uplinks per hour at one uplink every 5 minutes
+#define KEYFRAME_INTERVAL 12
+
+/**
+ * Size of the fields of an uplink as Cayenne LPP, with the LPP types channels 2 .. 15 had before NestCodec
+ */
+static size_t lpp_size (const int32_t* row)
+{
+  CayenneLPP lpp(51);
+  lpp.addTemperature(2, row[0] / 10.0f);
+  lpp.addTemperature(3, row[1] / 10.0f);
+  lpp.addRelativeHumidity(4, row[2] / 2.0f);
+  lpp.addAnalogInput(8, row[3] / 100.0f);
+  lpp.addAnalogInput(13, row[4] / 1000.0f);
+  lpp.addAnalogInput(15, row[5] / 100.0f);
+  return lpp.getSize();
+}
+
+void setUp () {}
+void tearDown () {}
+
+void test_day_against_cayenne_lpp ()
+{
+  NestEncoder encoder;
+  NestDecoder decoder;
+  size_t nest_bytes = 0, lpp_bytes = 0, keyframe_bytes = 0;
+  int64_t ns = 0;
+
+  for (size_t i = 0; i < DAY_UPLINKS; i++)
+  {
+    bool keyframe = i % KEYFRAME_INTERVAL == 0;
+    auto start = std::chrono::steady_clock::now();
+    encoder.begin(keyframe);
+    for (size_t f = 0; f < DAY_FIELDS; f++) TEST_ASSERT_TRUE(encoder.add(day_channels[f], day[i][f]));
+    size_t size = encoder.finish();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    // every keyframe is acknowledged
+    if (keyframe) encoder.acknowledge();
+
+    nest_bytes += size;
+    if (keyframe) keyframe_bytes += size;
+    lpp_bytes += lpp_size(day[i]);
+
+    int32_t values[NEST_CODEC_CHANNELS];
+    bool present[NEST_CODEC_CHANNELS];
+    TEST_ASSERT_TRUE(decoder.decode(encoder.get_buffer(), size, values, present));
+    for (size_t f = 0; f < DAY_FIELDS; f++)
+    {
+      TEST_ASSERT_TRUE(present[day_channels[f]]);
+      TEST_ASSERT_EQUAL_INT32(day[i][f], values[day_channels[f]]);
+    }
+  }
+
+  char message[160];
+  snprintf(message, sizeof message, "%d uplinks of %d fields: NestCodec %zu bytes (keyframes %zu), Cayenne LPP %zu bytes, %.0f %%",
+           DAY_UPLINKS, DAY_FIELDS, nest_bytes, keyframe_bytes, lpp_bytes, 100.0 * nest_bytes / lpp_bytes);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof message, "NestCodec: %.0f ns per payload", (double)ns / DAY_UPLINKS);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(lpp_bytes / 2, nest_bytes);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_day_against_cayenne_lpp);
+  return UNITY_END();
+}
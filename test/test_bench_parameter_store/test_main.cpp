@@ -0,0 +1,130 @@
+/**
+ * Benchmark of ParameterStore against the std::maps of std::vectors it replaced in main.cpp:
+ * time and heap allocations of setting, getting and marking values as sent
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <map>
+#include <new>
+#include <vector>
+#include "ParameterStore.h"
+
+// Built for the esp32 only as part of SerialCommHelper
+#include "DataStructure.cpp"
+#include "ParameterStore.cpp"
+
+#define ROUNDS 20000
+
+static size_t allocations = 0;
+
+void* operator new (size_t size)
+{
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete (void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+  free(p);
+}
+
+/**
+ * map_data and prev_sent_data of main.cpp before ParameterStore
+ */
+class MapStore
+{
+public:
+  std::map<unsigned char, std::vector<unsigned char>> map_data, prev_sent_data;
+
+  void set (unsigned char code, const unsigned char* data)
+  {
+    unsigned char size = get_parameter_size(code);
+    if (size == 0 || data == nullptr) return;
+    std::vector<unsigned char> v(data, data + size);
+    if (map_data.count(code) == 0) map_data.insert(std::make_pair(code, v));
+    else map_data[code] = v;
+  }
+
+  bool get (unsigned char code, unsigned char* data)
+  {
+    if (map_data.count(code) == 0) return false;
+    memcpy(data, map_data[code].data(), map_data[code].size());
+    return true;
+  }
+
+  void mark_sent (unsigned char code)
+  {
+    if (map_data.count(code) != 0) prev_sent_data[code] = map_data[code];
+  }
+};
+
+struct Result
+{
+  double ns_per_op;
+  double allocations_per_op;
+  unsigned long checksum;
+};
+
+/**
+ * Set every parameter, read it back and mark every fourth round as sent
+ */
+template <typename Store> static Result run (Store& store)
+{
+  unsigned char data[PARAMETER_SIZE_MAX], value[PARAMETER_SIZE_MAX];
+  unsigned long checksum = 0;
+  size_t ops = 0;
+
+  allocations = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int round = 0; round < ROUNDS; round++)
+  {
+    for (unsigned char code = 1; code < PARAMETER_COUNT; code++)
+    {
+      data[0] = round >> 8;
+      data[1] = round + code;
+      store.set(code, data);
+      store.get(code, value);
+      checksum += value[0];
+      if (round % 4 == 0) store.mark_sent(code);
+      ops++;
+    }
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  return { (double)ns / ops, (double)allocations / ops, checksum };
+}
+
+void setUp () {}
+void tearDown () {}
+
+void test_parameter_store_against_maps ()
+{
+  static ParameterStore store;
+  MapStore maps;
+  Result flat = run(store);
+  Result tree = run(maps);
+
+  char message[128];
+  snprintf(message, sizeof message, "ParameterStore: %.1f ns, %.2f allocations per set/get", flat.ns_per_op, flat.allocations_per_op);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof message, "std::map of std::vector: %.1f ns, %.2f allocations per set/get", tree.ns_per_op, tree.allocations_per_op);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_EQUAL(tree.checksum, flat.checksum);
+  TEST_ASSERT_EQUAL(0, flat.allocations_per_op);
+  TEST_ASSERT_GREATER_OR_EQUAL(1, tree.allocations_per_op);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_parameter_store_against_maps);
+  return UNITY_END();
+}
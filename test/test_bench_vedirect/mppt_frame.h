@@ -0,0 +1,31 @@
+/**
+ * Text protocol frame of a BlueSolar MPPT 75/15 with the load output on, composed after the VE.Direct protocol
+ * description. The checksum byte is appended by the test, so the bytes of the frame add up to 0.
+ */
+
+#ifndef MPPT_FRAME_H
+#define MPPT_FRAME_H
+
+static const char mppt_frame[] =
+  "\r\nPID\t0xA053"
+  "\r\nFW\t159"
+  "\r\nSER#\tHQ2132ABCDE"
+  "\r\nV\t12800"
+  "\r\nI\t-250"
+  "\r\nVPV\t18540"
+  "\r\nPPV\t0"
+  "\r\nCS\t0"
+  "\r\nMPPT\t0"
+  "\r\nOR\t0x00000001"
+  "\r\nERR\t0"
+  "\r\nLOAD\tON"
+  "\r\nIL\t250"
+  "\r\nH19\t1234"
+  "\r\nH20\t12"
+  "\r\nH21\t95"
+  "\r\nH22\t34"
+  "\r\nH23\t180"
+  "\r\nHSDS\t17"
+  "\r\nChecksum\t";
+
+#endif // MPPT_FRAME_H
@@ -0,0 +1,126 @@
+/**
+ * Benchmark of VeDirectFrameHandler: frames per second and heap allocations per frame when replaying an MPPT frame,
+ * after checking the values parsed from it
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <new>
+#include "VeDirectFrameHandler.h"
+#include "mppt_frame.h"
+
+#define FRAMES 20000
+
+static size_t allocations = 0;
+
+void* operator new (size_t size)
+{
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete (void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+  free(p);
+}
+
+static std::string frame;
+
+/**
+ * mppt_frame with the checksum byte that makes the bytes of the frame add up to 0
+ */
+static std::string checksummed (const char* text)
+{
+  std::string f(text);
+  uint8_t sum = 0;
+  for (char c : f) sum += (uint8_t)c;
+  f.push_back((char)(uint8_t)(0x100 - sum));
+  return f;
+}
+
+static void replay (VeDirectFrameHandler& handler, const std::string& data)
+{
+  for (char c : data) handler.rxData((uint8_t)c);
+}
+
+void setUp ()
+{
+  frame = checksummed(mppt_frame);
+}
+
+void tearDown () {}
+
+void test_values_of_the_frame ()
+{
+  VeDirectFrameHandler handler;
+  replay(handler, frame);
+
+  int32_t value = 0;
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::V, value));
+  TEST_ASSERT_EQUAL_INT32(12800, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::I, value));
+  TEST_ASSERT_EQUAL_INT32(-250, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::PID, value));
+  TEST_ASSERT_EQUAL_INT32(0xA053, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::OR, value));
+  TEST_ASSERT_EQUAL_INT32(1, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::LOAD, value));
+  TEST_ASSERT_EQUAL_INT32(1, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::IL, value));
+  TEST_ASSERT_EQUAL_INT32(250, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::H20, value));
+  TEST_ASSERT_EQUAL_INT32(12, value);
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::HSDS, value));
+  TEST_ASSERT_EQUAL_INT32(17, value);
+  TEST_ASSERT_FALSE(handler.hasValue(VeLabel::SOC));
+}
+
+void test_frame_with_bad_checksum_is_rejected ()
+{
+  VeDirectFrameHandler handler;
+  std::string bad = frame;
+  bad[bad.find("12800") + 1] = '3';
+  replay(handler, bad);
+  TEST_ASSERT_FALSE(handler.hasValue(VeLabel::V));
+
+  // The next valid frame is accepted again
+  replay(handler, frame);
+  TEST_ASSERT_TRUE(handler.hasValue(VeLabel::V));
+}
+
+void test_frames_per_second ()
+{
+  VeDirectFrameHandler handler;
+  replay(handler, frame);
+
+  allocations = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < FRAMES; i++) replay(handler, frame);
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  char message[128];
+  snprintf(message, sizeof message, "%zu byte frame: %.0f frames/s, %.1f ns/byte, %.2f allocations per frame",
+           frame.size(), FRAMES * 1e9 / ns, (double)ns / FRAMES / frame.size(), (double)allocations / FRAMES);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, allocations);
+
+  int32_t value = 0;
+  TEST_ASSERT_TRUE(handler.getValue(VeLabel::VPV, value));
+  TEST_ASSERT_EQUAL_INT32(18540, value);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_values_of_the_frame);
+  RUN_TEST(test_frame_with_bad_checksum_is_rejected);
+  RUN_TEST(test_frames_per_second);
+  return UNITY_END();
+}
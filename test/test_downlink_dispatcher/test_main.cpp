@@ -0,0 +1,343 @@
+/**
+ * Host tests of DownlinkDispatcher: accepted frames, every reason to reject one and a deterministic fuzz loop over
+ * truncated, resized and bit flipped frames. Run it under AddressSanitizer with pio test -e native_asan
+ */
+
+#include <unity.h>
+#include <string.h>
+#include <vector>
+#include "DownlinkDispatcher.h"
+
+#define FUZZ_ITERATIONS 50000
+
+static const uint8_t key[DOWNLINK_KEY_SIZE] = { 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19 };
+static const uint8_t device_id[DOWNLINK_DEVICE_ID_SIZE] = { 0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x00, 0x00, 0x01 };
+
+static DownlinkDispatcher dispatcher;
+
+// Calls of the handlers, in order
+static std::vector<uint8_t> calls;
+static std::vector<uint8_t> last_args;
+static uint32_t persisted_counter;
+
+static bool handle_ok (const uint8_t* args, size_t len)
+{
+  calls.push_back(0x01);
+  last_args.assign(args, args + len);
+  return true;
+}
+
+static bool handle_fail (const uint8_t* args, size_t len)
+{
+  calls.push_back(0x02);
+  return false;
+}
+
+static void persist_counter (uint32_t counter)
+{
+  persisted_counter = counter;
+}
+
+/**
+ * Frame of a counter and commands, authenticated with a key and device id
+ */
+static std::vector<uint8_t> frame (uint32_t counter, std::vector<uint8_t> commands,
+                                   const uint8_t* frame_key = key, const uint8_t* frame_device_id = device_id)
+{
+  std::vector<uint8_t> data = { (uint8_t)(counter >> 24), (uint8_t)(counter >> 16), (uint8_t)(counter >> 8), (uint8_t)counter };
+  data.insert(data.end(), commands.begin(), commands.end());
+
+  uint8_t mac[crypto_auth_hmacsha256_BYTES];
+  crypto_auth_hmacsha256_state state;
+  crypto_auth_hmacsha256_init(&state, frame_key, DOWNLINK_KEY_SIZE);
+  crypto_auth_hmacsha256_update(&state, frame_device_id, DOWNLINK_DEVICE_ID_SIZE);
+  crypto_auth_hmacsha256_update(&state, data.data(), data.size());
+  crypto_auth_hmacsha256_final(&state, mac);
+  data.insert(data.end(), mac, mac + DOWNLINK_MAC_SIZE);
+  return data;
+}
+
+static int parse (const std::vector<uint8_t>& data)
+{
+  return dispatcher.parse(data.data(), data.size());
+}
+
+void setUp ()
+{
+  dispatcher = DownlinkDispatcher();
+  dispatcher.set_key(key, device_id);
+  dispatcher.set_counter_callback(persist_counter);
+  dispatcher.add({ 0x01, 0, 2, handle_ok, "ok" });
+  dispatcher.add({ 0x02, 1, 1, handle_fail, "fail" });
+  calls.clear();
+  last_args.clear();
+  persisted_counter = 0;
+}
+
+void tearDown () {}
+
+void test_add ()
+{
+  TEST_ASSERT_EQUAL(2, dispatcher.get_command_count());
+  TEST_ASSERT_FALSE(dispatcher.add({ 0x01, 0, 0, handle_ok, "taken" }));
+  TEST_ASSERT_FALSE(dispatcher.add({ 0x03, 0, 0, nullptr, "no handler" }));
+  TEST_ASSERT_EQUAL(2, dispatcher.get_command_count());
+}
+
+void test_accepted_frame_runs_every_command ()
+{
+  TEST_ASSERT_EQUAL(2, parse(frame(5, { 0x01, 0x02, 0xAB, 0xCD, 0x02, 0x01, 0x00, 0x01, 0x00 })));
+  TEST_ASSERT_EQUAL(3, calls.size());
+  TEST_ASSERT_EQUAL(0x01, calls[0]);
+  TEST_ASSERT_EQUAL(0x02, calls[1]);
+  TEST_ASSERT_EQUAL(0x01, calls[2]);
+  TEST_ASSERT_EQUAL(0, last_args.size());
+  TEST_ASSERT_EQUAL(5, dispatcher.get_counter());
+  TEST_ASSERT_EQUAL(5, persisted_counter);
+
+  // a frame without commands only advances the counter
+  TEST_ASSERT_EQUAL(0, parse(frame(6, {})));
+  TEST_ASSERT_EQUAL(6, dispatcher.get_counter());
+}
+
+void test_reject_without_key ()
+{
+  DownlinkDispatcher unkeyed;
+  unkeyed.add({ 0x01, 0, 2, handle_ok, "ok" });
+  std::vector<uint8_t> data = frame(1, { 0x01, 0x00 });
+  TEST_ASSERT_EQUAL(-1, unkeyed.parse(data.data(), data.size()));
+  TEST_ASSERT_EQUAL(0, calls.size());
+}
+
+void test_reject_short_frame ()
+{
+  std::vector<uint8_t> data = frame(1, {});
+  TEST_ASSERT_EQUAL(-1, dispatcher.parse(data.data(), data.size() - 1));
+  TEST_ASSERT_EQUAL(-1, dispatcher.parse(data.data(), 0));
+}
+
+void test_reject_wrong_mac ()
+{
+  std::vector<uint8_t> data = frame(1, { 0x01, 0x00 });
+  data[4] ^= 0x01;
+  TEST_ASSERT_EQUAL(-1, parse(data));
+
+  data = frame(1, { 0x01, 0x00 });
+  data.back() ^= 0x80;
+  TEST_ASSERT_EQUAL(-1, parse(data));
+
+  uint8_t other_key[DOWNLINK_KEY_SIZE] = { 0x20 };
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x01, 0x00 }, other_key)));
+
+  // a frame for another device with the same key
+  uint8_t other_device_id[DOWNLINK_DEVICE_ID_SIZE] = { 0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x00, 0x00, 0x02 };
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x01, 0x00 }, key, other_device_id)));
+
+  TEST_ASSERT_EQUAL(0, calls.size());
+  TEST_ASSERT_EQUAL(0, dispatcher.get_counter());
+}
+
+void test_reject_replay ()
+{
+  std::vector<uint8_t> data = frame(10, { 0x01, 0x00 });
+  TEST_ASSERT_EQUAL(1, parse(data));
+  TEST_ASSERT_EQUAL(-1, parse(data));
+  TEST_ASSERT_EQUAL(-1, parse(frame(9, { 0x01, 0x00 })));
+  TEST_ASSERT_EQUAL(1, calls.size());
+
+  // the counter persisted before a reset is restored
+  dispatcher.set_counter(100);
+  TEST_ASSERT_EQUAL(-1, parse(frame(100, { 0x01, 0x00 })));
+  TEST_ASSERT_EQUAL(1, parse(frame(101, { 0x01, 0x00 })));
+}
+
+void test_reject_invalid_commands ()
+{
+  // unknown opcode
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x01, 0x00, 0x7F, 0x00 })));
+  // argument length out of the range of the command
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x01, 0x03, 0x00, 0x00, 0x00 })));
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x02, 0x00 })));
+  // arguments beyond the end of the commands
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x01, 0x02, 0x00 })));
+  // opcode without length byte
+  TEST_ASSERT_EQUAL(-1, parse(frame(1, { 0x01, 0x00, 0x01 })));
+
+  // the valid commands in front of an invalid one are not run, the counter does not advance
+  TEST_ASSERT_EQUAL(0, calls.size());
+  TEST_ASSERT_EQUAL(0, dispatcher.get_counter());
+  TEST_ASSERT_EQUAL(0, persisted_counter);
+  TEST_ASSERT_EQUAL(1, parse(frame(1, { 0x01, 0x00 })));
+}
+
+/**
+ * Deterministic pseudo random numbers, xorshift32
+ */
+static uint32_t fuzz_state;
+
+static uint32_t fuzz_next ()
+{
+  fuzz_state ^= fuzz_state << 13;
+  fuzz_state ^= fuzz_state >> 17;
+  fuzz_state ^= fuzz_state << 5;
+  return fuzz_state;
+}
+
+static uint32_t fuzz_below (uint32_t n)
+{
+  return fuzz_next() % n;
+}
+
+/**
+ * Random commands; valid ones of the table, with an invalid opcode, length or truncation if invalid is set
+ */
+static std::vector<uint8_t> fuzz_commands (bool invalid)
+{
+  std::vector<uint8_t> commands;
+  size_t count = fuzz_below(5);
+  for (size_t i = 0; i < count; i++)
+  {
+    if (fuzz_below(2))
+    {
+      size_t args = fuzz_below(3);
+      commands.push_back(0x01);
+      commands.push_back(args);
+      for (size_t j = 0; j < args; j++) commands.push_back(fuzz_next());
+    }
+    else
+    {
+      commands.push_back(0x02);
+      commands.push_back(0x01);
+      commands.push_back(fuzz_next());
+    }
+  }
+  if (invalid)
+  {
+    switch (fuzz_below(3))
+    {
+      case 0: commands.push_back(0x03 + fuzz_below(0xFD)); commands.push_back(0x00); break;
+      case 1: commands.push_back(0x02); commands.push_back(fuzz_below(2) ? 0x00 : 0x02 + fuzz_below(0xFE)); break;
+      default: commands.push_back(0x01); break;
+    }
+  }
+  return commands;
+}
+
+/**
+ * Number of handler calls and of calls that succeed for valid commands
+ */
+static void fuzz_expected (const std::vector<uint8_t>& commands, size_t& runs, int& done)
+{
+  runs = 0;
+  done = 0;
+  for (size_t i = 0; i < commands.size(); i += 2 + commands[i + 1])
+  {
+    runs++;
+    if (commands[i] == 0x01) done++;
+  }
+}
+
+void test_fuzz_mutated_frames_run_no_handler ()
+{
+  fuzz_state = 0x2545F491;
+  size_t accepted = 0;
+  for (int n = 0; n < FUZZ_ITERATIONS; n++)
+  {
+    uint32_t counter = dispatcher.get_counter();
+    std::vector<uint8_t> commands = fuzz_commands(false);
+    std::vector<uint8_t> data = frame(counter + 1, commands);
+    std::vector<uint8_t> mutated = data;
+
+    switch (fuzz_below(4))
+    {
+      case 0:
+        // truncated
+        mutated.resize(fuzz_below(data.size()));
+        break;
+      case 1:
+        // random length and bytes
+        mutated.resize(fuzz_below(64));
+        for (uint8_t& b : mutated) b = fuzz_next();
+        break;
+      case 2:
+        // bytes appended
+        for (size_t i = 1 + fuzz_below(4); i > 0; i--) mutated.push_back(fuzz_next());
+        break;
+      default:
+        // bits flipped
+        for (size_t i = 1 + fuzz_below(4); i > 0; i--) mutated[fuzz_below(mutated.size())] ^= 1 << fuzz_below(8);
+        break;
+    }
+    if (mutated == data) continue;
+
+    // the buffer holds exactly the mutated frame, so ASan catches every read past its end
+    uint8_t* buffer = new uint8_t[mutated.size() + 1];
+    memcpy(buffer, mutated.data(), mutated.size());
+    int result = dispatcher.parse(mutated.empty() ? nullptr : buffer, mutated.size());
+    delete[] buffer;
+    TEST_ASSERT_EQUAL(-1, result);
+    TEST_ASSERT_EQUAL(0, calls.size());
+    TEST_ASSERT_EQUAL(counter, dispatcher.get_counter());
+
+    // every so often the unmodified frame, which is still accepted
+    if (n % 16 == 0)
+    {
+      size_t runs;
+      int done;
+      fuzz_expected(commands, runs, done);
+      TEST_ASSERT_EQUAL(done, parse(data));
+      TEST_ASSERT_EQUAL(runs, calls.size());
+      TEST_ASSERT_EQUAL(counter + 1, dispatcher.get_counter());
+      calls.clear();
+      accepted++;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(0, accepted);
+}
+
+void test_fuzz_signed_commands_run_only_if_valid ()
+{
+  fuzz_state = 0x9E3779B9;
+  size_t rejected = 0;
+  for (int n = 0; n < FUZZ_ITERATIONS; n++)
+  {
+    uint32_t counter = dispatcher.get_counter();
+    bool invalid = fuzz_below(2);
+    std::vector<uint8_t> commands = fuzz_commands(invalid);
+    calls.clear();
+
+    int result = parse(frame(counter + 1, commands));
+    if (invalid)
+    {
+      TEST_ASSERT_EQUAL(-1, result);
+      TEST_ASSERT_EQUAL(0, calls.size());
+      TEST_ASSERT_EQUAL(counter, dispatcher.get_counter());
+      rejected++;
+    }
+    else
+    {
+      size_t runs;
+      int done;
+      fuzz_expected(commands, runs, done);
+      TEST_ASSERT_EQUAL(done, result);
+      TEST_ASSERT_EQUAL(runs, calls.size());
+      TEST_ASSERT_EQUAL(counter + 1, dispatcher.get_counter());
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(0, rejected);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_add);
+  RUN_TEST(test_accepted_frame_runs_every_command);
+  RUN_TEST(test_reject_without_key);
+  RUN_TEST(test_reject_short_frame);
+  RUN_TEST(test_reject_wrong_mac);
+  RUN_TEST(test_reject_replay);
+  RUN_TEST(test_reject_invalid_commands);
+  RUN_TEST(test_fuzz_mutated_frames_run_no_handler);
+  RUN_TEST(test_fuzz_signed_commands_run_only_if_valid);
+  return UNITY_END();
+}
@@ -0,0 +1,125 @@
+/**
+ * Host tests of EnergyMeter: 64 bit products, clock wraparound, gaps, the carried remainder and the slot ring
+ */
+
+#include <unity.h>
+#include "EnergyMeter.h"
+
+static EnergyMeter meter;
+
+void setUp ()
+{
+  meter = EnergyMeter();
+}
+
+void tearDown () {}
+
+void test_large_products_do_not_overflow ()
+{
+  // 60 V at 100 A is 6 kW, 6e9 µW beyond the 32 bit range, for the longest integrated gap
+  meter.add_sample(60000, 100000, 0);
+  meter.add_sample(60000, 100000, ENERGY_METER_MAX_GAP_MS);
+  TEST_ASSERT_EQUAL_INT64(6000000000LL * ENERGY_METER_MAX_GAP_MS / 1000, meter.get_energy());
+
+  // the largest 32 bit inputs for 1 ms each way; the remainder of 609 nJ is carried and cancels exactly
+  meter.clear();
+  meter.add_sample(INT32_MAX, INT32_MAX, 0);
+  meter.add_sample(INT32_MIN + 1, INT32_MAX, 1);
+  TEST_ASSERT_EQUAL_INT64(4611686014132420LL, meter.get_energy());
+  meter.add_sample(0, 0, 2);
+  TEST_ASSERT_EQUAL_INT64(0, meter.get_energy());
+}
+
+void test_clock_wraparound ()
+{
+  // 12 V at 1 A for 1 s across the wrap of millis()
+  meter.add_sample(12000, 1000, UINT32_MAX - 499);
+  meter.add_sample(12000, 1000, 500);
+  TEST_ASSERT_EQUAL_INT64(12000000, meter.get_energy());
+  TEST_ASSERT_EQUAL(0, meter.get_uncovered_ms());
+}
+
+void test_gap_counts_as_uncovered ()
+{
+  meter.add_sample(12000, 1000, 1000);
+  meter.add_sample(12000, 1000, 1000 + ENERGY_METER_MAX_GAP_MS + 1);
+  TEST_ASSERT_EQUAL_INT64(0, meter.get_energy());
+  TEST_ASSERT_EQUAL(ENERGY_METER_MAX_GAP_MS + 1, meter.get_uncovered_ms());
+
+  // integration continues from the sample after the gap
+  meter.add_sample(12000, 1000, 2000 + ENERGY_METER_MAX_GAP_MS + 1);
+  TEST_ASSERT_EQUAL_INT64(12000000, meter.get_energy());
+  TEST_ASSERT_EQUAL(ENERGY_METER_MAX_GAP_MS + 1, meter.get_uncovered_ms());
+
+  // a gap of exactly max_gap_ms is still integrated
+  EnergyMeter short_gaps(100);
+  short_gaps.add_sample(1000, 1000, 0);
+  short_gaps.add_sample(1000, 1000, 100);
+  short_gaps.add_sample(1000, 1000, 201);
+  TEST_ASSERT_EQUAL_INT64(100000, short_gaps.get_energy());
+  TEST_ASSERT_EQUAL(101, short_gaps.get_uncovered_ms());
+}
+
+void test_remainder_is_carried_over ()
+{
+  // 1 µW for 1 ms is 1 nJ; a thousand of them make one µJ
+  for (uint32_t t = 0; t <= 1000; t++) meter.add_sample(1, 1, t);
+  TEST_ASSERT_EQUAL_INT64(1, meter.get_energy());
+
+  // negative power borrows from the remainder instead of rounding towards zero
+  meter.clear();
+  meter.add_sample(-1, 1, 0);
+  meter.add_sample(0, 0, 999);
+  TEST_ASSERT_EQUAL_INT64(-1, meter.get_energy());
+  meter.add_sample(1, 1, 1000);
+  meter.add_sample(1, 1, 1999);
+  TEST_ASSERT_EQUAL_INT64(0, meter.get_energy());
+
+  // the remainder is kept across closed slots
+  meter.clear();
+  meter.add_sample(1, 1, 0);
+  meter.add_sample(1, 1, 600);
+  TEST_ASSERT_EQUAL_INT64(0, meter.close_slot());
+  meter.add_sample(1, 1, 1000);
+  TEST_ASSERT_EQUAL_INT64(1, meter.get_energy());
+}
+
+void test_slot_ring_wraps ()
+{
+  int64_t energy;
+  uint32_t uncovered;
+  TEST_ASSERT_FALSE(meter.get_slot(0, energy));
+
+  // energy of slot n is n mJ: 1 V at 1 mA for n s
+  uint32_t t = 0;
+  meter.add_sample(1000, 1, t);
+  for (int n = 1; n <= ENERGY_METER_SLOTS + 3; n++)
+  {
+    for (int s = 0; s < n; s++)
+    {
+      t += 1000;
+      meter.add_sample(1000, 1, t);
+    }
+    TEST_ASSERT_EQUAL_INT64(n * 1000, meter.close_slot());
+  }
+
+  TEST_ASSERT_EQUAL(ENERGY_METER_SLOTS, meter.get_slot_count());
+  TEST_ASSERT_TRUE(meter.get_slot(0, energy, &uncovered));
+  TEST_ASSERT_EQUAL_INT64((ENERGY_METER_SLOTS + 3) * 1000, energy);
+  TEST_ASSERT_EQUAL(0, uncovered);
+  TEST_ASSERT_TRUE(meter.get_slot(ENERGY_METER_SLOTS - 1, energy));
+  TEST_ASSERT_EQUAL_INT64(4 * 1000, energy);
+  TEST_ASSERT_FALSE(meter.get_slot(ENERGY_METER_SLOTS, energy));
+  TEST_ASSERT_EQUAL_INT64(0, meter.get_energy());
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_large_products_do_not_overflow);
+  RUN_TEST(test_clock_wraparound);
+  RUN_TEST(test_gap_counts_as_uncovered);
+  RUN_TEST(test_remainder_is_carried_over);
+  RUN_TEST(test_slot_ring_wraps);
+  return UNITY_END();
+}
@@ -0,0 +1,107 @@
+/**
+ * Host tests of the framing of serial protocol version 2: COBS and CRC CCITT
+ */
+
+#include <unity.h>
+#include "Cobs.h"
+#include "CRC-CCITT.h"
+
+// Built for the esp32 only as part of their libraries
+#include "Cobs.cpp"
+#include "CRC-CCITT.cpp"
+
+void setUp () {}
+void tearDown () {}
+
+/**
+ * Encode, check for delimiters and decode again
+ */
+static void round_trip (const uint8_t* data, size_t len)
+{
+  std::vector<uint8_t> encoded(COBS_ENCODED_MAX(len));
+  size_t encoded_len = cobs_encode(data, len, encoded.data());
+  TEST_ASSERT_LESS_OR_EQUAL(COBS_ENCODED_MAX(len), encoded_len);
+  for (size_t i = 0; i < encoded_len; i++) TEST_ASSERT_NOT_EQUAL(0x00, encoded[i]);
+
+  std::vector<uint8_t> decoded(encoded_len);
+  TEST_ASSERT_EQUAL(len, cobs_decode(encoded.data(), encoded_len, decoded.data()));
+  if (len > 0) TEST_ASSERT_EQUAL_UINT8_ARRAY(data, decoded.data(), len);
+}
+
+void test_cobs_known_frames ()
+{
+  const uint8_t data[] = { 0x11, 0x22, 0x00, 0x33 };
+  const uint8_t expected[] = { 0x03, 0x11, 0x22, 0x02, 0x33 };
+  uint8_t encoded[COBS_ENCODED_MAX(sizeof data)];
+  TEST_ASSERT_EQUAL(sizeof expected, cobs_encode(data, sizeof data, encoded));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, encoded, sizeof expected);
+
+  const uint8_t zero[] = { 0x00 };
+  const uint8_t expected_zero[] = { 0x01, 0x01 };
+  TEST_ASSERT_EQUAL(sizeof expected_zero, cobs_encode(zero, sizeof zero, encoded));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_zero, encoded, sizeof expected_zero);
+
+  TEST_ASSERT_EQUAL(1, cobs_encode(nullptr, 0, encoded));
+  TEST_ASSERT_EQUAL_HEX8(0x01, encoded[0]);
+}
+
+void test_cobs_round_trip ()
+{
+  std::vector<uint8_t> data(600);
+  for (size_t len : { 1, 2, 253, 254, 255, 508, 509, 600 })
+  {
+    // runs of non-zero bytes across the block limit of 254 bytes
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)(i % 255 + 1);
+    round_trip(data.data(), len);
+
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)(i * 7);
+    round_trip(data.data(), len);
+
+    std::fill(data.begin(), data.begin() + len, 0x00);
+    round_trip(data.data(), len);
+  }
+}
+
+void test_cobs_rejects_invalid_frames ()
+{
+  uint8_t decoded[8];
+  // a block must not start with 0x00
+  const uint8_t zero_code[] = { 0x02, 0x11, 0x00, 0x22 };
+  TEST_ASSERT_EQUAL(0, cobs_decode(zero_code, sizeof zero_code, decoded));
+  // a block must not exceed the frame
+  const uint8_t too_long[] = { 0x05, 0x11, 0x22 };
+  TEST_ASSERT_EQUAL(0, cobs_decode(too_long, sizeof too_long, decoded));
+  // a delimiter must not occur inside a block
+  const uint8_t delimiter[] = { 0x03, 0x11, 0x00 };
+  TEST_ASSERT_EQUAL(0, cobs_decode(delimiter, sizeof delimiter, decoded));
+}
+
+void test_crc_ccitt_check_value ()
+{
+  uint8_t data[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, crc_ccitt(data, sizeof data));
+}
+
+void test_crc_validate ()
+{
+  // CRC appended LSB first, as in the frames of Nuki SL and of serial protocol version 2
+  uint8_t frame[] = { 0x01, 0x00, 0x03, 0x00, 0x2A, 0x00, 0x00 };
+  uint16_t crc = crc_ccitt(frame, sizeof frame - 2);
+  frame[5] = crc;
+  frame[6] = crc >> 8;
+  TEST_ASSERT_TRUE(crc_validate(frame, sizeof frame));
+
+  frame[2] ^= 0x10;
+  TEST_ASSERT_FALSE(crc_validate(frame, sizeof frame));
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_cobs_known_frames);
+  RUN_TEST(test_cobs_round_trip);
+  RUN_TEST(test_cobs_rejects_invalid_frames);
+  RUN_TEST(test_crc_ccitt_check_value);
+  RUN_TEST(test_crc_validate);
+  return UNITY_END();
+}
@@ -0,0 +1,263 @@
+/**
+ * Host tests of the batch handling of Logbuch; BLEUlmernest and Schluesselbund are replaced by fakes
+ */
+
+#include <unity.h>
+#include "Logbuch.h"
+
+// Built for the esp32 only as part of BLEUlmernest
+#include "Logbuch.cpp"
+
+/**
+ * Fakes of the BLE transactions: a request is recorded, the test completes it with batch_done()
+ */
+
+struct log_request
+{
+  uint32_t start_index;
+  uint16_t count;
+  uint8_t order;
+};
+
+static std::vector<log_request> requests;
+static ble_callback_fn pending_callback;
+static void* pending_context;
+static bool request_accepted;
+static const char* lock_address;
+
+bool BLEUlmernest::request_log_entries (uint32_t start_index, uint16_t count, bool with_count, uint8_t order,
+                                        ble_callback_fn callback, void* context, uint32_t timeout_ms)
+{
+  if (!request_accepted) return false;
+  requests.push_back({ start_index, count, order });
+  pending_callback = callback;
+  pending_context = context;
+  return true;
+}
+
+Schluesselbund* BLEUlmernest::get_Bund ()
+{
+  static Schluesselbund bund;
+  return &bund;
+}
+
+Schluesselbund::Schluesselbund () {}
+
+size_t Schluesselbund::get_address (char* stored_address)
+{
+  strcpy(stored_address, lock_address);
+  return strlen(lock_address);
+}
+
+/**
+ * Log entry command of Nuki SL
+ */
+static std::vector<uint8_t> log_entry (uint32_t index, log_types type, uint8_t data = 0)
+{
+  std::vector<uint8_t> a(58, 0);
+  a[6] = index;
+  a[7] = index >> 8;
+  a[8] = index >> 16;
+  a[9] = index >> 24;
+  a[53] = (uint8_t)type;
+  a[54] = data;
+  return a;
+}
+
+/**
+ * Complete the pending request with the entries from first to last
+ */
+static void complete (uint32_t first, uint32_t last, bool success = true)
+{
+  ble_result result = {};
+  result.success = success;
+  for (uint32_t i = first; i <= last && first > 0; i++) result.logs.push_back(log_entry(i, i % 2 ? log_types::lock_action : log_types::door_sensor));
+  pending_callback(result, pending_context);
+}
+
+static size_t sync_calls;
+static bool sync_success;
+static uint32_t sync_first_new;
+
+static void sync_done (bool success, uint32_t first_new, void* context)
+{
+  sync_calls++;
+  sync_success = success;
+  sync_first_new = first_new;
+}
+
+static Logbuch* logbuch;
+
+void setUp ()
+{
+  Preferences::storage().clear();
+  requests.clear();
+  request_accepted = true;
+  lock_address = "54:d2:72:00:00:01";
+  sync_calls = 0;
+  logbuch = new Logbuch();
+  logbuch->init();
+}
+
+void tearDown ()
+{
+  delete logbuch;
+}
+
+void test_first_sync_fetches_the_most_recent_entry ()
+{
+  TEST_ASSERT_TRUE(logbuch->sync(sync_done));
+  TEST_ASSERT_TRUE(logbuch->is_running());
+  TEST_ASSERT_FALSE(logbuch->sync(sync_done));
+  TEST_ASSERT_EQUAL(1, requests.size());
+  TEST_ASSERT_EQUAL(0, requests[0].start_index);
+  TEST_ASSERT_EQUAL(1, requests[0].count);
+  TEST_ASSERT_EQUAL(0x01, requests[0].order);
+
+  complete(41, 41);
+  TEST_ASSERT_FALSE(logbuch->is_running());
+  TEST_ASSERT_EQUAL(1, sync_calls);
+  TEST_ASSERT_TRUE(sync_success);
+  TEST_ASSERT_EQUAL(41, logbuch->get_last_index());
+  // the entry to start from is not new
+  TEST_ASSERT_EQUAL(42, sync_first_new);
+}
+
+void test_full_batches_are_followed_up ()
+{
+  logbuch->sync();
+  complete(100, 100);
+
+  TEST_ASSERT_TRUE(logbuch->sync(sync_done));
+  TEST_ASSERT_EQUAL(101, requests[1].start_index);
+  TEST_ASSERT_EQUAL(LOGBUCH_BATCH, requests[1].count);
+  TEST_ASSERT_EQUAL(0x00, requests[1].order);
+
+  complete(101, 100 + LOGBUCH_BATCH);
+  TEST_ASSERT_EQUAL(3, requests.size());
+  TEST_ASSERT_EQUAL(101 + LOGBUCH_BATCH, requests[2].start_index);
+
+  // a short batch ends the sync
+  complete(101 + LOGBUCH_BATCH, 105 + LOGBUCH_BATCH);
+  TEST_ASSERT_EQUAL(3, requests.size());
+  TEST_ASSERT_EQUAL(1, sync_calls);
+  TEST_ASSERT_EQUAL(101, sync_first_new);
+  TEST_ASSERT_EQUAL(105 + LOGBUCH_BATCH, logbuch->get_last_index());
+  TEST_ASSERT_EQUAL(1 + LOGBUCH_BATCH + 5, logbuch->size());
+  TEST_ASSERT_EQUAL(105 + LOGBUCH_BATCH, logbuch->get(0)->index);
+}
+
+void test_batches_per_sync_are_limited ()
+{
+  logbuch->sync();
+  complete(1, 1);
+
+  logbuch->sync(sync_done);
+  uint32_t next = 2;
+  for (size_t i = 0; i < LOGBUCH_BATCHES_MAX; i++)
+  {
+    complete(next, next + LOGBUCH_BATCH - 1);
+    next += LOGBUCH_BATCH;
+  }
+  TEST_ASSERT_EQUAL(1 + LOGBUCH_BATCHES_MAX, requests.size());
+  TEST_ASSERT_EQUAL(1, sync_calls);
+  TEST_ASSERT_TRUE(sync_success);
+
+  // the next sync goes on from there
+  logbuch->sync(sync_done);
+  TEST_ASSERT_EQUAL(next, requests.back().start_index);
+}
+
+void test_entries_are_taken_once ()
+{
+  logbuch->sync();
+  complete(10, 10);
+  logbuch->sync();
+  complete(8, 12);
+  TEST_ASSERT_EQUAL(3, logbuch->size());
+  TEST_ASSERT_EQUAL(12, logbuch->get(0)->index);
+  TEST_ASSERT_EQUAL(11, logbuch->get(1)->index);
+  TEST_ASSERT_EQUAL(10, logbuch->get(2)->index);
+  TEST_ASSERT_NULL(logbuch->get(3));
+}
+
+void test_failed_batch_keeps_the_entries ()
+{
+  logbuch->sync();
+  complete(10, 10);
+  logbuch->sync(sync_done);
+  complete(11, 13, false);
+  TEST_ASSERT_FALSE(sync_success);
+  TEST_ASSERT_FALSE(logbuch->is_running());
+  TEST_ASSERT_EQUAL(13, logbuch->get_last_index());
+
+  request_accepted = false;
+  TEST_ASSERT_FALSE(logbuch->sync(sync_done));
+  TEST_ASSERT_FALSE(logbuch->is_running());
+}
+
+void test_count ()
+{
+  logbuch->sync();
+  complete(10, 10);
+  logbuch->sync();
+  complete(11, 16);
+  // odd indexes are lock actions
+  TEST_ASSERT_EQUAL(3, logbuch->count(log_types::lock_action));
+  TEST_ASSERT_EQUAL(4, logbuch->count(log_types::door_sensor));
+  TEST_ASSERT_EQUAL(2, logbuch->count(log_types::lock_action, 12));
+  TEST_ASSERT_EQUAL(0, logbuch->count(log_types::calibration));
+}
+
+void test_ring_keeps_the_most_recent_entries ()
+{
+  logbuch->sync();
+  complete(1, 1);
+  while (logbuch->get_last_index() < 2 * LOGBUCH_RING_SIZE)
+  {
+    uint32_t next = logbuch->get_last_index() + 1;
+    logbuch->sync();
+    complete(next, next + LOGBUCH_BATCH - 1);
+    while (logbuch->is_running())
+    {
+      next = logbuch->get_last_index() + 1;
+      complete(next, next + LOGBUCH_BATCH - 1);
+    }
+  }
+  TEST_ASSERT_EQUAL(LOGBUCH_RING_SIZE, logbuch->size());
+  TEST_ASSERT_EQUAL(logbuch->get_last_index(), logbuch->get(0)->index);
+  TEST_ASSERT_EQUAL(logbuch->get_last_index() - LOGBUCH_RING_SIZE + 1, logbuch->get(LOGBUCH_RING_SIZE - 1)->index);
+}
+
+void test_last_index_survives_a_restart ()
+{
+  logbuch->sync();
+  complete(10, 10);
+  logbuch->sync();
+  complete(11, 15);
+
+  Logbuch restarted;
+  restarted.init();
+  TEST_ASSERT_EQUAL(15, restarted.get_last_index());
+  TEST_ASSERT_EQUAL(0, restarted.size());
+
+  // indexes of another lock are forgotten
+  lock_address = "54:d2:72:00:00:02";
+  Logbuch other_lock;
+  other_lock.init();
+  TEST_ASSERT_EQUAL(0, other_lock.get_last_index());
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_sync_fetches_the_most_recent_entry);
+  RUN_TEST(test_full_batches_are_followed_up);
+  RUN_TEST(test_batches_per_sync_are_limited);
+  RUN_TEST(test_entries_are_taken_once);
+  RUN_TEST(test_failed_batch_keeps_the_entries);
+  RUN_TEST(test_count);
+  RUN_TEST(test_ring_keeps_the_most_recent_entries);
+  RUN_TEST(test_last_index_survives_a_restart);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+/**
+ * Host tests of the uplink payload format: round trip through NestEncoder and NestDecoder
+ */
+
+#include <unity.h>
+#include "NestCodec.h"
+
+static NestEncoder encoder;
+static NestDecoder decoder;
+
+static int32_t values[NEST_CODEC_CHANNELS];
+static bool present[NEST_CODEC_CHANNELS];
+
+void setUp ()
+{
+  encoder = NestEncoder();
+  decoder.reset();
+}
+
+void tearDown () {}
+
+/**
+ * Encode the payload assembled, decode it and compare a channel
+ */
+static void decode_payload ()
+{
+  size_t size = encoder.finish();
+  TEST_ASSERT_EQUAL(encoder.get_size(), size);
+  TEST_ASSERT_TRUE(decoder.decode(encoder.get_buffer(), size, values, present));
+}
+
+void test_keyframe_round_trip ()
+{
+  encoder.begin(true);
+  TEST_ASSERT_TRUE(encoder.is_keyframe());
+  TEST_ASSERT_TRUE(encoder.add(2, -123));
+  TEST_ASSERT_TRUE(encoder.add(5, 1));
+  TEST_ASSERT_TRUE(encoder.add(18, 1000));
+  TEST_ASSERT_TRUE(encoder.add(20, 65535));
+  TEST_ASSERT_FALSE(encoder.add(2, 0));
+  TEST_ASSERT_FALSE(encoder.add(NEST_CODEC_CHANNELS, 0));
+  decode_payload();
+
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++) TEST_ASSERT_EQUAL(i == 2 || i == 5 || i == 18 || i == 20, present[i]);
+  TEST_ASSERT_EQUAL_INT32(-123, values[2]);
+  TEST_ASSERT_EQUAL_INT32(1, values[5]);
+  TEST_ASSERT_EQUAL_INT32(1000, values[18]);
+  TEST_ASSERT_EQUAL_INT32(65535, values[20]);
+}
+
+void test_values_are_clamped ()
+{
+  encoder.begin(true);
+  encoder.add(3, -40000);
+  encoder.add(4, 300);
+  encoder.add(18, -1);
+  decode_payload();
+  TEST_ASSERT_EQUAL_INT32(INT16_MIN, values[3]);
+  TEST_ASSERT_EQUAL_INT32(255, values[4]);
+  TEST_ASSERT_EQUAL_INT32(0, values[18]);
+}
+
+void test_delta_round_trip ()
+{
+  encoder.begin(true);
+  encoder.add(2, 200);
+  encoder.add(8, 1250);
+  encoder.add(17, -50);
+  decode_payload();
+  encoder.acknowledge();
+  TEST_ASSERT_TRUE(encoder.has_reference_frame());
+
+  // 4 bit delta, 8 bit delta, absolute, and a channel missing in the keyframe
+  encoder.begin(false);
+  TEST_ASSERT_FALSE(encoder.is_keyframe());
+  size_t header = encoder.get_size();
+  TEST_ASSERT_EQUAL(header + 1, encoder.get_size_with(2, 203));
+  encoder.add(2, 203);
+  encoder.add(8, 1150);
+  encoder.add(17, 2000);
+  encoder.add(13, 12800);
+  decode_payload();
+
+  TEST_ASSERT_EQUAL_INT32(203, values[2]);
+  TEST_ASSERT_EQUAL_INT32(1150, values[8]);
+  TEST_ASSERT_EQUAL_INT32(2000, values[17]);
+  TEST_ASSERT_EQUAL_INT32(12800, values[13]);
+}
+
+void test_delta_before_acknowledge_is_a_keyframe ()
+{
+  encoder.begin(false);
+  TEST_ASSERT_TRUE(encoder.is_keyframe());
+
+  // a keyframe that was not acknowledged does not become the reference
+  encoder.add(2, 100);
+  decode_payload();
+  encoder.begin(false);
+  TEST_ASSERT_TRUE(encoder.is_keyframe());
+}
+
+void test_delta_to_unknown_keyframe_is_rejected ()
+{
+  encoder.begin(true);
+  encoder.add(2, 100);
+  encoder.finish();
+  encoder.acknowledge();
+
+  encoder.begin(false);
+  encoder.add(2, 101);
+  size_t size = encoder.finish();
+  TEST_ASSERT_FALSE(decoder.decode(encoder.get_buffer(), size, values, present));
+}
+
+void test_truncated_and_foreign_payloads_are_rejected ()
+{
+  encoder.begin(true);
+  encoder.add(20, 230);
+  size_t size = encoder.finish();
+  TEST_ASSERT_FALSE(decoder.decode(encoder.get_buffer(), size - 1, values, present));
+
+  uint8_t payload[NEST_CODEC_SIZE_MAX];
+  memcpy(payload, encoder.get_buffer(), size);
+  payload[0] = (payload[0] & 0x0F) | (NEST_CODEC_VERSION + 1) << 4;
+  TEST_ASSERT_FALSE(decoder.decode(payload, size, values, present));
+}
+
+void test_sequence_wrap ()
+{
+  // keyframes cycle through every sequence number, deltas always refer to the last acknowledged one
+  for (int32_t round = 0; round < 3 * NEST_CODEC_SEQUENCES; round++)
+  {
+    encoder.begin(true);
+    encoder.add(11, round);
+    decode_payload();
+    TEST_ASSERT_EQUAL_INT32(round, values[11]);
+    encoder.acknowledge();
+
+    encoder.begin(false);
+    encoder.add(11, round + 3);
+    decode_payload();
+    TEST_ASSERT_EQUAL_INT32(round + 3, values[11]);
+  }
+}
+
+void test_reset_forgets_the_reference ()
+{
+  encoder.begin(true);
+  encoder.add(11, 1);
+  encoder.finish();
+  encoder.acknowledge();
+  encoder.reset();
+  TEST_ASSERT_FALSE(encoder.has_reference_frame());
+  encoder.begin(false);
+  TEST_ASSERT_TRUE(encoder.is_keyframe());
+}
+
+void test_sequence_skips_the_reference ()
+{
+  encoder.begin(true);
+  encoder.add(11, 42);
+  decode_payload();
+  encoder.acknowledge();
+  uint8_t reference = encoder.get_buffer()[0] & 0x07;
+
+  // lost keyframes wrap around without taking the slot of the reference
+  for (size_t i = 0; i < 2 * NEST_CODEC_SEQUENCES; i++)
+  {
+    encoder.begin(true);
+    encoder.add(11, 0);
+    encoder.finish();
+    TEST_ASSERT_NOT_EQUAL(reference, encoder.get_buffer()[0] & 0x07);
+  }
+
+  encoder.begin(false);
+  encoder.add(11, 44);
+  decode_payload();
+  TEST_ASSERT_EQUAL_INT32(44, values[11]);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_keyframe_round_trip);
+  RUN_TEST(test_values_are_clamped);
+  RUN_TEST(test_delta_round_trip);
+  RUN_TEST(test_delta_before_acknowledge_is_a_keyframe);
+  RUN_TEST(test_delta_to_unknown_keyframe_is_rejected);
+  RUN_TEST(test_truncated_and_foreign_payloads_are_rejected);
+  RUN_TEST(test_sequence_wrap);
+  RUN_TEST(test_reset_forgets_the_reference);
+  RUN_TEST(test_sequence_skips_the_reference);
+  return UNITY_END();
+}
@@ -0,0 +1,169 @@
+/**
+ * Host tests of ParameterStore and the parameter table
+ */
+
+#include <unity.h>
+#include <thread>
+#include "ParameterStore.h"
+
+// Built for the esp32 only as part of SerialCommHelper
+#include "DataStructure.cpp"
+#include "ParameterStore.cpp"
+
+static ParameterStore store;
+
+void setUp ()
+{
+  store.clear();
+  native_millis = 1000;
+}
+
+void tearDown () {}
+
+void test_set_and_get ()
+{
+  unsigned char code = (unsigned char)parameter_code::temp_outside;
+  unsigned char data[] = { 0xFF, 0x38 };
+  unsigned char value[PARAMETER_SIZE_MAX] = {0};
+
+  TEST_ASSERT_FALSE(store.has_value(code));
+  TEST_ASSERT_FALSE(store.get(code, value));
+  TEST_ASSERT_EQUAL(0, store.get_timestamp(code));
+
+  TEST_ASSERT_TRUE(store.set(code, data));
+  TEST_ASSERT_TRUE(store.get(code, value));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, value, 2);
+  TEST_ASSERT_EQUAL(1000, store.get_timestamp(code));
+  TEST_ASSERT_EQUAL_INT32(-200, parameter_value(code, value));
+}
+
+void test_unknown_codes_are_rejected ()
+{
+  unsigned char data[] = { 0x01, 0x02 };
+  TEST_ASSERT_FALSE(store.set(0x00, data));
+  TEST_ASSERT_FALSE(store.set(PARAMETER_COUNT, data));
+  TEST_ASSERT_FALSE(store.set(0xFF, data));
+  TEST_ASSERT_FALSE(store.set((unsigned char)parameter_code::door, nullptr));
+  TEST_ASSERT_FALSE(store.has_value(PARAMETER_COUNT));
+  TEST_ASSERT_FALSE(store.get(0xFF, nullptr));
+}
+
+void test_dirty_until_sent ()
+{
+  unsigned char code = (unsigned char)parameter_code::battery_volt;
+  unsigned char first[] = { 0x04, 0xD2 };
+  unsigned char second[] = { 0x04, 0xE0 };
+  unsigned char value[PARAMETER_SIZE_MAX];
+
+  // nothing to mark before a value is set
+  store.mark_sent(code);
+  TEST_ASSERT_FALSE(store.has_sent_value(code));
+
+  store.set(code, first);
+  TEST_ASSERT_TRUE(store.is_dirty(code));
+  store.mark_sent(code);
+  TEST_ASSERT_FALSE(store.is_dirty(code));
+  TEST_ASSERT_TRUE(store.get_sent(code, value));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(first, value, 2);
+
+  // the value sent is kept until the next mark_sent()
+  native_millis = 5000;
+  store.set(code, second);
+  TEST_ASSERT_TRUE(store.is_dirty(code));
+  TEST_ASSERT_EQUAL(5000, store.get_timestamp(code));
+  TEST_ASSERT_TRUE(store.get_sent(code, value));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(first, value, 2);
+  TEST_ASSERT_TRUE(store.get(code, value));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(second, value, 2);
+}
+
+void test_clear ()
+{
+  unsigned char code = (unsigned char)parameter_code::door;
+  unsigned char data[] = { 0x01 };
+  store.set(code, data);
+  store.mark_sent(code);
+  store.clear();
+  TEST_ASSERT_FALSE(store.has_value(code));
+  TEST_ASSERT_FALSE(store.has_sent_value(code));
+  TEST_ASSERT_FALSE(store.is_dirty(code));
+}
+
+/**
+ * ve_task and loop() on the two cores: two threads write a 16 bit slot, another one reads it meanwhile.
+ * Every write stores a byte and its complement, so a value mixed from two writes shows as torn.
+ */
+void test_concurrent_reads_are_never_torn ()
+{
+  const unsigned char code = (unsigned char)parameter_code::battery_volt;
+  const unsigned int writes = 2000000;
+  unsigned char data[] = { 0x00, 0xFF };
+  store.set(code, data);
+
+  std::atomic<int> writers(2);
+  unsigned long reads = 0, torn = 0;
+  std::thread reader([&]
+  {
+    unsigned char value[PARAMETER_SIZE_MAX];
+    while (writers.load() > 0)
+    {
+      if (!store.get(code, value)) continue;
+      if ((unsigned char)~value[0] != value[1]) torn++;
+      reads++;
+    }
+  });
+
+  auto write = [&] (unsigned int offset)
+  {
+    unsigned char value[PARAMETER_SIZE_MAX];
+    for (unsigned int i = 0; i < writes; i++)
+    {
+      value[0] = i + offset;
+      value[1] = ~(i + offset);
+      store.set(code, value);
+    }
+    writers--;
+  };
+  std::thread first(write, 0), second(write, 0x80);
+
+  first.join();
+  second.join();
+  reader.join();
+
+  char message[96];
+  snprintf(message, sizeof message, "2 x %u writes, %lu concurrent reads, %lu torn", writes, reads, torn);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(0, reads);
+  TEST_ASSERT_EQUAL(0, torn);
+}
+
+void test_parameter_bytes_clamp_to_the_size ()
+{
+  unsigned char data[PARAMETER_SIZE_MAX];
+  unsigned char code = (unsigned char)parameter_code::temp_inside;
+
+  TEST_ASSERT_TRUE(parameter_bytes(code, -40000, data));
+  TEST_ASSERT_EQUAL_INT32(INT16_MIN, parameter_value(code, data));
+  TEST_ASSERT_TRUE(parameter_bytes(code, 40000, data));
+  TEST_ASSERT_EQUAL_INT32(INT16_MAX, parameter_value(code, data));
+
+  code = (unsigned char)parameter_code::humidity_inside;
+  TEST_ASSERT_TRUE(parameter_bytes(code, -5, data));
+  TEST_ASSERT_EQUAL_INT32(0, parameter_value(code, data));
+  TEST_ASSERT_TRUE(parameter_bytes(code, 300, data));
+  TEST_ASSERT_EQUAL_INT32(255, parameter_value(code, data));
+
+  TEST_ASSERT_FALSE(parameter_bytes(0x00, 1, data));
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_set_and_get);
+  RUN_TEST(test_unknown_codes_are_rejected);
+  RUN_TEST(test_dirty_until_sent);
+  RUN_TEST(test_clear);
+  RUN_TEST(test_concurrent_reads_are_never_torn);
+  RUN_TEST(test_parameter_bytes_clamp_to_the_size);
+  return UNITY_END();
+}
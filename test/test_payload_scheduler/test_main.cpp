@@ -0,0 +1,210 @@
+/**
+ * Host tests of the packing of payload fields by PayloadScheduler
+ */
+
+#include <unity.h>
+#include "PayloadScheduler.h"
+
+// Current raw value of every channel, read by the fields
+static int32_t channel_values[NEST_CODEC_CHANNELS];
+static bool channel_valid[NEST_CODEC_CHANNELS];
+static size_t sent_calls;
+
+static bool read_channel (const payload_field& field, int32_t& value)
+{
+  value = channel_values[field.channel];
+  return channel_valid[field.channel];
+}
+
+static void count_sent (const payload_field& field, int32_t value)
+{
+  sent_calls++;
+}
+
+static payload_field field (unsigned char channel, uint8_t priority, int32_t threshold = 0, uint32_t max_age = 0, uint32_t min_interval = 0)
+{
+  return { channel, priority, threshold, max_age, min_interval, read_channel, count_sent, channel };
+}
+
+static PayloadScheduler scheduler;
+static NestEncoder encoder;
+static NestDecoder decoder;
+static int32_t values[NEST_CODEC_CHANNELS];
+static bool present[NEST_CODEC_CHANNELS];
+
+/**
+ * Build a keyframe and decode which channels it contains
+ */
+static size_t build (size_t max_size, uint32_t now)
+{
+  encoder.begin(true);
+  size_t rolled_over = scheduler.build(encoder, max_size, now);
+  size_t size = encoder.finish();
+  TEST_ASSERT_LESS_OR_EQUAL(max_size, size);
+  TEST_ASSERT_TRUE(decoder.decode(encoder.get_buffer(), size, values, present));
+  return rolled_over;
+}
+
+void setUp ()
+{
+  scheduler = PayloadScheduler();
+  encoder = NestEncoder();
+  decoder.reset();
+  for (size_t i = 0; i < NEST_CODEC_CHANNELS; i++)
+  {
+    channel_values[i] = 0;
+    channel_valid[i] = true;
+  }
+  sent_calls = 0;
+}
+
+void tearDown () {}
+
+void test_add_rejects_invalid_fields ()
+{
+  TEST_ASSERT_FALSE(scheduler.add(field(NEST_CODEC_CHANNELS, 1)));
+  payload_field no_read = field(2, 1);
+  no_read.read = nullptr;
+  TEST_ASSERT_FALSE(scheduler.add(no_read));
+
+  for (size_t i = 0; i < PAYLOAD_FIELDS_MAX; i++) TEST_ASSERT_TRUE(scheduler.add(field(i % NEST_CODEC_CHANNELS, 1)));
+  TEST_ASSERT_FALSE(scheduler.add(field(2, 1)));
+  TEST_ASSERT_EQUAL(PAYLOAD_FIELDS_MAX, scheduler.get_field_count());
+}
+
+void test_fields_are_sent_once_until_changed ()
+{
+  scheduler.add(field(2, 1, 5));
+  channel_values[2] = 100;
+  TEST_ASSERT_EQUAL(0, build(NEST_CODEC_SIZE_MAX, 0));
+  TEST_ASSERT_TRUE(present[2]);
+  TEST_ASSERT_EQUAL(1, sent_calls);
+
+  // within the threshold
+  channel_values[2] = 105;
+  build(NEST_CODEC_SIZE_MAX, 1000);
+  TEST_ASSERT_FALSE(present[2]);
+
+  channel_values[2] = 106;
+  build(NEST_CODEC_SIZE_MAX, 2000);
+  TEST_ASSERT_TRUE(present[2]);
+  TEST_ASSERT_EQUAL_INT32(106, values[2]);
+}
+
+void test_max_age_and_min_interval ()
+{
+  scheduler.add(field(2, 1, 0, 10000));
+  scheduler.add(field(14, 1, -1, 0, 3600000));
+  build(NEST_CODEC_SIZE_MAX, 0);
+  TEST_ASSERT_TRUE(present[2]);
+  TEST_ASSERT_TRUE(present[14]);
+
+  channel_values[14] = 7;
+  build(NEST_CODEC_SIZE_MAX, 9999);
+  TEST_ASSERT_FALSE(present[2]);
+  TEST_ASSERT_FALSE(present[14]);
+
+  build(NEST_CODEC_SIZE_MAX, 10000);
+  TEST_ASSERT_TRUE(present[2]);
+  TEST_ASSERT_FALSE(present[14]);
+
+  build(NEST_CODEC_SIZE_MAX, 3600000);
+  TEST_ASSERT_TRUE(present[14]);
+  TEST_ASSERT_EQUAL_INT32(7, values[14]);
+}
+
+void test_fields_without_value_are_skipped ()
+{
+  scheduler.add(field(11, 1));
+  channel_valid[11] = false;
+  TEST_ASSERT_EQUAL(0, build(NEST_CODEC_SIZE_MAX, 0));
+  TEST_ASSERT_FALSE(present[11]);
+  TEST_ASSERT_EQUAL(0, sent_calls);
+}
+
+void test_packing_by_priority_rolls_over ()
+{
+  // header of 8 + 21 bits leaves 11 bits of a 5 byte payload: one 8 bit field, not a 16 bit one
+  scheduler.add(field(20, 1));
+  scheduler.add(field(2, 3));
+  scheduler.add(field(11, 2));
+  scheduler.add(field(12, 2));
+
+  TEST_ASSERT_EQUAL(3, build(6, 0));
+  TEST_ASSERT_TRUE(present[2]);
+  TEST_ASSERT_FALSE(present[11] || present[12] || present[20]);
+
+  // a field that does not fit is skipped for smaller ones of lower priority
+  TEST_ASSERT_EQUAL(2, build(5, 1000));
+  TEST_ASSERT_TRUE(present[11]);
+  TEST_ASSERT_FALSE(present[12] || present[20]);
+
+  TEST_ASSERT_EQUAL(1, build(5, 2000));
+  TEST_ASSERT_TRUE(present[12]);
+
+  TEST_ASSERT_EQUAL(0, build(6, 3000));
+  TEST_ASSERT_TRUE(present[20]);
+  TEST_ASSERT_EQUAL(4, sent_calls);
+}
+
+void test_equal_priority_oldest_first ()
+{
+  scheduler.add(field(11, 1, -1));
+  scheduler.add(field(12, 1, -1));
+  build(NEST_CODEC_SIZE_MAX, 0);
+
+  // both pending again; only one fits, the one sent longer ago goes first
+  build(5, 1000);
+  bool first_11 = present[11];
+  TEST_ASSERT_TRUE(present[11] != present[12]);
+  build(5, 2000);
+  TEST_ASSERT_EQUAL(!first_11, present[11]);
+  build(5, 3000);
+  TEST_ASSERT_EQUAL(first_11, present[11]);
+}
+
+void test_snapshot_and_reset ()
+{
+  scheduler.add(field(2, 1));
+  scheduler.add(field(11, 2));
+  build(NEST_CODEC_SIZE_MAX, 0);
+  build(NEST_CODEC_SIZE_MAX, 1000);
+  TEST_ASSERT_FALSE(present[2] || present[11]);
+
+  // a snapshot contains every field and marks nothing sent
+  encoder.begin(true);
+  TEST_ASSERT_EQUAL(2, scheduler.snapshot(encoder, NEST_CODEC_SIZE_MAX));
+  TEST_ASSERT_EQUAL(2, sent_calls);
+
+  scheduler.reset();
+  build(NEST_CODEC_SIZE_MAX, 2000);
+  TEST_ASSERT_TRUE(present[2] && present[11]);
+}
+
+void test_set_threshold ()
+{
+  scheduler.add(field(2, 1, 100));
+  scheduler.add(field(3, 1, 100));
+  build(NEST_CODEC_SIZE_MAX, 0);
+
+  TEST_ASSERT_EQUAL(1, scheduler.set_threshold(2, 0));
+  channel_values[2] = 1;
+  channel_values[3] = 1;
+  build(NEST_CODEC_SIZE_MAX, 1000);
+  TEST_ASSERT_TRUE(present[2]);
+  TEST_ASSERT_FALSE(present[3]);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_add_rejects_invalid_fields);
+  RUN_TEST(test_fields_are_sent_once_until_changed);
+  RUN_TEST(test_max_age_and_min_interval);
+  RUN_TEST(test_fields_without_value_are_skipped);
+  RUN_TEST(test_packing_by_priority_rolls_over);
+  RUN_TEST(test_equal_priority_oldest_first);
+  RUN_TEST(test_snapshot_and_reset);
+  RUN_TEST(test_set_threshold);
+  return UNITY_END();
+}
@@ -0,0 +1,266 @@
+/**
+ * Heap soak test of SerialComm_Helper: queueing and sending transmissions allocates nothing, neither in the first
+ * cycles nor in steady state, with the legacy protocol and with protocol version 2 frames
+ */
+
+#include <unity.h>
+#include <new>
+#include <vector>
+
+// Built for the esp32 only as part of SerialCommHelper and BLEUlmernest
+#include "SerialCommHelper.cpp"
+#include "DataStructure.cpp"
+#include "Cobs.cpp"
+#include "CRC-CCITT.cpp"
+#include "Helper.cpp"
+
+#define WARM_UP_CYCLES 16
+#define SOAK_CYCLES 2000
+
+// Allocations are counted while counting is set, i.e. inside the calls of SerialComm_Helper only
+static bool counting = false;
+static size_t allocations = 0;
+
+void* operator new (size_t size)
+{
+  if (counting) allocations++;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[] (size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete (void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete (void* p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[] (void* p, size_t) noexcept
+{
+  free(p);
+}
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc (size_t);
+
+// Catches allocations in C code and in the C++ runtime besides operator new
+extern "C" void* malloc (size_t size)
+{
+  if (counting) allocations++;
+  return __libc_malloc(size);
+}
+#endif
+
+// Parameter values of the externally implemented data storage
+static unsigned char storage[256][2];
+
+/**
+ * Externally implemented methods of SerialComm_Helper, see main.cpp
+ */
+
+void SerialComm_Helper::set_data (unsigned char parameter_code, unsigned char* data)
+{
+  memcpy(storage[parameter_code], data, get_parameter_size(parameter_code));
+}
+
+bool SerialComm_Helper::get_data (unsigned char parameter_code, unsigned char* data)
+{
+  memcpy(data, storage[parameter_code], get_parameter_size(parameter_code));
+  return true;
+}
+
+void SerialComm_Helper::set_state (unsigned char state) {}
+
+const unsigned char SerialComm_Helper::get_state ()
+{
+  return 0;
+}
+
+void SerialComm_Helper::update_lock () {}
+
+void SerialComm_Helper::unlock_on_serial_cmd () {}
+
+void SerialComm_Helper::lock_on_serial_cmd () {}
+
+void SerialComm_Helper::wipe_storage_on_serial_cmd () {}
+
+void SerialComm_Helper::restart_on_serial_cmd () {}
+
+static HardwareSerial port;
+static SerialComm_Helper* helper;
+
+void setUp ()
+{
+  port = HardwareSerial();
+  port.written.reserve(1 << 16);
+  helper = new SerialComm_Helper(port);
+  native_millis = 0;
+}
+
+void tearDown ()
+{
+  delete helper;
+}
+
+/**
+ * Sequence numbers of the data frames written since the last call
+ */
+static std::vector<unsigned char> written_data_frames ()
+{
+  std::vector<unsigned char> seqs;
+  std::vector<unsigned char> encoded;
+  for (unsigned char b : port.written)
+  {
+    if (b != 0x00)
+    {
+      encoded.push_back(b);
+      continue;
+    }
+    if (encoded.empty()) continue;
+    std::vector<unsigned char> raw(encoded.size());
+    size_t len = cobs_decode(encoded.data(), encoded.size(), raw.data());
+    if (len > 0 && raw[0] == (unsigned char)frame_type::data) seqs.push_back(raw[1]);
+    encoded.clear();
+  }
+  return seqs;
+}
+
+/**
+ * Acknowledgement frame from Raspberry Pi
+ */
+static std::vector<unsigned char> ack (unsigned char seq)
+{
+  unsigned char raw[FRAME_HEADER_BYTES + FRAME_CRC_BYTES] = { (unsigned char)frame_type::ack, seq };
+  uint16_t crc = crc_ccitt(raw, FRAME_HEADER_BYTES);
+  raw[2] = crc;
+  raw[3] = crc >> 8;
+  std::vector<unsigned char> frame(COBS_ENCODED_MAX(sizeof raw) + 2);
+  size_t len = 0;
+  frame[len++] = 0x00;
+  len += cobs_encode(raw, sizeof raw, frame.data() + len);
+  frame[len++] = 0x00;
+  frame.resize(len);
+  return frame;
+}
+
+/**
+ * One cycle of the traffic of a loop() pass: requests and updates to Raspberry Pi, a request from Raspberry Pi
+ * and a LoRa message
+ * @return Number of allocations inside SerialComm_Helper during the cycle
+ */
+static size_t cycle (std::vector<unsigned char> received)
+{
+  port.inject(received.data(), received.size());
+  port.written.clear();
+  native_millis += 10;
+
+  allocations = 0;
+  counting = true;
+  helper->request_data((unsigned char)parameter_code::temp_inside);
+  helper->request_data((unsigned char)parameter_code::humidity_inside);
+  helper->update_door(1);
+  helper->update_lock(0);
+  helper->tx_sleep_raspberry();
+  for (int i = 0; i < 8 && port.available() > 0; i++) helper->loop();
+  helper->loop();
+  counting = false;
+
+  TEST_ASSERT_GREATER_THAN(0, port.written.size());
+  return allocations;
+}
+
+static const std::vector<unsigned char> legacy_traffic =
+{
+  (unsigned char)cmd_code::request_data, 0x02, (unsigned char)parameter_code::battery_volt, (unsigned char)parameter_code::door,
+  (unsigned char)cmd_code::update_data, 0x03, (unsigned char)parameter_code::temp_outside, 0x00, 0xC8,
+  (unsigned char)cmd_code::lora_msg, 0x04, 0x01, 0x02, 0x03, 0x04
+};
+
+void test_allocations_are_counted ()
+{
+  allocations = 0;
+  counting = true;
+  std::vector<unsigned char>* v = new std::vector<unsigned char>(16);
+  counting = false;
+  delete v;
+  TEST_ASSERT_GREATER_OR_EQUAL(2, allocations);
+}
+
+void test_legacy_protocol_allocates_nothing ()
+{
+  // The buffers have a fixed capacity, so not even the first cycles allocate
+  TEST_ASSERT_EQUAL(0, cycle(legacy_traffic));
+  for (int i = 1; i < WARM_UP_CYCLES; i++) cycle(legacy_traffic);
+
+  size_t total = 0;
+  for (int i = 0; i < SOAK_CYCLES; i++) total += cycle(legacy_traffic);
+  TEST_ASSERT_EQUAL(0, total);
+}
+
+void test_frames_allocate_nothing ()
+{
+  port.inject({ (unsigned char)cmd_code::protocol, 0x01, 0x02 });
+  helper->loop();
+  TEST_ASSERT_EQUAL(2, helper->get_protocol_version());
+
+  // Data frames of Raspberry Pi carrying the legacy traffic, with increasing sequence numbers
+  std::vector<std::vector<unsigned char>> frames(256);
+  for (int seq = 0; seq < 256; seq++)
+  {
+    std::vector<unsigned char> raw = { (unsigned char)frame_type::data, (unsigned char)seq };
+    raw.insert(raw.end(), legacy_traffic.begin(), legacy_traffic.end());
+    uint16_t crc = crc_ccitt(raw.data(), raw.size());
+    raw.push_back(crc);
+    raw.push_back(crc >> 8);
+    frames[seq].resize(COBS_ENCODED_MAX(raw.size()) + 2);
+    size_t len = 0;
+    frames[seq][len++] = 0x00;
+    len += cobs_encode(raw.data(), raw.size(), frames[seq].data() + len);
+    frames[seq][len++] = 0x00;
+    frames[seq].resize(len);
+  }
+
+  // Acknowledge every data frame of the device in the next cycle
+  std::vector<unsigned char> acks;
+  size_t total = 0;
+  for (int i = 0; i < WARM_UP_CYCLES + SOAK_CYCLES; i++)
+  {
+    std::vector<unsigned char> received = acks;
+    received.insert(received.end(), frames[(i + 1) % 256].begin(), frames[(i + 1) % 256].end());
+    size_t n = cycle(received);
+    if (i == 0) TEST_ASSERT_EQUAL(0, n);
+    if (i >= WARM_UP_CYCLES) total += n;
+
+    acks.clear();
+    for (unsigned char seq : written_data_frames())
+    {
+      std::vector<unsigned char> a = ack(seq);
+      acks.insert(acks.end(), a.begin(), a.end());
+    }
+    TEST_ASSERT_GREATER_THAN(0, acks.size());
+  }
+  TEST_ASSERT_EQUAL(0, total);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_allocations_are_counted);
+  RUN_TEST(test_legacy_protocol_allocates_nothing);
+  RUN_TEST(test_frames_allocate_nothing);
+  return UNITY_END();
+}
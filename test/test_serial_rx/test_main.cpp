@@ -0,0 +1,372 @@
+/**
+ * Host tests of SerialComm_Helper::rx(): transmissions and protocol version 2 frames split across and packed into
+ * loop() passes, the timeout of a partial transmission, acknowledgements, NAKs and the bound of bytes handled per pass
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <vector>
+
+// Built for the esp32 only as part of SerialCommHelper and BLEUlmernest
+#include "SerialCommHelper.cpp"
+#include "DataStructure.cpp"
+#include "Cobs.cpp"
+#include "CRC-CCITT.cpp"
+#include "Helper.cpp"
+
+// Values handed to the externally implemented methods, in order
+static std::vector<std::vector<unsigned char>> updates;
+static unsigned int unlocks;
+
+/**
+ * Externally implemented methods of SerialComm_Helper, see main.cpp
+ */
+
+void SerialComm_Helper::set_data (unsigned char parameter_code, unsigned char* data)
+{
+  updates.push_back({ parameter_code, data[0], data[1] });
+}
+
+bool SerialComm_Helper::get_data (unsigned char parameter_code, unsigned char* data)
+{
+  return false;
+}
+
+void SerialComm_Helper::set_state (unsigned char state) {}
+
+const unsigned char SerialComm_Helper::get_state ()
+{
+  return 0;
+}
+
+void SerialComm_Helper::update_lock () {}
+
+void SerialComm_Helper::unlock_on_serial_cmd ()
+{
+  unlocks++;
+}
+
+void SerialComm_Helper::lock_on_serial_cmd () {}
+
+void SerialComm_Helper::wipe_storage_on_serial_cmd () {}
+
+void SerialComm_Helper::restart_on_serial_cmd () {}
+
+static HardwareSerial port;
+static SerialComm_Helper* helper;
+
+void setUp ()
+{
+  port = HardwareSerial();
+  helper = new SerialComm_Helper(port);
+  updates.clear();
+  unlocks = 0;
+  native_millis = 0;
+}
+
+void tearDown ()
+{
+  delete helper;
+}
+
+/**
+ * Protocol version 2 frame of a type, sequence number and payload, delimited on both ends
+ */
+static std::vector<unsigned char> frame (frame_type type, unsigned char seq, std::vector<unsigned char> payload = {})
+{
+  std::vector<unsigned char> raw = { (unsigned char)type, seq };
+  raw.insert(raw.end(), payload.begin(), payload.end());
+  uint16_t crc = crc_ccitt(raw.data(), raw.size());
+  raw.push_back(crc);
+  raw.push_back(crc >> 8);
+
+  std::vector<unsigned char> encoded(COBS_ENCODED_MAX(raw.size()) + 2);
+  size_t len = 0;
+  encoded[len++] = 0x00;
+  len += cobs_encode(raw.data(), raw.size(), encoded.data() + len);
+  encoded[len++] = 0x00;
+  encoded.resize(len);
+  return encoded;
+}
+
+/**
+ * Decoded frames written to the port since the last call
+ */
+static std::vector<std::vector<unsigned char>> written_frames ()
+{
+  std::vector<std::vector<unsigned char>> frames;
+  std::vector<unsigned char> encoded;
+  for (unsigned char b : port.written)
+  {
+    if (b != 0x00)
+    {
+      encoded.push_back(b);
+      continue;
+    }
+    if (encoded.empty()) continue;
+    std::vector<unsigned char> raw(encoded.size());
+    raw.resize(cobs_decode(encoded.data(), encoded.size(), raw.data()));
+    frames.push_back(raw);
+    encoded.clear();
+  }
+  port.written.clear();
+  return frames;
+}
+
+/**
+ * Accept the protocol version 2 offer of Raspberry Pi
+ */
+static void switch_to_version_2 ()
+{
+  port.inject({ (unsigned char)cmd_code::protocol, 0x01, 0x02 });
+  helper->loop();
+  TEST_ASSERT_EQUAL(2, helper->get_protocol_version());
+  port.written.clear();
+}
+
+void test_transmission_split_across_passes ()
+{
+  // cmd, length and the data bytes arrive in separate passes
+  port.inject({ (unsigned char)cmd_code::update_data });
+  helper->loop();
+  port.inject({ 0x03 });
+  helper->loop();
+  port.inject({ (unsigned char)parameter_code::temp_inside, 0x01 });
+  helper->loop();
+  TEST_ASSERT_EQUAL(0, updates.size());
+
+  port.inject({ 0x2C });
+  helper->loop();
+  TEST_ASSERT_EQUAL(1, updates.size());
+  TEST_ASSERT_EQUAL_HEX8((unsigned char)parameter_code::temp_inside, updates[0][0]);
+  TEST_ASSERT_EQUAL_HEX8(0x01, updates[0][1]);
+  TEST_ASSERT_EQUAL_HEX8(0x2C, updates[0][2]);
+}
+
+void test_two_transmissions_in_one_pass ()
+{
+  port.inject({ (unsigned char)cmd_code::update_data, 0x03, (unsigned char)parameter_code::battery_volt, 0x04, 0xD2,
+                (unsigned char)cmd_code::unlock, 0x00 });
+  helper->loop();
+  TEST_ASSERT_EQUAL(1, updates.size());
+  TEST_ASSERT_EQUAL_HEX8((unsigned char)parameter_code::battery_volt, updates[0][0]);
+  TEST_ASSERT_EQUAL_HEX8(0xD2, updates[0][2]);
+  TEST_ASSERT_EQUAL(1, unlocks);
+  TEST_ASSERT_EQUAL(0, port.available());
+}
+
+void test_partial_transmission_times_out ()
+{
+  port.inject({ (unsigned char)cmd_code::update_data, 0x03, (unsigned char)parameter_code::temp_inside });
+  helper->loop();
+
+  // Still waiting for data within the timeout
+  native_millis += RX_FRAME_TIMEOUT_MS;
+  helper->loop();
+  TEST_ASSERT_EQUAL(0, updates.size());
+
+  // The next transmission is decoded from its cmd byte, not as the rest of the dropped one
+  native_millis += 1;
+  port.inject({ (unsigned char)cmd_code::unlock, 0x00 });
+  helper->loop();
+  TEST_ASSERT_EQUAL(0, updates.size());
+  TEST_ASSERT_EQUAL(1, unlocks);
+}
+
+void test_bytes_per_pass_are_bounded ()
+{
+  // A lora_msg transmission of 255 data bytes takes several passes
+  std::vector<unsigned char> burst = { (unsigned char)cmd_code::lora_msg, 0xFF };
+  for (int i = 0; i < 0xFF; i++) burst.push_back(i);
+  port.inject(burst.data(), burst.size());
+
+  int passes = 0;
+  std::chrono::nanoseconds worst(0);
+  while (port.available() > 0)
+  {
+    size_t before = port.available();
+    auto start = std::chrono::steady_clock::now();
+    helper->loop();
+    worst = std::max(worst, std::chrono::steady_clock::now() - start);
+    TEST_ASSERT_LESS_OR_EQUAL(RX_MAX_BYTES_PER_LOOP, before - port.available());
+    passes++;
+  }
+  TEST_ASSERT_EQUAL((burst.size() + RX_MAX_BYTES_PER_LOOP - 1) / RX_MAX_BYTES_PER_LOOP, passes);
+  TEST_ASSERT_EQUAL(0xFF, helper->get_lora_msg_size());
+  TEST_ASSERT_EQUAL_HEX8(0xFE, helper->get_lora_msg()[0xFE]);
+
+  char message[64];
+  snprintf(message, sizeof(message), "worst loop() pass: %lld ns", (long long)worst.count());
+  TEST_MESSAGE(message);
+  // Generous bound for a shared host; a pass handles at most RX_MAX_BYTES_PER_LOOP bytes and never waits
+  TEST_ASSERT_LESS_THAN(10000000, worst.count());
+}
+
+void test_ve_exec_toggle_reports_the_state ()
+{
+  // The VeDirect handler can not be switched off any more; the command is answered with its state
+  port.inject({ (unsigned char)cmd_code::ve_exec_toggle, 0x01, 0x00 });
+  helper->loop();
+  std::vector<unsigned char> reply = { (unsigned char)cmd_code::ve_exec_toggle, 0x01, 0x01, 0x00 };
+  TEST_ASSERT_EQUAL(reply.size(), port.written.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(reply.data(), port.written.data(), reply.size());
+
+  // The next transmission is decoded as before
+  port.inject({ (unsigned char)cmd_code::unlock, 0x00 });
+  helper->loop();
+  TEST_ASSERT_EQUAL(1, unlocks);
+}
+
+void test_frame_split_across_passes ()
+{
+  switch_to_version_2();
+  std::vector<unsigned char> data = frame(frame_type::data, 1, { (unsigned char)cmd_code::update_data, 0x03,
+                                                                 (unsigned char)parameter_code::temp_inside, 0x00, 0xE1 });
+  for (unsigned char b : data)
+  {
+    TEST_ASSERT_EQUAL(0, updates.size());
+    port.inject({ b });
+    helper->loop();
+  }
+  TEST_ASSERT_EQUAL(1, updates.size());
+  TEST_ASSERT_EQUAL_HEX8(0xE1, updates[0][2]);
+
+  std::vector<std::vector<unsigned char>> frames = written_frames();
+  TEST_ASSERT_EQUAL(1, frames.size());
+  TEST_ASSERT_EQUAL_HEX8((unsigned char)frame_type::ack, frames[0][0]);
+  TEST_ASSERT_EQUAL(1, frames[0][1]);
+}
+
+void test_two_frames_in_one_pass ()
+{
+  switch_to_version_2();
+  std::vector<unsigned char> data = frame(frame_type::data, 1, { (unsigned char)cmd_code::update_data, 0x03,
+                                                                 (unsigned char)parameter_code::battery_volt, 0x04, 0xD2 });
+  std::vector<unsigned char> second = frame(frame_type::data, 2, { (unsigned char)cmd_code::unlock, 0x00 });
+  data.insert(data.end(), second.begin(), second.end());
+  port.inject(data.data(), data.size());
+  helper->loop();
+
+  TEST_ASSERT_EQUAL(1, updates.size());
+  TEST_ASSERT_EQUAL(1, unlocks);
+  std::vector<std::vector<unsigned char>> frames = written_frames();
+  TEST_ASSERT_EQUAL(2, frames.size());
+  TEST_ASSERT_EQUAL(1, frames[0][1]);
+  TEST_ASSERT_EQUAL(2, frames[1][1]);
+}
+
+void test_corrupt_frame_is_not_dispatched ()
+{
+  switch_to_version_2();
+  std::vector<unsigned char> data = frame(frame_type::data, 1, { (unsigned char)cmd_code::unlock, 0x00 });
+  data[3] ^= 0x04;
+  port.inject(data.data(), data.size());
+  helper->loop();
+  TEST_ASSERT_EQUAL(0, unlocks);
+
+  // It could have been a data frame, so the sender is asked to repeat it
+  std::vector<std::vector<unsigned char>> frames = written_frames();
+  TEST_ASSERT_EQUAL(1, frames.size());
+  TEST_ASSERT_EQUAL_HEX8((unsigned char)frame_type::nak, frames[0][0]);
+
+  // The retransmission is dispatched
+  data = frame(frame_type::data, 1, { (unsigned char)cmd_code::unlock, 0x00 });
+  port.inject(data.data(), data.size());
+  helper->loop();
+  TEST_ASSERT_EQUAL(1, unlocks);
+}
+
+void test_noise_and_broken_control_frames_are_not_nacked ()
+{
+  switch_to_version_2();
+
+  // Noise between delimiters, also shorter than a legacy protocol offer
+  port.inject({ 0x00, 0x05, 0x00, 0x02, 0x47, 0x00, 0x55, 0x66, 0x77, 0x88, 0x99, 0x00 });
+  helper->loop();
+
+  // A broken acknowledgement
+  std::vector<unsigned char> data = frame(frame_type::ack, 1);
+  data[data.size() - 2] ^= 0x10;
+  port.inject(data.data(), data.size());
+  helper->loop();
+  TEST_ASSERT_EQUAL(0, written_frames().size());
+
+  // Noise longer than a frame
+  std::vector<unsigned char> noise(FRAME_ENCODED_MAX + 8, 0x42);
+  noise.push_back(0x00);
+  port.inject(noise.data(), noise.size());
+  while (port.available() > 0) helper->loop();
+  TEST_ASSERT_EQUAL(0, written_frames().size());
+}
+
+void test_data_frame_without_delimiter_is_nacked ()
+{
+  switch_to_version_2();
+
+  // The delimiter between two data frames got lost, so both run into one frame that is too long
+  std::vector<unsigned char> payload(FRAME_PAYLOAD_MAX / 2, 0x01);
+  payload[0] = (unsigned char)cmd_code::lora_msg;
+  payload[1] = payload.size() - 2;
+  std::vector<unsigned char> data = frame(frame_type::data, 1, payload);
+  std::vector<unsigned char> second = frame(frame_type::data, 2, payload);
+  data.pop_back();
+  data.insert(data.end(), second.begin() + 1, second.end());
+  port.inject(data.data(), data.size());
+  while (port.available() > 0) helper->loop();
+
+  std::vector<std::vector<unsigned char>> frames = written_frames();
+  TEST_ASSERT_EQUAL(1, frames.size());
+  TEST_ASSERT_EQUAL_HEX8((unsigned char)frame_type::nak, frames[0][0]);
+}
+
+void test_duplicate_frame_is_acknowledged_only ()
+{
+  switch_to_version_2();
+  std::vector<unsigned char> data = frame(frame_type::data, 7, { (unsigned char)cmd_code::unlock, 0x00 });
+  port.inject(data.data(), data.size());
+  port.inject(data.data(), data.size());
+  helper->loop();
+
+  TEST_ASSERT_EQUAL(1, unlocks);
+  std::vector<std::vector<unsigned char>> frames = written_frames();
+  TEST_ASSERT_EQUAL(2, frames.size());
+  TEST_ASSERT_EQUAL_HEX8((unsigned char)frame_type::ack, frames[1][0]);
+  TEST_ASSERT_EQUAL(7, frames[1][1]);
+}
+
+void test_partial_frame_times_out ()
+{
+  switch_to_version_2();
+  std::vector<unsigned char> data = frame(frame_type::data, 1, { (unsigned char)cmd_code::unlock, 0x00 });
+  port.inject(data.data(), data.size() - 3);
+  helper->loop();
+
+  // The rest arrives too late and is no valid frame on its own
+  native_millis += RX_FRAME_TIMEOUT_MS + 1;
+  port.inject(data.data() + data.size() - 3, 3);
+  helper->loop();
+  TEST_ASSERT_EQUAL(0, unlocks);
+
+  data = frame(frame_type::data, 2, { (unsigned char)cmd_code::unlock, 0x00 });
+  port.inject(data.data(), data.size());
+  helper->loop();
+  TEST_ASSERT_EQUAL(1, unlocks);
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_transmission_split_across_passes);
+  RUN_TEST(test_two_transmissions_in_one_pass);
+  RUN_TEST(test_partial_transmission_times_out);
+  RUN_TEST(test_bytes_per_pass_are_bounded);
+  RUN_TEST(test_ve_exec_toggle_reports_the_state);
+  RUN_TEST(test_frame_split_across_passes);
+  RUN_TEST(test_two_frames_in_one_pass);
+  RUN_TEST(test_corrupt_frame_is_not_dispatched);
+  RUN_TEST(test_noise_and_broken_control_frames_are_not_nacked);
+  RUN_TEST(test_data_frame_without_delimiter_is_nacked);
+  RUN_TEST(test_duplicate_frame_is_acknowledged_only);
+  RUN_TEST(test_partial_frame_times_out);
+  return UNITY_END();
+}
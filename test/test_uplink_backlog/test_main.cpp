@@ -0,0 +1,179 @@
+/**
+ * Host tests of UplinkBacklog on a partition in RAM, see native_shims/esp_partition.h
+ */
+
+#include <unity.h>
+#include "UplinkBacklog.h"
+
+#define SECTORS 4
+
+static uint8_t record[BACKLOG_RECORD_DATA_MAX];
+static uint8_t buffer[256];
+
+/**
+ * Record of a length with the number in its first bytes
+ */
+static const uint8_t* make_record (uint32_t number, size_t len)
+{
+  memset(record, 0xA5, len);
+  memcpy(record, &number, sizeof number);
+  return record;
+}
+
+static uint32_t record_number (const uint8_t* data)
+{
+  uint32_t number;
+  memcpy(&number, data, sizeof number);
+  return number;
+}
+
+void setUp ()
+{
+  native_flash().assign(SECTORS * BACKLOG_SECTOR_SIZE, 0xFF);
+}
+
+void tearDown () {}
+
+void test_begin_needs_two_sectors ()
+{
+  native_flash().assign(BACKLOG_SECTOR_SIZE, 0xFF);
+  UplinkBacklog backlog("backlog");
+  TEST_ASSERT_FALSE(backlog.begin());
+  TEST_ASSERT_FALSE(backlog.append(make_record(1, 8), 8));
+  TEST_ASSERT_EQUAL(0, backlog.peek(buffer, sizeof buffer));
+
+  native_flash().clear();
+  TEST_ASSERT_FALSE(backlog.begin());
+}
+
+void test_append_peek_commit ()
+{
+  UplinkBacklog backlog("backlog");
+  TEST_ASSERT_TRUE(backlog.begin());
+  TEST_ASSERT_EQUAL(SECTORS * BACKLOG_SECTOR_SIZE, backlog.get_capacity());
+  TEST_ASSERT_EQUAL(0, backlog.peek(buffer, sizeof buffer));
+
+  TEST_ASSERT_TRUE(backlog.append(make_record(1, 10), 10));
+  TEST_ASSERT_TRUE(backlog.append(make_record(2, 20), 20));
+  TEST_ASSERT_TRUE(backlog.append(make_record(3, 30), 30));
+  TEST_ASSERT_FALSE(backlog.append(record, BACKLOG_RECORD_DATA_MAX + 1));
+  TEST_ASSERT_EQUAL(3, backlog.get_pending_count());
+
+  // only whole records, each with its length byte
+  TEST_ASSERT_EQUAL(1 + 10 + 1 + 20, backlog.peek(buffer, 40));
+  TEST_ASSERT_EQUAL(10, buffer[0]);
+  TEST_ASSERT_EQUAL(1, record_number(buffer + 1));
+  TEST_ASSERT_EQUAL(20, buffer[11]);
+  TEST_ASSERT_EQUAL(2, record_number(buffer + 12));
+
+  // peek without commit leaves the records pending
+  TEST_ASSERT_EQUAL(3, backlog.get_pending_count());
+  backlog.peek(buffer, 40);
+  backlog.commit();
+  TEST_ASSERT_EQUAL(1, backlog.get_pending_count());
+
+  TEST_ASSERT_EQUAL(1 + 30, backlog.peek(buffer, sizeof buffer));
+  TEST_ASSERT_EQUAL(3, record_number(buffer + 1));
+  backlog.commit();
+  TEST_ASSERT_EQUAL(0, backlog.get_pending_count());
+  TEST_ASSERT_EQUAL(0, backlog.peek(buffer, sizeof buffer));
+}
+
+void test_records_survive_a_reboot ()
+{
+  {
+    UplinkBacklog backlog("backlog");
+    backlog.begin();
+    for (uint32_t i = 1; i <= 5; i++) backlog.append(make_record(i, 16), 16);
+    backlog.peek(buffer, 2 * (1 + 16));
+    backlog.commit();
+  }
+
+  UplinkBacklog backlog("backlog");
+  TEST_ASSERT_TRUE(backlog.begin());
+  TEST_ASSERT_EQUAL(3, backlog.get_pending_count());
+  backlog.peek(buffer, 1 + 16);
+  TEST_ASSERT_EQUAL(3, record_number(buffer + 1));
+
+  // sequence numbers continue after the kept records
+  backlog.append(make_record(6, 16), 16);
+  backlog.peek(buffer, sizeof buffer);
+  backlog.commit();
+  TEST_ASSERT_EQUAL(0, backlog.get_pending_count());
+  TEST_ASSERT_EQUAL(6, record_number(buffer + 3 * (1 + 16) + 1));
+}
+
+void test_torn_record_ends_the_records ()
+{
+  {
+    UplinkBacklog backlog("backlog");
+    backlog.begin();
+    for (uint32_t i = 1; i <= 3; i++) backlog.append(make_record(i, 24), 24);
+  }
+  // power loss while writing the data of the last record
+  native_flash()[2 * (BACKLOG_RECORD_HEADER_SIZE + 24) + BACKLOG_RECORD_HEADER_SIZE] = 0x00;
+
+  UplinkBacklog backlog("backlog");
+  TEST_ASSERT_TRUE(backlog.begin());
+  TEST_ASSERT_EQUAL(2, backlog.get_pending_count());
+
+  // the torn record is not written over
+  TEST_ASSERT_TRUE(backlog.append(make_record(4, 24), 24));
+  TEST_ASSERT_EQUAL(3, backlog.get_pending_count());
+  TEST_ASSERT_EQUAL(3 * (1 + 24), backlog.peek(buffer, sizeof buffer));
+  TEST_ASSERT_EQUAL(1, record_number(buffer + 1));
+  TEST_ASSERT_EQUAL(2, record_number(buffer + 1 + 25));
+  TEST_ASSERT_EQUAL(4, record_number(buffer + 1 + 50));
+}
+
+void test_full_partition_evicts_the_oldest_sector ()
+{
+  UplinkBacklog backlog("backlog");
+  backlog.begin();
+
+  const size_t len = BACKLOG_RECORD_DATA_MAX;
+  const size_t per_sector = BACKLOG_SECTOR_SIZE / (BACKLOG_RECORD_HEADER_SIZE + len);
+  uint32_t count = SECTORS * per_sector + 1;
+  for (uint32_t i = 1; i <= count; i++) TEST_ASSERT_TRUE(backlog.append(make_record(i, len), len));
+
+  // entering the first sector again erased its records
+  TEST_ASSERT_EQUAL(count - per_sector, backlog.get_pending_count());
+  TEST_ASSERT_EQUAL(1 + len, backlog.peek(buffer, 1 + len));
+  TEST_ASSERT_EQUAL(per_sector + 1, record_number(buffer + 1));
+
+  // drain everything across the wrap of the ring
+  uint32_t expected = per_sector + 1;
+  while (size_t size = backlog.peek(buffer, sizeof buffer))
+  {
+    for (size_t i = 0; i < size; i += 1 + buffer[i]) TEST_ASSERT_EQUAL(expected++, record_number(buffer + i + 1));
+    backlog.commit();
+  }
+  TEST_ASSERT_EQUAL(count + 1, expected);
+  TEST_ASSERT_EQUAL(0, backlog.get_pending_count());
+}
+
+void test_clear ()
+{
+  UplinkBacklog backlog("backlog");
+  backlog.begin();
+  backlog.append(make_record(1, 8), 8);
+  backlog.clear();
+  TEST_ASSERT_EQUAL(0, backlog.get_pending_count());
+  TEST_ASSERT_EQUAL(0, backlog.peek(buffer, sizeof buffer));
+
+  UplinkBacklog rebooted("backlog");
+  rebooted.begin();
+  TEST_ASSERT_EQUAL(0, rebooted.get_pending_count());
+}
+
+int main ()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_needs_two_sectors);
+  RUN_TEST(test_append_peek_commit);
+  RUN_TEST(test_records_survive_a_reboot);
+  RUN_TEST(test_torn_record_ends_the_records);
+  RUN_TEST(test_full_partition_evicts_the_oldest_sector);
+  RUN_TEST(test_clear);
+  return UNITY_END();
+}